@@ -2,6 +2,7 @@
 #ifndef QASM_NEW_TO_OLD_HPP
 
 #include "cqasm.hpp"
+#include "cqasm-unitary.hpp"
 #include "qasm_ast.hpp"
 
 namespace compiler {
@@ -94,7 +95,7 @@ static Operation *convert_instruction(const cqasm::semantic::Instruction &instru
                 Qubits(convert_indices(instruction.operands[0]->as_qubit_refs()->index))
             );
             {
-                auto mat = instruction.operands[1]->as_const_complex_matrix()->value;
+                const auto mat = cqasm::unitary::matrix_operand(instruction.operands);
                 std::vector<double> mat_elements;
                 for (size_t row = 1; row <= mat.size_rows(); row++) {
                     for (size_t col = 1; col <= mat.size_cols(); col++) {
@@ -155,7 +156,7 @@ static Operation *convert_instruction(const cqasm::semantic::Instruction &instru
         case ParameterType::SingleString:
             op = new Operation(
                 instruction.instruction->name,
-                instruction.operands[0]->as_const_string()->value
+                instruction.operands[0]->as_const_string()->value.get()
             );
             break;
         case ParameterType::NotGate:
@@ -0,0 +1,52 @@
+/** This test is for u gates with sparse and controlled matrix operands **/
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <iostream>
+#include <vector>
+#include <string>
+#include "qasm_semantic.hpp"
+#include "doctest/doctest.h"
+
+/**
+ * Resolves a u gate on qubit 0 with the given matrix operand and converts it
+ * to the old API format.
+ */
+static compiler::Operation *convert_u(const cqasm::values::Value &matrix)
+{
+    using namespace compiler::new_to_old;
+    auto analyzer = cqasm::analyzer::Analyzer{};
+    analyzer.register_instruction_with_annotation<ParameterType>(ParameterType::SingleQubitMatrix, "u", "Qu");
+    auto qubits = cqasm::tree::make<cqasm::values::QubitRefs>();
+    qubits->index.add(cqasm::tree::make<cqasm::values::ConstInt>(0));
+    cqasm::values::Values operands;
+    operands.add(qubits);
+    operands.add(matrix);
+    return convert_instruction(*analyzer.resolve_instruction("u", operands));
+}
+
+TEST_CASE("Test for the structured_matrix.qasm file")
+{
+    using namespace cqasm::primitives;
+
+    // open a file handle to a particular file:
+    FILE *myfile = fopen("structured_matrix.qasm", "r");
+
+    compiler::QasmSemanticChecker sm(myfile);
+
+    CHECK(sm.parseResult() == 0);   // Stop here if it fails.
+
+    // The file contains the Y gate as a dense matrix.
+    auto qasm_representation = sm.getQasmRepresentation();
+    auto subcircuit = qasm_representation.getSubCircuits().getAllSubCircuits().at(0);
+    auto dense = subcircuit.getOperationsCluster().at(0)->getOperations().at(0)->getUMatrixElements();
+    CHECK(dense.size() == 8);
+
+    // The same gate as a sparse and as a controlled matrix without controls
+    // converts to the same elements.
+    auto y = CMatrix({0.0, Complex(0.0, -1.0), Complex(0.0, 1.0), 0.0}, 2);
+    auto sparse = convert_u(cqasm::tree::make<cqasm::values::ConstSparseComplexMatrix>(SparseCMatrix::from_dense(y)));
+    REQUIRE(sparse != nullptr);
+    CHECK(sparse->getUMatrixElements() == dense);
+    auto controlled = convert_u(cqasm::tree::make<cqasm::values::ConstControlledComplexMatrix>(ControlledCMatrix(0, y)));
+    REQUIRE(controlled != nullptr);
+    CHECK(controlled->getUMatrixElements() == dense);
+}
@@ -0,0 +1,3 @@
+version 1.0
+qubits 1
+u q[0], [0, 0, 0, -1, 0, 1, 0, 0]
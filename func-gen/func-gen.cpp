@@ -136,7 +136,27 @@ void register_into(resolver::FunctionTable &table) {
         source << "    values::check_const(v);" << std::endl;
         size_t index = 0;
         for (auto arg_typ : func.cqasm_args) {
-            source << "    auto " << (char)('a' + index) << " = v[" << index << "]";
+            // Interned values are bound by reference to the stored value, so
+            // they don't need to be copied. Complex matrices may be sparse or
+            // controlled, in which case they are converted to a dense matrix
+            // in a local variable; dense ones are bound by reference as well.
+            auto name = (char)('a' + index);
+            switch (arg_typ) {
+                case 'u':
+                case 'n':
+                    source << "    primitives::CMatrix " << name << "_dense;" << std::endl;
+                    source << "    const auto &";
+                    break;
+                case 's':
+                case 'j': source << "    const auto &"; break;
+                default: source << "    auto "; break;
+            }
+            source << name << " = ";
+            switch (arg_typ) {
+                case 'u':
+                case 'n': source << "values::dense_complex_matrix(v[" << index << "], " << name << "_dense)"; break;
+                default: source << "v[" << index << "]"; break;
+            }
             switch (arg_typ) {
                 case 'b': source << "->as_const_bool()->value"; break;
                 case 'a': source << "->as_const_axis()->value"; break;
@@ -144,10 +164,8 @@ void register_into(resolver::FunctionTable &table) {
                 case 'r': source << "->as_const_real()->value"; break;
                 case 'c': source << "->as_const_complex()->value"; break;
                 case 'm': source << "->as_const_real_matrix()->value"; break;
-                case 'u':
-                case 'n': source << "->as_const_complex_matrix()->value"; break;
-                case 's': source << "->as_const_string()->value"; break;
-                case 'j': source << "->as_const_json()->value"; break;
+                case 's': source << "->as_const_string()->value.get()"; break;
+                case 'j': source << "->as_const_json()->value.get()"; break;
             }
             source << ";" << std::endl;
             index++;
@@ -3,11 +3,61 @@
 #include "cqasm-ast.hpp"
 #include "cqasm-semantic.hpp"
 #include "cqasm-resolver.hpp"
+#include "cqasm-parse-helper.hpp"
+#include "cqasm-index.hpp"
 #include <cstdio>
 
 namespace cqasm {
 namespace analyzer {
 
+/**
+ * Cost of analyzing a single statement, as measured when the statement
+ * profile is enabled using Analyzer::enable_statement_profile().
+ */
+class StatementProfile {
+public:
+
+    /**
+     * Location of the statement in the source file.
+     */
+    parser::SourceLocation location;
+
+    /**
+     * The kind of statement; bundle, mapping, or subcircuit.
+     */
+    std::string kind;
+
+    /**
+     * Time taken to analyze the statement in nanoseconds.
+     */
+    uint64_t duration;
+
+    /**
+     * Number of tree nodes (semantic nodes and values) constructed while
+     * analyzing the statement, including intermediate values that didn't
+     * end up in the semantic tree.
+     */
+    size_t nodes;
+
+    /**
+     * Total size of those nodes in bytes, excluding any memory they
+     * allocate themselves, such as the elements of a matrix.
+     */
+    size_t bytes;
+
+    /**
+     * Creates a statement profile.
+     */
+    StatementProfile(
+        const parser::SourceLocation &location,
+        const std::string &kind,
+        uint64_t duration,
+        size_t nodes,
+        size_t bytes
+    );
+
+};
+
 /**
  * Analysis result class.
  */
@@ -25,6 +75,20 @@ public:
      */
     std::vector<std::string> errors;
 
+    /**
+     * Index from instruction name to the positions at which the instruction
+     * occurs in the semantic tree. This is only filled when the index was
+     * enabled using Analyzer::enable_instruction_index().
+     */
+    index::InstructionIndex instruction_index;
+
+    /**
+     * The statements that took the longest to analyze, slowest first. This
+     * is only filled when the statement profile was enabled using
+     * Analyzer::enable_statement_profile().
+     */
+    std::vector<StatementProfile> slow_statements;
+
 };
 
 /**
@@ -86,6 +150,35 @@ private:
      */
     bool resolve_error_model;
 
+    /**
+     * When set, the analyzer checks that the instructions within a bundle
+     * don't use the same qubit or measurement bit, in addition to the
+     * allow_parallel checks that are always performed. This is disabled by
+     * default.
+     */
+    bool detect_bundle_conflicts;
+
+    /**
+     * When set, the analyzer builds an index from instruction name to
+     * instruction positions while it constructs the semantic tree, and
+     * returns it via AnalysisResult::instruction_index. This is disabled by
+     * default.
+     */
+    bool build_instruction_index;
+
+    /**
+     * The number of slowest statements that the analyzer reports via
+     * AnalysisResult::slow_statements, or 0 to disable the statement
+     * profile. This is disabled by default.
+     */
+    size_t num_slow_statements;
+
+    /**
+     * The memory resource that the semantic tree is allocated from, or
+     * nullptr to use the resource selected for the calling thread.
+     */
+    memory::Resource *memory_resource;
+
 public:
 
     /**
@@ -206,6 +299,52 @@ public:
         register_error_model(model);
     }
 
+    /**
+     * Enables or disables the check for qubit and measurement bit conflicts
+     * between the instructions of a bundle. When enabled, a bundle such as
+     * `x q[0] | y q[0]` results in an analysis error. The check is linear in
+     * the number of operands of the bundle.
+     */
+    void enable_bundle_conflict_check(bool enable = true);
+
+    /**
+     * Enables or disables construction of the instruction index that is
+     * returned as part of the analysis result. This allows all occurrences of
+     * a particular instruction to be found without walking the tree.
+     */
+    void enable_instruction_index(bool enable = true);
+
+    /**
+     * Enables the statement profile, which measures the time taken and the
+     * tree nodes constructed for each statement, and returns the given
+     * number of slowest statements as part of the analysis result. This
+     * helps finding out which statement makes a file slow to analyze. Pass
+     * 0 to disable the profile again.
+     */
+    void enable_statement_profile(size_t num_statements = 10);
+
+    /**
+     * Sets the memory resource that the semantic tree and its annotations
+     * are allocated from, for example an arena per request. The resource
+     * must outlive the analysis results. Pass nullptr to use the resource
+     * selected for the calling thread again, which is the default.
+     */
+    void set_memory_resource(memory::Resource *resource);
+
+    /**
+     * Resolves an unconditional instruction with the given name and operands
+     * against the registered instruction set, in the same way the analyzer
+     * resolves instructions in a cQASM file. This is intended for passes that
+     * construct new instructions. If no instructions were registered, an
+     * unresolved instruction node is returned. Throws an AnalysisError if
+     * resolution fails. Annotation data and line number information still
+     * need to be set by the caller.
+     */
+    tree::One<semantic::Instruction> resolve_instruction(
+        const std::string &name,
+        const values::Values &operands
+    ) const;
+
     /**
      * Analyzes the given program AST node.
      */
@@ -215,3 +354,8 @@ public:
 
 } // namespace analyzer
 } // namespace cqasm
+
+/**
+ * Stream << overload for statement profiles.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::analyzer::StatementProfile& profile);
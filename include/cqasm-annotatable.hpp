@@ -16,11 +16,13 @@
 #pragma once
 
 #include <memory>
+#include <new>
 #include <vector>
 #include <typeinfo>
 #include <typeindex>
 #include <unordered_map>
 #include <functional>
+#include "cqasm-memory.hpp"
 
 namespace cqasm {
 namespace annotatable {
@@ -56,6 +58,31 @@ private:
         type(type)
     {}
 
+    /**
+     * Constructs an Anything object holding a T constructed from the given
+     * argument. The value is allocated from the memory resource selected for
+     * the calling thread, and returned to it when the Anything is destroyed.
+     */
+    template <typename T, typename Arg>
+    static Anything construct(Arg &&arg) {
+        memory::Allocator<T> allocator;
+        T *data = allocator.allocate(1);
+        try {
+            new (data) T(std::forward<Arg>(arg));
+        } catch (...) {
+            allocator.deallocate(data, 1);
+            throw;
+        }
+        return Anything(
+            data,
+            [allocator](void *data) mutable {
+                static_cast<T*>(data)->~T();
+                allocator.deallocate(static_cast<T*>(data), 1);
+            },
+            std::type_index(typeid(T))
+        );
+    }
+
 public:
 
     /**
@@ -72,13 +99,7 @@ public:
      */
     template <typename T>
     static Anything make(const T &ob) {
-        return Anything(
-            new T(ob),
-            [](void *data) {
-                delete static_cast<T*>(data);
-            },
-            std::type_index(typeid(T))
-        );
+        return construct<T>(ob);
     }
 
     /**
@@ -86,13 +107,7 @@ public:
      */
     template <typename T>
     static Anything make(T &&ob) {
-        return Anything(
-            new T(std::move(ob)),
-            [](void *data) {
-                delete static_cast<T*>(data);
-            },
-            std::type_index(typeid(T))
-        );
+        return construct<T>(std::move(ob));
     }
 
     /**
@@ -195,7 +210,7 @@ public:
      */
     template <typename T>
     void set_annotation(const T &ob) {
-        annotations[std::type_index(typeid(T))] = std::make_shared<Anything>(Anything::make<T>(ob));
+        annotations[std::type_index(typeid(T))] = std::allocate_shared<Anything>(memory::Allocator<Anything>(), Anything::make<T>(ob));
     }
 
     /**
@@ -209,7 +224,7 @@ public:
      */
     template <typename T>
     void set_annotation(T &&ob) {
-        annotations[std::type_index(typeid(T))] = std::make_shared<Anything>(Anything::make<T>(std::move(ob)));
+        annotations[std::type_index(typeid(T))] = std::allocate_shared<Anything>(memory::Allocator<Anything>(), Anything::make<T>(std::move(ob)));
     }
 
     /**
@@ -221,6 +236,14 @@ public:
         return annotations.count(std::type_index(typeid(T)));
     }
 
+    /**
+     * Returns whether this object holds an annotation object of the given
+     * type, for when the type is only known at runtime.
+     */
+    bool has_annotation(const std::type_index &type) const {
+        return annotations.count(type);
+    }
+
     /**
      * Returns a mutable pointer to the annotation object of the given type
      * held by this object, or `nullptr` if there is no such annotation.
@@ -295,6 +318,70 @@ public:
         }
     }
 
+    /**
+     * Makes this object refer to the same annotation object of type T as the
+     * source object, rather than to a copy of it, such that modifications
+     * through either object are visible through both. If the source object
+     * doesn't have an annotation of type T, any such annotation on this
+     * object is removed.
+     */
+    template <typename T>
+    void share_annotation(const Annotatable &src) {
+        auto it = src.annotations.find(std::type_index(typeid(T)));
+        if (it == src.annotations.end()) {
+            erase_annotation<T>();
+        } else {
+            annotations[it->first] = it->second;
+        }
+    }
+
+    /**
+     * Returns the number of annotations attached to this object.
+     */
+    size_t get_annotation_count() const {
+        return annotations.size();
+    }
+
+    /**
+     * Returns whether this object has annotations of the same types as the
+     * given object, and refers to the same (shared) annotation objects.
+     */
+    bool has_same_annotations(const Annotatable &rhs) const {
+        if (annotations.size() != rhs.annotations.size()) {
+            return false;
+        }
+        for (const auto &it : annotations) {
+            auto rhs_it = rhs.annotations.find(it.first);
+            if (rhs_it == rhs.annotations.end() || rhs_it->second != it.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Releases the excess memory held by the annotation table.
+     */
+    void shrink_annotations() {
+        if (annotations.empty()) {
+            std::unordered_map<std::type_index, std::shared_ptr<Anything>>().swap(annotations);
+        } else {
+            annotations.rehash(0);
+        }
+    }
+
+    /**
+     * Returns the approximate amount of heap memory in bytes used by the
+     * annotation table, not including the annotation objects themselves.
+     */
+    size_t get_annotation_table_size() const {
+        size_t size = annotations.size() * (sizeof(std::pair<std::type_index, std::shared_ptr<Anything>>) + 2 * sizeof(void*));
+        if (annotations.bucket_count() > 1) {
+            size += annotations.bucket_count() * sizeof(void*);
+        }
+        return size;
+    }
+
 };
 
 } // namespace annotatable
@@ -0,0 +1,377 @@
+/**
+ * C interface to libqasm, for use through the foreign function interfaces
+ * of other languages. The interface only uses opaque handles, fixed-width
+ * integers, doubles and C strings, so its ABI doesn't depend on the C++
+ * headers or compiler.
+ *
+ * A program is read out through bulk accessors that each copy one flat array
+ * into a caller-provided buffer, rather than through one call per tree node.
+ * Every bulk accessor takes the buffer and its capacity in elements, copies
+ * as many elements as fit, and returns the total number of elements. Call it
+ * with a null buffer and zero capacity first to find out how large the
+ * buffer needs to be.
+ *
+ * The instructions of a program are numbered in program order, across all
+ * bundles and subcircuits. Their operands are numbered in the same way, and
+ * described by cqasm_operand records. The values of the operands are stored
+ * in two shared arrays, one for integers and one for reals, and in a string
+ * table.
+ *
+ * Functions that create a handle return null on failure, and functions
+ * that return a status return nonzero on failure. cqasm_get_last_error()
+ * describes the last such failure of the calling thread. Errors in the cQASM
+ * input are not failures; they are reported by the returned handles.
+ *
+ * Handles may be used from any thread, but not from multiple threads at the
+ * same time, except for the const accessors of a program.
+ */
+#ifndef CQASM_C_H
+#define CQASM_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Version of this interface. It is incremented when functions are added;
+ * existing functions and records don't change.
+ */
+#define CQASM_C_API_VERSION 1
+
+/**
+ * Operand kind for something that can't be represented through this
+ * interface. The operand has no values.
+ */
+#define CQASM_OPERAND_OTHER 0
+
+/**
+ * Operand kind for qubit references. The qubit indices are stored in the
+ * integer array.
+ */
+#define CQASM_OPERAND_QUBIT_REFS 1
+
+/**
+ * Operand kind for measurement bit references. The bit indices are stored in
+ * the integer array.
+ */
+#define CQASM_OPERAND_BIT_REFS 2
+
+/**
+ * Operand kind for booleans. The value is stored in the integer array as 0
+ * or 1.
+ */
+#define CQASM_OPERAND_BOOL 3
+
+/**
+ * Operand kind for axes. The value is stored in the integer array as 0, 1 or
+ * 2 for X, Y or Z.
+ */
+#define CQASM_OPERAND_AXIS 4
+
+/**
+ * Operand kind for integers. The value is stored in the integer array.
+ */
+#define CQASM_OPERAND_INT 5
+
+/**
+ * Operand kind for reals. The value is stored in the real array.
+ */
+#define CQASM_OPERAND_REAL 6
+
+/**
+ * Operand kind for complex numbers. The real and imaginary part are stored
+ * in the real array.
+ */
+#define CQASM_OPERAND_COMPLEX 7
+
+/**
+ * Operand kind for real matrices. The elements are stored in the real array
+ * in row-major order.
+ */
+#define CQASM_OPERAND_REAL_MATRIX 8
+
+/**
+ * Operand kind for complex matrices, including sparse and controlled ones.
+ * The elements are stored in the real array in row-major order, as real and
+ * imaginary part pairs.
+ */
+#define CQASM_OPERAND_COMPLEX_MATRIX 9
+
+/**
+ * Operand kind for strings. The offset is the index of the string in the
+ * string table.
+ */
+#define CQASM_OPERAND_STRING 10
+
+/**
+ * Operand kind for JSON data. The offset is the index of the JSON text in
+ * the string table.
+ */
+#define CQASM_OPERAND_JSON 11
+
+/**
+ * Description of an operand of an instruction.
+ */
+typedef struct cqasm_operand {
+
+    /**
+     * The kind of operand, one of the CQASM_OPERAND_* constants.
+     */
+    int32_t kind;
+
+    /**
+     * The number of rows of a matrix, or 1 for scalars.
+     */
+    uint32_t rows;
+
+    /**
+     * The number of columns of a matrix, or 1 for scalars.
+     */
+    uint32_t cols;
+
+    /**
+     * Always zero; makes the padding explicit.
+     */
+    uint32_t reserved;
+
+    /**
+     * The index of the first value of the operand in the integer or real
+     * array, or of the string in the string table.
+     */
+    uint64_t offset;
+
+    /**
+     * The number of values of the operand in the integer or real array.
+     */
+    uint64_t size;
+
+} cqasm_operand;
+
+/**
+ * Opaque handle to an analyzer, which holds the instruction set, error
+ * models, functions and mappings that programs are analyzed against.
+ */
+typedef struct cqasm_analyzer cqasm_analyzer;
+
+/**
+ * Opaque handle to the result of parsing a cQASM file.
+ */
+typedef struct cqasm_parse_result cqasm_parse_result;
+
+/**
+ * Opaque handle to an analyzed program, or to the errors that prevented its
+ * analysis.
+ */
+typedef struct cqasm_program cqasm_program;
+
+/**
+ * Returns CQASM_C_API_VERSION of the library, which may be newer than that
+ * of the header the caller was compiled against.
+ */
+uint32_t cqasm_get_api_version(void);
+
+/**
+ * Returns a description of the last failure of a function of this interface
+ * on the calling thread, or an empty string if there was none. The string is
+ * valid until the next failure on the same thread.
+ */
+const char *cqasm_get_last_error(void);
+
+/**
+ * Creates an analyzer without any instructions, error models, functions or
+ * mappings. Returns null on failure.
+ */
+cqasm_analyzer *cqasm_analyzer_new(void);
+
+/**
+ * Destroys an analyzer. Programs analyzed with it remain valid. Does nothing
+ * for null.
+ */
+void cqasm_analyzer_free(cqasm_analyzer *analyzer);
+
+/**
+ * Registers the default functions and mappings, such as the operators, pi,
+ * and the axes. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_default_functions_and_mappings(cqasm_analyzer *analyzer);
+
+/**
+ * Registers an instruction with the given name and parameter type string,
+ * in the same format as the C++ interface. Once an instruction is registered,
+ * only registered instructions are accepted. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_instruction(
+    cqasm_analyzer *analyzer,
+    const char *name,
+    const char *param_types,
+    int allow_conditional,
+    int allow_parallel,
+    int allow_reused_qubits
+);
+
+/**
+ * Registers an error model with the given name and parameter type string.
+ * Once an error model is registered, only registered error models are
+ * accepted. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_error_model(
+    cqasm_analyzer *analyzer,
+    const char *name,
+    const char *param_types
+);
+
+/**
+ * Parses the given file. Returns null on failure, for example when the file
+ * can't be read.
+ */
+cqasm_parse_result *cqasm_parse_file(const char *filename);
+
+/**
+ * Parses the given null-terminated string. The filename is only used in
+ * error messages, and may be null. Returns null on failure.
+ */
+cqasm_parse_result *cqasm_parse_string(const char *data, const char *filename);
+
+/**
+ * Destroys a parse result. Does nothing for null.
+ */
+void cqasm_parse_result_free(cqasm_parse_result *result);
+
+/**
+ * Returns the number of parse errors.
+ */
+size_t cqasm_parse_result_get_num_errors(const cqasm_parse_result *result);
+
+/**
+ * Returns the parse error with the given index, or null if out of range.
+ */
+const char *cqasm_parse_result_get_error(const cqasm_parse_result *result, size_t index);
+
+/**
+ * Analyzes the given parse result. If it has parse errors, the program
+ * reports those instead. Returns null on failure.
+ */
+cqasm_program *cqasm_analyze(const cqasm_analyzer *analyzer, const cqasm_parse_result *result);
+
+/**
+ * Parses and analyzes the given null-terminated string. The filename is only
+ * used in error messages, and may be null. Returns null on failure.
+ */
+cqasm_program *cqasm_analyze_string(
+    const cqasm_analyzer *analyzer,
+    const char *data,
+    const char *filename
+);
+
+/**
+ * Destroys a program. Does nothing for null.
+ */
+void cqasm_program_free(cqasm_program *program);
+
+/**
+ * Returns the number of parse and analysis errors. The accessors below only
+ * return data if this is zero.
+ */
+size_t cqasm_program_get_num_errors(const cqasm_program *program);
+
+/**
+ * Returns the error with the given index, or null if out of range.
+ */
+const char *cqasm_program_get_error(const cqasm_program *program, size_t index);
+
+/**
+ * Copies the components of the file version, major first.
+ */
+size_t cqasm_program_get_version(const cqasm_program *program, int64_t *buffer, size_t capacity);
+
+/**
+ * Returns the number of qubits of the program.
+ */
+int64_t cqasm_program_get_num_qubits(const cqasm_program *program);
+
+/**
+ * Copies, for every subcircuit and one past the last, the index of its first
+ * bundle.
+ */
+size_t cqasm_program_get_subcircuit_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity);
+
+/**
+ * Copies the number of iterations of every subcircuit.
+ */
+size_t cqasm_program_get_subcircuit_iterations(const cqasm_program *program, int64_t *buffer, size_t capacity);
+
+/**
+ * Returns the name of the subcircuit with the given index, or null if out
+ * of range.
+ */
+const char *cqasm_program_get_subcircuit_name(const cqasm_program *program, size_t index);
+
+/**
+ * Copies, for every bundle and one past the last, the index of its first
+ * instruction.
+ */
+size_t cqasm_program_get_bundle_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity);
+
+/**
+ * Copies the instruction ID of every instruction. Instructions with the same
+ * case-insensitive name get the same ID; IDs are numbered from zero in order
+ * of first use.
+ */
+size_t cqasm_program_get_instruction_ids(const cqasm_program *program, uint32_t *buffer, size_t capacity);
+
+/**
+ * Returns the number of distinct instruction IDs.
+ */
+size_t cqasm_program_get_num_instruction_names(const cqasm_program *program);
+
+/**
+ * Returns the lowercase name of the instructions with the given ID, or null
+ * if out of range.
+ */
+const char *cqasm_program_get_instruction_name(const cqasm_program *program, uint32_t id);
+
+/**
+ * Copies, for every instruction and one past the last, the index of its
+ * first operand.
+ */
+size_t cqasm_program_get_operand_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity);
+
+/**
+ * Copies, for every instruction, the index of the operand that holds its
+ * condition, or -1 if it is unconditional. Conditions are stored after the
+ * operands of all instructions.
+ */
+size_t cqasm_program_get_conditions(const cqasm_program *program, int64_t *buffer, size_t capacity);
+
+/**
+ * Copies the operand records, including those of the conditions.
+ */
+size_t cqasm_program_get_operands(const cqasm_program *program, cqasm_operand *buffer, size_t capacity);
+
+/**
+ * Copies the integer array, holding the qubit and bit indices and the
+ * integer, boolean and axis values of the operands.
+ */
+size_t cqasm_program_get_integers(const cqasm_program *program, int64_t *buffer, size_t capacity);
+
+/**
+ * Copies the real array, holding the real, complex and matrix values of the
+ * operands.
+ */
+size_t cqasm_program_get_reals(const cqasm_program *program, double *buffer, size_t capacity);
+
+/**
+ * Returns the string with the given index in the string table, or null if
+ * out of range. If length is not null, the length of the string is stored
+ * there, since strings may contain null characters.
+ */
+const char *cqasm_program_get_string(const cqasm_program *program, uint64_t index, size_t *length);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // CQASM_C_H
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "cqasm-semantic.hpp"
+
+namespace cqasm {
+namespace compact {
+
+/**
+ * What compact() does with the source location annotations of the tree.
+ */
+enum class Locations {
+
+    /**
+     * Leave them as they are.
+     */
+    Keep,
+
+    /**
+     * Make nodes with equal locations share a single location object.
+     */
+    Deduplicate,
+
+    /**
+     * Remove the locations of values (operands, conditions, qubit and bit
+     * indices, and so on), and deduplicate the others. Error messages about
+     * statements still carry a location.
+     */
+    StripValues,
+
+    /**
+     * Remove all locations.
+     */
+    Strip
+
+};
+
+/**
+ * Options for compact().
+ */
+class Options {
+public:
+
+    /**
+     * Whether to release the memory reserved by node lists and annotation
+     * tables beyond what they currently hold. Defaults to true.
+     */
+    bool shrink_containers;
+
+    /**
+     * What to do with source locations. Defaults to Locations::Deduplicate.
+     */
+    Locations locations;
+
+    /**
+     * Whether equal constant values (including qubit and bit indices) with
+     * equal locations and no other annotations should be replaced by a
+     * single shared node. Defaults to true.
+     */
+    bool share_constants;
+
+    /**
+     * Whether equal instruction and error model descriptors with the same
+     * annotation objects should be replaced by a single shared descriptor.
+     * Defaults to true.
+     */
+    bool share_descriptors;
+
+    /**
+     * Creates the default options.
+     */
+    Options();
+
+};
+
+/**
+ * Statistics reported by compact().
+ */
+class Report {
+public:
+
+    /**
+     * Approximate heap memory used by the tree before compaction, in bytes,
+     * as computed by memory_usage().
+     */
+    size_t bytes_before;
+
+    /**
+     * Approximate heap memory used by the tree after compaction, in bytes,
+     * as computed by memory_usage().
+     */
+    size_t bytes_after;
+
+    /**
+     * Creates an empty report.
+     */
+    Report();
+
+    /**
+     * Returns the number of bytes reclaimed.
+     */
+    size_t bytes_reclaimed() const;
+
+};
+
+/**
+ * Returns an estimate of the heap memory in bytes used by the given semantic
+ * tree, including its values, descriptors, annotation tables, and source
+ * locations. Nodes and annotation objects that are shared are counted once.
+ * Annotations of other types than source locations are only counted by
+ * their table entries, since their size is not known. This is the total of
+ * the per-type breakdown returned by `program.memory_usage()`.
+ */
+size_t memory_usage(const semantic::Program &program);
+
+/**
+ * Reduces the memory footprint of the given semantic tree, for instance
+ * before storing it in a long-lived cache, according to the given options.
+ * Returns how much memory the tree used before and after.
+ *
+ * Note that sharing nodes, annotation objects, and descriptors means that
+ * modifying one of them in place affects all places that use it; replace
+ * them instead. The semantic tree does not refer to the AST it was analyzed
+ * from, so releasing that is a matter of dropping the parse result.
+ *
+ * This takes time linear in the size of the tree.
+ */
+Report compact(semantic::Program &program, const Options &options = Options());
+
+} // namespace compact
+} // namespace cqasm
+
+/**
+ * Stream << overload for compaction reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::compact::Report& report);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "cqasm-semantic.hpp"
+#include "cqasm-parse-helper.hpp"
+
+namespace cqasm {
+namespace diff {
+
+/**
+ * A difference between two semantic trees, as returned by diff().
+ */
+class Edit {
+public:
+
+    /**
+     * Whether a node was added or removed, or a node or field changed.
+     */
+    tree::EditKind kind;
+
+    /**
+     * The path to the node or field relative to the programs, for instance
+     * `subcircuits[0].bundles[2].items[0].name`. List indices refer to the
+     * new program, except for removed nodes.
+     */
+    std::string path;
+
+    /**
+     * For changed fields, the old value as printed.
+     */
+    std::string old_value;
+
+    /**
+     * For changed fields, the new value as printed.
+     */
+    std::string new_value;
+
+    /**
+     * Location of the innermost node in the old program that contains the
+     * edit, or null if unknown. This points into the old program.
+     */
+    const parser::SourceLocation *old_location;
+
+    /**
+     * Location of the innermost node in the new program that contains the
+     * edit, or null if unknown. This points into the new program.
+     */
+    const parser::SourceLocation *new_location;
+
+    /**
+     * Creates an edit from the given difference reported by tree::Differ.
+     */
+    explicit Edit(const tree::Edit &edit);
+
+};
+
+/**
+ * Returns the differences between the given analyzed programs, in tree
+ * order. Subtrees are compared by their Merkle hashes, which ignore
+ * annotation objects such as source locations, and only mismatching
+ * subtrees are descended into. Lists are aligned, such that inserted and
+ * removed statements are reported as such. The hashes are computed into
+ * the given tables, which may already hold the hashes of earlier diffs of
+ * the same, unmodified programs; the diff itself then takes time roughly
+ * proportional to the size of the change.
+ */
+std::vector<Edit> diff(
+    const semantic::Program &old_program,
+    const semantic::Program &new_program,
+    tree::MerkleHashes &old_hashes,
+    tree::MerkleHashes &new_hashes
+);
+
+/**
+ * Returns the differences between the given analyzed programs, in tree
+ * order, computing the Merkle hashes of both programs first.
+ */
+std::vector<Edit> diff(const semantic::Program &old_program, const semantic::Program &new_program);
+
+} // namespace diff
+} // namespace cqasm
+
+/**
+ * Stream << overload for edits, writing a single line like
+ * `changed subcircuits[0].bundles[2].items[0].name at a.cq:5:1 / b.cq:5:1: x -> y`.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::diff::Edit& edit);
@@ -63,6 +63,29 @@ public:
 using ErrorModelRef = tree::Maybe<ErrorModel>;
 
 } // namespace error_model
+
+namespace primitives {
+
+/**
+ * Adds the memory used by the error model descriptor that the given reference
+ * refers to, if any, to the given memory usage report. Descriptors that are
+ * shared by several nodes are counted once.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const error_model::ErrorModelRef &ref);
+
+/**
+ * Freezes or thaws the error model descriptor that the given reference refers
+ * to, if any, along with its parameter types. See tree::Frozen.
+ */
+void set_frozen(const error_model::ErrorModelRef &ref, bool frozen);
+
+/**
+ * Returns a hash of the error model descriptor that the given reference refers
+ * to, consistent with its equality operator. See tree::MerkleHashes.
+ */
+uint64_t hash(const error_model::ErrorModelRef &ref);
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "cqasm-semantic.hpp"
+#include <cstdint>
+#include <unordered_map>
+
+namespace cqasm {
+namespace index {
+
+/**
+ * Position of an instruction within a semantic tree, consisting of the index
+ * of the subcircuit within the program, the index of the bundle within the
+ * subcircuit, and the index of the instruction within the bundle.
+ */
+struct Position {
+
+    /**
+     * Index of the subcircuit within semantic::Program::subcircuits.
+     */
+    uint32_t subcircuit;
+
+    /**
+     * Index of the bundle within semantic::Subcircuit::bundles.
+     */
+    uint32_t bundle;
+
+    /**
+     * Index of the instruction within semantic::Bundle::items.
+     */
+    uint32_t item;
+
+    /**
+     * Equality operator.
+     */
+    bool operator==(const Position &rhs) const;
+
+    /**
+     * Inequality operator.
+     */
+    inline bool operator!=(const Position &rhs) const {
+        return !(*this == rhs);
+    }
+
+};
+
+/**
+ * A list of instruction positions, in program order.
+ */
+using Positions = std::vector<Position>;
+
+/**
+ * Inverted index from instruction names to the positions at which they occur
+ * in a semantic tree. This allows questions like "where are all the measure
+ * instructions?" to be answered in time proportional to the number of
+ * occurrences rather than the size of the program. Names are matched case
+ * insensitively, like everywhere else in libqasm.
+ *
+ * The index refers to the tree by position only, so it is invalidated when
+ * subcircuits, bundles, or instructions are added to or removed from the
+ * tree. Use build() to construct a new one after doing so.
+ */
+class InstructionIndex {
+private:
+
+    /**
+     * Map from lowercase instruction name to the positions of the
+     * instructions with that name.
+     */
+    std::unordered_map<std::string, Positions> occurrences;
+
+public:
+
+    /**
+     * Builds an index for the given program in a single pass.
+     */
+    static InstructionIndex build(const semantic::Program &program);
+
+    /**
+     * Records that the given instruction occurs at the given position.
+     * Positions must be added in program order for the lists returned by
+     * find() to be in program order.
+     */
+    void add(const semantic::Instruction &insn, const Position &position);
+
+    /**
+     * Removes all entries from the index.
+     */
+    void clear();
+
+    /**
+     * Returns the positions of all instructions with the given name. An empty
+     * list is returned if the instruction does not occur at all.
+     */
+    const Positions &find(const std::string &name) const;
+
+    /**
+     * Returns the positions of all instructions that were resolved to the
+     * given instruction type. Unresolved instructions are never returned. The
+     * given program must be the one the index was built for.
+     */
+    Positions find(
+        const semantic::Program &program,
+        const instruction::Instruction &instruction
+    ) const;
+
+    /**
+     * Returns the number of times an instruction with the given name occurs.
+     */
+    size_t count(const std::string &name) const;
+
+    /**
+     * Returns the map from lowercase instruction name to positions.
+     */
+    const std::unordered_map<std::string, Positions> &get_table() const;
+
+};
+
+/**
+ * A contiguous range of flat instruction positions, as returned by the
+ * queries of TimelineIndex.
+ */
+using FlatRange = tree::FlatRange<uint32_t>;
+
+/**
+ * Compressed sparse row (CSR) representation of, for each index of a qubit or
+ * bit register, the sorted list of flat positions of the instructions using
+ * it. The positions for index k are stored in entries[offsets[k]] up to (but
+ * excluding) entries[offsets[k+1]].
+ */
+class Timeline {
+public:
+
+    /**
+     * Offsets into entries for each register index, plus one extra offset
+     * marking the end of the last list.
+     */
+    std::vector<uint32_t> offsets;
+
+    /**
+     * The concatenation of the position lists of all register indices.
+     */
+    std::vector<uint32_t> entries;
+
+    /**
+     * Returns the number of register indices in this timeline. This is one
+     * past the highest index that is used at least once.
+     */
+    size_t size() const;
+
+    /**
+     * Returns all positions for the given register index, in program order.
+     * If the index is out of range, an empty range is returned.
+     */
+    FlatRange get(size_t index) const;
+
+    /**
+     * Returns the positions p for the given register index for which
+     * from <= p < to, in program order. This takes time logarithmic in the
+     * number of positions for the given index.
+     */
+    FlatRange get(size_t index, uint32_t from, uint32_t to) const;
+
+};
+
+/**
+ * Per-qubit and per-bit timeline index for a semantic tree. The instructions
+ * of the program are numbered in program order, starting from zero at the
+ * first instruction of the first subcircuit and counting the instructions
+ * within a bundle in order; this is called the flat position of an
+ * instruction. For each qubit and each measurement bit, the index stores the
+ * sorted list of flat positions of the instructions that reference it.
+ * Qubits are taken from QubitRefs operands; bits are taken from BitRefs
+ * operands as well as from the condition of conditional instructions. An
+ * instruction that references the same qubit or bit more than once is only
+ * listed once.
+ *
+ * Like InstructionIndex, this index is invalidated by structural changes to
+ * the tree.
+ */
+class TimelineIndex {
+private:
+
+    /**
+     * Map from flat position to tree position.
+     */
+    std::vector<Position> stream;
+
+    /**
+     * Timelines for the qubit register.
+     */
+    Timeline qubit_timeline;
+
+    /**
+     * Timelines for the measurement bit register.
+     */
+    Timeline bit_timeline;
+
+public:
+
+    /**
+     * Builds an index for the given program. Subcircuits are divided over
+     * up to num_threads threads, each of which counts and then fills in the
+     * positions for its own part of the program; the per-thread counts are
+     * merged with a prefix sum in between. If num_threads is zero, the number
+     * of hardware threads is used.
+     */
+    static TimelineIndex build(const semantic::Program &program, size_t num_threads = 0);
+
+    /**
+     * Returns the total number of instructions in the program, i.e. one past
+     * the highest flat position.
+     */
+    size_t size() const;
+
+    /**
+     * Converts the given flat position into a tree position. Throws
+     * std::out_of_range if the position does not exist.
+     */
+    const Position &locate(uint32_t flat) const;
+
+    /**
+     * Returns the flat positions of all instructions using the given qubit,
+     * in program order.
+     */
+    FlatRange qubit(size_t qubit) const;
+
+    /**
+     * Returns the flat positions p of the instructions using the given qubit
+     * for which from <= p < to, in program order. This takes logarithmic
+     * time.
+     */
+    FlatRange qubit(size_t qubit, uint32_t from, uint32_t to) const;
+
+    /**
+     * Returns the flat positions of all instructions using the given
+     * measurement bit, in program order.
+     */
+    FlatRange bit(size_t bit) const;
+
+    /**
+     * Returns the flat positions p of the instructions using the given
+     * measurement bit for which from <= p < to, in program order. This takes
+     * logarithmic time.
+     */
+    FlatRange bit(size_t bit, uint32_t from, uint32_t to) const;
+
+    /**
+     * Returns the qubit timelines.
+     */
+    const Timeline &qubits() const;
+
+    /**
+     * Returns the measurement bit timelines.
+     */
+    const Timeline &bits() const;
+
+};
+
+/**
+ * Returns the instruction at the given position of the given program. Throws
+ * std::out_of_range if the position does not exist.
+ */
+const semantic::Instruction &get(
+    const semantic::Program &program,
+    const Position &position
+);
+
+} // namespace index
+} // namespace cqasm
+
+/**
+ * Stream << overload for instruction positions.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::index::Position& position);
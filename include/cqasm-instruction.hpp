@@ -98,6 +98,29 @@ public:
 using InstructionRef = tree::Maybe<Instruction>;
 
 } // namespace instruction
+
+namespace primitives {
+
+/**
+ * Adds the memory used by the instruction descriptor that the given reference
+ * refers to, if any, to the given memory usage report. Descriptors that are
+ * shared by several nodes are counted once.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const instruction::InstructionRef &ref);
+
+/**
+ * Freezes or thaws the instruction descriptor that the given reference refers
+ * to, if any, along with its parameter types. See tree::Frozen.
+ */
+void set_frozen(const instruction::InstructionRef &ref, bool frozen);
+
+/**
+ * Returns a hash of the instruction descriptor that the given reference refers
+ * to, consistent with its equality operator. See tree::MerkleHashes.
+ */
+uint64_t hash(const instruction::InstructionRef &ref);
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
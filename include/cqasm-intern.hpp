@@ -0,0 +1,426 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include "cqasm-primitives.hpp"
+
+namespace cqasm {
+namespace intern {
+
+/**
+ * The number of independently locked stripes of each table of a Pool.
+ * Lookups of values that hash to different stripes don't contend.
+ */
+const size_t NUM_STRIPES = 16;
+
+/**
+ * Lock-striped hash table of deduplicated, immutable values of type T. The
+ * values are looked up by their primitives::hash() and equality operator.
+ * The table keeps a reference to every value it ever returned, until
+ * purge() finds that nothing else refers to it anymore.
+ */
+template <class T>
+class Table {
+private:
+
+    /**
+     * A part of the table with its own lock.
+     */
+    struct Stripe {
+
+        /**
+         * Protects values.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * The values in this stripe, keyed by their hash.
+         */
+        std::unordered_multimap<uint64_t, std::shared_ptr<const T>> values;
+
+    };
+
+    /**
+     * The stripes. Values are assigned to them by hash.
+     */
+    std::array<Stripe, NUM_STRIPES> stripes;
+
+public:
+
+    /**
+     * Returns the stored value equal to the given one, storing a copy of it
+     * if there is none yet.
+     */
+    template <class U>
+    std::shared_ptr<const T> get(U &&value) {
+        auto hash = primitives::hash(value);
+        auto &stripe = stripes[(hash >> 32) % NUM_STRIPES];
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto range = stripe.values.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (*it->second == value) {
+                return it->second;
+            }
+        }
+        auto stored = std::make_shared<const T>(std::forward<U>(value));
+        stripe.values.emplace(hash, stored);
+        return stored;
+    }
+
+    /**
+     * Returns the number of distinct values in the table.
+     */
+    size_t size() const {
+        size_t count = 0;
+        for (const auto &stripe : stripes) {
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            count += stripe.values.size();
+        }
+        return count;
+    }
+
+    /**
+     * Removes the values that are no longer referred to by anything but the
+     * table, and returns how many were removed. New references to a value
+     * can only be made by copying an existing one or through get(), which
+     * takes the lock, so a value that is only referred to by the table
+     * can't be picked up again while this runs.
+     */
+    size_t purge() {
+        size_t count = 0;
+        for (auto &stripe : stripes) {
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            for (auto it = stripe.values.begin(); it != stripe.values.end();) {
+                if (it->second.use_count() == 1) {
+                    it = stripe.values.erase(it);
+                    count++;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return count;
+    }
+
+};
+
+/**
+ * Pool of deduplicated, immutable strings and complex matrices, shared by
+ * all the programs that are analyzed while the pool is selected. Batch
+ * tools that keep many programs in memory can use this to store the
+ * instruction names, mapping names, string and JSON constants and gate
+ * unitaries that these programs have in common only once. Lookups are
+ * thread-safe.
+ *
+ * The pool is selected per thread with set_pool() or a Scope object, or for
+ * all threads that don't select one with set_default_pool(). Values stay
+ * alive for as long as they are referred to, also after the pool is
+ * destroyed.
+ */
+class Pool {
+private:
+
+    /**
+     * The interned strings.
+     */
+    Table<primitives::Str> strings;
+
+    /**
+     * The interned complex matrices.
+     */
+    Table<primitives::CMatrix> matrices;
+
+public:
+
+    /**
+     * Creates an empty pool.
+     */
+    Pool() = default;
+
+    // The tables contain mutexes, so the pool can't be copied.
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    /**
+     * Returns the stored string equal to the given one, storing a copy of it
+     * if there is none yet.
+     */
+    std::shared_ptr<const primitives::Str> get(const primitives::Str &value);
+
+    /**
+     * Returns the stored string equal to the given one, storing it if there
+     * is none yet.
+     */
+    std::shared_ptr<const primitives::Str> get(primitives::Str &&value);
+
+    /**
+     * Returns the stored matrix equal to the given one, storing a copy of it
+     * if there is none yet.
+     */
+    std::shared_ptr<const primitives::CMatrix> get(const primitives::CMatrix &value);
+
+    /**
+     * Returns the stored matrix equal to the given one, storing it if there
+     * is none yet.
+     */
+    std::shared_ptr<const primitives::CMatrix> get(primitives::CMatrix &&value);
+
+    /**
+     * Returns the number of distinct values in the pool.
+     */
+    size_t size() const;
+
+    /**
+     * Removes the values that are no longer referred to by any program from
+     * the pool, and returns how many were removed.
+     */
+    size_t purge();
+
+    /**
+     * Returns the process-wide pool. It is not selected by default; use
+     * set_default_pool() or a Scope to do so.
+     */
+    static Pool &global();
+
+};
+
+/**
+ * Returns the pool selected for the calling thread, or the default pool if
+ * the thread didn't select one. Returns nullptr if neither is set, in which
+ * case values are not deduplicated.
+ */
+Pool *get_pool();
+
+/**
+ * Selects the pool for the calling thread, or falls back to the default pool
+ * when nullptr is passed. Returns the previously selected pool.
+ */
+Pool *set_pool(Pool *pool);
+
+/**
+ * Selects the pool used by threads that didn't select one themselves, or
+ * disables interning for them when nullptr is passed. Returns the previous
+ * default pool.
+ */
+Pool *set_default_pool(Pool *pool);
+
+/**
+ * RAII object that selects an interning pool for the calling thread for as
+ * long as it exists, and restores the previously selected pool when it is
+ * destroyed.
+ */
+class Scope {
+private:
+
+    /**
+     * The pool that was selected before this scope.
+     */
+    Pool *previous;
+
+public:
+
+    /**
+     * Selects the given pool, or the default pool for nullptr.
+     */
+    explicit Scope(Pool *pool);
+
+    /**
+     * Restores the previously selected pool.
+     */
+    ~Scope();
+
+    // Scopes must be destroyed in reverse order of construction, so they
+    // can't be copied.
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+};
+
+/**
+ * Immutable value of type T, stored in the pool that was selected when it
+ * was created, or inline if no pool was selected. Copies of pooled values
+ * share the stored value; values that are stored inline cost the same as a
+ * plain T. Values behave like a const T otherwise: they convert to const T&
+ * implicitly, and members of T are accessed through ->. Assigning a new
+ * value replaces the reference.
+ */
+template <class T>
+class Interned {
+private:
+
+    /**
+     * The value stored in the pool, or nullptr if it is stored inline.
+     */
+    std::shared_ptr<const T> shared;
+
+    /**
+     * The value, if it is not stored in a pool.
+     */
+    T local;
+
+public:
+
+    /**
+     * Creates a default-constructed value. This doesn't allocate.
+     */
+    Interned() = default;
+
+    /**
+     * Stores a copy of the given value.
+     */
+    Interned(const T &value) {
+        if (auto pool = get_pool()) {
+            shared = pool->get(value);
+        } else {
+            local = value;
+        }
+    }
+
+    /**
+     * Stores the given value.
+     */
+    Interned(T &&value) {
+        if (auto pool = get_pool()) {
+            shared = pool->get(std::move(value));
+        } else {
+            local = std::move(value);
+        }
+    }
+
+    /**
+     * Returns whether the value is stored in a pool.
+     */
+    bool is_pooled() const {
+        return shared != nullptr;
+    }
+
+    /**
+     * Returns the stored value.
+     */
+    const T &get() const {
+        return shared ? *shared : local;
+    }
+
+    /**
+     * Returns the stored value.
+     */
+    operator const T&() const {
+        return get();
+    }
+
+    /**
+     * Returns the stored value.
+     */
+    const T &operator*() const {
+        return get();
+    }
+
+    /**
+     * Provides access to the members of the stored value.
+     */
+    const T *operator->() const {
+        return &get();
+    }
+
+    /**
+     * Returns whether the values are equal. Values from the same pool are
+     * equal if and only if they share their storage.
+     */
+    bool operator==(const Interned &rhs) const {
+        return (shared && shared == rhs.shared) || get() == rhs.get();
+    }
+
+    /**
+     * Returns whether the values differ.
+     */
+    bool operator!=(const Interned &rhs) const {
+        return !(*this == rhs);
+    }
+
+    /**
+     * Returns whether the stored value equals the given value.
+     */
+    bool operator==(const T &rhs) const {
+        return get() == rhs;
+    }
+
+    /**
+     * Returns whether the stored value differs from the given value.
+     */
+    bool operator!=(const T &rhs) const {
+        return !(get() == rhs);
+    }
+
+    /**
+     * Returns whether the given value equals the stored value.
+     */
+    friend bool operator==(const T &lhs, const Interned &rhs) {
+        return rhs == lhs;
+    }
+
+    /**
+     * Returns whether the given value differs from the stored value.
+     */
+    friend bool operator!=(const T &lhs, const Interned &rhs) {
+        return rhs != lhs;
+    }
+
+};
+
+/**
+ * Interned string primitive, used for the names and string constants of the
+ * semantic tree.
+ */
+using Str = Interned<primitives::Str>;
+
+/**
+ * Interned complex matrix primitive, used for the matrix constants of the
+ * semantic tree.
+ */
+using CMatrix = Interned<primitives::CMatrix>;
+
+} // namespace intern
+
+namespace primitives {
+
+/**
+ * Adds the heap memory of the given interned string to the given memory
+ * usage report. Pooled strings are counted once, with the memory they own,
+ * as a cqasm::intern::Str object; strings stored inline are attributed to
+ * the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const intern::Str &str);
+
+/**
+ * Adds the heap memory of the given interned matrix to the given memory
+ * usage report. Pooled matrices are counted once, with the memory they own,
+ * as a cqasm::intern::CMatrix object; matrices stored inline are attributed
+ * to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const intern::CMatrix &matrix);
+
+/**
+ * Returns a hash of the given interned value, equal to that of the value
+ * itself.
+ */
+template <class T>
+uint64_t hash(const intern::Interned<T> &value) {
+    return hash(value.get());
+}
+
+} // namespace primitives
+} // namespace cqasm
+
+/**
+ * Stream << overload for interned values.
+ */
+template <class T>
+std::ostream& operator<<(std::ostream& os, const ::cqasm::intern::Interned<T>& value) {
+    return os << value.get();
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace cqasm {
+namespace memory {
+
+/**
+ * Interface for memory resources that the tree nodes and annotations of a
+ * program can be allocated from, such as a per-request arena or a NUMA-local
+ * pool.
+ *
+ * The resource is selected per thread with set_resource() or a Scope object.
+ * Everything allocated while a resource is selected remembers the resource it
+ * came from, so it is returned to the right resource regardless of which
+ * resource is selected when it is freed. The resource must therefore outlive
+ * everything allocated from it.
+ */
+class Resource {
+public:
+
+    /**
+     * Virtual destructor, for proper cleanup of derived resources.
+     */
+    virtual ~Resource() = default;
+
+    /**
+     * Allocates the given number of bytes, aligned for any fundamental type.
+     * Throws std::bad_alloc on failure.
+     */
+    virtual void *allocate(size_t size) = 0;
+
+    /**
+     * Frees memory previously returned by allocate() with the same size.
+     */
+    virtual void deallocate(void *ptr, size_t size) = 0;
+
+};
+
+/**
+ * Memory resource that hands out memory from large chunks, and only frees it
+ * when the arena is released or destroyed. Individual deallocations are
+ * no-ops. This makes allocation very cheap and keeps the nodes of a program
+ * close together, at the cost of not reusing memory until the whole program
+ * is dropped. Not thread-safe; use one arena per thread or per request.
+ */
+class Arena : public Resource {
+private:
+
+    /**
+     * The chunks allocated so far.
+     */
+    std::vector<std::unique_ptr<char[]>> chunks;
+
+    /**
+     * The size of newly allocated chunks.
+     */
+    size_t chunk_size;
+
+    /**
+     * The next free byte in the current chunk.
+     */
+    char *next;
+
+    /**
+     * The number of free bytes remaining in the current chunk.
+     */
+    size_t remaining;
+
+    /**
+     * The total number of bytes handed out.
+     */
+    size_t used;
+
+    /**
+     * The total number of bytes allocated for chunks.
+     */
+    size_t reserved;
+
+public:
+
+    /**
+     * Creates an empty arena that allocates chunks of the given size.
+     * Allocations larger than a chunk get a chunk of their own.
+     */
+    explicit Arena(size_t chunk_size = 64 * 1024);
+
+    /**
+     * Allocates the given number of bytes from the current chunk, or from a
+     * new one if the current chunk is full.
+     */
+    void *allocate(size_t size) override;
+
+    /**
+     * Does nothing; memory is only freed by release().
+     */
+    void deallocate(void *ptr, size_t size) override;
+
+    /**
+     * Frees all chunks. Everything allocated from the arena must have been
+     * destroyed by then.
+     */
+    void release();
+
+    /**
+     * Returns the total number of bytes handed out since construction or the
+     * last release().
+     */
+    size_t get_used() const;
+
+    /**
+     * Returns the total number of bytes allocated for chunks.
+     */
+    size_t get_reserved() const;
+
+};
+
+/**
+ * Returns the memory resource selected for the calling thread, or nullptr
+ * if the library's default allocation strategy is used.
+ */
+Resource *get_resource();
+
+/**
+ * Selects the memory resource for the calling thread, or restores the
+ * default allocation strategy when nullptr is passed. Returns the previously
+ * selected resource.
+ */
+Resource *set_resource(Resource *resource);
+
+/**
+ * Allocates memory from the given resource, or using the global operator new
+ * if it is nullptr.
+ */
+void *allocate(Resource *resource, size_t size);
+
+/**
+ * Frees memory allocated by allocate() with the same resource and size.
+ */
+void deallocate(Resource *resource, void *ptr, size_t size);
+
+/**
+ * RAII object that selects a memory resource for the calling thread for as
+ * long as it exists, and restores the previously selected resource when it
+ * is destroyed.
+ */
+class Scope {
+private:
+
+    /**
+     * The resource that was selected before this scope.
+     */
+    Resource *previous;
+
+public:
+
+    /**
+     * Selects the given resource, or the default allocation strategy for
+     * nullptr.
+     */
+    explicit Scope(Resource *resource);
+
+    /**
+     * Restores the previously selected resource.
+     */
+    ~Scope();
+
+    // Scopes must be destroyed in reverse order of construction, so they
+    // can't be copied.
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+};
+
+/**
+ * Standard allocator that allocates from the memory resource that was
+ * selected for the calling thread when the allocator was constructed. Used
+ * with std::allocate_shared, the allocator is stored in the control block,
+ * so the object is returned to the right resource when it is destroyed.
+ */
+template <class T>
+class Allocator {
+private:
+    template <class U>
+    friend class Allocator;
+
+    /**
+     * The resource to allocate from, or nullptr for the global operator new.
+     */
+    Resource *resource;
+
+public:
+
+    /**
+     * The allocated type.
+     */
+    using value_type = T;
+
+    /**
+     * Creates an allocator for the currently selected resource.
+     */
+    Allocator() : resource(memory::get_resource()) {}
+
+    /**
+     * Creates an allocator for the given resource.
+     */
+    explicit Allocator(Resource *resource) : resource(resource) {}
+
+    /**
+     * Converts from an allocator for a different type.
+     */
+    template <class U>
+    Allocator(const Allocator<U> &other) : resource(other.resource) {}
+
+    /**
+     * Allocates memory for n objects.
+     */
+    T *allocate(size_t n) {
+        return static_cast<T*>(memory::allocate(resource, n * sizeof(T)));
+    }
+
+    /**
+     * Frees memory for n objects.
+     */
+    void deallocate(T *ptr, size_t n) {
+        memory::deallocate(resource, ptr, n * sizeof(T));
+    }
+
+    /**
+     * Returns the resource that this allocator allocates from.
+     */
+    Resource *get_resource() const {
+        return resource;
+    }
+
+    /**
+     * Allocators are equal when they allocate from the same resource.
+     */
+    template <class U>
+    bool operator==(const Allocator<U> &other) const {
+        return resource == other.resource;
+    }
+
+    /**
+     * Allocators are equal when they allocate from the same resource.
+     */
+    template <class U>
+    bool operator!=(const Allocator<U> &other) const {
+        return resource != other.resource;
+    }
+
+};
+
+} // namespace memory
+} // namespace cqasm
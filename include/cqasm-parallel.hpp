@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cqasm {
+namespace parallel {
+
+class TaskGroup;
+
+/**
+ * Pool of worker threads that run the tasks of task groups. Every worker
+ * has its own task queue; tasks submitted by a worker go to its own queue
+ * and are taken from the back (most recent first), while idle workers steal
+ * the oldest tasks from the front of the queues of the others. Tasks
+ * submitted by threads outside the pool go to a shared queue. Threads that
+ * wait for a task group run queued tasks in the meantime, so tasks may
+ * submit and wait for nested task groups without deadlocking the pool.
+ */
+class WorkPool {
+private:
+    friend class TaskGroup;
+
+    /**
+     * A task and the group it belongs to.
+     */
+    struct Task {
+
+        /**
+         * The function to run.
+         */
+        std::function<void()> function;
+
+        /**
+         * The group that the task belongs to.
+         */
+        TaskGroup *group;
+
+    };
+
+    /**
+     * The task queue of a thread.
+     */
+    struct Queue {
+
+        /**
+         * Protects tasks.
+         */
+        std::mutex mutex;
+
+        /**
+         * The queued tasks.
+         */
+        std::deque<Task> tasks;
+
+    };
+
+    /**
+     * The task queues. The first is shared by the threads outside the pool,
+     * the others belong to the worker threads.
+     */
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    /**
+     * The worker threads.
+     */
+    std::vector<std::thread> threads;
+
+    /**
+     * The number of tasks in all queues together.
+     */
+    std::atomic<size_t> queued;
+
+    /**
+     * Protects stopping and is used to wake up idle workers.
+     */
+    std::mutex mutex;
+
+    /**
+     * Signalled when tasks are queued or the pool is stopped.
+     */
+    std::condition_variable wakeup;
+
+    /**
+     * Whether the pool is being destroyed.
+     */
+    bool stopping;
+
+    /**
+     * Returns the index of the queue of the calling thread.
+     */
+    size_t get_queue() const;
+
+    /**
+     * Queues a task on the queue of the calling thread.
+     */
+    void push(Task &&task);
+
+    /**
+     * Takes a task from the queue of the calling thread or steals one from
+     * another queue, and runs it. Returns false if there was no task.
+     */
+    bool run_one();
+
+    /**
+     * Main loop of the worker thread with the given queue index.
+     */
+    void work(size_t index);
+
+public:
+
+    /**
+     * Creates a pool for the given number of threads, including the thread
+     * that waits for the tasks, so num_threads - 1 worker threads are
+     * started. If num_threads is zero, the number of hardware threads is
+     * used.
+     */
+    explicit WorkPool(size_t num_threads = 0);
+
+    /**
+     * Stops the worker threads. All task groups must have been waited for.
+     */
+    ~WorkPool();
+
+    // The worker threads refer to the pool, so it can't be copied.
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    /**
+     * Returns the number of threads that the pool was created for.
+     */
+    size_t get_num_threads() const;
+
+};
+
+/**
+ * A group of tasks run by a WorkPool, that can be waited for as a whole.
+ * Tasks may be added from any thread, including from the tasks of the
+ * group themselves.
+ */
+class TaskGroup {
+private:
+    friend class WorkPool;
+
+    /**
+     * The pool that runs the tasks.
+     */
+    WorkPool &pool;
+
+    /**
+     * The number of tasks that were added but did not finish yet.
+     */
+    std::atomic<size_t> pending;
+
+    /**
+     * Protects error and is used to wait for the tasks.
+     */
+    std::mutex mutex;
+
+    /**
+     * Signalled when the last pending task finishes.
+     */
+    std::condition_variable done;
+
+    /**
+     * The first exception thrown by one of the tasks, if any.
+     */
+    std::exception_ptr error;
+
+    /**
+     * Called by the pool when one of the tasks of this group finishes,
+     * with the exception that it threw, if any.
+     */
+    void finish(std::exception_ptr task_error);
+
+public:
+
+    /**
+     * Creates an empty group of tasks to be run by the given pool.
+     */
+    explicit TaskGroup(WorkPool &pool);
+
+    /**
+     * Waits for the remaining tasks, ignoring any exceptions they throw.
+     */
+    ~TaskGroup();
+
+    // The queued tasks refer to the group, so it can't be copied.
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * Adds a task to the group, to be run by any thread of the pool.
+     */
+    void run(std::function<void()> task);
+
+    /**
+     * Waits for all tasks of the group to finish, running queued tasks of
+     * the pool on the calling thread in the meantime. If any of the tasks
+     * threw an exception, the first one is rethrown.
+     */
+    void wait();
+
+};
+
+} // namespace parallel
+} // namespace cqasm
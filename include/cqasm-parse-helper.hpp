@@ -1,6 +1,7 @@
 #pragma once
 
 #include "cqasm-ast.hpp"
+#include "cqasm-memory.hpp"
 #include <cstdio>
 
 namespace cqasm {
@@ -28,20 +29,32 @@ public:
 };
 
 /**
- * Parse the given file.
+ * Parse the given file. If a memory resource is given, the AST is allocated
+ * from it; otherwise the resource selected for the calling thread is used.
  */
-ParseResult parse_file(const std::string &filename);
+ParseResult parse_file(const std::string &filename, memory::Resource *resource = nullptr);
 
 /**
- * Parse using the given file pointer.
+ * Parse using the given file pointer. If a memory resource is given, the AST
+ * is allocated from it; otherwise the resource selected for the calling
+ * thread is used.
  */
-ParseResult parse_file(FILE *file, const std::string &filename = "<unknown>");
+ParseResult parse_file(
+    FILE *file,
+    const std::string &filename = "<unknown>",
+    memory::Resource *resource = nullptr
+);
 
 /**
  * Parse the given string. A filename may be given in addition for use within
- * error messages.
+ * error messages. If a memory resource is given, the AST is allocated from
+ * it; otherwise the resource selected for the calling thread is used.
  */
-ParseResult parse_string(const std::string &data, const std::string &filename="<unknown>");
+ParseResult parse_string(
+    const std::string &data,
+    const std::string &filename = "<unknown>",
+    memory::Resource *resource = nullptr
+);
 
 /**
  * Internal helper class for parsing cQASM files.
@@ -75,9 +88,9 @@ public:
     ParseResult result;
 
 private:
-    friend ParseResult parse_file(const std::string &filename);
-    friend ParseResult parse_file(FILE *file, const std::string &filename);
-    friend ParseResult parse_string(const std::string &data, const std::string &filename);
+    friend ParseResult parse_file(const std::string &filename, memory::Resource *resource);
+    friend ParseResult parse_file(FILE *file, const std::string &filename, memory::Resource *resource);
+    friend ParseResult parse_string(const std::string &data, const std::string &filename, memory::Resource *resource);
 
     /**
      * Parse a string or file with flex/bison. If use_file is set, the file
@@ -168,6 +181,16 @@ public:
 };
 
 } // namespace parser
+
+namespace primitives {
+
+/**
+ * Adds the heap memory owned by the given source location to the given
+ * memory usage report, attributed to the given type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const parser::SourceLocation &location);
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "cqasm-analyzer.hpp"
+#include <unordered_map>
+
+namespace cqasm {
+namespace peephole {
+
+/**
+ * A peephole rewrite rule. The rule matches a sequence of consecutive gates
+ * with the given names, all applied to the same ordered list of qubits, and
+ * replaces them with gates with the given names applied to those qubits.
+ */
+class Rule {
+public:
+
+    /**
+     * Names of the gates to match, in program order.
+     */
+    std::vector<std::string> pattern;
+
+    /**
+     * Names of the gates to replace the match with, in program order. May be
+     * empty to cancel the matched gates.
+     */
+    std::vector<std::string> replacement;
+
+    /**
+     * The number of qubit operands of the gates.
+     */
+    size_t num_qubits;
+
+};
+
+/**
+ * Table of peephole rules. The gate names in the rules are checked against
+ * the instruction set of the analyzer the table is constructed with, and
+ * replacement gates are resolved through it as well. The analyzer must
+ * outlive the table.
+ *
+ * Rules are stored in a hash table keyed by the gate names of the pattern,
+ * so matching a window of gates against all rules takes constant time for a
+ * bounded pattern length.
+ */
+class RuleTable {
+private:
+
+    /**
+     * The analyzer used to check and resolve gates.
+     */
+    const analyzer::Analyzer &analyzer;
+
+    /**
+     * The list of rules.
+     */
+    std::vector<Rule> rules;
+
+    /**
+     * Map from lowercase gate name to a unique identifier for that name, for
+     * all names used in rule patterns.
+     */
+    std::unordered_map<std::string, uint32_t> name_ids;
+
+    /**
+     * Map from pattern key to rule index. The key consists of the number of
+     * qubits followed by the name identifiers of the pattern, each packed
+     * into four bytes of a string.
+     */
+    std::unordered_map<std::string, size_t> patterns;
+
+    /**
+     * The length of the longest pattern.
+     */
+    size_t max_length;
+
+public:
+
+    /**
+     * Creates an empty rule table using the given analyzer.
+     */
+    explicit RuleTable(const analyzer::Analyzer &analyzer);
+
+    /**
+     * Adds a rule. Throws an AnalysisError if one of the gates cannot be
+     * resolved for the given number of qubit operands, and
+     * std::invalid_argument if the pattern is empty, if the replacement is
+     * not shorter than the pattern (which would allow rules to rewrite
+     * indefinitely), or if a rule with the same pattern already exists.
+     */
+    void add(
+        const std::vector<std::string> &pattern,
+        const std::vector<std::string> &replacement = {},
+        size_t num_qubits = 1
+    );
+
+    /**
+     * Adds a set of default rules, such as cancellation of pairs of
+     * self-inverse gates (x, y, z, h, cnot, cz, swap) and of s/sdag and
+     * t/tdag, and the h-conjugations of x and z. Rules that refer to gates
+     * that the analyzer does not know are silently skipped.
+     */
+    void add_default_rules();
+
+    /**
+     * Returns the analyzer used to resolve gates.
+     */
+    const analyzer::Analyzer &get_analyzer() const;
+
+    /**
+     * Returns the list of rules.
+     */
+    const std::vector<Rule> &get_rules() const;
+
+    /**
+     * Returns the identifier for the given gate name, or -1 if the name is not
+     * used by any rule pattern.
+     */
+    int64_t get_name_id(const std::string &name) const;
+
+    /**
+     * Returns the index of the rule matching the given pattern key, or -1 if
+     * there is no such rule. See the patterns member for the format of the
+     * key.
+     */
+    int64_t find(const std::string &key) const;
+
+    /**
+     * Returns the length of the longest pattern.
+     */
+    size_t get_max_length() const;
+
+};
+
+/**
+ * Applies the rules in the given table to the given program in a single
+ * pass. Returns the net number of instructions removed.
+ *
+ * The program is treated as a stream of gates per subcircuit. Only gates that
+ * are alone in their bundle, are unconditional, and have only single-qubit
+ * references as operands participate in matching. For each ordered tuple of
+ * qubits, a window of the most recent consecutive gates on exactly those
+ * qubits is kept; a gate on any of those qubits in a different configuration
+ * or with a different kind of operand closes the window, as does any
+ * instruction that does not use qubits and the end of a subcircuit. When the
+ * tail of a window matches a rule, the matched gates are replaced, and the
+ * replacement gates are pushed onto the window like new gates, such that
+ * rewrites can cascade. Since every rewrite removes at least one gate, the
+ * total running time is linear in the number of instructions.
+ *
+ * Replacement gates take the place of the last gate of the match and have
+ * its source location. Annotations of matched gates are dropped.
+ *
+ * Note that a window is closed as soon as a conflicting gate is seen, even
+ * if that gate is cancelled later on. For example, in x a; cnot a, b;
+ * cnot a, b; x a, only the cnot gates are removed. Running the optimizer
+ * again catches such cases.
+ */
+size_t optimize(semantic::Program &program, const RuleTable &rules);
+
+} // namespace peephole
+} // namespace cqasm
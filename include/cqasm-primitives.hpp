@@ -4,8 +4,16 @@
 #include <cstdint>
 #include <complex>
 #include <vector>
+#include <memory>
+#include <stdexcept>
+#include "cqasm-utils.hpp"
 
 namespace cqasm {
+
+namespace tree {
+class MemoryUsage;
+} // namespace tree
+
 namespace primitives {
 
 /**
@@ -72,7 +80,7 @@ public:
      * Creates an empty matrix.
      */
     Matrix()
-        : data(ncols), nrows(1), ncols(0)
+        : data(), nrows(1), ncols(0)
     {}
 
     /**
@@ -171,12 +179,393 @@ using RMatrix = Matrix<Real>;
  */
 using CMatrix = Matrix<Complex>;
 
+/**
+ * Complex matrix stored in compressed sparse row (CSR) form, for large
+ * matrices with few nonzero elements, such as permutation matrices. The
+ * contents are immutable and shared between copies, so copying is cheap.
+ */
+class SparseCMatrix {
+private:
+    friend void add_memory_usage(tree::MemoryUsage &usage, const char *type, const SparseCMatrix &matrix);
+
+    /**
+     * The shared contents of the matrix.
+     */
+    struct Data {
+
+        /**
+         * The number of rows.
+         */
+        size_t nrows;
+
+        /**
+         * The number of columns.
+         */
+        size_t ncols;
+
+        /**
+         * For each row, the index of its first element in col_indices and
+         * values, followed by the total number of elements.
+         */
+        std::vector<size_t> row_offsets;
+
+        /**
+         * The zero-based column index of each stored element, strictly
+         * increasing within each row.
+         */
+        std::vector<size_t> col_indices;
+
+        /**
+         * The value of each stored element. These are never zero.
+         */
+        std::vector<Complex> values;
+
+    };
+
+    /**
+     * The shared contents of the matrix.
+     */
+    std::shared_ptr<const Data> data;
+
+public:
+
+    /**
+     * Creates an empty matrix.
+     */
+    SparseCMatrix();
+
+    /**
+     * Creates a matrix from its CSR representation. row_offsets must have
+     * nrows + 1 nondecreasing entries starting at zero and ending at the
+     * number of elements, and the zero-based column indices must be in
+     * range and strictly increasing within each row. Explicitly stored
+     * zeros are dropped. Throws std::invalid_argument if the representation
+     * is invalid.
+     */
+    SparseCMatrix(
+        size_t nrows,
+        size_t ncols,
+        const std::vector<size_t> &row_offsets,
+        const std::vector<size_t> &col_indices,
+        const std::vector<Complex> &values
+    );
+
+    /**
+     * Converts from a dense matrix.
+     */
+    static SparseCMatrix from_dense(const CMatrix &matrix);
+
+    /**
+     * Returns the permutation matrix that maps basis state i to basis state
+     * permutation[i]. Throws std::invalid_argument if the given vector is
+     * not a permutation.
+     */
+    static SparseCMatrix permutation(const std::vector<size_t> &permutation);
+
+    /**
+     * Returns the number of rows.
+     */
+    size_t size_rows() const;
+
+    /**
+     * Returns the number of columns.
+     */
+    size_t size_cols() const;
+
+    /**
+     * Returns the number of stored (nonzero) elements.
+     */
+    size_t size_nonzero() const;
+
+    /**
+     * Returns the row offsets of the CSR representation.
+     */
+    const std::vector<size_t> &get_row_offsets() const;
+
+    /**
+     * Returns the column indices of the CSR representation.
+     */
+    const std::vector<size_t> &get_col_indices() const;
+
+    /**
+     * Returns the stored values of the CSR representation.
+     */
+    const std::vector<Complex> &get_values() const;
+
+    /**
+     * Returns the value at the given position. row and col start at 1, like
+     * for Matrix. Throws a std::range_error when either or both indices are
+     * out of range.
+     */
+    Complex at(size_t row, size_t col) const;
+
+    /**
+     * Converts to a dense matrix.
+     */
+    CMatrix to_dense() const;
+
+    /**
+     * Equality operator for sparse matrices.
+     */
+    bool operator==(const SparseCMatrix &rhs) const;
+
+    /**
+     * Inequality operator for sparse matrices.
+     */
+    bool operator!=(const SparseCMatrix &rhs) const;
+
+    /**
+     * Returns whether this matrix equals the given dense matrix, without
+     * converting either of them.
+     */
+    bool operator==(const CMatrix &rhs) const;
+
+    /**
+     * Returns whether this matrix differs from the given dense matrix,
+     * without converting either of them.
+     */
+    bool operator!=(const CMatrix &rhs) const;
+
+};
+
+/**
+ * Complex matrix of a controlled gate, i.e. the identity matrix except for
+ * the bottom-right block, which is the matrix of the target gate. This is
+ * the matrix of a gate with the given number of control qubits as its most
+ * significant (first) qubits. The target matrix is immutable and shared
+ * between copies, so copying is cheap.
+ */
+class ControlledCMatrix {
+private:
+    friend void add_memory_usage(tree::MemoryUsage &usage, const char *type, const ControlledCMatrix &matrix);
+
+    /**
+     * The number of control qubits.
+     */
+    size_t num_controls;
+
+    /**
+     * The matrix of the target gate.
+     */
+    std::shared_ptr<const CMatrix> target;
+
+public:
+
+    /**
+     * Creates a controlled matrix without controls for the 1x1 identity.
+     */
+    ControlledCMatrix();
+
+    /**
+     * Creates a controlled matrix from the number of control qubits and the
+     * target matrix. Throws std::invalid_argument if the target matrix is not
+     * square, or if the result would be too large to address.
+     */
+    ControlledCMatrix(size_t num_controls, const CMatrix &target);
+
+    /**
+     * Returns the number of control qubits.
+     */
+    size_t get_num_controls() const;
+
+    /**
+     * Returns the target matrix.
+     */
+    const CMatrix &get_target() const;
+
+    /**
+     * Returns the number of rows.
+     */
+    size_t size_rows() const;
+
+    /**
+     * Returns the number of columns.
+     */
+    size_t size_cols() const;
+
+    /**
+     * Returns the value at the given position. row and col start at 1, like
+     * for Matrix. Throws a std::range_error when either or both indices are
+     * out of range.
+     */
+    Complex at(size_t row, size_t col) const;
+
+    /**
+     * Converts to a sparse matrix.
+     */
+    SparseCMatrix to_sparse() const;
+
+    /**
+     * Converts to a dense matrix.
+     */
+    CMatrix to_dense() const;
+
+    /**
+     * Equality operator for controlled matrices.
+     */
+    bool operator==(const ControlledCMatrix &rhs) const;
+
+    /**
+     * Inequality operator for controlled matrices.
+     */
+    bool operator!=(const ControlledCMatrix &rhs) const;
+
+    /**
+     * Returns whether this matrix equals the given dense matrix, without
+     * converting either of them.
+     */
+    bool operator==(const CMatrix &rhs) const;
+
+    /**
+     * Returns whether this matrix differs from the given dense matrix,
+     * without converting either of them.
+     */
+    bool operator!=(const CMatrix &rhs) const;
+
+};
+
 /**
  * Version number primitive used within the AST and semantic trees.
  */
 class Version : public std::vector<Int> {
 };
 
+/**
+ * Adds the heap memory owned by the given primitive to the given memory
+ * usage report, attributed to the given node type. This is used by the
+ * add_memory_usage() functions of the generated tree nodes, and is
+ * overloaded for primitives that own heap memory. This generic version is
+ * used for those that don't.
+ */
+template <class T>
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const T &object) {
+    (void)usage;
+    (void)type;
+    (void)object;
+}
+
+/**
+ * Freezes or thaws the tree nodes referred to by the given primitive. This is
+ * used by the set_frozen() functions of the generated tree nodes, and is
+ * overloaded for the primitives that refer to nodes. This generic version is
+ * used for those that don't.
+ */
+template <class T>
+void set_frozen(const T &object, bool frozen) {
+    (void)object;
+    (void)frozen;
+}
+
+/**
+ * Adds the heap memory owned by the given string to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const Str &str);
+
+/**
+ * Adds the heap memory owned by the given matrix to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const RMatrix &matrix);
+
+/**
+ * Adds the heap memory owned by the given matrix to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const CMatrix &matrix);
+
+/**
+ * Adds the heap memory used by the given matrix to the given memory usage
+ * report. The shared contents are counted once, as a separate type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const SparseCMatrix &matrix);
+
+/**
+ * Adds the heap memory used by the given matrix to the given memory usage
+ * report. The shared target matrix is counted once, as a separate type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const ControlledCMatrix &matrix);
+
+/**
+ * Adds the heap memory owned by the given version number to the given
+ * memory usage report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const Version &version);
+
+/**
+ * Returns a hash of the given primitive that is consistent with its equality
+ * operator, for the Merkle hashes of the generated tree nodes (see
+ * tree::MerkleHashes). This is overloaded for the primitive types; this
+ * generic version returns zero, which is consistent with any equality
+ * operator but does not tell anything apart.
+ */
+template <class T>
+uint64_t hash(const T &object) {
+    (void)object;
+    return 0;
+}
+
+/**
+ * Returns a hash of the given string.
+ */
+uint64_t hash(const Str &str);
+
+/**
+ * Returns a hash of the given boolean.
+ */
+uint64_t hash(Bool value);
+
+/**
+ * Returns a hash of the given axis.
+ */
+uint64_t hash(Axis axis);
+
+/**
+ * Returns a hash of the given integer.
+ */
+uint64_t hash(Int value);
+
+/**
+ * Returns a hash of the given real number. Positive and negative zero hash
+ * the same, since they compare equal.
+ */
+uint64_t hash(Real value);
+
+/**
+ * Returns a hash of the given complex number.
+ */
+uint64_t hash(const Complex &value);
+
+/**
+ * Returns a hash of the given matrix, covering its shape and elements.
+ */
+template <class T>
+uint64_t hash(const Matrix<T> &matrix) {
+    uint64_t result = utils::hash_combine(matrix.size_rows(), matrix.size_cols());
+    for (size_t row = 1; row <= matrix.size_rows(); row++) {
+        for (size_t col = 1; col <= matrix.size_cols(); col++) {
+            result = utils::hash_combine(result, hash(matrix.at(row, col)));
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns a hash of the given sparse matrix, covering its shape and its
+ * stored elements.
+ */
+uint64_t hash(const SparseCMatrix &matrix);
+
+/**
+ * Returns a hash of the given controlled matrix.
+ */
+uint64_t hash(const ControlledCMatrix &matrix);
+
+/**
+ * Returns a hash of the given version number.
+ */
+uint64_t hash(const Version &version);
+
 } // namespace primitives
 } // namespace cqasm
 
@@ -206,6 +595,16 @@ std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::Matrix<T>&
     return os;
 }
 
+/**
+ * Stream << overload for sparse matrix nodes.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::SparseCMatrix& mat);
+
+/**
+ * Stream << overload for controlled matrix nodes.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::ControlledCMatrix& mat);
+
 /**
  * Stream << overload for version nodes.
  */
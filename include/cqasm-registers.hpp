@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cqasm-semantic.hpp"
+
+namespace cqasm {
+namespace registers {
+
+/**
+ * Mapping between the qubit/bit indices of a program before and after
+ * compaction, as returned by compact().
+ */
+class RegisterMap {
+public:
+
+    /**
+     * For each index before compaction, the index after compaction, or -1 if
+     * the index was not used.
+     */
+    std::vector<primitives::Int> old_to_new;
+
+    /**
+     * For each index after compaction, the index before compaction.
+     */
+    std::vector<primitives::Int> new_to_old;
+
+};
+
+/**
+ * Renumbers the qubits and measurement bits of the given program, such that
+ * only the indices that are actually used remain, in their original order.
+ * All qubit and bit references in the program are rewritten accordingly,
+ * including those in conditions, the error model, mappings, and annotations,
+ * and num_qubits is set to the number of used indices (or one, if no qubits
+ * or bits are used at all, since a program needs at least one qubit). Qubits
+ * and bits share a single mapping, because measurements implicitly write to
+ * the bit with the same index as the measured qubit. Returns the mapping.
+ *
+ * The qubit/bit reference nodes are updated in place, but the index nodes
+ * within them are replaced rather than modified, because the analyzer may
+ * share those between references.
+ *
+ * This takes time linear in the size of the program and the original number
+ * of qubits.
+ */
+RegisterMap compact(semantic::Program &program);
+
+} // namespace registers
+} // namespace cqasm
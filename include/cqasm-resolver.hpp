@@ -43,6 +43,14 @@ public:
      */
     values::Value resolve(const std::string &name) const;
 
+    /**
+     * Returns the value of a mapping without copying it. Throws
+     * NameResolutionFailure if no mapping by the given name exists. The
+     * value is shared with the table, so it must not be modified or added
+     * to a tree.
+     */
+    const values::Value &get(const std::string &name) const;
+
     /**
      * Grants read access to the underlying map.
      */
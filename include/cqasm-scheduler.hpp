@@ -0,0 +1,83 @@
+#pragma once
+
+#include "cqasm-semantic.hpp"
+
+namespace cqasm {
+namespace scheduler {
+
+/**
+ * Annotation for instruction::Instruction that specifies the named hardware
+ * resources (control electronics, for instance) that an instruction of this
+ * type occupies while it executes. Each named resource can be used by at
+ * most one instruction per bundle. Instructions without this annotation only
+ * occupy their qubits and bits.
+ */
+class ResourceUsage {
+public:
+
+    /**
+     * The names of the resources used by the instruction.
+     */
+    std::vector<std::string> resources;
+
+    /**
+     * Constructs a resource usage annotation.
+     */
+    explicit ResourceUsage(const std::vector<std::string> &resources);
+
+};
+
+/**
+ * Statistics reported by schedule().
+ */
+class Report {
+public:
+
+    /**
+     * Total number of bundles over all subcircuits before scheduling.
+     */
+    size_t bundles_before;
+
+    /**
+     * Total number of bundles over all subcircuits after scheduling.
+     */
+    size_t bundles_after;
+
+    /**
+     * Creates an empty report.
+     */
+    Report();
+
+};
+
+/**
+ * Reschedules the instructions of each subcircuit of the given program as
+ * soon as possible, packing them into as few bundles as the dependencies
+ * between them allow. Returns how many bundles there were before and after.
+ *
+ * The bundles of the original program are the units of scheduling; they are
+ * never split, but can be merged with other bundles. A bundle depends on all
+ * earlier bundles that use one of its qubits or bits, or one of the named
+ * resources of its instructions as specified by ResourceUsage annotations.
+ * Qubit k and measurement bit k are considered to be the same resource,
+ * because measurements write to the bit corresponding to the measured qubit,
+ * and the bits in the condition of conditional instructions count as used.
+ * Bundles containing an instruction that is not allowed to be parallelized,
+ * as well as bundles that don't use any qubits or bits at all (which are
+ * assumed to affect the whole machine), act as barriers: they end up in a
+ * bundle of their own, and nothing is moved across them.
+ *
+ * Bundles placed in the same cycle are merged in program order, keeping the
+ * annotations of all of them and the source location of the first.
+ *
+ * Scheduling takes O(n log n) time in the number of bundles.
+ */
+Report schedule(semantic::Program &program);
+
+} // namespace scheduler
+} // namespace cqasm
+
+/**
+ * Stream << overload for scheduler reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::scheduler::Report& report);
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "cqasm-unitary.hpp"
+#include "cqasm-parallel.hpp"
+#include <memory>
+#include <random>
+
+namespace cqasm {
+namespace simulator {
+
+/**
+ * Exception thrown by Simulator::run() when the program contains something
+ * that cannot be simulated, such as an instruction without a known matrix.
+ */
+CQASM_ANALYSIS_ERROR(SimulationError);
+
+/**
+ * Reference statevector simulator for semantic programs, intended for
+ * validating optimization passes on small circuits. The state of n qubits is
+ * stored as 2^n complex amplitudes, so memory usage is 16 * 2^n bytes;
+ * about 28 qubits is the practical limit.
+ *
+ * Qubit k corresponds to bit k of the amplitude index. The real and
+ * imaginary parts are stored in separate arrays, such that the gate kernels
+ * consist of simple loops over contiguous blocks of amplitudes, which the
+ * compiler can vectorize. For larger states, the amplitude updates are
+ * divided over the threads of a work pool owned by the simulator.
+ *
+ * When running a program, consecutive gates that only act on the lowest
+ * qubits are collected and applied one cache-sized block of amplitudes at a
+ * time, such that the state is only streamed through memory once for the
+ * whole batch rather than once per gate.
+ */
+class Simulator {
+private:
+
+    /**
+     * The number of qubits.
+     */
+    size_t num_qubits;
+
+    /**
+     * The real parts of the amplitudes.
+     */
+    std::vector<primitives::Real> re;
+
+    /**
+     * The imaginary parts of the amplitudes.
+     */
+    std::vector<primitives::Real> im;
+
+    /**
+     * The measurement bit register.
+     */
+    std::vector<bool> bits;
+
+    /**
+     * The maximum number of threads to use.
+     */
+    size_t num_threads;
+
+    /**
+     * The pool that runs the amplitude updates, or null if only the calling
+     * thread is used.
+     */
+    std::unique_ptr<parallel::WorkPool> pool;
+
+    /**
+     * A gate waiting to be applied by flush(). Single-qubit gates only use
+     * the first four matrix elements.
+     */
+    struct PendingGate {
+
+        /**
+         * The qubit for single-qubit gates, or the most significant qubit
+         * of the matrix for two-qubit gates.
+         */
+        size_t a;
+
+        /**
+         * The least significant qubit of the matrix for two-qubit gates.
+         */
+        size_t b;
+
+        /**
+         * Whether this is a two-qubit gate.
+         */
+        bool two_qubit;
+
+        /**
+         * Real parts of the matrix elements, in row-major order.
+         */
+        primitives::Real mr[16];
+
+        /**
+         * Imaginary parts of the matrix elements, in row-major order.
+         */
+        primitives::Real mi[16];
+
+    };
+
+    /**
+     * Gates collected by run() that all act on qubits within a single
+     * block of amplitudes, in the order they should be applied.
+     */
+    std::vector<PendingGate> pending;
+
+    /**
+     * Applies the pending gates, one block of amplitudes at a time.
+     */
+    void flush();
+
+    /**
+     * Random number generator used for measurements.
+     */
+    std::mt19937_64 rng;
+
+    /**
+     * Returns whether the condition of the given instruction is satisfied.
+     */
+    bool evaluate_condition(const semantic::Instruction &insn) const;
+
+    /**
+     * Applies the given instruction, assuming that its condition has already
+     * been checked. Gates that only act on qubits within a single block of
+     * amplitudes are added to the pending gates rather than applied
+     * immediately.
+     */
+    void apply(const semantic::Instruction &insn);
+
+public:
+
+    /**
+     * Creates a simulator for zero qubits, using at most the given number of
+     * threads for the amplitude updates, and seeding the random number
+     * generator used for measurements with the given seed. If num_threads
+     * is zero, the number of hardware threads is used.
+     */
+    explicit Simulator(size_t num_threads = 0, uint64_t seed = 0);
+
+    /**
+     * Resets the simulator to the all-zero state of the given number of
+     * qubits, and clears the bit register. Throws std::invalid_argument if
+     * the state doesn't fit in memory, in which case the simulator is left
+     * with zero qubits.
+     */
+    void reset(size_t num_qubits);
+
+    /**
+     * Returns the number of qubits.
+     */
+    size_t get_num_qubits() const;
+
+    /**
+     * Returns the amplitude of the given basis state.
+     */
+    primitives::Complex get_amplitude(size_t index) const;
+
+    /**
+     * Returns the probability of measuring a one for the given qubit.
+     */
+    primitives::Real get_probability(size_t qubit) const;
+
+    /**
+     * Returns the bit register.
+     */
+    const std::vector<bool> &get_bits() const;
+
+    /**
+     * Applies a single-qubit gate.
+     */
+    void apply(const unitary::Matrix2 &matrix, size_t qubit);
+
+    /**
+     * Applies a two-qubit gate, with qubit a as the most significant qubit
+     * of the matrix. Throws std::invalid_argument if the matrix is not 4x4 or
+     * the qubits are equal.
+     */
+    void apply(const primitives::CMatrix &matrix, size_t a, size_t b);
+
+    /**
+     * Measures the given qubit in the Z basis, collapsing the state and
+     * storing the result in the bit with the same index. Returns the result.
+     */
+    bool measure(size_t qubit);
+
+    /**
+     * Resets the given qubit to zero by measuring it and flipping it if the
+     * result was one.
+     */
+    void prep(size_t qubit);
+
+    /**
+     * Runs the given program, starting from the all-zero state of
+     * program.num_qubits qubits. Subcircuits are repeated according to their
+     * iteration count. The instructions in a bundle are applied in order,
+     * but their conditions are all evaluated before any of them is applied.
+     *
+     * Gates are simulated using the matrix returned by unitary::matrix_of(),
+     * or if that is empty, using the matrix operand of the instruction (see
+     * unitary::matrix_operand()). 2x2 matrices are applied to each qubit of
+     * the qubit operand, 4x4 matrices pairwise to the qubits of two qubit
+     * operands. Furthermore, the following instructions are recognized by
+     * name: measure, measure_z, and measure_all (measurement in the Z basis),
+     * prep and prep_z (reset to zero), not (bit flip), and display, wait,
+     * skip, and barrier (no-op). Conditions must be constant booleans or bit
+     * references, in which case all referenced bits must be set. Anything
+     * else results in a SimulationError.
+     */
+    void run(const semantic::Program &program);
+
+};
+
+} // namespace simulator
+} // namespace cqasm
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cqasm {
+namespace trace {
+
+/**
+ * A span recorded by the tracer.
+ */
+class Event {
+public:
+
+    /**
+     * The name of the span. Must point to a string with static lifetime.
+     */
+    const char *name;
+
+    /**
+     * The category of the span. Must point to a string with static lifetime.
+     */
+    const char *category;
+
+    /**
+     * Additional information, such as the name of the file being processed.
+     * May be empty.
+     */
+    std::string detail;
+
+    /**
+     * Start time in nanoseconds since tracing was enabled.
+     */
+    uint64_t start;
+
+    /**
+     * Duration in nanoseconds.
+     */
+    uint64_t duration;
+
+    /**
+     * Sequence number of the thread that recorded the span, starting at 1
+     * in order of the first span recorded by each thread.
+     */
+    uint32_t thread;
+
+};
+
+/**
+ * Whether tracing is enabled. Use is_enabled() instead of accessing this
+ * directly.
+ */
+extern std::atomic<bool> tracing_enabled;
+
+/**
+ * Returns whether tracing is enabled.
+ */
+inline bool is_enabled() {
+    return tracing_enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * Enables tracing, discarding any previously recorded events. Each thread
+ * keeps at most the given number of most recent events.
+ */
+void enable(size_t capacity_per_thread = 1 << 16);
+
+/**
+ * Disables tracing. Events recorded so far are kept.
+ */
+void disable();
+
+/**
+ * Discards all recorded events.
+ */
+void clear();
+
+/**
+ * Returns a copy of all recorded events, ordered by start time. Spans that
+ * are still open are not included.
+ */
+std::vector<Event> get_events();
+
+/**
+ * Writes all recorded events to the given stream as a Chrome trace event
+ * JSON document.
+ */
+void write_chrome_json(std::ostream &os);
+
+/**
+ * Returns the current time in nanoseconds since tracing was enabled.
+ */
+uint64_t now();
+
+/**
+ * Records the given event in the ring buffer of the calling thread.
+ */
+void record(const char *name, const char *category, std::string &&detail, uint64_t start, uint64_t duration);
+
+/**
+ * RAII object that records a span from its construction to its destruction
+ * if tracing was enabled when it was constructed, and costs no more than
+ * reading an atomic flag otherwise. The name and category must be string
+ * literals or otherwise have static lifetime.
+ */
+class Span {
+private:
+
+    /**
+     * The name of the span.
+     */
+    const char *name;
+
+    /**
+     * The category of the span.
+     */
+    const char *category;
+
+    /**
+     * Additional information about the span.
+     */
+    std::string detail;
+
+    /**
+     * Start time of the span.
+     */
+    uint64_t start;
+
+    /**
+     * Whether the span is being recorded.
+     */
+    bool active;
+
+public:
+
+    /**
+     * Opens a span with the given name and category.
+     */
+    Span(const char *name, const char *category) :
+        name(name),
+        category(category),
+        start(0),
+        active(is_enabled())
+    {
+        if (active) {
+            start = now();
+        }
+    }
+
+    /**
+     * Opens a span with the given name, category, and detail string. The
+     * detail string is only copied if tracing is enabled.
+     */
+    Span(const char *name, const char *category, const std::string &detail) :
+        name(name),
+        category(category),
+        start(0),
+        active(is_enabled())
+    {
+        if (active) {
+            this->detail = detail;
+            start = now();
+        }
+    }
+
+    /**
+     * Closes the span.
+     */
+    ~Span() {
+        if (active) {
+
+            // If tracing was enabled again while the span was open, the
+            // epoch has moved past its start.
+            auto end = now();
+            record(name, category, std::move(detail), start, end > start ? end - start : 0);
+
+        }
+    }
+
+    // Spans can't be copied or moved.
+    Span(const Span&) = delete;
+    Span &operator=(const Span&) = delete;
+
+};
+
+} // namespace trace
+} // namespace cqasm
@@ -36,13 +36,27 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
+#include <cstdint>
 #include <typeinfo>
 #include <typeindex>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <ostream>
+#include <string>
 #include <functional>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include "cqasm-annotatable.hpp"
+#include "cqasm-memory.hpp"
+#include "cqasm-parallel.hpp"
+#include "cqasm-utils.hpp"
 
 namespace cqasm {
 namespace tree {
@@ -62,12 +76,527 @@ public:
 
 };
 
+/**
+ * Statistics of the node pool of a thread, as returned by
+ * get_node_pool_statistics().
+ */
+struct NodePoolStatistics {
+
+    /**
+     * Number of node allocations that went through the pool.
+     */
+    size_t allocations;
+
+    /**
+     * Number of those allocations that reused a previously freed block
+     * instead of calling the global operator new.
+     */
+    size_t recycled;
+
+    /**
+     * Memory currently held in the free lists of the pool in bytes.
+     */
+    size_t cached_bytes;
+
+};
+
+/**
+ * Allocates memory for a node of the given size. Nodes are allocated from
+ * per-thread pools with free lists per size class, such that programs that
+ * are parsed and dropped over and over again reuse the memory of their
+ * predecessors without going back to malloc. Allocations larger than the
+ * largest size class go straight to the global operator new.
+ */
+void *allocate_node(size_t size);
+
+/**
+ * Frees memory allocated by allocate_node() with the same size. The block
+ * is kept in the free list of the calling thread if the pool has room for
+ * it, and freed otherwise. Blocks may be freed by a different thread than
+ * the one that allocated them.
+ */
+void deallocate_node(void *ptr, size_t size);
+
+/**
+ * Allocates memory for a node of the given size from the memory resource
+ * selected for the calling thread, or using allocate_node() if there is none.
+ * This is used for nodes created with new. The node doesn't record where it
+ * came from; the tree reference that takes ownership of it does, so it must
+ * do so while the same resource is still selected (see adopt()).
+ */
+void *new_node(size_t size);
+
+/**
+ * Frees memory allocated by new_node() with the same size. The memory is
+ * returned to the resource of the DeleteScope for the given node if there is
+ * one, and using deallocate_node() otherwise.
+ */
+void delete_node(void *ptr, size_t size);
+
+/**
+ * RAII object that makes delete_node() return the given node to the given
+ * memory resource while it exists. This is used by the tree references that
+ * own nodes created with new while a resource was selected. Scopes may be
+ * nested, such that the children of the node can be deleted in the
+ * meantime.
+ */
+class DeleteScope {
+private:
+
+    /**
+     * The node and resource of the enclosing scope.
+     */
+    const void *previous_node;
+    memory::Resource *previous_resource;
+
+public:
+
+    /**
+     * Makes delete_node() return the given node, being a pointer to the
+     * most-derived object, to the given resource, or to the node pool if
+     * nullptr is passed.
+     */
+    DeleteScope(const void *node, memory::Resource *resource);
+
+    /**
+     * Restores the enclosing scope.
+     */
+    ~DeleteScope();
+
+    // Scopes must be destroyed in reverse order of construction, so they
+    // can't be copied.
+    DeleteScope(const DeleteScope&) = delete;
+    DeleteScope& operator=(const DeleteScope&) = delete;
+
+};
+
+/**
+ * Deletes a node created with new that no tree reference took ownership of.
+ * The node is returned to the memory resource selected for the calling
+ * thread, which must be the one that was selected when the node was created.
+ * Like set_raw() and add_raw(), this only exists for the parser.
+ */
+template <class T>
+void delete_raw(T *ptr) {
+    if (!ptr) {
+        return;
+    }
+    DeleteScope scope(dynamic_cast<const void*>(ptr), memory::get_resource());
+    delete ptr;
+}
+
+/**
+ * Sets the maximum number of bytes each thread keeps in its node pool for
+ * reuse. Setting it to 0 disables recycling, such that nodes are allocated
+ * and freed using the global operator new and delete. This is the default,
+ * because while the pool is several times faster than malloc for the
+ * allocations themselves, the recycled blocks are scattered in memory,
+ * which can make traversing the new trees slower than what malloc saves.
+ * Measure before enabling it.
+ */
+void set_node_pool_capacity(size_t bytes);
+
+/**
+ * Returns the maximum number of bytes each thread keeps in its node pool.
+ */
+size_t get_node_pool_capacity();
+
+/**
+ * Frees all memory held by the node pool of the calling thread. This is
+ * done automatically when the thread exits.
+ */
+void release_node_pool();
+
+/**
+ * Returns the statistics of the node pool of the calling thread.
+ */
+NodePoolStatistics get_node_pool_statistics();
+
+/**
+ * Base class for objects that tree references can point to, being the tree
+ * nodes and the instruction and error model descriptors of the semantic tree.
+ *
+ * When the library is compiled with CQASM_INTRUSIVE_REFCOUNT defined, this
+ * holds the reference count of the object, which is then updated with plain,
+ * non-atomic instructions instead of the atomic operations of
+ * std::shared_ptr. Such trees must only be used by a single thread at a
+ * time; use Frozen to share them between threads. Without
+ * CQASM_INTRUSIVE_REFCOUNT, this class is empty.
+ */
+class RefCounted {
+#ifdef CQASM_INTRUSIVE_REFCOUNT
+private:
+    template <class T>
+    friend class Ptr;
+
+    /**
+     * The number of references to this object.
+     */
+    mutable size_t ref_count;
+
+    /**
+     * Whether the object is part of a frozen tree, in which case the
+     * reference count is not updated.
+     */
+    mutable bool frozen;
+
+    /**
+     * The memory resource that was selected when the first reference to the
+     * object was made, to which it is returned when the last one goes away.
+     */
+    mutable memory::Resource *resource;
+
+public:
+
+    /**
+     * Creates an object that is not referenced yet.
+     */
+    RefCounted() : ref_count(0), frozen(false), resource(nullptr) {}
+
+    /**
+     * Copies an object. The copy is not referenced yet.
+     */
+    RefCounted(const RefCounted &other) : ref_count(0), frozen(false), resource(nullptr) {
+        (void)other;
+    }
+
+    /**
+     * Assigns an object. The reference count is left as is.
+     */
+    RefCounted &operator=(const RefCounted &other) {
+        (void)other;
+        return *this;
+    }
+
+    /**
+     * Freezes or thaws this object. Returns whether that changed anything.
+     */
+    bool mark_frozen(bool frozen) const {
+        if (this->frozen == frozen) {
+            return false;
+        }
+        this->frozen = frozen;
+        return true;
+    }
+
+#else
+public:
+
+    /**
+     * Freezes or thaws this object. Returns whether that changed anything,
+     * which is never the case when the reference counts are atomic.
+     */
+    bool mark_frozen(bool frozen) const {
+        (void)frozen;
+        return false;
+    }
+
+#endif
+};
+
+#ifdef CQASM_INTRUSIVE_REFCOUNT
+
+/**
+ * Reference-counted pointer to an object deriving from RefCounted, with the
+ * reference count stored in the object itself. It behaves like the subset of
+ * std::shared_ptr that the tree classes use, but does not use atomic
+ * operations.
+ */
+template <class T>
+class Ptr {
+private:
+    template <class U>
+    friend class Ptr;
+
+    /**
+     * The object pointed to, or nullptr.
+     */
+    T *ptr;
+
+    /**
+     * Adds a reference to the object, if any.
+     */
+    void acquire() const {
+        if (ptr && !ptr->RefCounted::frozen) {
+            ptr->RefCounted::ref_count++;
+        }
+    }
+
+    /**
+     * Drops a reference to the object, if any, and deletes it if that was
+     * the last one.
+     */
+    void release() const {
+        if (ptr && !ptr->RefCounted::frozen && !--ptr->RefCounted::ref_count) {
+            if (auto resource = ptr->RefCounted::resource) {
+                DeleteScope scope(dynamic_cast<const void*>(ptr), resource);
+                delete ptr;
+            } else {
+                delete ptr;
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Constructs a null pointer.
+     */
+    Ptr() : ptr(nullptr) {}
+
+    /**
+     * Constructs a null pointer.
+     */
+    Ptr(std::nullptr_t) : ptr(nullptr) {}
+
+    /**
+     * Constructs a pointer to the given object, which must be allocated
+     * with new, and adds a reference to it. If this is the first reference,
+     * the object is returned to the memory resource that is selected now
+     * when the last reference goes away.
+     */
+    explicit Ptr(T *ptr) : ptr(ptr) {
+        if (ptr && !ptr->RefCounted::ref_count) {
+            ptr->RefCounted::resource = memory::get_resource();
+        }
+        acquire();
+    }
+
+    /**
+     * Copy constructor.
+     */
+    Ptr(const Ptr &other) : ptr(other.ptr) {
+        acquire();
+    }
+
+    /**
+     * Move constructor.
+     */
+    Ptr(Ptr &&other) : ptr(other.ptr) {
+        other.ptr = nullptr;
+    }
+
+    /**
+     * Copy constructor for pointers to derived types.
+     */
+    template <class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    Ptr(const Ptr<U> &other) : ptr(other.ptr) {
+        acquire();
+    }
+
+    /**
+     * Move constructor for pointers to derived types.
+     */
+    template <class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    Ptr(Ptr<U> &&other) : ptr(other.ptr) {
+        other.ptr = nullptr;
+    }
+
+    /**
+     * Drops the reference, if any.
+     */
+    ~Ptr() {
+        release();
+    }
+
+    /**
+     * Copy assignment.
+     */
+    Ptr &operator=(const Ptr &other) {
+        Ptr(other).swap(*this);
+        return *this;
+    }
+
+    /**
+     * Move assignment.
+     */
+    Ptr &operator=(Ptr &&other) {
+        Ptr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    /**
+     * Swaps the objects pointed to.
+     */
+    void swap(Ptr &other) {
+        std::swap(ptr, other.ptr);
+    }
+
+    /**
+     * Drops the reference, if any, and makes this a null pointer.
+     */
+    void reset() {
+        Ptr().swap(*this);
+    }
+
+    /**
+     * Returns the raw pointer.
+     */
+    T *get() const {
+        return ptr;
+    }
+
+    /**
+     * Dereference operator.
+     */
+    T &operator*() const {
+        return *ptr;
+    }
+
+    /**
+     * Member access operator.
+     */
+    T *operator->() const {
+        return ptr;
+    }
+
+    /**
+     * Returns whether this is not a null pointer.
+     */
+    explicit operator bool() const {
+        return ptr != nullptr;
+    }
+
+    /**
+     * Returns the number of references to the object, or 0 for a null
+     * pointer.
+     */
+    long use_count() const {
+        return ptr ? static_cast<long>(ptr->RefCounted::ref_count) : 0;
+    }
+
+    /**
+     * Performs a static cast on a pointer.
+     */
+    template <class U>
+    Ptr<U> static_cast_to() const {
+        return Ptr<U>(static_cast<U*>(ptr));
+    }
+
+};
+
+/**
+ * Returns whether two pointers point to the same object.
+ */
+template <class T, class U>
+bool operator==(const Ptr<T> &lhs, const Ptr<U> &rhs) {
+    return lhs.get() == rhs.get();
+}
+
+/**
+ * Returns whether two pointers point to different objects.
+ */
+template <class T, class U>
+bool operator!=(const Ptr<T> &lhs, const Ptr<U> &rhs) {
+    return lhs.get() != rhs.get();
+}
+
+/**
+ * Returns whether the given pointer is null.
+ */
+template <class T>
+bool operator==(const Ptr<T> &lhs, std::nullptr_t) {
+    return !lhs;
+}
+
+/**
+ * Returns whether the given pointer is not null.
+ */
+template <class T>
+bool operator!=(const Ptr<T> &lhs, std::nullptr_t) {
+    return static_cast<bool>(lhs);
+}
+
+/**
+ * Stream << overload for pointers, printing the address.
+ */
+template <class T>
+std::ostream &operator<<(std::ostream &os, const Ptr<T> &ptr) {
+    return os << static_cast<const void*>(ptr.get());
+}
+
+/**
+ * Statically casts the given pointer.
+ */
+template <class T, class U>
+Ptr<T> static_pointer_cast(const Ptr<U> &ptr) {
+    return ptr.template static_cast_to<T>();
+}
+
+#else
+
+/**
+ * Reference-counted pointer type used for the tree references. This is
+ * std::shared_ptr, unless CQASM_INTRUSIVE_REFCOUNT is defined.
+ */
+template <class T>
+using Ptr = std::shared_ptr<T>;
+
+/**
+ * Statically casts the given pointer.
+ */
+template <class T, class U>
+Ptr<T> static_pointer_cast(const Ptr<U> &ptr) {
+    return std::static_pointer_cast<T>(ptr);
+}
+
+#endif
+
+/**
+ * Statically casts the given pointer, which is moved from. This doesn't
+ * touch the reference count when the cast is implicit, i.e. when casting
+ * to the same or to a base type.
+ */
+template <class T, class U>
+typename std::enable_if<std::is_convertible<U*, T*>::value, Ptr<T>>::type
+static_pointer_cast(Ptr<U> &&ptr) {
+    return Ptr<T>(std::move(ptr));
+}
+
+/**
+ * Statically casts the given pointer, which is moved from.
+ */
+template <class T, class U>
+typename std::enable_if<!std::is_convertible<U*, T*>::value, Ptr<T>>::type
+static_pointer_cast(Ptr<U> &&ptr) {
+    Ptr<U> moved(std::move(ptr));
+    return tree::static_pointer_cast<T>(static_cast<const Ptr<U>&>(moved));
+}
+
 /**
  * Base class for all tree nodes.
  */
-class Base : public annotatable::Annotatable, public Completable {
+class Base : public annotatable::Annotatable, public Completable, public RefCounted {
+public:
+
+    /**
+     * Allocates nodes created with new from the memory resource selected for
+     * the calling thread, or from its node pool if there is none. Nodes
+     * allocated from a resource must be handed to a tree reference with
+     * set_raw() or add_raw() while the resource is still selected, and must
+     * not be deleted directly.
+     */
+    static void *operator new(size_t size) {
+        return new_node(size);
+    }
+
+    /**
+     * Returns nodes deleted with delete to the resource they were allocated
+     * from.
+     */
+    static void operator delete(void *ptr, size_t size) {
+        delete_node(ptr, size);
+    }
+
 };
 
+/**
+ * Takes ownership of the given node, which must have been created with new.
+ * Defined below.
+ */
+template <class T>
+Ptr<T> adopt(T *ptr);
+
 /**
  * Convenience class for a reference to an optional AST node.
  */
@@ -78,7 +607,7 @@ protected:
     /**
      * The contained value. Must be non-null for a completed AST.
      */
-    std::shared_ptr<T> val;
+    Ptr<T> val;
 
 public:
 
@@ -88,59 +617,61 @@ public:
     Maybe() : val() {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    explicit Maybe(const std::shared_ptr<S> &value) : val(std::static_pointer_cast<T>(value)) {}
+    explicit Maybe(const Ptr<S> &value) : val(tree::static_pointer_cast<T>(value)) {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    explicit Maybe(std::shared_ptr<S> &&value) : val(std::static_pointer_cast<T>(std::move(value))) {}
+    explicit Maybe(Ptr<S> &&value) : val(tree::static_pointer_cast<T>(std::move(value))) {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    Maybe(const Maybe<S> &value) : val(std::static_pointer_cast<T>(value.val)) {}
+    Maybe(const Maybe<S> &value) : val(tree::static_pointer_cast<T>(value.val)) {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    Maybe(Maybe<S> &&value) : val(std::static_pointer_cast<T>(std::move(value.val))) {}
+    Maybe(Maybe<S> &&value) : val(tree::static_pointer_cast<T>(std::move(value.val))) {}
 
     /**
      * Sets the value to a reference to the given object, or clears it if null.
      */
     template <class S>
-    void set(const std::shared_ptr<S> &value) {
-        val = std::static_pointer_cast<T>(value);
+    void set(const Ptr<S> &value) {
+        val = tree::static_pointer_cast<T>(value);
     }
 
     /**
      * Sets the value to a reference to the given object, or clears it if null.
      */
     template <class S>
-    Maybe &operator=(const std::shared_ptr<S> &value) {
+    Maybe &operator=(const Ptr<S> &value) {
         set<S>(value);
+        return *this;
     }
 
     /**
      * Sets the value to a reference to the given object, or clears it if null.
      */
     template <class S>
-    void set(std::shared_ptr<S> &&value) {
-        val = std::static_pointer_cast<T>(std::move(value));
+    void set(Ptr<S> &&value) {
+        val = tree::static_pointer_cast<T>(std::move(value));
     }
 
     /**
      * Sets the value to a reference to the given object, or clears it if null.
      */
     template <class S>
-    Maybe &operator=(std::shared_ptr<S> &&value) {
+    Maybe &operator=(Ptr<S> &&value) {
         set<S>(std::move(value));
+        return *this;
     }
 
     /**
@@ -148,7 +679,7 @@ public:
      */
     template <class S>
     void set(const Maybe<S> &value) {
-        val = std::static_pointer_cast<T>(value.get_ptr());
+        val = tree::static_pointer_cast<T>(value.get_ptr());
     }
 
     /**
@@ -157,6 +688,7 @@ public:
     template <class S>
     Maybe &operator=(const Maybe<S> &value) {
         set<S>(std::move(value));
+        return *this;
     }
 
     /**
@@ -164,7 +696,7 @@ public:
      */
     template <class S>
     void set(Maybe<S> &&value) {
-        val = std::static_pointer_cast<T>(std::move(value.get_ptr()));
+        val = tree::static_pointer_cast<T>(std::move(value.get_ptr()));
     }
 
     /**
@@ -173,6 +705,7 @@ public:
     template <class S>
     Maybe &operator=(Maybe<S> &&value) {
         set<S>(std::move(value));
+        return *this;
     }
 
     /**
@@ -184,7 +717,7 @@ public:
      */
     template <class S>
     void set_raw(S *ob) {
-        val = std::shared_ptr<T>(static_cast<T*>(ob));
+        val = adopt(static_cast<T*>(ob));
     }
 
     /**
@@ -259,27 +792,31 @@ public:
     }
 
     /**
-     * Returns an immutable copy of the underlying shared_ptr.
+     * Returns an immutable copy of the underlying pointer.
      */
-    const std::shared_ptr<T> &get_ptr() const {
+    const Ptr<T> &get_ptr() const {
         return val;
     }
 
     /**
-     * Returns a mutable copy of the underlying shared_ptr.
+     * Returns a mutable copy of the underlying pointer.
      */
-    std::shared_ptr<T> &get_ptr() {
+    Ptr<T> &get_ptr() {
         return val;
     }
 
     /**
      * Up- or downcasts this value. If the cast succeeds, the returned value
-     * is nonempty and its shared_ptr points to the same data block as this
-     * value does. If the cast fails, an empty Maybe is returned.
+     * is nonempty and its pointer points to the same data block as this
+     * value does. If the cast fails, an empty Maybe is returned. The cast is
+     * checked using the node type and S::is_type() rather than RTTI.
      */
     template <class S>
     Maybe<S> as() const {
-        return Maybe<S>(std::dynamic_pointer_cast<S>(val));
+        if (!val || !S::is_type(val->type())) {
+            return Maybe<S>();
+        }
+        return Maybe<S>(tree::static_pointer_cast<S>(val));
     }
 
     /**
@@ -332,16 +869,16 @@ public:
     One() : Maybe<T>() {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    explicit One(const std::shared_ptr<S> &value) : Maybe<T>(value) {}
+    explicit One(const Ptr<S> &value) : Maybe<T>(value) {}
 
     /**
-     * Constructor for an empty or filled node given an existing shared_ptr.
+     * Constructor for an empty or filled node given an existing pointer.
      */
     template <class S>
-    explicit One(std::shared_ptr<S> &&value) : Maybe<T>(std::move(value)) {}
+    explicit One(Ptr<S> &&value) : Maybe<T>(std::move(value)) {}
 
     /**
      * Constructor for an empty or filled node given an existing Maybe.
@@ -365,233 +902,1899 @@ public:
 };
 
 /**
- * Constructs a One object, analogous to std::make_shared.
+ * Counts of the nodes constructed by a thread, using make(), make_in(), or
+ * by cloning.
  */
-template <class T, typename... Args>
-One<T> make(Args... args) {
-    return One<T>(std::make_shared<T>(args...));
+struct Allocations {
+
+    /**
+     * Number of nodes constructed.
+     */
+    size_t nodes;
+
+    /**
+     * Total size of the nodes constructed in bytes, excluding any memory
+     * they allocate themselves.
+     */
+    size_t bytes;
+
+};
+
+/**
+ * Returns the allocation counts of the calling thread. These only ever
+ * increase; take the difference between two snapshots to measure what an
+ * operation allocated. Nodes are only counted while a CountAllocations
+ * object exists on any thread.
+ */
+inline Allocations &get_allocations() {
+    static thread_local Allocations allocations = {0, 0};
+    return allocations;
 }
 
 /**
- * Convenience class for zero or more AST nodes.
+ * Returns the number of CountAllocations objects that currently exist.
+ */
+inline std::atomic<size_t> &get_allocation_counters() {
+    static std::atomic<size_t> counters(0);
+    return counters;
+}
+
+/**
+ * Enables counting node constructions in get_allocations() for as long as
+ * the object exists. Counting is off by default, so construction doesn't
+ * pay for it unless it's used.
+ */
+class CountAllocations {
+public:
+
+    /**
+     * Enables counting.
+     */
+    CountAllocations() {
+        get_allocation_counters()++;
+    }
+
+    /**
+     * Disables counting again, unless other objects still exist.
+     */
+    ~CountAllocations() {
+        get_allocation_counters()--;
+    }
+
+    // Copying would unbalance the counter.
+    CountAllocations(const CountAllocations&) = delete;
+    CountAllocations& operator=(const CountAllocations&) = delete;
+
+};
+
+/**
+ * Standard allocator that allocates from the memory resource that was
+ * selected for the calling thread when the allocator was constructed, or
+ * from the node pool of the allocating thread if there was none. Used by
+ * make() to allocate nodes along with the control blocks of their shared
+ * pointers; the control block stores the allocator, so nodes are returned
+ * to the resource they came from.
  */
 template <class T>
-class Any : public Completable {
-protected:
+class PoolAllocator {
+private:
+    template <class U>
+    friend class PoolAllocator;
 
     /**
-     * The contained vector.
+     * The resource to allocate from, or nullptr for the node pool.
      */
-    std::vector<One<T>> vec;
+    memory::Resource *resource;
 
 public:
 
     /**
-     * Adds the given value. No-op when the value is empty.
+     * The type of the allocated objects.
      */
-    template <class S>
-    void add(const Maybe<S> &ob, ssize_t pos=-1) {
-        if (ob.empty()) {
-            return;
-        }
-        if (pos < 0 || (size_t)pos >= size()) {
-            this->vec.emplace_back(
-                std::static_pointer_cast<T>(ob.get_ptr()));
-        } else {
-            this->vec.emplace(this->vec.cbegin() + pos,
-                              std::static_pointer_cast<T>(
-                                  ob.get_ptr()));
+    using value_type = T;
+
+    /**
+     * Creates an allocator for the currently selected resource.
+     */
+    PoolAllocator() : resource(memory::get_resource()) {}
+
+    /**
+     * Creates an allocator for the given resource, or for the node pool if
+     * nullptr is passed.
+     */
+    explicit PoolAllocator(memory::Resource *resource) : resource(resource) {}
+
+    /**
+     * Converts from an allocator for another type.
+     */
+    template <class U>
+    PoolAllocator(const PoolAllocator<U> &other) : resource(other.resource) {}
+
+    /**
+     * Allocates memory for the given number of objects.
+     */
+    T *allocate(size_t n) {
+        if (resource) {
+            return static_cast<T*>(resource->allocate(n * sizeof(T)));
         }
+        return static_cast<T*>(allocate_node(n * sizeof(T)));
     }
 
     /**
-     * Adds the NEW-ALLOCATED value pointed to AND TAKES OWNERSHIP. In almost
-     * all cases, you should use add(make(...), pos) instead! This only exists
-     * because the Yacc parser is one of the exceptions where you can't help
-     * it, because the nodes have to be stored in a union while parsing, and
-     * that can only be done with raw pointers.
+     * Frees memory for the given number of objects.
      */
-    template <class S>
-    void add_raw(S *ob, ssize_t pos=-1) {
-        if (!ob) {
-            throw std::runtime_error("add_raw called with nullptr!");
-        }
-        if (pos < 0 || (size_t)pos >= size()) {
-            this->vec.emplace_back(std::shared_ptr<T>(static_cast<T*>(ob)));
+    void deallocate(T *ptr, size_t n) {
+        if (resource) {
+            resource->deallocate(ptr, n * sizeof(T));
         } else {
-            this->vec.emplace(this->vec.cbegin() + pos, std::shared_ptr<T>(static_cast<T*>(ob)));
+            deallocate_node(ptr, n * sizeof(T));
         }
     }
 
     /**
-     * Extends this Any with another.
+     * Allocators are equal when they allocate from the same resource.
      */
-    void extend(Any<T> &other) {
-        this->vec.insert(this->vec.end(), other.vec.begin(), other.vec.end());
+    template <class U>
+    bool operator==(const PoolAllocator<U> &other) const {
+        return resource == other.resource;
     }
 
     /**
-     * Removes the object at the given index, or at the back if no index is
-     * given.
+     * Allocators are equal when they allocate from the same resource.
      */
-    void remove(ssize_t pos=-1) {
-        if (size() == 0) {
-            return;
-        }
-        if (pos < 0 || pos >= size()) {
-            pos = size() - 1;
-        }
-        this->vec.erase(this->vec.cbegin() + pos);
+    template <class U>
+    bool operator!=(const PoolAllocator<U> &other) const {
+        return resource != other.resource;
     }
 
+};
+
+#ifndef CQASM_INTRUSIVE_REFCOUNT
+
+/**
+ * Deleter for nodes created with new while a memory resource was selected,
+ * which returns them to that resource.
+ */
+class NodeDeleter {
+private:
+
     /**
-     * Removes the contained values.
+     * The resource the node was allocated from.
      */
-    void reset() {
-        vec.clear();
+    memory::Resource *resource;
+
+public:
+
+    /**
+     * Creates a deleter for nodes allocated from the given resource.
+     */
+    explicit NodeDeleter(memory::Resource *resource) : resource(resource) {}
+
+    /**
+     * Deletes the given node.
+     */
+    template <class T>
+    void operator()(T *ptr) const {
+        DeleteScope scope(dynamic_cast<const void*>(ptr), resource);
+        delete ptr;
+    }
+
+};
+
+#endif
+
+/**
+ * Takes ownership of the given node, which must have been created with new.
+ * If a memory resource is selected, the node was allocated from it, and the
+ * reference remembers to return it there: with std::shared_ptr, the deleter
+ * does so and the control block is allocated from the resource as well; with
+ * CQASM_INTRUSIVE_REFCOUNT, the node records the resource itself. Without a
+ * resource, this is an ordinary pointer to the node, so nodes created with
+ * new don't carry any extra data in the default configuration.
+ */
+template <class T>
+Ptr<T> adopt(T *ptr) {
+#ifdef CQASM_INTRUSIVE_REFCOUNT
+    return Ptr<T>(ptr);
+#else
+    auto resource = memory::get_resource();
+    if (!resource) {
+        return Ptr<T>(ptr);
+    }
+    return Ptr<T>(ptr, NodeDeleter(resource), PoolAllocator<T>(resource));
+#endif
+}
+
+/**
+ * Constructs a node of the given type from the given memory resource, or
+ * from the node pool if nullptr is passed, and returns a pointer to it. With
+ * std::shared_ptr, the control block is allocated along with the node; with
+ * CQASM_INTRUSIVE_REFCOUNT, the node is allocated with Base::operator new.
+ * While counting is enabled (see CountAllocations), the node is counted in
+ * get_allocations(); this covers make(), make_in(), and the generated
+ * clone() methods.
+ */
+template <class T, typename... Args>
+Ptr<T> construct(memory::Resource *resource, Args&&... args) {
+    if (get_allocation_counters().load(std::memory_order_relaxed)) {
+        auto &allocations = get_allocations();
+        allocations.nodes++;
+        allocations.bytes += sizeof(T);
+    }
+#ifdef CQASM_INTRUSIVE_REFCOUNT
+    memory::Scope scope(resource);
+    return Ptr<T>(new T(std::forward<Args>(args)...));
+#else
+    return std::allocate_shared<T>(PoolAllocator<T>(resource), std::forward<Args>(args)...);
+#endif
+}
+
+/**
+ * Constructs a One object, analogous to std::make_shared. The node and the
+ * control block of its shared pointer, if any, are allocated from the memory
+ * resource selected for the calling thread, or from the node pool if there
+ * is none.
+ */
+template <class T, typename... Args>
+One<T> make(Args&&... args) {
+    return One<T>(construct<T>(memory::get_resource(), std::forward<Args>(args)...));
+}
+
+/**
+ * Constructs a One object like make(), but allocates it from the given
+ * memory resource, regardless of the resource selected for the calling
+ * thread.
+ */
+template <class T, typename... Args>
+One<T> make_in(memory::Resource *resource, Args&&... args) {
+    return One<T>(construct<T>(resource, std::forward<Args>(args)...));
+}
+
+/**
+ * Returns the number of elements that Any and Many lists of the given node
+ * type store inside the list object itself, before falling back to a heap
+ * allocation. This default stores nothing inline. tree-gen generates
+ * overloads of this function for node types with an inline_capacity
+ * directive, which are found through argument-dependent lookup.
+ */
+template <class T>
+constexpr size_t inline_capacity(const T*) {
+    return 0;
+}
+
+/**
+ * Vector with room for N elements inside the object itself, such that short
+ * lists don't need a heap allocation. This is the storage of Any and Many.
+ * Only the operations needed there are provided. Iterators are pointers,
+ * invalidated by insertions and removals like those of std::vector.
+ */
+template <class E, size_t N>
+class SmallVector {
+private:
+
+    /**
+     * Pointer to the elements, either in buffer or on the heap.
+     */
+    E *elements;
+
+    /**
+     * Number of elements.
+     */
+    size_t num_elements;
+
+    /**
+     * Number of elements there is room for.
+     */
+    size_t num_allocated;
+
+    /**
+     * Inline storage for the first N elements.
+     */
+    typename std::aligned_storage<sizeof(E), alignof(E)>::type buffer[N];
+
+    /**
+     * Returns a pointer to the inline storage.
+     */
+    E *inline_elements() {
+        return reinterpret_cast<E*>(buffer);
     }
 
     /**
-     * Returns whether this Any is empty.
+     * Moves the elements to inline storage if the given capacity fits, or to
+     * a new heap block with room for the given number of elements otherwise.
+     * The capacity must differ from the current one.
      */
-    virtual bool empty() const {
-        return vec.empty();
+    void reallocate(size_t capacity) {
+        if (capacity <= N) {
+            move_to(inline_elements(), N);
+        } else {
+            move_to(static_cast<E*>(::operator new(capacity * sizeof(E))), capacity);
+        }
     }
 
     /**
-     * Returns the number of elements in this Any.
+     * Moves the elements to the given storage with room for the given number
+     * of elements, and frees the heap block the elements were in, if any.
      */
-    size_t size() const {
-        return vec.size();
+    void move_to(E *target, size_t capacity) {
+        for (size_t i = 0; i < num_elements; i++) {
+            new (target + i) E(std::move(elements[i]));
+            elements[i].~E();
+        }
+        if (!is_inline()) {
+            ::operator delete(elements);
+        }
+        elements = target;
+        num_allocated = capacity;
     }
 
     /**
-     * Returns a mutable reference to the contained value at the given index.
-     * Raises an `out_of_range` when the reference is empty.
+     * Takes the contents of the given vector, leaving it empty.
      */
-    One<T> &at(size_t index) {
-        return vec.at(index);
+    void take(SmallVector &src) {
+        if (src.is_inline()) {
+            for (auto &element : src) {
+                emplace_back(std::move(element));
+            }
+            src.clear();
+        } else {
+            elements = src.elements;
+            num_elements = src.num_elements;
+            num_allocated = src.num_allocated;
+            src.elements = src.inline_elements();
+            src.num_elements = 0;
+            src.num_allocated = N;
+        }
     }
 
     /**
-     * Shorthand for `at()`. Unlike std::vector's operator[], this also checks
-     * bounds.
+     * Destroys the elements and frees the heap block, if any, returning to
+     * the empty, inline state.
      */
-    One<T> &operator[] (size_t index) {
-        return at(index);
+    void release() {
+        clear();
+        if (!is_inline()) {
+            ::operator delete(elements);
+            elements = inline_elements();
+            num_allocated = N;
+        }
     }
 
+public:
+
     /**
-     * Returns an immutable reference to the contained value at the given
-     * index. Raises an `out_of_range` when the reference is empty.
+     * Mutable iterator type.
      */
-    const One<T> &at(size_t index) const {
-        return vec.at(index);
+    using iterator = E*;
+
+    /**
+     * Immutable iterator type.
+     */
+    using const_iterator = const E*;
+
+    /**
+     * Constructs an empty vector.
+     */
+    SmallVector() : elements(inline_elements()), num_elements(0), num_allocated(N) {
     }
 
     /**
-     * Shorthand for `at()`. Unlike std::vector's operator[], this also checks
-     * bounds.
+     * Copy constructor.
      */
-    const One<T> &operator[] (size_t index) const {
-        return at(index);
+    SmallVector(const SmallVector &src) : SmallVector() {
+        reserve(src.size());
+        for (const auto &element : src) {
+            emplace_back(element);
+        }
     }
 
     /**
-     * Returns a copy of the reference to the last value in the list. If the
-     * list is empty, an empty reference is returned.
+     * Move constructor.
      */
-    Maybe<T> back() const {
-        if (vec.empty()) {
-            return Maybe<T>();
-        } else {
-            return vec.back();
+    SmallVector(SmallVector &&src) : SmallVector() {
+        take(src);
+    }
+
+    /**
+     * Copy assignment.
+     */
+    SmallVector &operator=(const SmallVector &src) {
+        if (this != &src) {
+            clear();
+            reserve(src.size());
+            for (const auto &element : src) {
+                emplace_back(element);
+            }
         }
+        return *this;
     }
 
     /**
-     * `begin()` for for-each loops.
+     * Move assignment.
      */
-    typename std::vector<One<T>>::iterator begin() {
-        return vec.begin();
+    SmallVector &operator=(SmallVector &&src) {
+        if (this != &src) {
+            release();
+            take(src);
+        }
+        return *this;
     }
 
     /**
-     * `begin()` for for-each loops.
+     * Destructor.
      */
-    typename std::vector<One<T>>::const_iterator begin() const {
-        return vec.begin();
+    ~SmallVector() {
+        release();
     }
 
     /**
-     * `end()` for for-each loops.
+     * Returns whether the elements are stored inline.
      */
-    typename std::vector<One<T>>::iterator end() {
-        return vec.end();
+    bool is_inline() const {
+        return elements == reinterpret_cast<const E*>(buffer);
     }
 
     /**
-     * `end()` for for-each loops.
+     * Returns the number of elements.
      */
-    typename std::vector<One<T>>::const_iterator end() const {
-        return vec.end();
+    size_t size() const {
+        return num_elements;
     }
 
     /**
-     * Equality operator.
+     * Returns whether there are no elements.
      */
-    bool operator==(const Any& rhs) const {
-        return vec == rhs.vec;
+    bool empty() const {
+        return num_elements == 0;
     }
 
     /**
-     * Inequality operator.
+     * Returns the number of elements there is room for.
      */
-    inline bool operator!=(const Any& rhs) const {
-        return !(*this == rhs);
+    size_t capacity() const {
+        return num_allocated;
     }
 
     /**
-     * Returns whether this object is complete/fully defined.
+     * Makes room for at least the given number of elements.
      */
-    bool is_complete() const override {
-        for (auto &sptr : this->vec) {
-            if (!sptr->is_complete()) {
-                return false;
-            }
+    void reserve(size_t capacity) {
+        if (capacity > num_allocated) {
+            reallocate(capacity);
         }
-        return true;
     }
 
     /**
-     * Visit this object.
+     * Releases unused heap memory, moving the elements back to inline
+     * storage if they fit.
      */
-    template <class V>
-    void visit(V &visitor) {
-        for (auto &sptr : this->vec) {
-            if (!sptr.empty()) {
-                sptr->visit(visitor);
-            }
+    void shrink_to_fit() {
+        if (!is_inline() && num_elements < num_allocated) {
+            reallocate(num_elements);
         }
     }
 
-};
+    /**
+     * Constructs an element at the back.
+     */
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        if (num_elements < num_allocated) {
+            new (elements + num_elements) E(std::forward<Args>(args)...);
+            num_elements++;
+            return;
+        }
 
-/**
- * Convenience class for one or more AST nodes.
- */
-template <class T>
-class Many : public Any<T> {
-public:
+        // The arguments may refer to an element of this vector, so the new
+        // element is constructed before the old storage is released.
+        auto capacity = num_allocated * 2;
+        auto target = static_cast<E*>(::operator new(capacity * sizeof(E)));
+        try {
+            new (target + num_elements) E(std::forward<Args>(args)...);
+        } catch (...) {
+            ::operator delete(target);
+            throw;
+        }
+        move_to(target, capacity);
+        num_elements++;
+    }
 
     /**
-     * Returns whether this object is complete/fully defined.
+     * Constructs an element before the given position.
      */
-    bool is_complete() const override {
-        return !this->vec.empty() && Any<T>::is_complete();
+    template <class... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        auto index = pos - begin();
+        emplace_back(std::forward<Args>(args)...);
+        std::rotate(begin() + index, end() - 1, end());
+        return begin() + index;
     }
 
-};
+    /**
+     * Inserts copies of the given range of elements before the given
+     * position. The range may refer to elements of this vector.
+     */
+    template <class It>
+    iterator insert(const_iterator pos, It first, It last) {
+        auto index = pos - begin();
+        auto old_size = num_elements;
+        auto count = static_cast<size_t>(std::distance(first, last));
+        if (old_size + count <= num_allocated) {
+            for (; first != last; ++first) {
+                emplace_back(*first);
+            }
+        } else {
 
-} // namespace tree
-} // namespace cqasm
+            // Copy the range into the new storage before the old storage,
+            // which the range may refer to, is released.
+            auto capacity = std::max(old_size + count, num_allocated * 2);
+            auto target = static_cast<E*>(::operator new(capacity * sizeof(E)));
+            size_t copied = 0;
+            try {
+                for (; first != last; ++first, ++copied) {
+                    new (target + old_size + copied) E(*first);
+                }
+            } catch (...) {
+                for (size_t i = 0; i < copied; i++) {
+                    target[old_size + i].~E();
+                }
+                ::operator delete(target);
+                throw;
+            }
+            move_to(target, capacity);
+            num_elements += count;
+
+        }
+        std::rotate(begin() + index, begin() + old_size, end());
+        return begin() + index;
+    }
+
+    /**
+     * Removes the element at the given position.
+     */
+    iterator erase(const_iterator pos) {
+        auto index = pos - begin();
+        std::move(begin() + index + 1, end(), begin() + index);
+        num_elements--;
+        elements[num_elements].~E();
+        return begin() + index;
+    }
+
+    /**
+     * Removes all elements, keeping the allocated memory.
+     */
+    void clear() {
+        for (size_t i = 0; i < num_elements; i++) {
+            elements[i].~E();
+        }
+        num_elements = 0;
+    }
+
+    /**
+     * Returns a mutable reference to the element at the given index. Raises
+     * an `out_of_range` when the index is out of range.
+     */
+    E &at(size_t index) {
+        if (index >= num_elements) {
+            throw std::out_of_range("index out of range");
+        }
+        return elements[index];
+    }
+
+    /**
+     * Returns an immutable reference to the element at the given index.
+     * Raises an `out_of_range` when the index is out of range.
+     */
+    const E &at(size_t index) const {
+        if (index >= num_elements) {
+            throw std::out_of_range("index out of range");
+        }
+        return elements[index];
+    }
+
+    /**
+     * Returns a mutable reference to the last element.
+     */
+    E &back() {
+        return elements[num_elements - 1];
+    }
+
+    /**
+     * Returns an immutable reference to the last element.
+     */
+    const E &back() const {
+        return elements[num_elements - 1];
+    }
+
+    /**
+     * Returns a mutable iterator to the first element.
+     */
+    iterator begin() {
+        return elements;
+    }
+
+    /**
+     * Returns an immutable iterator to the first element.
+     */
+    const_iterator begin() const {
+        return elements;
+    }
+
+    /**
+     * Returns an immutable iterator to the first element.
+     */
+    const_iterator cbegin() const {
+        return elements;
+    }
+
+    /**
+     * Returns a mutable past-the-end iterator.
+     */
+    iterator end() {
+        return elements + num_elements;
+    }
+
+    /**
+     * Returns an immutable past-the-end iterator.
+     */
+    const_iterator end() const {
+        return elements + num_elements;
+    }
+
+    /**
+     * Returns an immutable past-the-end iterator.
+     */
+    const_iterator cend() const {
+        return elements + num_elements;
+    }
+
+    /**
+     * Equality operator.
+     */
+    bool operator==(const SmallVector &rhs) const {
+        return num_elements == rhs.num_elements && std::equal(begin(), end(), rhs.begin());
+    }
+
+};
+
+/**
+ * SmallVector without inline storage, which is just a std::vector.
+ */
+template <class E>
+class SmallVector<E, 0> : public std::vector<E> {
+public:
+
+    /**
+     * Returns whether the elements are stored inline, which is never the
+     * case.
+     */
+    bool is_inline() const {
+        return false;
+    }
+
+};
+
+/**
+ * Convenience class for zero or more AST nodes.
+ */
+template <class T>
+class Any : public Completable {
+public:
+
+    /**
+     * The type of the storage of the list. Up to
+     * `inline_capacity(static_cast<const T*>(nullptr))` elements are stored
+     * inside the Any object itself.
+     */
+    using Storage = SmallVector<One<T>, inline_capacity(static_cast<const T*>(nullptr))>;
+
+    /**
+     * Mutable iterator type.
+     */
+    using iterator = typename Storage::iterator;
+
+    /**
+     * Immutable iterator type.
+     */
+    using const_iterator = typename Storage::const_iterator;
+
+protected:
+
+    /**
+     * The contained vector.
+     */
+    Storage vec;
+
+public:
+
+    /**
+     * Adds the given value. No-op when the value is empty.
+     */
+    template <class S>
+    void add(const Maybe<S> &ob, ssize_t pos=-1) {
+        if (ob.empty()) {
+            return;
+        }
+        if (pos < 0 || (size_t)pos >= size()) {
+            this->vec.emplace_back(
+                tree::static_pointer_cast<T>(ob.get_ptr()));
+        } else {
+            this->vec.emplace(this->vec.cbegin() + pos,
+                              tree::static_pointer_cast<T>(
+                                  ob.get_ptr()));
+        }
+    }
+
+    /**
+     * Adds the NEW-ALLOCATED value pointed to AND TAKES OWNERSHIP. In almost
+     * all cases, you should use add(make(...), pos) instead! This only exists
+     * because the Yacc parser is one of the exceptions where you can't help
+     * it, because the nodes have to be stored in a union while parsing, and
+     * that can only be done with raw pointers.
+     */
+    template <class S>
+    void add_raw(S *ob, ssize_t pos=-1) {
+        if (!ob) {
+            throw std::runtime_error("add_raw called with nullptr!");
+        }
+        if (pos < 0 || (size_t)pos >= size()) {
+            this->vec.emplace_back(adopt(static_cast<T*>(ob)));
+        } else {
+            this->vec.emplace(this->vec.cbegin() + pos, adopt(static_cast<T*>(ob)));
+        }
+    }
+
+    /**
+     * Extends this Any with another, which may be this Any itself.
+     */
+    void extend(Any<T> &other) {
+        if (&other == this) {
+
+            // std::vector, used for lists without inline storage, doesn't
+            // allow inserting a range of itself.
+            auto copy = this->vec;
+            this->vec.insert(this->vec.end(), copy.begin(), copy.end());
+
+        } else {
+            this->vec.insert(this->vec.end(), other.vec.begin(), other.vec.end());
+        }
+    }
+
+    /**
+     * Removes the object at the given index, or at the back if no index is
+     * given.
+     */
+    void remove(ssize_t pos=-1) {
+        if (size() == 0) {
+            return;
+        }
+        if (pos < 0 || pos >= size()) {
+            pos = size() - 1;
+        }
+        this->vec.erase(this->vec.cbegin() + pos);
+    }
+
+    /**
+     * Removes the contained values.
+     */
+    void reset() {
+        vec.clear();
+    }
+
+    /**
+     * Returns whether this Any is empty.
+     */
+    virtual bool empty() const {
+        return vec.empty();
+    }
+
+    /**
+     * Returns the number of elements in this Any.
+     */
+    size_t size() const {
+        return vec.size();
+    }
+
+    /**
+     * Returns the number of elements this Any has room for without
+     * reallocating.
+     */
+    size_t capacity() const {
+        return vec.capacity();
+    }
+
+    /**
+     * Returns the number of elements this Any has room for in a separate
+     * heap allocation, or 0 if the elements are stored inline.
+     */
+    size_t heap_capacity() const {
+        return vec.is_inline() ? 0 : vec.capacity();
+    }
+
+    /**
+     * Releases the memory reserved for elements that were never added or
+     * have been removed.
+     */
+    void shrink_to_fit() {
+        vec.shrink_to_fit();
+    }
+
+    /**
+     * Returns a mutable reference to the contained value at the given index.
+     * Raises an `out_of_range` when the reference is empty.
+     */
+    One<T> &at(size_t index) {
+        return vec.at(index);
+    }
+
+    /**
+     * Shorthand for `at()`. Unlike std::vector's operator[], this also checks
+     * bounds.
+     */
+    One<T> &operator[] (size_t index) {
+        return at(index);
+    }
+
+    /**
+     * Returns an immutable reference to the contained value at the given
+     * index. Raises an `out_of_range` when the reference is empty.
+     */
+    const One<T> &at(size_t index) const {
+        return vec.at(index);
+    }
+
+    /**
+     * Shorthand for `at()`. Unlike std::vector's operator[], this also checks
+     * bounds.
+     */
+    const One<T> &operator[] (size_t index) const {
+        return at(index);
+    }
+
+    /**
+     * Returns a copy of the reference to the last value in the list. If the
+     * list is empty, an empty reference is returned.
+     */
+    Maybe<T> back() const {
+        if (vec.empty()) {
+            return Maybe<T>();
+        } else {
+            return vec.back();
+        }
+    }
+
+    /**
+     * `begin()` for for-each loops.
+     */
+    iterator begin() {
+        return vec.begin();
+    }
+
+    /**
+     * `begin()` for for-each loops.
+     */
+    const_iterator begin() const {
+        return vec.begin();
+    }
+
+    /**
+     * `end()` for for-each loops.
+     */
+    iterator end() {
+        return vec.end();
+    }
+
+    /**
+     * `end()` for for-each loops.
+     */
+    const_iterator end() const {
+        return vec.end();
+    }
+
+    /**
+     * Equality operator.
+     */
+    bool operator==(const Any& rhs) const {
+        return vec == rhs.vec;
+    }
+
+    /**
+     * Inequality operator.
+     */
+    inline bool operator!=(const Any& rhs) const {
+        return !(*this == rhs);
+    }
+
+    /**
+     * Returns whether this object is complete/fully defined.
+     */
+    bool is_complete() const override {
+        for (auto &sptr : this->vec) {
+            if (!sptr->is_complete()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Visit this object.
+     */
+    template <class V>
+    void visit(V &visitor) {
+        for (auto &sptr : this->vec) {
+            if (!sptr.empty()) {
+                sptr->visit(visitor);
+            }
+        }
+    }
+
+};
+
+/**
+ * Convenience class for one or more AST nodes.
+ */
+template <class T>
+class Many : public Any<T> {
+public:
+
+    /**
+     * Returns whether this object is complete/fully defined.
+     */
+    bool is_complete() const override {
+        return !this->vec.empty() && Any<T>::is_complete();
+    }
+
+};
+
+/**
+ * Freezes or thaws the given optional child node and its descendants. This
+ * is used by the set_frozen() functions generated for each node type.
+ */
+template <class T>
+void set_frozen(const Maybe<T> &child, bool frozen) {
+    if (!child.empty()) {
+        child->set_frozen(frozen);
+    }
+}
+
+/**
+ * Freezes or thaws the given child nodes and their descendants. This is used
+ * by the set_frozen() functions generated for each node type.
+ */
+template <class T>
+void set_frozen(const Any<T> &children, bool frozen) {
+    for (const auto &child : children) {
+        tree::set_frozen(child, frozen);
+    }
+}
+
+/**
+ * Read-only handle to a tree that can be shared between threads, for
+ * instance to hand a program analyzed by one thread to several others.
+ * Copying and destroying Frozen objects is thread-safe.
+ *
+ * With CQASM_INTRUSIVE_REFCOUNT, constructing a Frozen object marks all
+ * nodes of the tree as frozen, which stops their non-atomic reference counts
+ * from being updated, such that references into the tree may be copied and
+ * dropped by any thread. Such references must not outlive the last Frozen
+ * object, and references that existed before the tree was frozen must not
+ * be copied or dropped until then. When the last Frozen object is destroyed,
+ * the tree is thawed and the reference that it held is dropped.
+ */
+template <class T>
+class Frozen {
+private:
+
+    /**
+     * Shared state of the Frozen objects of a single tree.
+     */
+    struct Holder {
+
+        /**
+         * The root node of the tree.
+         */
+        One<T> root;
+
+        /**
+         * Takes ownership of the given tree and freezes it.
+         */
+        explicit Holder(One<T> &&root) : root(std::move(root)) {
+            tree::set_frozen(this->root, true);
+        }
+
+        /**
+         * Thaws the tree.
+         */
+        ~Holder() {
+            tree::set_frozen(root, false);
+        }
+
+    };
+
+    /**
+     * The shared state, using an atomic reference count.
+     */
+    std::shared_ptr<const Holder> holder;
+
+public:
+
+    /**
+     * Constructs an empty handle.
+     */
+    Frozen() : holder() {}
+
+    /**
+     * Freezes the given tree. The tree must not be modified anymore.
+     */
+    explicit Frozen(One<T> root) : holder(std::make_shared<const Holder>(std::move(root))) {}
+
+    /**
+     * Returns whether this handle is empty.
+     */
+    bool empty() const {
+        return !holder || holder->root.empty();
+    }
+
+    /**
+     * Returns the root node of the tree.
+     */
+    const One<T> &get() const {
+        if (!holder) {
+            throw std::out_of_range("dereferencing empty Frozen object");
+        }
+        return holder->root;
+    }
+
+    /**
+     * Returns a reference to the root node of the tree.
+     */
+    const T &operator*() const {
+        return *get();
+    }
+
+    /**
+     * Returns a pointer to the root node of the tree.
+     */
+    const T *operator->() const {
+        return &*get();
+    }
+
+};
+
+/**
+ * Index of a node in one of the node arrays of the flat tree variants that
+ * tree-gen generates, or of a child in their list array.
+ */
+using FlatIndex = uint32_t;
+
+/**
+ * Index used by empty references in flat trees.
+ */
+const FlatIndex FLAT_NONE = UINT32_MAX;
+
+/**
+ * Converts an array size to a flat tree index. Throws a `length_error` if the
+ * flat tree would get too large.
+ */
+inline FlatIndex to_flat_index(size_t index) {
+    if (index >= FLAT_NONE) {
+        throw std::length_error("flat tree is too large");
+    }
+    return static_cast<FlatIndex>(index);
+}
+
+/**
+ * A list of child nodes in a flat tree, referring to a contiguous range of
+ * the list array of the tree.
+ */
+struct FlatList {
+
+    /**
+     * The index of the first child in the list array.
+     */
+    FlatIndex offset;
+
+    /**
+     * The number of children.
+     */
+    FlatIndex size;
+
+    /**
+     * Constructs an empty list.
+     */
+    FlatList() : offset(0), size(0) {}
+
+};
+
+/**
+ * Read-only view of a contiguous range of elements, as returned for the
+ * lists of a flat tree.
+ */
+template <class T>
+class FlatRange {
+private:
+
+    /**
+     * The first element.
+     */
+    const T *first;
+
+    /**
+     * The number of elements.
+     */
+    size_t count;
+
+public:
+
+    /**
+     * Constructs a view of the given number of elements.
+     */
+    FlatRange(const T *first, size_t count) : first(first), count(count) {}
+
+    /**
+     * Returns the number of elements.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * Returns whether there are no elements.
+     */
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * Returns the element at the given index, without bounds checking.
+     */
+    const T &operator[](size_t index) const {
+        return first[index];
+    }
+
+    /**
+     * Returns an iterator to the first element.
+     */
+    const T *begin() const {
+        return first;
+    }
+
+    /**
+     * Returns an iterator past the last element.
+     */
+    const T *end() const {
+        return first + count;
+    }
+
+};
+
+/**
+ * Memory used by the objects of a single type, as reported by MemoryUsage.
+ */
+struct TypeMemoryUsage {
+
+    /**
+     * Number of distinct objects of this type.
+     */
+    size_t count;
+
+    /**
+     * Heap memory used by these objects in bytes, including the memory they
+     * own, such as node lists, strings, annotation tables, and matrix
+     * elements.
+     */
+    size_t bytes;
+
+};
+
+/**
+ * Estimate of the heap memory used by a tree, broken down per node type.
+ * This is filled by the add_memory_usage() functions generated for each
+ * node type, normally through `Node::memory_usage()`. Objects that are
+ * shared between several places in the tree, such as deduplicated nodes or
+ * annotations, are counted only once. Annotations of other types than the
+ * source location are only counted by their table entries, since their
+ * size is not known.
+ */
+class MemoryUsage {
+private:
+
+    /**
+     * The objects counted so far.
+     */
+    std::unordered_set<const void*> counted;
+
+    /**
+     * Usage per type, keyed by the address of the type name.
+     */
+    std::unordered_map<const char*, TypeMemoryUsage> types;
+
+    /**
+     * Total heap memory used in bytes.
+     */
+    size_t total;
+
+public:
+
+    /**
+     * Approximate overhead of the control block of a shared pointer
+     * allocated with std::make_shared() or make().
+     */
+    static const size_t SHARED_OVERHEAD = 2 * sizeof(void*);
+
+    /**
+     * Creates an empty report.
+     */
+    MemoryUsage();
+
+    /**
+     * Counts a shared heap object of the given type name and size, unless
+     * it was already counted. Returns whether it was counted now; if not,
+     * the memory it owns should not be counted again either. The type name
+     * must have static lifetime.
+     */
+    bool add_object(const void *object, const char *type, size_t size);
+
+    /**
+     * Counts additional heap memory owned by an object of the given type
+     * that was already counted.
+     */
+    void add_bytes(const char *type, size_t bytes);
+
+    /**
+     * Counts the annotation table of a node of the given type.
+     */
+    void add_annotations(const char *type, const annotatable::Annotatable &object);
+
+    /**
+     * Counts an optional child node.
+     */
+    template <class T>
+    void add_children(const char *type, const Maybe<T> &child) {
+        (void)type;
+        if (!child.empty()) {
+            child->add_memory_usage(*this);
+        }
+    }
+
+    /**
+     * Counts a list of child nodes, including the storage of the list.
+     */
+    template <class T>
+    void add_children(const char *type, const Any<T> &children) {
+        add_bytes(type, children.heap_capacity() * sizeof(One<T>));
+        for (const auto &child : children) {
+            if (!child.empty()) {
+                child->add_memory_usage(*this);
+            }
+        }
+    }
+
+    /**
+     * Returns the total heap memory used in bytes.
+     */
+    size_t get_total() const;
+
+    /**
+     * Returns the memory used per type, keyed by type name.
+     */
+    std::map<std::string, TypeMemoryUsage> get_types() const;
+
+};
+
+/**
+ * Index of the nodes of a tree by node type, such that all nodes of a given
+ * type can be found in time proportional to their number. The index is
+ * built in a single pass by the add_to_index() functions generated for each
+ * node type, normally through `Node::index_types()`. It descends into the
+ * external trees referred to by the nodes as well, so for instance the
+ * values used by a semantic tree can be found through the same index.
+ * Nodes that are shared between several places in the tree are listed once
+ * for every place. The index refers to the nodes by plain pointers, so it
+ * must not outlive the tree.
+ */
+class TypeIndex {
+private:
+
+    /**
+     * A node whose descendants have not been indexed yet, along with the
+     * function that indexes them.
+     */
+    struct Pending {
+
+        /**
+         * The node.
+         */
+        const Base *node;
+
+        /**
+         * Adds the node and its descendants to the given index.
+         */
+        void (*add)(const Base *node, TypeIndex &index);
+
+    };
+
+    /**
+     * The nodes of a single tree, bucketed by node type.
+     */
+    struct TreeNodes {
+
+        /**
+         * The key of the NodeType enumeration of the tree; see tree_key().
+         */
+        const void *tree;
+
+        /**
+         * The nodes per node type, in the order in which they were found.
+         */
+        std::vector<std::vector<const Base*>> types;
+
+    };
+
+    /**
+     * The nodes per tree.
+     */
+    std::vector<TreeNodes> trees;
+
+    /**
+     * The tree to which the last node was added, as an index into trees.
+     */
+    size_t last_tree;
+
+    /**
+     * When non-null, child nodes are appended to this list instead of
+     * being indexed immediately. This is used to divide the tree over
+     * several threads.
+     */
+    std::vector<Pending> *pending;
+
+    /**
+     * Returns the key that identifies the tree with the given NodeType
+     * enumeration. This is the address of a variable that exists once for
+     * every enumeration, so trees are told apart without relying on RTTI.
+     */
+    template <class E>
+    static const void *tree_key() {
+        static const char key = 0;
+        return &key;
+    }
+
+    /**
+     * Adds the given node and its descendants to the given index.
+     */
+    template <class T>
+    static void add_pending(const Base *node, TypeIndex &index) {
+        static_cast<const T*>(node)->add_to_index(index);
+    }
+
+    /**
+     * Returns the nodes of the tree with the given NodeType enumeration, or
+     * null if no nodes of that tree have been indexed.
+     */
+    const TreeNodes *find_tree(const void *tree) const;
+
+    /**
+     * Returns the nodes of the given type of the tree with the given
+     * NodeType enumeration, creating an empty bucket if needed.
+     */
+    std::vector<const Base*> &get_bucket(const void *tree, size_t type);
+
+    /**
+     * Appends the nodes of the given index to this one.
+     */
+    void merge(const TypeIndex &other);
+
+    /**
+     * Indexes the given node and its descendants, using up to num_threads
+     * threads.
+     */
+    void build(Pending root, size_t num_threads);
+
+public:
+
+    /**
+     * Creates an empty index.
+     */
+    TypeIndex();
+
+    /**
+     * Builds an index of the given node and its descendants. The tree is
+     * divided over up to num_threads threads below the first few levels,
+     * after which the per-thread indices are concatenated; the nodes of each
+     * type are then no longer in depth-first order, but the order is still
+     * deterministic. If num_threads is zero, the number of hardware threads
+     * is used. The tree must not be modified while the index is built.
+     */
+    template <class T>
+    static TypeIndex build(const T &root, size_t num_threads = 1) {
+        TypeIndex index;
+        index.build(Pending{&root, &TypeIndex::add_pending<T>}, num_threads);
+        return index;
+    }
+
+    /**
+     * Adds a single node of the given type to the index. The type must be
+     * a value of the NodeType enumeration of the tree that the node
+     * belongs to.
+     */
+    template <class E>
+    void add_node(E type, const Base *node) {
+        auto index = static_cast<size_t>(type);
+        if (last_tree < trees.size() && trees[last_tree].tree == tree_key<E>() && index < trees[last_tree].types.size()) {
+            trees[last_tree].types[index].push_back(node);
+        } else {
+            get_bucket(tree_key<E>(), index).push_back(node);
+        }
+    }
+
+    /**
+     * Indexes an optional child node and its descendants.
+     */
+    template <class T>
+    void add_children(const Maybe<T> &child) {
+        if (child.empty()) {
+            return;
+        }
+        if (pending) {
+            pending->push_back(Pending{child.get_ptr().get(), &TypeIndex::add_pending<T>});
+        } else {
+            child->add_to_index(*this);
+        }
+    }
+
+    /**
+     * Indexes a list of child nodes and their descendants.
+     */
+    template <class T>
+    void add_children(const Any<T> &children) {
+        for (const auto &child : children) {
+            add_children(child);
+        }
+    }
+
+    /**
+     * Returns the nodes of exactly the given type, in constant time. The
+     * type must be a value of the NodeType enumeration of one of the
+     * indexed trees.
+     */
+    template <class E>
+    const std::vector<const Base*> &get_nodes(E type) const {
+        static const std::vector<const Base*> none;
+        auto tree = find_tree(tree_key<E>());
+        auto index = static_cast<size_t>(type);
+        if (!tree || index >= tree->types.size()) {
+            return none;
+        }
+        return tree->types[index];
+    }
+
+    /**
+     * Returns all nodes of the given (possibly abstract) node class.
+     */
+    template <class T>
+    std::vector<const T*> find() const {
+        using E = typename std::decay<decltype(std::declval<const T&>().type())>::type;
+        std::vector<const T*> nodes;
+        auto tree = find_tree(tree_key<E>());
+        if (!tree) {
+            return nodes;
+        }
+        for (size_t type = 0; type < tree->types.size(); type++) {
+            if (T::is_type(static_cast<E>(type))) {
+                for (auto node : tree->types[type]) {
+                    nodes.push_back(static_cast<const T*>(node));
+                }
+            }
+        }
+        return nodes;
+    }
+
+    /**
+     * Returns the number of nodes of the given (possibly abstract) node
+     * class.
+     */
+    template <class T>
+    size_t count() const {
+        using E = typename std::decay<decltype(std::declval<const T&>().type())>::type;
+        size_t count = 0;
+        auto tree = find_tree(tree_key<E>());
+        if (!tree) {
+            return count;
+        }
+        for (size_t type = 0; type < tree->types.size(); type++) {
+            if (T::is_type(static_cast<E>(type))) {
+                count += tree->types[type].size();
+            }
+        }
+        return count;
+    }
+
+};
+
+/**
+ * Merkle hashes of the nodes of one or more trees. The hash of a node covers
+ * its type, its primitive fields, and the hashes of its children, including
+ * those in external trees, but not its annotation objects, consistent with
+ * the equality operator of the nodes; equal subtrees thus have equal hashes.
+ * The hashes are computed bottom-up by the compute_hash() functions
+ * generated for each node type, and are remembered per node, so the hashes
+ * of a tree can be computed once and reused for comparisons against any
+ * number of other trees. The tree must not be modified while the hashes are
+ * in use.
+ */
+class MerkleHashes {
+private:
+
+    /**
+     * The hashes computed so far.
+     */
+    std::unordered_map<const Base*, uint64_t> hashes;
+
+public:
+
+    /**
+     * Returns the hash of the given node, computing it along with those of
+     * its descendants if this wasn't done yet.
+     */
+    template <class T>
+    uint64_t get(const T &node) {
+        auto it = hashes.find(&node);
+        if (it != hashes.end()) {
+            return it->second;
+        }
+        auto hash = node.compute_hash(*this);
+        hashes.emplace(&node, hash);
+        return hash;
+    }
+
+    /**
+     * Returns the hash of an optional child node.
+     */
+    template <class T>
+    uint64_t get_children(const Maybe<T> &child) {
+        if (child.empty()) {
+            return 0;
+        }
+        return utils::hash_combine(1, get(*child));
+    }
+
+    /**
+     * Returns the hash of a list of child nodes.
+     */
+    template <class T>
+    uint64_t get_children(const Any<T> &children) {
+        uint64_t hash = children.size();
+        for (const auto &child : children) {
+            hash = utils::hash_combine(hash, get_children(child));
+        }
+        return hash;
+    }
+
+    /**
+     * Returns the initial hash for a node of the given type, which must be a
+     * value of the NodeType enumeration of its tree.
+     */
+    template <class E>
+    static uint64_t seed(E type) {
+        return utils::hash_combine(0xC0A5E5EEDull, static_cast<uint64_t>(type));
+    }
+
+    /**
+     * Returns the number of nodes hashed so far.
+     */
+    size_t size() const;
+
+};
+
+/**
+ * Kind of difference between two trees found by Differ.
+ */
+enum class EditKind {
+
+    /**
+     * A node was added to the new tree.
+     */
+    Added,
+
+    /**
+     * A node was removed from the old tree.
+     */
+    Removed,
+
+    /**
+     * A node was replaced by one of another type, or a primitive field of a
+     * node changed.
+     */
+    Changed
+
+};
+
+/**
+ * A difference between two trees found by Differ.
+ */
+struct Edit {
+
+    /**
+     * The kind of difference.
+     */
+    EditKind kind;
+
+    /**
+     * The path to the node or field relative to the roots of the trees, for
+     * instance `subcircuits[0].bundles[2].items[0].name`. List indices refer
+     * to the new tree, except for removed nodes.
+     */
+    std::string path;
+
+    /**
+     * The removed or replaced node in the old tree, or the node whose field
+     * changed; null for added nodes.
+     */
+    const Base *old_node;
+
+    /**
+     * The added or replacing node in the new tree, or the node whose field
+     * changed; null for removed nodes.
+     */
+    const Base *new_node;
+
+    /**
+     * For changed fields, the old value as printed by its stream <<
+     * overload.
+     */
+    std::string old_value;
+
+    /**
+     * For changed fields, the new value as printed by its stream <<
+     * overload.
+     */
+    std::string new_value;
+
+    /**
+     * The innermost node in the old tree that has a context annotation (see
+     * Differ) and contains the edit, or null if there is none. For added
+     * nodes, this is an ancestor of the place where the node was added.
+     */
+    const Base *old_context;
+
+    /**
+     * The innermost node in the new tree that has a context annotation and
+     * contains the edit, or null if there is none. For removed nodes, this
+     * is an ancestor of the place where the node was removed.
+     */
+    const Base *new_context;
+
+};
+
+/**
+ * Structural diff of two trees based on their Merkle hashes. Starting at the
+ * roots, subtrees with equal hashes are skipped, so only the paths to the
+ * differences are descended into; the cost of a diff is thus roughly
+ * proportional to the size of the change times the depth of the tree, plus
+ * the cost of computing the hashes if they are not known yet. The children
+ * of lists are aligned by their hashes, such that inserted and removed
+ * nodes are reported as such rather than as changes to all nodes after
+ * them. The comparison is done by the diff_fields() functions generated for
+ * each node type.
+ */
+class Differ {
+private:
+
+    /**
+     * A step of the alignment of two lists, other than keeping an element.
+     */
+    struct AlignStep {
+
+        /**
+         * The kind of step. Changed means that the elements are compared
+         * recursively.
+         */
+        EditKind kind;
+
+        /**
+         * The index in the old list, for removed and changed elements.
+         */
+        size_t old_index;
+
+        /**
+         * The index in the new list, for added and changed elements.
+         */
+        size_t new_index;
+
+    };
+
+    /**
+     * A pair of nodes being compared.
+     */
+    struct Level {
+
+        /**
+         * The node in the old tree.
+         */
+        const Base *old_node;
+
+        /**
+         * The node in the new tree.
+         */
+        const Base *new_node;
+
+        /**
+         * The innermost node with a context annotation in the old tree.
+         */
+        const Base *old_context;
+
+        /**
+         * The innermost node with a context annotation in the new tree.
+         */
+        const Base *new_context;
+
+    };
+
+    /**
+     * The hashes of the old tree.
+     */
+    MerkleHashes &old_hashes;
+
+    /**
+     * The hashes of the new tree.
+     */
+    MerkleHashes &new_hashes;
+
+    /**
+     * The type of the annotation that marks context nodes, such as a source
+     * location, or null for none.
+     */
+    const std::type_info *context_type;
+
+    /**
+     * The pairs of nodes being compared, from the roots inwards.
+     */
+    std::vector<Level> levels;
+
+    /**
+     * The path to the current node or field.
+     */
+    std::string path;
+
+    /**
+     * The differences found so far.
+     */
+    std::vector<Edit> edits;
+
+    /**
+     * Aligns two lists by the hashes of their elements, returning the steps
+     * needed to turn the old list into the new one, in order.
+     */
+    static std::vector<AlignStep> align(const std::vector<uint64_t> &old_list, const std::vector<uint64_t> &new_list);
+
+    /**
+     * Appends the given field name to the path, returning the length of the
+     * path before.
+     */
+    size_t enter_field(const char *name);
+
+    /**
+     * Appends the given list index to the path, returning the length of the
+     * path before.
+     */
+    size_t enter_index(size_t index);
+
+    /**
+     * Starts comparing the given pair of nodes.
+     */
+    void enter_node(const Base &old_node, const Base &new_node);
+
+    /**
+     * Returns the given node if it has a context annotation, or the given
+     * context otherwise.
+     */
+    const Base *get_context(const Base *node, const Base *context) const;
+
+    /**
+     * Records a difference at the current path.
+     */
+    void add_edit(EditKind kind, const Base *old_node, const Base *new_node);
+
+    /**
+     * Compares the given optional nodes.
+     */
+    template <class T>
+    void diff_child(const Maybe<T> &old_child, const Maybe<T> &new_child) {
+        if (old_child.empty() && new_child.empty()) {
+            return;
+        } else if (old_child.empty()) {
+            add_edit(EditKind::Added, nullptr, new_child.get_ptr().get());
+        } else if (new_child.empty()) {
+            add_edit(EditKind::Removed, old_child.get_ptr().get(), nullptr);
+        } else {
+            diff_nodes(*old_child, *new_child);
+        }
+    }
+
+public:
+
+    /**
+     * Creates a differ for trees with the given hashes. Nodes that have an
+     * annotation of the given type, if any, are recorded as the context of
+     * the edits within them.
+     */
+    Differ(MerkleHashes &old_hashes, MerkleHashes &new_hashes, const std::type_info *context_type = nullptr);
+
+    /**
+     * Compares the given nodes and their descendants.
+     */
+    template <class T>
+    void diff_nodes(const T &old_node, const T &new_node) {
+        if (old_hashes.get(old_node) == new_hashes.get(new_node)) {
+            return;
+        }
+        enter_node(old_node, new_node);
+        if (old_node.type() != new_node.type()) {
+            add_edit(EditKind::Changed, &old_node, &new_node);
+        } else {
+            old_node.diff_fields(new_node, *this);
+        }
+        levels.pop_back();
+    }
+
+    /**
+     * Compares optional child nodes.
+     */
+    template <class T>
+    void diff_children(const char *name, const Maybe<T> &old_child, const Maybe<T> &new_child) {
+        auto length = enter_field(name);
+        diff_child(old_child, new_child);
+        path.resize(length);
+    }
+
+    /**
+     * Compares lists of child nodes.
+     */
+    template <class T>
+    void diff_children(const char *name, const Any<T> &old_children, const Any<T> &new_children) {
+        auto length = enter_field(name);
+        std::vector<uint64_t> old_list, new_list;
+        old_list.reserve(old_children.size());
+        for (const auto &child : old_children) {
+            old_list.push_back(old_hashes.get_children(child));
+        }
+        new_list.reserve(new_children.size());
+        for (const auto &child : new_children) {
+            new_list.push_back(new_hashes.get_children(child));
+        }
+        for (const auto &step : align(old_list, new_list)) {
+            auto index_length = enter_index(step.kind == EditKind::Removed ? step.old_index : step.new_index);
+            if (step.kind == EditKind::Added) {
+                add_edit(EditKind::Added, nullptr, new_children[step.new_index].get_ptr().get());
+            } else if (step.kind == EditKind::Removed) {
+                add_edit(EditKind::Removed, old_children[step.old_index].get_ptr().get(), nullptr);
+            } else {
+                diff_child(old_children[step.old_index], new_children[step.new_index]);
+            }
+            path.resize(index_length);
+        }
+        path.resize(length);
+    }
+
+    /**
+     * Records that the primitive field with the given name of the nodes
+     * being compared changed from the given old value to the given new
+     * value, as printed.
+     */
+    void add_changed_field(const char *name, const std::string &old_value, const std::string &new_value);
+
+    /**
+     * Returns the differences found so far, in tree order.
+     */
+    const std::vector<Edit> &get_edits() const;
+
+};
+
+} // namespace tree
+} // namespace cqasm
+
+/**
+ * Stream << overload for memory usage reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::tree::MemoryUsage& usage);
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "cqasm-analyzer.hpp"
+#include <functional>
+
+namespace cqasm {
+namespace unitary {
+
+/**
+ * Function computing the unitary matrix of an instruction from its operands.
+ * The operands are passed in the same form as they appear in the semantic
+ * tree, including the qubit references. The function should return an empty
+ * matrix if it cannot determine the matrix for the given operands.
+ */
+using MatrixFunction = std::function<primitives::CMatrix(const values::Values &operands)>;
+
+/**
+ * Annotation for instruction::Instruction that specifies the unitary matrix
+ * of the instruction, for use by the optimization passes in this namespace.
+ * The matrix for n qubits is a 2^n by 2^n matrix, with qubit operands in
+ * order from most to least significant. Instructions without this annotation
+ * are treated as opaque.
+ *
+ * You would normally attach this while registering the instruction, using
+ * analyzer::Analyzer::register_instruction_with_annotation().
+ */
+class GateMatrix {
+public:
+
+    /**
+     * The function computing the matrix from the instruction operands.
+     */
+    MatrixFunction matrix;
+
+    /**
+     * Constructs a gate matrix annotation from a function.
+     */
+    explicit GateMatrix(const MatrixFunction &matrix);
+
+    /**
+     * Constructs a gate matrix annotation for an instruction with a fixed
+     * matrix.
+     */
+    explicit GateMatrix(const primitives::CMatrix &matrix);
+
+};
+
+/**
+ * Stack-allocated 2x2 complex matrix, used as the kernel for single-qubit
+ * gate computations. Elements are stored in row-major order.
+ */
+class Matrix2 {
+public:
+
+    /**
+     * The matrix elements in row-major order.
+     */
+    primitives::Complex m[4];
+
+    /**
+     * Returns the identity matrix.
+     */
+    static Matrix2 identity();
+
+    /**
+     * Converts from a CMatrix. Throws std::invalid_argument if the matrix is
+     * not 2x2.
+     */
+    static Matrix2 from_cmatrix(const primitives::CMatrix &matrix);
+
+    /**
+     * Converts to a CMatrix.
+     */
+    primitives::CMatrix to_cmatrix() const;
+
+    /**
+     * Matrix product. Note that applying a then b corresponds to b * a.
+     */
+    inline Matrix2 operator*(const Matrix2 &rhs) const {
+        Matrix2 result;
+        result.m[0] = m[0] * rhs.m[0] + m[1] * rhs.m[2];
+        result.m[1] = m[0] * rhs.m[1] + m[1] * rhs.m[3];
+        result.m[2] = m[2] * rhs.m[0] + m[3] * rhs.m[2];
+        result.m[3] = m[2] * rhs.m[1] + m[3] * rhs.m[3];
+        return result;
+    }
+
+};
+
+/**
+ * Returns the unitary matrix of the given instruction, based on the
+ * GateMatrix annotation of its instruction type. Returns an empty matrix if
+ * the instruction is unresolved, has no such annotation, or the annotation
+ * cannot determine the matrix.
+ */
+primitives::CMatrix matrix_of(const semantic::Instruction &insn);
+
+/**
+ * Returns the matrix operand of instructions like `u q[0], [...]`, i.e. the
+ * first complex matrix operand of the given operand list. Sparse and
+ * controlled matrix operands are converted to dense matrices. This can be
+ * used as the MatrixFunction of such instructions. Returns an empty matrix if
+ * there is no such operand.
+ */
+primitives::CMatrix matrix_operand(const values::Values &operands);
+
+/**
+ * Registers the usual single-qubit gates (i, x, y, z, h, s, sdag, t, tdag,
+ * x90, y90, mx90, my90, rx, ry, and rz), the usual two-qubit gates (cnot, cz,
+ * swap, cr, and crk), as well as the generic one- and two-qubit unitary gate
+ * `u`, with the given analyzer, along with their GateMatrix annotations.
+ */
+void register_default_gates(analyzer::Analyzer &analyzer);
+
+/**
+ * Fuses runs of consecutive single-qubit gates on the same qubit into a
+ * single instruction with a constant-folded matrix operand. The fused
+ * instruction is resolved by the given analyzer using the given name and
+ * the operand types (qubit, complex matrix), so the analyzer must know such
+ * an instruction; `u` as registered by register_default_gates() works.
+ *
+ * Only gates that are in a bundle on their own, are unconditional, operate
+ * on exactly one qubit, and have a 2x2 matrix according to matrix_of() are
+ * fused. A run on a qubit is broken by any other instruction using that
+ * qubit, by any instruction that does not use any qubits (these are assumed
+ * to act on the whole machine), and by subcircuit boundaries. Runs of length
+ * one are left as they are. The fused instruction takes the place and source
+ * location of the last gate of its run; the annotations of the fused gates
+ * are dropped. Returns the number of instructions that were removed.
+ */
+size_t fuse_single_qubit_gates(
+    semantic::Program &program,
+    const analyzer::Analyzer &analyzer,
+    const std::string &name = "u"
+);
+
+} // namespace unitary
+} // namespace cqasm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 namespace cqasm {
 namespace utils {
@@ -15,5 +16,17 @@ std::string lowercase(const std::string &name);
  */
 bool case_insensitive_equals(const std::string &lhs, const std::string &rhs);
 
+/**
+ * Mixes the given value into the given hash, using the finalizer of
+ * splitmix64 to spread the bits. Used for the structural hashes of the
+ * trees.
+ */
+inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+    uint64_t x = seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
 } // namespace utils
 } // namespace cqasm
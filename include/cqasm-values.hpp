@@ -47,6 +47,23 @@ void check_const(const Value &value);
  */
 void check_const(const Values &values);
 
+/**
+ * Returns the given complex matrix value as a dense matrix. Sparse and
+ * controlled matrices are converted; this is needed wherever the elements of
+ * a complex matrix operand are accessed directly, since promote() keeps these
+ * representations as they are. Returns an empty matrix if the value is not a
+ * constant complex matrix.
+ */
+primitives::CMatrix dense_complex_matrix(const Value &value);
+
+/**
+ * Like dense_complex_matrix(), but returns a reference to the stored matrix
+ * if the value is a dense matrix already, and only converts the value into
+ * the given storage otherwise. The result may refer to the value or to the
+ * storage, so it must not outlive either.
+ */
+const primitives::CMatrix &dense_complex_matrix(const Value &value, primitives::CMatrix &storage);
+
 } // namespace values
 } // namespace cqasm
 
@@ -1,17 +1,43 @@
+#include <algorithm>
+#include <chrono>
 #include <unordered_set>
 #include "cqasm-analyzer.hpp"
 #include "cqasm-parse-helper.hpp"
 #include "cqasm-utils.hpp"
+#include "cqasm-trace.hpp"
 #include "cqasm-functions-gen.hpp"
 
 namespace cqasm {
 namespace analyzer {
 
+/**
+ * Creates a statement profile.
+ */
+StatementProfile::StatementProfile(
+    const parser::SourceLocation &location,
+    const std::string &kind,
+    uint64_t duration,
+    size_t nodes,
+    size_t bytes
+) :
+    location(location),
+    kind(kind),
+    duration(duration),
+    nodes(nodes),
+    bytes(bytes)
+{}
+
 /**
  * Creates a new semantic analyzer.
  */
-Analyzer::Analyzer() : resolve_instructions(false), resolve_error_model(false) {
-}
+Analyzer::Analyzer() :
+    resolve_instructions(false),
+    resolve_error_model(false),
+    detect_bundle_conflicts(false),
+    build_instruction_index(false),
+    num_slow_statements(0),
+    memory_resource(nullptr)
+{}
 
 /**
  * Registers an initial mapping from the given name to the given value.
@@ -109,6 +135,73 @@ void Analyzer::register_error_model(
     register_error_model(error_model::ErrorModel(name, param_types));
 }
 
+/**
+ * Enables or disables the check for qubit and measurement bit conflicts
+ * between the instructions of a bundle. When enabled, a bundle such as
+ * `x q[0] | y q[0]` results in an analysis error. The check is linear in
+ * the number of operands of the bundle.
+ */
+void Analyzer::enable_bundle_conflict_check(bool enable) {
+    detect_bundle_conflicts = enable;
+}
+
+/**
+ * Enables or disables construction of the instruction index that is
+ * returned as part of the analysis result. This allows all occurrences of
+ * a particular instruction to be found without walking the tree.
+ */
+void Analyzer::enable_instruction_index(bool enable) {
+    build_instruction_index = enable;
+}
+
+/**
+ * Enables the statement profile, which measures the time taken and the
+ * tree nodes constructed for each statement, and returns the given
+ * number of slowest statements as part of the analysis result. This
+ * helps finding out which statement makes a file slow to analyze. Pass
+ * 0 to disable the profile again.
+ */
+void Analyzer::enable_statement_profile(size_t num_statements) {
+    num_slow_statements = num_statements;
+}
+
+/**
+ * Sets the memory resource that the semantic tree and its annotations
+ * are allocated from, for example an arena per request. The resource
+ * must outlive the analysis results. Pass nullptr to use the resource
+ * selected for the calling thread again, which is the default.
+ */
+void Analyzer::set_memory_resource(memory::Resource *resource) {
+    memory_resource = resource;
+}
+
+/**
+ * Resolves an unconditional instruction with the given name and operands
+ * against the registered instruction set, in the same way the analyzer
+ * resolves instructions in a cQASM file. This is intended for passes that
+ * construct new instructions. If no instructions were registered, an
+ * unresolved instruction node is returned. Throws an AnalysisError if
+ * resolution fails. Annotation data and line number information still
+ * need to be set by the caller.
+ */
+tree::One<semantic::Instruction> Analyzer::resolve_instruction(
+    const std::string &name,
+    const values::Values &operands
+) const {
+    memory::Scope scope(memory_resource ? memory_resource : memory::get_resource());
+    tree::One<semantic::Instruction> node;
+    if (resolve_instructions) {
+        node = instruction_set.resolve(name, operands);
+    } else {
+        node = tree::make<semantic::Instruction>(
+            tree::Maybe<instruction::Instruction>(),
+            name, values::Value(), operands,
+            tree::Any<semantic::AnnotationData>());
+    }
+    node->condition.set(tree::make<values::ConstBool>(true));
+    return node;
+}
+
 /**
  * Scope information.
  */
@@ -130,6 +223,34 @@ public:
 
 };
 
+/**
+ * Orders statement profiles from slowest to fastest.
+ */
+static bool is_slower(const StatementProfile &a, const StatementProfile &b) {
+    return a.duration > b.duration;
+}
+
+/**
+ * Set of qubit or measurement bit indices. Indices within the register are
+ * stored in a dense bitset, which is grown up to the size of the register as
+ * needed; indices outside of it can only come from user-specified initial
+ * mappings, and are stored in a hash set, such that their value doesn't
+ * determine the size of the bitset.
+ */
+struct BundleIndices {
+
+    /**
+     * Bitset of the indices within the register.
+     */
+    std::vector<uint64_t> dense;
+
+    /**
+     * The indices outside of the register.
+     */
+    std::unordered_set<primitives::Int> sparse;
+
+};
+
 /**
  * Helper class for analyzing a single AST. This contains the stateful
  * information that Analyzer can't have (to allow Analyzer to be reused).
@@ -140,6 +261,14 @@ public:
     AnalysisResult result;
     Scope scope;
 
+    /**
+     * Sets of the qubit/measurement bit indices used by a bundle, used by
+     * analyze_bundle_conflicts(). These are kept around between bundles and
+     * are empty outside of that function.
+     */
+    BundleIndices qubits_in_bundle;
+    BundleIndices bits_in_bundle;
+
     /**
      * Analyzes the given AST using the given analyzer.
      */
@@ -157,6 +286,18 @@ public:
      */
     void analyze_qubits(const ast::Expression &count);
 
+    /**
+     * Records the cost of analyzing the given statement, given the time and
+     * allocation counts from before it was analyzed. Only the slowest
+     * statements are kept, as a heap in result.slow_statements with the
+     * fastest of them at the front.
+     */
+    void profile_statement(
+        const ast::Statement &stmt,
+        std::chrono::steady_clock::time_point start,
+        const tree::Allocations &allocations
+    );
+
     /**
      * Analyzes the given bundle and, if valid, adds it to the current
      * subcircuit. If an error occurs, the message is added to the result
@@ -164,6 +305,13 @@ public:
      */
     void analyze_bundle(const ast::Bundle &bundle);
 
+    /**
+     * Checks that no two instructions in the given bundle use the same qubit
+     * or measurement bit. Any conflicts are pushed into the result error
+     * vector.
+     */
+    void analyze_bundle_conflicts(const semantic::Bundle &bundle);
+
     /**
      * Analyzes the given instruction. If an error occurs, the message is added to
      * the result error vector, and an empty Maybe is returned.
@@ -274,6 +422,8 @@ public:
  * Analyzes the given AST.
  */
 AnalysisResult Analyzer::analyze(const ast::Program &ast) const {
+    trace::Span span("analyze", "analyzer");
+    memory::Scope scope(memory_resource ? memory_resource : memory::get_resource());
     auto result = AnalyzerHelper(*this, ast).result;
     if (result.errors.empty() && !result.root.is_complete()) {
         std::cerr << *result.root;
@@ -300,19 +450,39 @@ AnalyzerHelper::AnalyzerHelper(
         result.root->copy_annotation<parser::SourceLocation>(ast);
 
         // Check and set the version.
-        analyze_version(*ast.version);
+        {
+            trace::Span span("version", "analyzer");
+            analyze_version(*ast.version);
+        }
 
         // Handle the qubits statement.
-        analyze_qubits(*ast.num_qubits);
+        {
+            trace::Span span("qubits", "analyzer");
+            analyze_qubits(*ast.num_qubits);
+        }
 
-        // Read the statements.
-        for (auto stmt : ast.statements->items) {
+        // Read the statements. Node constructions are only counted while
+        // the statement profile needs them.
+        std::unique_ptr<tree::CountAllocations> count_allocations;
+        if (analyzer.num_slow_statements) {
+            count_allocations.reset(new tree::CountAllocations());
+        }
+        for (const auto &stmt : ast.statements->items) {
+            std::chrono::steady_clock::time_point start;
+            tree::Allocations allocations = {0, 0};
+            if (analyzer.num_slow_statements) {
+                start = std::chrono::steady_clock::now();
+                allocations = tree::get_allocations();
+            }
             try {
                 if (auto bundle = stmt->as_bundle()) {
+                    trace::Span span("bundle", "analyzer");
                     analyze_bundle(*bundle);
                 } else if (auto mapping = stmt->as_mapping()) {
+                    trace::Span span("mapping", "analyzer");
                     analyze_mapping(*mapping);
                 } else if (auto subcircuit = stmt->as_subcircuit()) {
+                    trace::Span span("subcircuit", "analyzer");
                     analyze_subcircuit(*subcircuit);
                 } else {
                     throw std::runtime_error("unexpected expression node");
@@ -321,10 +491,14 @@ AnalyzerHelper::AnalyzerHelper(
                 e.context(*stmt);
                 result.errors.push_back(e.get_message());
             }
+            if (analyzer.num_slow_statements) {
+                profile_statement(*stmt, start, allocations);
+            }
         }
 
         // Save the list of final mappings.
-        for (auto it : scope.mappings.get_table()) {
+        trace::Span span("mappings", "analyzer");
+        for (const auto &it : scope.mappings.get_table()) {
             const auto &name = it.first;
             const auto &value = it.second.first;
             const auto &ast_node = it.second.second;
@@ -350,6 +524,53 @@ AnalyzerHelper::AnalyzerHelper(
     } catch (error::AnalysisError &e) {
         result.errors.push_back(e.get_message());
     }
+
+    // Order the statement profile from slowest to fastest.
+    std::sort_heap(result.slow_statements.begin(), result.slow_statements.end(), is_slower);
+
+}
+
+/**
+ * Records the cost of analyzing the given statement, given the time and
+ * allocation counts from before it was analyzed. Only the slowest
+ * statements are kept, as a heap in result.slow_statements with the fastest
+ * of them at the front.
+ */
+void AnalyzerHelper::profile_statement(
+    const ast::Statement &stmt,
+    std::chrono::steady_clock::time_point start,
+    const tree::Allocations &allocations
+) {
+
+    // This uses the steady clock directly rather than trace::now(), since
+    // the epoch of the latter moves when tracing is enabled.
+    uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+    auto &profiles = result.slow_statements;
+    if (profiles.size() == analyzer.num_slow_statements) {
+        if (duration <= profiles.front().duration) {
+            return;
+        }
+        std::pop_heap(profiles.begin(), profiles.end(), is_slower);
+        profiles.pop_back();
+    }
+    const char *kind = "statement";
+    if (stmt.as_bundle()) {
+        kind = "bundle";
+    } else if (stmt.as_mapping()) {
+        kind = "mapping";
+    } else if (stmt.as_subcircuit()) {
+        kind = "subcircuit";
+    }
+    auto location = stmt.get_annotation_ptr<parser::SourceLocation>();
+    profiles.emplace_back(
+        location ? *location : parser::SourceLocation("<unknown>"),
+        kind, duration,
+        tree::get_allocations().nodes - allocations.nodes,
+        tree::get_allocations().bytes - allocations.bytes
+    );
+    std::push_heap(profiles.begin(), profiles.end(), is_slower);
 }
 
 /**
@@ -452,6 +673,13 @@ void AnalyzerHelper::analyze_bundle(const ast::Bundle &bundle) {
                     result.errors.push_back(e.get_message());
                 }
             }
+
+            // If requested, also ensure that the instructions don't use the
+            // same qubits or measurement bits.
+            if (analyzer.detect_bundle_conflicts) {
+                analyze_bundle_conflicts(*node);
+            }
+
         }
 
         // It's possible that no instructions end up being added, due to all
@@ -475,8 +703,19 @@ void AnalyzerHelper::analyze_bundle(const ast::Bundle &bundle) {
             result.root->subcircuits.add(subcircuit_node);
         }
 
+        // Record the positions of the instructions in the index, if enabled.
+        auto &bundles = result.root->subcircuits.back()->bundles;
+        if (analyzer.build_instruction_index) {
+            index::Position position;
+            position.subcircuit = result.root->subcircuits.size() - 1;
+            position.bundle = bundles.size();
+            for (position.item = 0; position.item < node->items.size(); position.item++) {
+                result.instruction_index.add(*node->items[position.item], position);
+            }
+        }
+
         // Add the node to the last subcircuit.
-        result.root->subcircuits.back()->bundles.add(node);
+        bundles.add(node);
 
     } catch (error::AnalysisError &e) {
         e.context(bundle);
@@ -484,6 +723,107 @@ void AnalyzerHelper::analyze_bundle(const ast::Bundle &bundle) {
     }
 }
 
+/**
+ * Returns whether the given index is in the given set, and adds it if mark is
+ * true. The register has the given size.
+ */
+static bool test_and_mark(BundleIndices &set, primitives::Int index, primitives::Int size, bool mark) {
+    if (index < 0 || index >= size) {
+        if (mark) {
+            return !set.sparse.insert(index).second;
+        }
+        return set.sparse.count(index) > 0;
+    }
+    size_t word = (size_t)index / 64;
+    uint64_t mask = 1ull << ((size_t)index % 64);
+    if (word >= set.dense.size()) {
+        set.dense.resize(word + 1);
+    }
+    bool was_set = set.dense[word] & mask;
+    if (mark) {
+        set.dense[word] |= mask;
+    }
+    return was_set;
+}
+
+/**
+ * Removes the given index from the given set, along with the other indices in
+ * the same word of the bitset.
+ */
+static void clear_word(BundleIndices &set, primitives::Int index) {
+    if (index >= 0 && (size_t)index / 64 < set.dense.size()) {
+        set.dense[(size_t)index / 64] = 0;
+    }
+    if (!set.sparse.empty()) {
+        set.sparse.erase(index);
+    }
+}
+
+/**
+ * Checks that no two instructions in the given bundle use the same qubit or
+ * measurement bit. Any conflicts are pushed into the result error vector.
+ *
+ * The used indices are marked in BundleIndices sets, so the cost is linear
+ * in the total number of operand indices of the bundle, rather than quadratic
+ * in the number of instructions. Note that qubit and bit references
+ * are always stored as explicit index lists in the semantic tree at this
+ * point, so there's no need for interval overlap checks.
+ */
+void AnalyzerHelper::analyze_bundle_conflicts(const semantic::Bundle &bundle) {
+    auto num_qubits = result.root->num_qubits;
+    for (const auto &insn : bundle.items) {
+        try {
+
+            // Check all indices used by this instruction against those used
+            // by the previous instructions before marking any of them, such
+            // that reuse within a single instruction (which is governed by
+            // allow_reused_qubits) is not reported here.
+            for (int mark = 0; mark < 2; mark++) {
+                for (const auto &operand : insn->operands) {
+                    if (auto qubit_refs = operand->as_qubit_refs()) {
+                        for (const auto &index : qubit_refs->index) {
+                            if (test_and_mark(qubits_in_bundle, index->value, num_qubits, mark) && !mark) {
+                                throw error::AnalysisError(
+                                    "qubit with index " + std::to_string(index->value)
+                                    + " is used by more than one instruction in this bundle");
+                            }
+                        }
+                    } else if (auto bit_refs = operand->as_bit_refs()) {
+                        for (const auto &index : bit_refs->index) {
+                            if (test_and_mark(bits_in_bundle, index->value, num_qubits, mark) && !mark) {
+                                throw error::AnalysisError(
+                                    "measurement bit with index " + std::to_string(index->value)
+                                    + " is used by more than one instruction in this bundle");
+                            }
+                        }
+                    }
+                }
+            }
+
+        } catch (error::AnalysisError &e) {
+            e.context(*insn);
+            result.errors.push_back(e.get_message());
+        }
+    }
+
+    // Clear only the words we may have touched, such that the cost doesn't
+    // depend on the size of the qubit register.
+    for (const auto &insn : bundle.items) {
+        for (const auto &operand : insn->operands) {
+            if (auto qubit_refs = operand->as_qubit_refs()) {
+                for (const auto &index : qubit_refs->index) {
+                    clear_word(qubits_in_bundle, index->value);
+                }
+            } else if (auto bit_refs = operand->as_bit_refs()) {
+                for (const auto &index : bit_refs->index) {
+                    clear_word(bits_in_bundle, index->value);
+                }
+            }
+        }
+    }
+
+}
+
 /**
  * Analyzes the given instruction. If an error occurs, the message is added to
  * the result error vector, and an empty Maybe is returned. It's also possible
@@ -495,7 +835,7 @@ tree::Maybe<semantic::Instruction> AnalyzerHelper::analyze_instruction(const ast
 
         // Figure out the operand list.
         auto operands = values::Values();
-        for (auto operand_expr : insn.operands->items) {
+        for (const auto &operand_expr : insn.operands->items) {
             operands.add(analyze_expression(*operand_expr));
         }
 
@@ -536,7 +876,7 @@ tree::Maybe<semantic::Instruction> AnalyzerHelper::analyze_instruction(const ast
             std::unordered_set<primitives::Int> qubits_used;
             for (const auto &operand : operands) {
                 if (auto x = operand->as_qubit_refs()) {
-                    for (auto index : x->index) {
+                    for (const auto &index : x->index) {
                         if (!qubits_used.insert(index->value).second) {
                             throw error::AnalysisError(
                                 "qubit with index " + std::to_string(index->value)
@@ -679,12 +1019,12 @@ tree::Any<semantic::AnnotationData> AnalyzerHelper::analyze_annotations(
     const tree::Any<ast::AnnotationData> &annotations
 ) {
     auto retval = tree::Any<semantic::AnnotationData>();
-    for (auto annotation_ast : annotations) {
+    for (const auto &annotation_ast : annotations) {
         try {
             auto annotation = tree::make<semantic::AnnotationData>();
             annotation->interface = annotation_ast->interface->name;
             annotation->operation = annotation_ast->operation->name;
-            for (auto expression_ast : annotation_ast->operands->items) {
+            for (const auto &expression_ast : annotation_ast->operands->items) {
                 try {
                     annotation->operands.add(analyze_expression(*expression_ast));
                 } catch (error::AnalysisError &e) {
@@ -709,36 +1049,71 @@ tree::Any<semantic::AnnotationData> AnalyzerHelper::analyze_annotations(
 values::Value AnalyzerHelper::analyze_expression(const ast::Expression &expression) {
     values::Value retval;
     try {
-        if (auto int_lit = expression.as_integer_literal()) {
-            retval.set(tree::make<values::ConstInt>(int_lit->value));
-        } else if (auto float_lit = expression.as_float_literal()) {
-            retval.set(tree::make<values::ConstReal>(float_lit->value));
-        } else if (auto string_lit = expression.as_string_literal()) {
-            retval.set(tree::make<values::ConstString>(string_lit->value));
-        } else if (auto json_lit = expression.as_json_literal()) {
-            retval.set(tree::make<values::ConstJson>(json_lit->value));
-        } else if (auto matrix_lit = expression.as_matrix_literal()) {
-            retval.set(analyze_matrix(*matrix_lit));
-        } else if (auto ident = expression.as_identifier()) {
-            retval.set(scope.mappings.resolve(ident->name));
-        } else if (auto index = expression.as_index()) {
-            retval.set(analyze_index(*index));
-        } else if (auto func = expression.as_function_call()) {
-            retval.set(analyze_function(func->name->name, *func->arguments));
-        } else if (auto negate = expression.as_negate()) {
-            retval.set(analyze_operator("-", negate->expr));
-        } else if (auto power = expression.as_power()) {
-            retval.set(analyze_operator("**", power->lhs, power->rhs));
-        } else if (auto mult = expression.as_multiply()) {
-            retval.set(analyze_operator("*", mult->lhs, mult->rhs));
-        } else if (auto div = expression.as_divide()) {
-            retval.set(analyze_operator("/", div->lhs, div->rhs));
-        } else if (auto add = expression.as_add()) {
-            retval.set(analyze_operator("+", add->lhs, add->rhs));
-        } else if (auto sub = expression.as_subtract()) {
-            retval.set(analyze_operator("-", sub->lhs, sub->rhs));
-        } else {
-            throw std::runtime_error("unexpected expression node");
+        switch (expression.type()) {
+            case ast::NodeType::IntegerLiteral:
+                retval.set(tree::make<values::ConstInt>(
+                    static_cast<const ast::IntegerLiteral&>(expression).value));
+                break;
+            case ast::NodeType::FloatLiteral:
+                retval.set(tree::make<values::ConstReal>(
+                    static_cast<const ast::FloatLiteral&>(expression).value));
+                break;
+            case ast::NodeType::StringLiteral:
+                retval.set(tree::make<values::ConstString>(
+                    static_cast<const ast::StringLiteral&>(expression).value));
+                break;
+            case ast::NodeType::JsonLiteral:
+                retval.set(tree::make<values::ConstJson>(
+                    static_cast<const ast::JsonLiteral&>(expression).value));
+                break;
+            case ast::NodeType::MatrixLiteral:
+                retval.set(analyze_matrix(
+                    static_cast<const ast::MatrixLiteral&>(expression)));
+                break;
+            case ast::NodeType::Identifier:
+                retval.set(scope.mappings.resolve(
+                    static_cast<const ast::Identifier&>(expression).name));
+                break;
+            case ast::NodeType::Index:
+                retval.set(analyze_index(
+                    static_cast<const ast::Index&>(expression)));
+                break;
+            case ast::NodeType::FunctionCall: {
+                auto &func = static_cast<const ast::FunctionCall&>(expression);
+                retval.set(analyze_function(func.name->name, *func.arguments));
+                break;
+            }
+            case ast::NodeType::Negate:
+                retval.set(analyze_operator(
+                    "-", static_cast<const ast::Negate&>(expression).expr));
+                break;
+            case ast::NodeType::Power: {
+                auto &binop = static_cast<const ast::BinaryOp&>(expression);
+                retval.set(analyze_operator("**", binop.lhs, binop.rhs));
+                break;
+            }
+            case ast::NodeType::Multiply: {
+                auto &binop = static_cast<const ast::BinaryOp&>(expression);
+                retval.set(analyze_operator("*", binop.lhs, binop.rhs));
+                break;
+            }
+            case ast::NodeType::Divide: {
+                auto &binop = static_cast<const ast::BinaryOp&>(expression);
+                retval.set(analyze_operator("/", binop.lhs, binop.rhs));
+                break;
+            }
+            case ast::NodeType::Add: {
+                auto &binop = static_cast<const ast::BinaryOp&>(expression);
+                retval.set(analyze_operator("+", binop.lhs, binop.rhs));
+                break;
+            }
+            case ast::NodeType::Subtract: {
+                auto &binop = static_cast<const ast::BinaryOp&>(expression);
+                retval.set(analyze_operator("-", binop.lhs, binop.rhs));
+                break;
+            }
+            default:
+                throw std::runtime_error("unexpected expression node");
         }
     } catch (error::AnalysisError &e) {
         e.context(expression);
@@ -784,7 +1159,7 @@ values::Value AnalyzerHelper::analyze_matrix(const ast::MatrixLiteral &matrix_li
     // the ncols line is well-behaved.
     size_t nrows = matrix_lit.rows.size();
     size_t ncols = matrix_lit.rows[0]->items.size();
-    for (auto row : matrix_lit.rows) {
+    for (const auto &row : matrix_lit.rows) {
         if (row->items.size() != ncols) {
             throw error::AnalysisError("matrix is not rectangular");
         }
@@ -854,13 +1229,27 @@ values::Value AnalyzerHelper::analyze_matrix_helper(
  * Parses an index operator. Always returns a filled value or throws an error.
  */
 values::Value AnalyzerHelper::analyze_index(const ast::Index &index) {
-    auto expr = analyze_expression(*index.expr);
+
+    // Index the mapped value directly when the indexed expression is just
+    // an identifier, rather than copying it first; for q and b, that would
+    // copy the index list of the whole register for every reference.
+    values::Value expr;
+    if (auto identifier = index.expr->as_identifier()) {
+        try {
+            expr = scope.mappings.get(identifier->name);
+        } catch (error::AnalysisError &e) {
+            e.context(*identifier);
+            throw;
+        }
+    } else {
+        expr = analyze_expression(*index.expr);
+    }
     if (auto qubit_refs = expr->as_qubit_refs()) {
 
         // Qubit refs.
         auto indices = analyze_index_list(*index.indices,
                                           qubit_refs->index.size());
-        for (auto idx : indices) {
+        for (auto &idx : indices) {
             idx->value = qubit_refs->index[idx->value]->value;
         }
         return tree::make<values::QubitRefs>(indices);
@@ -870,7 +1259,7 @@ values::Value AnalyzerHelper::analyze_index(const ast::Index &index) {
         // Measurement bit refs.
         auto indices = analyze_index_list(*index.indices,
                                           bit_refs->index.size());
-        for (auto idx : indices) {
+        for (auto &idx : indices) {
             idx->value = bit_refs->index[idx->value]->value;
         }
         return tree::make<values::BitRefs>(indices);
@@ -891,7 +1280,7 @@ values::Value AnalyzerHelper::analyze_index(const ast::Index &index) {
  */
 tree::Many<values::ConstInt> AnalyzerHelper::analyze_index_list(const ast::IndexList &index_list, size_t size) {
     tree::Many<values::ConstInt> retval;
-    for (auto entry : index_list.items) {
+    for (const auto &entry : index_list.items) {
         if (auto item = entry->as_index_item()) {
 
             // Single index.
@@ -944,7 +1333,7 @@ tree::Many<values::ConstInt> AnalyzerHelper::analyze_index_list(const ast::Index
  */
 values::Value AnalyzerHelper::analyze_function(const ast::Identifier &name, const ast::ExpressionList &args) {
     auto arg_values = values::Values();
-    for (auto arg : args.items) {
+    for (const auto &arg : args.items) {
         arg_values.add(analyze_expression(*arg));
     }
     auto retval = scope.functions.call(name.name, arg_values);
@@ -971,3 +1360,13 @@ values::Value AnalyzerHelper::analyze_operator(
 
 } // namespace analyzer
 } // namespace cqasm
+
+/**
+ * Stream << overload for statement profiles.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::analyzer::StatementProfile& profile) {
+    os << profile.location << ": " << profile.kind << " took ";
+    os << profile.duration / 1000 << " us, constructing ";
+    os << profile.nodes << " nodes (" << profile.bytes << " bytes)";
+    return os;
+}
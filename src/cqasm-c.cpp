@@ -0,0 +1,680 @@
+#include "cqasm-c.h"
+#include "cqasm.hpp"
+#include "cqasm-utils.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+/**
+ * Wraps an analyzer.
+ */
+struct cqasm_analyzer {
+
+    /**
+     * The wrapped analyzer.
+     */
+    cqasm::analyzer::Analyzer analyzer;
+
+};
+
+/**
+ * Wraps a parse result.
+ */
+struct cqasm_parse_result {
+
+    /**
+     * The wrapped parse result.
+     */
+    cqasm::parser::ParseResult result;
+
+};
+
+/**
+ * An analyzed program, flattened into the arrays returned by the bulk
+ * accessors when the handle is created.
+ */
+struct cqasm_program {
+
+    /**
+     * The parse and analysis errors.
+     */
+    std::vector<std::string> errors;
+
+    /**
+     * The components of the file version.
+     */
+    std::vector<int64_t> version;
+
+    /**
+     * The number of qubits.
+     */
+    int64_t num_qubits;
+
+    /**
+     * The index of the first bundle of every subcircuit, and the number of
+     * bundles.
+     */
+    std::vector<uint64_t> subcircuit_offsets;
+
+    /**
+     * The number of iterations of every subcircuit.
+     */
+    std::vector<int64_t> subcircuit_iterations;
+
+    /**
+     * The name of every subcircuit.
+     */
+    std::vector<std::string> subcircuit_names;
+
+    /**
+     * The index of the first instruction of every bundle, and the number of
+     * instructions.
+     */
+    std::vector<uint64_t> bundle_offsets;
+
+    /**
+     * The instruction ID of every instruction.
+     */
+    std::vector<uint32_t> instruction_ids;
+
+    /**
+     * The lowercase instruction name of every ID.
+     */
+    std::vector<std::string> instruction_names;
+
+    /**
+     * The index of the first operand of every instruction, and the number of
+     * operands.
+     */
+    std::vector<uint64_t> operand_offsets;
+
+    /**
+     * The index of the condition operand of every instruction, or -1.
+     */
+    std::vector<int64_t> conditions;
+
+    /**
+     * The operand records.
+     */
+    std::vector<cqasm_operand> operands;
+
+    /**
+     * The integer values of the operands.
+     */
+    std::vector<int64_t> integers;
+
+    /**
+     * The real values of the operands.
+     */
+    std::vector<double> reals;
+
+    /**
+     * The string and JSON values of the operands.
+     */
+    std::vector<std::string> strings;
+
+};
+
+namespace cqasm {
+namespace c_api {
+
+/**
+ * Description of the last failure on this thread.
+ */
+static thread_local std::string last_error;
+
+/**
+ * Records the exception that is currently being handled as the last failure.
+ */
+static void set_last_error() {
+    try {
+        throw;
+    } catch (std::exception &e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "unknown error";
+    }
+}
+
+/**
+ * Copies as much of the given array as fits into the given buffer, and
+ * returns the size of the array.
+ */
+template <class T>
+static size_t copy_out(const std::vector<T> &data, T *buffer, size_t capacity) {
+    if (buffer) {
+        std::copy_n(data.begin(), std::min(capacity, data.size()), buffer);
+    }
+    return data.size();
+}
+
+/**
+ * Returns the given string, or null if the index is out of range.
+ */
+static const char *get_string(const std::vector<std::string> &strings, size_t index) {
+    if (index >= strings.size()) {
+        return nullptr;
+    }
+    return strings[index].c_str();
+}
+
+/**
+ * Flattens values into the operand records and value arrays of a program.
+ */
+class Flattener {
+private:
+
+    /**
+     * The program being flattened.
+     */
+    cqasm_program &program;
+
+    /**
+     * Map from lowercase instruction name to ID.
+     */
+    std::unordered_map<std::string, uint32_t> instruction_ids;
+
+    /**
+     * Adds an operand record for values that are stored in the integer
+     * array.
+     */
+    void add_integers(int32_t kind, const tree::Many<values::ConstInt> &index) {
+        program.operands.push_back({kind, 1, 1, 0, program.integers.size(), index.size()});
+        for (const auto &value : index) {
+            program.integers.push_back(value->value);
+        }
+    }
+
+    /**
+     * Adds an operand record for a scalar that is stored in the integer
+     * array.
+     */
+    void add_integer(int32_t kind, int64_t value) {
+        program.operands.push_back({kind, 1, 1, 0, program.integers.size(), 1});
+        program.integers.push_back(value);
+    }
+
+    /**
+     * Adds an operand record for a dense complex matrix.
+     */
+    void add_complex_matrix(const primitives::CMatrix &matrix) {
+        program.operands.push_back({
+            CQASM_OPERAND_COMPLEX_MATRIX,
+            static_cast<uint32_t>(matrix.size_rows()),
+            static_cast<uint32_t>(matrix.size_cols()),
+            0,
+            program.reals.size(),
+            2 * matrix.size_rows() * matrix.size_cols()
+        });
+        for (size_t row = 1; row <= matrix.size_rows(); row++) {
+            for (size_t col = 1; col <= matrix.size_cols(); col++) {
+                program.reals.push_back(matrix.at(row, col).real());
+                program.reals.push_back(matrix.at(row, col).imag());
+            }
+        }
+    }
+
+    /**
+     * Adds an operand record for a string in the string table.
+     */
+    void add_string(int32_t kind, const std::string &value) {
+        program.operands.push_back({kind, 1, 1, 0, program.strings.size(), 0});
+        program.strings.push_back(value);
+    }
+
+public:
+
+    /**
+     * Creates a flattener for the given program.
+     */
+    explicit Flattener(cqasm_program &program) : program(program) {}
+
+    /**
+     * Adds an operand record for the given value, and its values to the
+     * value arrays.
+     */
+    void add_operand(const values::Node &value) {
+        if (auto refs = value.as_qubit_refs()) {
+            add_integers(CQASM_OPERAND_QUBIT_REFS, refs->index);
+        } else if (auto refs = value.as_bit_refs()) {
+            add_integers(CQASM_OPERAND_BIT_REFS, refs->index);
+        } else if (auto constant = value.as_const_bool()) {
+            add_integer(CQASM_OPERAND_BOOL, constant->value ? 1 : 0);
+        } else if (auto constant = value.as_const_axis()) {
+            add_integer(CQASM_OPERAND_AXIS, static_cast<int64_t>(constant->value));
+        } else if (auto constant = value.as_const_int()) {
+            add_integer(CQASM_OPERAND_INT, constant->value);
+        } else if (auto constant = value.as_const_real()) {
+            program.operands.push_back({CQASM_OPERAND_REAL, 1, 1, 0, program.reals.size(), 1});
+            program.reals.push_back(constant->value);
+        } else if (auto constant = value.as_const_complex()) {
+            program.operands.push_back({CQASM_OPERAND_COMPLEX, 1, 1, 0, program.reals.size(), 2});
+            program.reals.push_back(constant->value.real());
+            program.reals.push_back(constant->value.imag());
+        } else if (auto constant = value.as_const_real_matrix()) {
+            const auto &matrix = constant->value;
+            program.operands.push_back({
+                CQASM_OPERAND_REAL_MATRIX,
+                static_cast<uint32_t>(matrix.size_rows()),
+                static_cast<uint32_t>(matrix.size_cols()),
+                0,
+                program.reals.size(),
+                matrix.size_rows() * matrix.size_cols()
+            });
+            for (size_t row = 1; row <= matrix.size_rows(); row++) {
+                for (size_t col = 1; col <= matrix.size_cols(); col++) {
+                    program.reals.push_back(matrix.at(row, col));
+                }
+            }
+        } else if (auto constant = value.as_const_complex_matrix()) {
+            add_complex_matrix(constant->value.get());
+        } else if (auto constant = value.as_const_sparse_complex_matrix()) {
+            add_complex_matrix(constant->value.to_dense());
+        } else if (auto constant = value.as_const_controlled_complex_matrix()) {
+            add_complex_matrix(constant->value.to_dense());
+        } else if (auto constant = value.as_const_string()) {
+            add_string(CQASM_OPERAND_STRING, constant->value.get());
+        } else if (auto constant = value.as_const_json()) {
+            add_string(CQASM_OPERAND_JSON, constant->value.get());
+        } else {
+            program.operands.push_back({CQASM_OPERAND_OTHER, 1, 1, 0, 0, 0});
+        }
+    }
+
+    /**
+     * Flattens the given program.
+     */
+    void add_program(const semantic::Program &root) {
+        for (auto component : root.version->items) {
+            program.version.push_back(component);
+        }
+        program.num_qubits = root.num_qubits;
+
+        // The conditions are added after all other operands, so collect them
+        // first.
+        std::vector<const values::Node*> conditions;
+        for (const auto &subcircuit : root.subcircuits) {
+            program.subcircuit_offsets.push_back(program.bundle_offsets.size());
+            program.subcircuit_iterations.push_back(subcircuit->iterations);
+            program.subcircuit_names.push_back(subcircuit->name);
+            for (const auto &bundle : subcircuit->bundles) {
+                program.bundle_offsets.push_back(program.instruction_ids.size());
+                for (const auto &insn : bundle->items) {
+                    auto name = utils::lowercase(insn->name);
+                    auto it = instruction_ids.find(name);
+                    if (it == instruction_ids.end()) {
+                        it = instruction_ids.emplace(name, program.instruction_names.size()).first;
+                        program.instruction_names.push_back(name);
+                    }
+                    program.instruction_ids.push_back(it->second);
+                    program.operand_offsets.push_back(program.operands.size());
+                    for (const auto &operand : insn->operands) {
+                        add_operand(*operand);
+                    }
+                    auto condition = insn->condition->as_const_bool();
+                    conditions.push_back(condition && condition->value ? nullptr : &*insn->condition);
+                }
+            }
+        }
+        program.subcircuit_offsets.push_back(program.bundle_offsets.size());
+        program.bundle_offsets.push_back(program.instruction_ids.size());
+        program.operand_offsets.push_back(program.operands.size());
+
+        for (auto condition : conditions) {
+            if (condition) {
+                program.conditions.push_back(program.operands.size());
+                add_operand(*condition);
+            } else {
+                program.conditions.push_back(-1);
+            }
+        }
+    }
+
+};
+
+/**
+ * Creates a program handle for the given parse result, analyzing it with the
+ * given analyzer if there were no parse errors.
+ */
+static cqasm_program *make_program(const analyzer::Analyzer &analyzer, const parser::ParseResult &parsed) {
+    std::unique_ptr<cqasm_program> program(new cqasm_program());
+    program->num_qubits = 0;
+    if (!parsed.errors.empty()) {
+        program->errors = parsed.errors;
+        return program.release();
+    }
+    auto analyzed = analyzer.analyze(*parsed.root->as_program());
+    if (!analyzed.errors.empty()) {
+        program->errors = analyzed.errors;
+        return program.release();
+    }
+    Flattener(*program).add_program(*analyzed.root);
+    return program.release();
+}
+
+} // namespace c_api
+} // namespace cqasm
+
+using namespace cqasm::c_api;
+
+/**
+ * Returns CQASM_C_API_VERSION of the library, which may be newer than that of
+ * the header the caller was compiled against.
+ */
+uint32_t cqasm_get_api_version(void) {
+    return CQASM_C_API_VERSION;
+}
+
+/**
+ * Returns a description of the last failure of a function of this interface
+ * on the calling thread, or an empty string if there was none. The string is
+ * valid until the next failure on the same thread.
+ */
+const char *cqasm_get_last_error(void) {
+    return last_error.c_str();
+}
+
+/**
+ * Creates an analyzer without any instructions, error models, functions or
+ * mappings. Returns null on failure.
+ */
+cqasm_analyzer *cqasm_analyzer_new(void) {
+    try {
+        return new cqasm_analyzer();
+    } catch (...) {
+        set_last_error();
+        return nullptr;
+    }
+}
+
+/**
+ * Destroys an analyzer. Programs analyzed with it remain valid. Does nothing
+ * for null.
+ */
+void cqasm_analyzer_free(cqasm_analyzer *analyzer) {
+    delete analyzer;
+}
+
+/**
+ * Registers the default functions and mappings, such as the operators, pi,
+ * and the axes. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_default_functions_and_mappings(cqasm_analyzer *analyzer) {
+    try {
+        analyzer->analyzer.register_default_functions_and_mappings();
+        return 0;
+    } catch (...) {
+        set_last_error();
+        return -1;
+    }
+}
+
+/**
+ * Registers an instruction with the given name and parameter type string, in
+ * the same format as the C++ interface. Once an instruction is registered,
+ * only registered instructions are accepted. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_instruction(
+    cqasm_analyzer *analyzer,
+    const char *name,
+    const char *param_types,
+    int allow_conditional,
+    int allow_parallel,
+    int allow_reused_qubits
+) {
+    try {
+        analyzer->analyzer.register_instruction(
+            name, param_types ? param_types : "",
+            allow_conditional != 0, allow_parallel != 0, allow_reused_qubits != 0);
+        return 0;
+    } catch (...) {
+        set_last_error();
+        return -1;
+    }
+}
+
+/**
+ * Registers an error model with the given name and parameter type string.
+ * Once an error model is registered, only registered error models are
+ * accepted. Returns nonzero on failure.
+ */
+int cqasm_analyzer_register_error_model(
+    cqasm_analyzer *analyzer,
+    const char *name,
+    const char *param_types
+) {
+    try {
+        analyzer->analyzer.register_error_model(name, param_types ? param_types : "");
+        return 0;
+    } catch (...) {
+        set_last_error();
+        return -1;
+    }
+}
+
+/**
+ * Parses the given file. Returns null on failure, for example when the file
+ * can't be read.
+ */
+cqasm_parse_result *cqasm_parse_file(const char *filename) {
+    try {
+        std::unique_ptr<cqasm_parse_result> result(new cqasm_parse_result());
+        result->result = cqasm::parser::parse_file(filename);
+        return result.release();
+    } catch (...) {
+        set_last_error();
+        return nullptr;
+    }
+}
+
+/**
+ * Parses the given null-terminated string. The filename is only used in error
+ * messages, and may be null. Returns null on failure.
+ */
+cqasm_parse_result *cqasm_parse_string(const char *data, const char *filename) {
+    try {
+        std::unique_ptr<cqasm_parse_result> result(new cqasm_parse_result());
+        result->result = cqasm::parser::parse_string(data, filename ? filename : "<unknown>");
+        return result.release();
+    } catch (...) {
+        set_last_error();
+        return nullptr;
+    }
+}
+
+/**
+ * Destroys a parse result. Does nothing for null.
+ */
+void cqasm_parse_result_free(cqasm_parse_result *result) {
+    delete result;
+}
+
+/**
+ * Returns the number of parse errors.
+ */
+size_t cqasm_parse_result_get_num_errors(const cqasm_parse_result *result) {
+    return result->result.errors.size();
+}
+
+/**
+ * Returns the parse error with the given index, or null if out of range.
+ */
+const char *cqasm_parse_result_get_error(const cqasm_parse_result *result, size_t index) {
+    return get_string(result->result.errors, index);
+}
+
+/**
+ * Analyzes the given parse result. If it has parse errors, the program
+ * reports those instead. Returns null on failure.
+ */
+cqasm_program *cqasm_analyze(const cqasm_analyzer *analyzer, const cqasm_parse_result *result) {
+    try {
+        return make_program(analyzer->analyzer, result->result);
+    } catch (...) {
+        set_last_error();
+        return nullptr;
+    }
+}
+
+/**
+ * Parses and analyzes the given null-terminated string. The filename is only
+ * used in error messages, and may be null. Returns null on failure.
+ */
+cqasm_program *cqasm_analyze_string(
+    const cqasm_analyzer *analyzer,
+    const char *data,
+    const char *filename
+) {
+    try {
+        auto parsed = cqasm::parser::parse_string(data, filename ? filename : "<unknown>");
+        return make_program(analyzer->analyzer, parsed);
+    } catch (...) {
+        set_last_error();
+        return nullptr;
+    }
+}
+
+/**
+ * Destroys a program. Does nothing for null.
+ */
+void cqasm_program_free(cqasm_program *program) {
+    delete program;
+}
+
+/**
+ * Returns the number of parse and analysis errors. The accessors below only
+ * return data if this is zero.
+ */
+size_t cqasm_program_get_num_errors(const cqasm_program *program) {
+    return program->errors.size();
+}
+
+/**
+ * Returns the error with the given index, or null if out of range.
+ */
+const char *cqasm_program_get_error(const cqasm_program *program, size_t index) {
+    return get_string(program->errors, index);
+}
+
+/**
+ * Copies the components of the file version, major first.
+ */
+size_t cqasm_program_get_version(const cqasm_program *program, int64_t *buffer, size_t capacity) {
+    return copy_out(program->version, buffer, capacity);
+}
+
+/**
+ * Returns the number of qubits of the program.
+ */
+int64_t cqasm_program_get_num_qubits(const cqasm_program *program) {
+    return program->num_qubits;
+}
+
+/**
+ * Copies, for every subcircuit and one past the last, the index of its first
+ * bundle.
+ */
+size_t cqasm_program_get_subcircuit_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity) {
+    return copy_out(program->subcircuit_offsets, buffer, capacity);
+}
+
+/**
+ * Copies the number of iterations of every subcircuit.
+ */
+size_t cqasm_program_get_subcircuit_iterations(const cqasm_program *program, int64_t *buffer, size_t capacity) {
+    return copy_out(program->subcircuit_iterations, buffer, capacity);
+}
+
+/**
+ * Returns the name of the subcircuit with the given index, or null if out of
+ * range.
+ */
+const char *cqasm_program_get_subcircuit_name(const cqasm_program *program, size_t index) {
+    return get_string(program->subcircuit_names, index);
+}
+
+/**
+ * Copies, for every bundle and one past the last, the index of its first
+ * instruction.
+ */
+size_t cqasm_program_get_bundle_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity) {
+    return copy_out(program->bundle_offsets, buffer, capacity);
+}
+
+/**
+ * Copies the instruction ID of every instruction. Instructions with the same
+ * case-insensitive name get the same ID; IDs are numbered from zero in order
+ * of first use.
+ */
+size_t cqasm_program_get_instruction_ids(const cqasm_program *program, uint32_t *buffer, size_t capacity) {
+    return copy_out(program->instruction_ids, buffer, capacity);
+}
+
+/**
+ * Returns the number of distinct instruction IDs.
+ */
+size_t cqasm_program_get_num_instruction_names(const cqasm_program *program) {
+    return program->instruction_names.size();
+}
+
+/**
+ * Returns the lowercase name of the instructions with the given ID, or null
+ * if out of range.
+ */
+const char *cqasm_program_get_instruction_name(const cqasm_program *program, uint32_t id) {
+    return get_string(program->instruction_names, id);
+}
+
+/**
+ * Copies, for every instruction and one past the last, the index of its first
+ * operand.
+ */
+size_t cqasm_program_get_operand_offsets(const cqasm_program *program, uint64_t *buffer, size_t capacity) {
+    return copy_out(program->operand_offsets, buffer, capacity);
+}
+
+/**
+ * Copies, for every instruction, the index of the operand that holds its
+ * condition, or -1 if it is unconditional. Conditions are stored after the
+ * operands of all instructions.
+ */
+size_t cqasm_program_get_conditions(const cqasm_program *program, int64_t *buffer, size_t capacity) {
+    return copy_out(program->conditions, buffer, capacity);
+}
+
+/**
+ * Copies the operand records, including those of the conditions.
+ */
+size_t cqasm_program_get_operands(const cqasm_program *program, cqasm_operand *buffer, size_t capacity) {
+    return copy_out(program->operands, buffer, capacity);
+}
+
+/**
+ * Copies the integer array, holding the qubit and bit indices and the
+ * integer, boolean and axis values of the operands.
+ */
+size_t cqasm_program_get_integers(const cqasm_program *program, int64_t *buffer, size_t capacity) {
+    return copy_out(program->integers, buffer, capacity);
+}
+
+/**
+ * Copies the real array, holding the real, complex and matrix values of the
+ * operands.
+ */
+size_t cqasm_program_get_reals(const cqasm_program *program, double *buffer, size_t capacity) {
+    return copy_out(program->reals, buffer, capacity);
+}
+
+/**
+ * Returns the string with the given index in the string table, or null if
+ * out of range. If length is not null, the length of the string is stored
+ * there, since strings may contain null characters.
+ */
+const char *cqasm_program_get_string(const cqasm_program *program, uint64_t index, size_t *length) {
+    if (index >= program->strings.size()) {
+        return nullptr;
+    }
+    if (length) {
+        *length = program->strings[index].size();
+    }
+    return program->strings[index].c_str();
+}
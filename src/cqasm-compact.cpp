@@ -0,0 +1,388 @@
+#include "cqasm-compact.hpp"
+#include "cqasm-parse-helper.hpp"
+#include "cqasm-utils.hpp"
+#include "cqasm-trace.hpp"
+#include <cstring>
+
+namespace cqasm {
+namespace compact {
+
+/**
+ * Creates the default options.
+ */
+Options::Options() :
+    shrink_containers(true),
+    locations(Locations::Deduplicate),
+    share_constants(true),
+    share_descriptors(true)
+{}
+
+/**
+ * Creates an empty report.
+ */
+Report::Report() : bytes_before(0), bytes_after(0) {}
+
+/**
+ * Returns the number of bytes reclaimed.
+ */
+size_t Report::bytes_reclaimed() const {
+    return bytes_before > bytes_after ? bytes_before - bytes_after : 0;
+}
+
+/**
+ * Returns an estimate of the heap memory in bytes used by the given semantic
+ * tree, including its values, descriptors, annotation tables, and source
+ * locations. Nodes and annotation objects that are shared are counted once.
+ * Annotations of other types than source locations are only counted by
+ * their table entries, since their size is not known. This is the total of
+ * the per-type breakdown returned by `program.memory_usage()`.
+ */
+size_t memory_usage(const semantic::Program &program) {
+    return program.memory_usage().get_total();
+}
+
+/**
+ * Appends the raw bytes of the given value to the given key.
+ */
+template <class T>
+static void append_key(std::string &key, const T &value) {
+    char buffer[sizeof(T)];
+    std::memcpy(buffer, &value, sizeof(T));
+    key.append(buffer, sizeof(T));
+}
+
+/**
+ * State of the compaction pass.
+ */
+class CompactHelper {
+public:
+
+    /**
+     * The options for the pass.
+     */
+    const Options &options;
+
+    /**
+     * Holders for the shared location objects, keyed by location contents.
+     */
+    std::unordered_map<std::string, annotatable::Annotatable> locations;
+
+    /**
+     * The shared constant nodes, keyed by type, contents, and location.
+     */
+    std::unordered_map<std::string, values::Value> constants;
+
+    /**
+     * The shared instruction descriptors, by lowercase name.
+     */
+    std::unordered_map<std::string, std::vector<instruction::InstructionRef>> instructions;
+
+    /**
+     * The shared error model descriptors.
+     */
+    std::vector<error_model::ErrorModelRef> error_models;
+
+    /**
+     * Creates the helper with the given options.
+     */
+    explicit CompactHelper(const Options &options) : options(options) {}
+
+    /**
+     * Returns the key identifying the contents of the given location.
+     */
+    static std::string location_key(const parser::SourceLocation &location) {
+        std::string key = location.filename;
+        key.push_back('\0');
+        append_key(key, location.first_line);
+        append_key(key, location.first_column);
+        append_key(key, location.last_line);
+        append_key(key, location.last_column);
+        return key;
+    }
+
+    /**
+     * Strips, deduplicates, or keeps the location of the given node, and
+     * shrinks its annotation table.
+     */
+    void node(annotatable::Annotatable &node, bool is_value) {
+        auto mode = options.locations;
+        if (mode == Locations::StripValues) {
+            mode = is_value ? Locations::Strip : Locations::Deduplicate;
+        }
+        if (mode == Locations::Strip) {
+            node.erase_annotation<parser::SourceLocation>();
+        } else if (mode == Locations::Deduplicate) {
+            if (auto location = node.get_annotation_ptr<parser::SourceLocation>()) {
+                auto &holder = locations[location_key(*location)];
+                if (holder.has_annotation<parser::SourceLocation>()) {
+                    node.share_annotation<parser::SourceLocation>(holder);
+                } else {
+                    holder.share_annotation<parser::SourceLocation>(node);
+                }
+            }
+        }
+        if (options.shrink_containers) {
+            node.shrink_annotations();
+        }
+    }
+
+    /**
+     * Shrinks the given node list if enabled.
+     */
+    template <class T>
+    void list(tree::Any<T> &list) {
+        if (options.shrink_containers) {
+            list.shrink_to_fit();
+        }
+    }
+
+    /**
+     * Returns the key identifying the type and contents of the given
+     * constant, or an empty string if it should not be shared.
+     */
+    static std::string constant_key(const values::Node &value) {
+        std::string key;
+        append_key(key, value.type());
+        if (auto constant = value.as_const_bool()) {
+            append_key(key, constant->value);
+        } else if (auto constant = value.as_const_axis()) {
+            append_key(key, constant->value);
+        } else if (auto constant = value.as_const_int()) {
+            append_key(key, constant->value);
+        } else if (auto constant = value.as_const_real()) {
+            append_key(key, constant->value);
+        } else if (auto constant = value.as_const_complex()) {
+            append_key(key, constant->value.real());
+            append_key(key, constant->value.imag());
+        } else if (auto constant = value.as_const_string()) {
+            key += constant->value;
+        } else if (auto constant = value.as_const_json()) {
+            key += constant->value;
+        } else if (auto constant = value.as_const_real_matrix()) {
+            append_key(key, constant->value.size_rows());
+            append_key(key, constant->value.size_cols());
+            for (size_t row = 1; row <= constant->value.size_rows(); row++) {
+                for (size_t col = 1; col <= constant->value.size_cols(); col++) {
+                    append_key(key, constant->value.at(row, col));
+                }
+            }
+        } else if (auto constant = value.as_const_complex_matrix()) {
+            append_key(key, constant->value->size_rows());
+            append_key(key, constant->value->size_cols());
+            for (size_t row = 1; row <= constant->value->size_rows(); row++) {
+                for (size_t col = 1; col <= constant->value->size_cols(); col++) {
+                    append_key(key, constant->value->at(row, col).real());
+                    append_key(key, constant->value->at(row, col).imag());
+                }
+            }
+        } else {
+            return "";
+        }
+
+        // Only nodes with the same location can be shared, and nodes with
+        // other annotations are left alone.
+        size_t num_annotations = 0;
+        if (auto location = value.get_annotation_ptr<parser::SourceLocation>()) {
+            key.push_back('@');
+            key += location_key(*location);
+            num_annotations++;
+        }
+        if (value.get_annotation_count() != num_annotations) {
+            return "";
+        }
+        return key;
+    }
+
+    /**
+     * Compacts the value in the given slot, replacing it with a shared node
+     * if enabled and possible.
+     */
+    template <class T>
+    void value(tree::Maybe<T> &slot) {
+        if (slot.empty()) {
+            return;
+        }
+        node(*slot, true);
+        if (auto qubit_refs = slot->as_qubit_refs()) {
+            indices(qubit_refs->index);
+        } else if (auto bit_refs = slot->as_bit_refs()) {
+            indices(bit_refs->index);
+        } else if (options.share_constants) {
+            auto key = constant_key(*slot);
+            if (!key.empty()) {
+                auto it = constants.find(key);
+                if (it == constants.end()) {
+                    constants.emplace(std::move(key), values::Value(slot));
+                } else {
+                    slot = it->second;
+                }
+            }
+        }
+    }
+
+    /**
+     * Compacts the given qubit or bit index list.
+     */
+    void indices(tree::Many<values::ConstInt> &indices) {
+        list(indices);
+        for (auto &index : indices) {
+            value(index);
+        }
+    }
+
+    /**
+     * Compacts the given list of values.
+     */
+    void values(values::Values &values) {
+        list(values);
+        for (auto &value : values) {
+            this->value(value);
+        }
+    }
+
+    /**
+     * Compacts the annotations of an annotated node, and the node itself.
+     */
+    void annotated(semantic::Annotated &node) {
+        this->node(node, false);
+        list(node.annotations);
+        for (auto &annotation : node.annotations) {
+            this->node(*annotation, false);
+            values(annotation->operands);
+        }
+    }
+
+    /**
+     * Compacts a list of types of a descriptor.
+     */
+    void types(types::Types &types) {
+        list(types);
+        for (auto &type : types) {
+            node(*type, false);
+        }
+    }
+
+    /**
+     * Compacts an instruction descriptor, replacing it with a shared one if
+     * enabled and possible.
+     */
+    void descriptor(instruction::InstructionRef &ref) {
+        if (ref.empty()) {
+            return;
+        }
+        if (options.share_descriptors) {
+            auto &candidates = instructions[utils::lowercase(ref->name)];
+            for (const auto &candidate : candidates) {
+                if (candidate.get_ptr() == ref.get_ptr()) {
+                    return;
+                }
+                if (*candidate == *ref && candidate->has_same_annotations(*ref)) {
+                    ref = candidate;
+                    return;
+                }
+            }
+            candidates.push_back(ref);
+        }
+        node(*ref, false);
+        types(ref->param_types);
+    }
+
+    /**
+     * Compacts an error model descriptor, replacing it with a shared one if
+     * enabled and possible.
+     */
+    void descriptor(error_model::ErrorModelRef &ref) {
+        if (ref.empty()) {
+            return;
+        }
+        if (options.share_descriptors) {
+            for (const auto &candidate : error_models) {
+                if (candidate.get_ptr() == ref.get_ptr()) {
+                    return;
+                }
+                if (*candidate == *ref && candidate->has_same_annotations(*ref)) {
+                    ref = candidate;
+                    return;
+                }
+            }
+            error_models.push_back(ref);
+        }
+        node(*ref, false);
+        types(ref->param_types);
+    }
+
+    /**
+     * Compacts a program.
+     */
+    void program(semantic::Program &program) {
+        node(program, false);
+        if (!program.version.empty()) {
+            node(*program.version, false);
+            if (options.shrink_containers) {
+                program.version->items.shrink_to_fit();
+            }
+        }
+        if (!program.error_model.empty()) {
+            auto &error_model = *program.error_model;
+            annotated(error_model);
+            descriptor(error_model.model);
+            values(error_model.parameters);
+        }
+        list(program.subcircuits);
+        for (auto &subcircuit : program.subcircuits) {
+            annotated(*subcircuit);
+            list(subcircuit->bundles);
+            for (auto &bundle : subcircuit->bundles) {
+                annotated(*bundle);
+                list(bundle->items);
+                for (auto &insn : bundle->items) {
+                    annotated(*insn);
+                    descriptor(insn->instruction);
+                    value(insn->condition);
+                    values(insn->operands);
+                }
+            }
+        }
+        list(program.mappings);
+        for (auto &mapping : program.mappings) {
+            annotated(*mapping);
+            value(mapping->value);
+        }
+    }
+
+};
+
+/**
+ * Reduces the memory footprint of the given semantic tree, for instance
+ * before storing it in a long-lived cache, according to the given options.
+ * Returns how much memory the tree used before and after.
+ *
+ * Note that sharing nodes, annotation objects, and descriptors means that
+ * modifying one of them in place affects all places that use it; replace
+ * them instead. The semantic tree does not refer to the AST it was analyzed
+ * from, so releasing that is a matter of dropping the parse result.
+ *
+ * This takes time linear in the size of the tree.
+ */
+Report compact(semantic::Program &program, const Options &options) {
+    trace::Span span("compact tree", "pass");
+    Report report;
+    report.bytes_before = memory_usage(program);
+    CompactHelper helper(options);
+    helper.program(program);
+    report.bytes_after = memory_usage(program);
+    return report;
+}
+
+} // namespace compact
+} // namespace cqasm
+
+/**
+ * Stream << overload for compaction reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::compact::Report& report) {
+    os << report.bytes_before << " bytes before compaction, ";
+    os << report.bytes_after << " after (";
+    os << report.bytes_reclaimed() << " reclaimed)";
+    return os;
+}
@@ -0,0 +1,100 @@
+#include "cqasm-diff.hpp"
+
+namespace cqasm {
+namespace diff {
+
+/**
+ * Returns the source location of the given node, if any.
+ */
+static const parser::SourceLocation *get_location(const tree::Base *node) {
+    if (!node) {
+        return nullptr;
+    }
+    return node->get_annotation_ptr<parser::SourceLocation>();
+}
+
+/**
+ * Creates an edit from the given difference reported by tree::Differ.
+ */
+Edit::Edit(const tree::Edit &edit) :
+    kind(edit.kind),
+    path(edit.path),
+    old_value(edit.old_value),
+    new_value(edit.new_value),
+    old_location(get_location(edit.old_context)),
+    new_location(get_location(edit.new_context))
+{}
+
+/**
+ * Returns the differences between the given analyzed programs, in tree
+ * order. Subtrees are compared by their Merkle hashes, which ignore
+ * annotation objects such as source locations, and only mismatching
+ * subtrees are descended into. Lists are aligned, such that inserted and
+ * removed statements are reported as such. The hashes are computed into the
+ * given tables, which may already hold the hashes of earlier diffs of the
+ * same, unmodified programs; the diff itself then takes time roughly
+ * proportional to the size of the change.
+ */
+std::vector<Edit> diff(
+    const semantic::Program &old_program,
+    const semantic::Program &new_program,
+    tree::MerkleHashes &old_hashes,
+    tree::MerkleHashes &new_hashes
+) {
+    tree::Differ differ(old_hashes, new_hashes, &typeid(parser::SourceLocation));
+    differ.diff_nodes(old_program, new_program);
+    std::vector<Edit> edits;
+    for (const auto &edit : differ.get_edits()) {
+        edits.emplace_back(edit);
+    }
+    return edits;
+}
+
+/**
+ * Returns the differences between the given analyzed programs, in tree
+ * order, computing the Merkle hashes of both programs first.
+ */
+std::vector<Edit> diff(const semantic::Program &old_program, const semantic::Program &new_program) {
+    tree::MerkleHashes old_hashes, new_hashes;
+    return diff(old_program, new_program, old_hashes, new_hashes);
+}
+
+} // namespace diff
+} // namespace cqasm
+
+/**
+ * Stream << overload for edits, writing a single line like
+ * `changed subcircuits[0].bundles[2].items[0].name at a.cq:5:1 / b.cq:5:1: x -> y`.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::diff::Edit& edit) {
+    switch (edit.kind) {
+        case ::cqasm::tree::EditKind::Added:
+            os << "added ";
+            break;
+        case ::cqasm::tree::EditKind::Removed:
+            os << "removed ";
+            break;
+        case ::cqasm::tree::EditKind::Changed:
+            os << "changed ";
+            break;
+    }
+    os << (edit.path.empty() ? "program" : edit.path);
+    if (edit.old_location || edit.new_location) {
+        os << " at ";
+        if (edit.old_location) {
+            os << *edit.old_location;
+        } else {
+            os << "?";
+        }
+        os << " / ";
+        if (edit.new_location) {
+            os << *edit.new_location;
+        } else {
+            os << "?";
+        }
+    }
+    if (!edit.old_value.empty() || !edit.new_value.empty()) {
+        os << ": " << edit.old_value << " -> " << edit.new_value;
+    }
+    return os;
+}
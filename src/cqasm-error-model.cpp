@@ -25,6 +25,51 @@ bool ErrorModel::operator==(const ErrorModel& rhs) const {
 }
 
 } // namespace error_model
+
+namespace primitives {
+
+/**
+ * Adds the memory used by the error model descriptor that the given reference
+ * refers to, if any, to the given memory usage report. Descriptors that are
+ * shared by several nodes are counted once.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const error_model::ErrorModelRef &ref) {
+    (void)type;
+    if (ref.empty()) {
+        return;
+    }
+    const char *name = "cqasm::error_model::ErrorModel";
+    if (usage.add_object(ref.get_ptr().get(), name, sizeof(error_model::ErrorModel))) {
+        usage.add_annotations(name, *ref);
+        add_memory_usage(usage, name, ref->name);
+        usage.add_children(name, ref->param_types);
+    }
+}
+
+/**
+ * Freezes or thaws the error model descriptor that the given reference refers
+ * to, if any, along with its parameter types. See tree::Frozen.
+ */
+void set_frozen(const error_model::ErrorModelRef &ref, bool frozen) {
+    if (!ref.empty() && ref->mark_frozen(frozen)) {
+        tree::set_frozen(ref->param_types, frozen);
+    }
+}
+
+/**
+ * Returns a hash of the error model descriptor that the given reference refers to,
+ * consistent with its equality operator. See tree::MerkleHashes.
+ */
+uint64_t hash(const error_model::ErrorModelRef &ref) {
+    if (ref.empty()) {
+        return 0;
+    }
+    uint64_t result = hash(utils::lowercase(ref->name));
+    result = utils::hash_combine(result, ref->param_types.size());
+    return result;
+}
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
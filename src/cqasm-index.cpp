@@ -0,0 +1,454 @@
+#include "cqasm-index.hpp"
+#include "cqasm-utils.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace cqasm {
+namespace index {
+
+/**
+ * Equality operator.
+ */
+bool Position::operator==(const Position &rhs) const {
+    return subcircuit == rhs.subcircuit
+        && bundle == rhs.bundle
+        && item == rhs.item;
+}
+
+/**
+ * Builds an index for the given program in a single pass.
+ */
+InstructionIndex InstructionIndex::build(const semantic::Program &program) {
+    InstructionIndex index;
+    Position position;
+    for (position.subcircuit = 0; position.subcircuit < program.subcircuits.size(); position.subcircuit++) {
+        const auto &subcircuit = *program.subcircuits[position.subcircuit];
+        for (position.bundle = 0; position.bundle < subcircuit.bundles.size(); position.bundle++) {
+            const auto &bundle = *subcircuit.bundles[position.bundle];
+            for (position.item = 0; position.item < bundle.items.size(); position.item++) {
+                index.add(*bundle.items[position.item], position);
+            }
+        }
+    }
+    return index;
+}
+
+/**
+ * Records that the given instruction occurs at the given position.
+ * Positions must be added in program order for the lists returned by
+ * find() to be in program order.
+ */
+void InstructionIndex::add(const semantic::Instruction &insn, const Position &position) {
+    occurrences[utils::lowercase(insn.name)].push_back(position);
+}
+
+/**
+ * Removes all entries from the index.
+ */
+void InstructionIndex::clear() {
+    occurrences.clear();
+}
+
+/**
+ * Returns the positions of all instructions with the given name. An empty
+ * list is returned if the instruction does not occur at all.
+ */
+const Positions &InstructionIndex::find(const std::string &name) const {
+    static const Positions none;
+    auto it = occurrences.find(utils::lowercase(name));
+    if (it == occurrences.end()) {
+        return none;
+    }
+    return it->second;
+}
+
+/**
+ * Returns the positions of all instructions that were resolved to the
+ * given instruction type. Unresolved instructions are never returned. The
+ * given program must be the one the index was built for.
+ */
+Positions InstructionIndex::find(
+    const semantic::Program &program,
+    const instruction::Instruction &instruction
+) const {
+
+    // Resolved instructions always have the name of their instruction type
+    // (modulo case), so we only need to check the occurrences of that name.
+    // Each semantic instruction node carries its own copy of the type, so we
+    // have to compare by value.
+    Positions result;
+    for (const auto &position : find(instruction.name)) {
+        const auto &insn = get(program, position);
+        if (!insn.instruction.empty() && *insn.instruction == instruction) {
+            result.push_back(position);
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns the number of times an instruction with the given name occurs.
+ */
+size_t InstructionIndex::count(const std::string &name) const {
+    return find(name).size();
+}
+
+/**
+ * Returns the map from lowercase instruction name to positions.
+ */
+const std::unordered_map<std::string, Positions> &InstructionIndex::get_table() const {
+    return occurrences;
+}
+
+/**
+ * Returns the number of register indices in this timeline. This is one
+ * past the highest index that is used at least once.
+ */
+size_t Timeline::size() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+/**
+ * Returns all positions for the given register index, in program order.
+ * If the index is out of range, an empty range is returned.
+ */
+FlatRange Timeline::get(size_t index) const {
+    if (index >= size()) {
+        return FlatRange(nullptr, 0);
+    }
+    return FlatRange(entries.data() + offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+/**
+ * Returns the positions p for the given register index for which
+ * from <= p < to, in program order. This takes time logarithmic in the
+ * number of positions for the given index.
+ */
+FlatRange Timeline::get(size_t index, uint32_t from, uint32_t to) const {
+    auto all = get(index);
+    if (from >= to) {
+        return FlatRange(all.begin(), 0);
+    }
+    auto first = std::lower_bound(all.begin(), all.end(), from);
+    auto last = std::lower_bound(first, all.end(), to);
+    return FlatRange(first, last - first);
+}
+
+/**
+ * Per-thread state used by TimelineIndex::build(). Each worker handles a
+ * contiguous range of subcircuits.
+ */
+struct TimelineWorker {
+
+    /**
+     * The range of subcircuits handled by this worker.
+     */
+    size_t first_subcircuit;
+    size_t last_subcircuit;
+
+    /**
+     * Flat position of the first instruction handled by this worker.
+     */
+    uint32_t first_flat;
+
+    /**
+     * Number of positions per qubit/bit found by this worker during the
+     * counting pass. These are converted into write cursors into the entry
+     * vectors by the merge step.
+     */
+    std::vector<uint32_t> qubit_counts;
+    std::vector<uint32_t> bit_counts;
+
+    /**
+     * One plus the flat position of the last instruction that was recorded
+     * for each qubit/bit, used to avoid listing an instruction more than once
+     * for the same qubit/bit.
+     */
+    std::vector<uint32_t> qubit_last;
+    std::vector<uint32_t> bit_last;
+
+};
+
+/**
+ * Records a use of the given register index by the instruction at the given
+ * flat position. During the counting pass (entries is null) this increments
+ * the count for the index; during the fill pass it writes the position to
+ * the cursor for the index.
+ */
+static void record_use(
+    primitives::Int index,
+    uint32_t flat,
+    std::vector<uint32_t> &counts,
+    std::vector<uint32_t> &last,
+    uint32_t *entries
+) {
+    if (index < 0) {
+        return;
+    }
+    size_t k = index;
+    if (k >= last.size()) {
+        last.resize(k + 1, 0);
+        counts.resize(k + 1, 0);
+    }
+    if (last[k] == flat + 1) {
+        return;
+    }
+    last[k] = flat + 1;
+    if (entries) {
+        entries[counts[k]++] = flat;
+    } else {
+        counts[k]++;
+    }
+}
+
+/**
+ * Runs the counting pass or the fill pass over the part of the program
+ * handled by the given worker. The counting pass also fills in the
+ * flat-to-tree position map. Note that the entry pointers may be null during
+ * the fill pass as well, but only if there is nothing to write to them.
+ */
+static void run_timeline_worker(
+    const semantic::Program &program,
+    TimelineWorker &worker,
+    bool fill,
+    std::vector<Position> &stream,
+    uint32_t *qubit_entries,
+    uint32_t *bit_entries
+) {
+    std::fill(worker.qubit_last.begin(), worker.qubit_last.end(), 0);
+    std::fill(worker.bit_last.begin(), worker.bit_last.end(), 0);
+    uint32_t flat = worker.first_flat;
+    Position position;
+    for (position.subcircuit = worker.first_subcircuit; position.subcircuit < worker.last_subcircuit; position.subcircuit++) {
+        const auto &subcircuit = *program.subcircuits[position.subcircuit];
+        for (position.bundle = 0; position.bundle < subcircuit.bundles.size(); position.bundle++) {
+            const auto &bundle = *subcircuit.bundles[position.bundle];
+            for (position.item = 0; position.item < bundle.items.size(); position.item++, flat++) {
+                const auto &insn = *bundle.items[position.item];
+                if (!fill) {
+                    stream[flat] = position;
+                }
+                for (const auto &operand : insn.operands) {
+                    if (auto qubit_refs = operand->as_qubit_refs()) {
+                        for (const auto &index : qubit_refs->index) {
+                            record_use(index->value, flat, worker.qubit_counts, worker.qubit_last, qubit_entries);
+                        }
+                    } else if (auto bit_refs = operand->as_bit_refs()) {
+                        for (const auto &index : bit_refs->index) {
+                            record_use(index->value, flat, worker.bit_counts, worker.bit_last, bit_entries);
+                        }
+                    }
+                }
+                if (!insn.condition.empty()) {
+                    if (auto bit_refs = insn.condition->as_bit_refs()) {
+                        for (const auto &index : bit_refs->index) {
+                            record_use(index->value, flat, worker.bit_counts, worker.bit_last, bit_entries);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Merges the per-worker counts for a register into the offset vector of the
+ * given timeline, converts the counts into write cursors, and allocates the
+ * entry vector.
+ */
+static void merge_timeline_counts(
+    Timeline &timeline,
+    std::vector<TimelineWorker> &workers,
+    std::vector<uint32_t> TimelineWorker::*counts
+) {
+    size_t size = 0;
+    for (const auto &worker : workers) {
+        size = std::max(size, (worker.*counts).size());
+    }
+    timeline.offsets.resize(size + 1);
+    uint32_t running = 0;
+    for (size_t k = 0; k < size; k++) {
+        timeline.offsets[k] = running;
+        for (auto &worker : workers) {
+            auto &worker_counts = worker.*counts;
+            if (k < worker_counts.size()) {
+                auto count = worker_counts[k];
+                worker_counts[k] = running;
+                running += count;
+            }
+        }
+    }
+    timeline.offsets[size] = running;
+    timeline.entries.resize(running);
+}
+
+/**
+ * Runs the given pass for all workers, using a thread for each worker but
+ * the first, which runs on the calling thread.
+ */
+static void run_timeline_workers(
+    const semantic::Program &program,
+    std::vector<TimelineWorker> &workers,
+    bool fill,
+    std::vector<Position> &stream,
+    uint32_t *qubit_entries,
+    uint32_t *bit_entries
+) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); i++) {
+        threads.emplace_back(
+            run_timeline_worker, std::cref(program), std::ref(workers[i]),
+            fill, std::ref(stream), qubit_entries, bit_entries
+        );
+    }
+    run_timeline_worker(program, workers[0], fill, stream, qubit_entries, bit_entries);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * Builds an index for the given program. Subcircuits are divided over
+ * up to num_threads threads, each of which counts and then fills in the
+ * positions for its own part of the program; the per-thread counts are
+ * merged with a prefix sum in between. If num_threads is zero, the number
+ * of hardware threads is used.
+ */
+TimelineIndex TimelineIndex::build(const semantic::Program &program, size_t num_threads) {
+    TimelineIndex index;
+
+    // Count the number of instructions per subcircuit.
+    std::vector<uint32_t> subcircuit_sizes;
+    uint32_t total = 0;
+    for (const auto &subcircuit : program.subcircuits) {
+        uint32_t size = 0;
+        for (const auto &bundle : subcircuit->bundles) {
+            size += bundle->items.size();
+        }
+        subcircuit_sizes.push_back(size);
+        total += size;
+    }
+    index.stream.resize(total);
+
+    // Divide the subcircuits over the workers, such that each worker gets
+    // about the same number of instructions.
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::max<size_t>(1, std::min(num_threads, subcircuit_sizes.size()));
+    std::vector<TimelineWorker> workers;
+    uint32_t flat = 0;
+    size_t subcircuit = 0;
+    for (size_t i = 0; i < num_threads; i++) {
+        TimelineWorker worker;
+        worker.first_subcircuit = subcircuit;
+        worker.first_flat = flat;
+        uint64_t target = (uint64_t)total * (i + 1) / num_threads;
+        while (subcircuit < subcircuit_sizes.size() && (flat < target || i + 1 == num_threads)) {
+            flat += subcircuit_sizes[subcircuit++];
+        }
+        worker.last_subcircuit = subcircuit;
+        workers.push_back(std::move(worker));
+    }
+
+    // Counting pass, merge, and fill pass.
+    run_timeline_workers(program, workers, false, index.stream, nullptr, nullptr);
+    merge_timeline_counts(index.qubit_timeline, workers, &TimelineWorker::qubit_counts);
+    merge_timeline_counts(index.bit_timeline, workers, &TimelineWorker::bit_counts);
+    run_timeline_workers(
+        program, workers, true, index.stream,
+        index.qubit_timeline.entries.data(),
+        index.bit_timeline.entries.data()
+    );
+
+    return index;
+}
+
+/**
+ * Returns the total number of instructions in the program, i.e. one past
+ * the highest flat position.
+ */
+size_t TimelineIndex::size() const {
+    return stream.size();
+}
+
+/**
+ * Converts the given flat position into a tree position. Throws
+ * std::out_of_range if the position does not exist.
+ */
+const Position &TimelineIndex::locate(uint32_t flat) const {
+    return stream.at(flat);
+}
+
+/**
+ * Returns the flat positions of all instructions using the given qubit,
+ * in program order.
+ */
+FlatRange TimelineIndex::qubit(size_t qubit) const {
+    return qubit_timeline.get(qubit);
+}
+
+/**
+ * Returns the flat positions p of the instructions using the given qubit
+ * for which from <= p < to, in program order. This takes logarithmic
+ * time.
+ */
+FlatRange TimelineIndex::qubit(size_t qubit, uint32_t from, uint32_t to) const {
+    return qubit_timeline.get(qubit, from, to);
+}
+
+/**
+ * Returns the flat positions of all instructions using the given
+ * measurement bit, in program order.
+ */
+FlatRange TimelineIndex::bit(size_t bit) const {
+    return bit_timeline.get(bit);
+}
+
+/**
+ * Returns the flat positions p of the instructions using the given
+ * measurement bit for which from <= p < to, in program order. This takes
+ * logarithmic time.
+ */
+FlatRange TimelineIndex::bit(size_t bit, uint32_t from, uint32_t to) const {
+    return bit_timeline.get(bit, from, to);
+}
+
+/**
+ * Returns the qubit timelines.
+ */
+const Timeline &TimelineIndex::qubits() const {
+    return qubit_timeline;
+}
+
+/**
+ * Returns the measurement bit timelines.
+ */
+const Timeline &TimelineIndex::bits() const {
+    return bit_timeline;
+}
+
+/**
+ * Returns the instruction at the given position of the given program. Throws
+ * std::out_of_range if the position does not exist.
+ */
+const semantic::Instruction &get(
+    const semantic::Program &program,
+    const Position &position
+) {
+    return *program
+        .subcircuits.at(position.subcircuit)
+        ->bundles.at(position.bundle)
+        ->items.at(position.item);
+}
+
+} // namespace index
+} // namespace cqasm
+
+/**
+ * Stream << overload for instruction positions.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::index::Position& position) {
+    os << position.subcircuit << ":" << position.bundle << ":" << position.item;
+    return os;
+}
@@ -41,6 +41,54 @@ bool Instruction::operator==(const Instruction& rhs) const {
 }
 
 } // namespace instruction
+
+namespace primitives {
+
+/**
+ * Adds the memory used by the instruction descriptor that the given reference
+ * refers to, if any, to the given memory usage report. Descriptors that are
+ * shared by several nodes are counted once.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const instruction::InstructionRef &ref) {
+    (void)type;
+    if (ref.empty()) {
+        return;
+    }
+    const char *name = "cqasm::instruction::Instruction";
+    if (usage.add_object(ref.get_ptr().get(), name, sizeof(instruction::Instruction))) {
+        usage.add_annotations(name, *ref);
+        add_memory_usage(usage, name, ref->name);
+        usage.add_children(name, ref->param_types);
+    }
+}
+
+/**
+ * Freezes or thaws the instruction descriptor that the given reference refers
+ * to, if any, along with its parameter types. See tree::Frozen.
+ */
+void set_frozen(const instruction::InstructionRef &ref, bool frozen) {
+    if (!ref.empty() && ref->mark_frozen(frozen)) {
+        tree::set_frozen(ref->param_types, frozen);
+    }
+}
+
+/**
+ * Returns a hash of the instruction descriptor that the given reference refers to,
+ * consistent with its equality operator. See tree::MerkleHashes.
+ */
+uint64_t hash(const instruction::InstructionRef &ref) {
+    if (ref.empty()) {
+        return 0;
+    }
+    uint64_t result = hash(utils::lowercase(ref->name));
+    result = utils::hash_combine(result, ref->param_types.size());
+    result = utils::hash_combine(result, hash(ref->allow_conditional));
+    result = utils::hash_combine(result, hash(ref->allow_parallel));
+    result = utils::hash_combine(result, hash(ref->allow_reused_qubits));
+    return result;
+}
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
@@ -0,0 +1,157 @@
+#include "cqasm-intern.hpp"
+#include "cqasm-tree.hpp"
+#include <atomic>
+
+namespace cqasm {
+namespace intern {
+
+/**
+ * The pool selected for the current thread.
+ */
+static thread_local Pool *current_pool = nullptr;
+
+/**
+ * The pool used by threads that didn't select one.
+ */
+static std::atomic<Pool*> default_pool(nullptr);
+
+/**
+ * Returns the stored string equal to the given one, storing a copy of it if
+ * there is none yet.
+ */
+std::shared_ptr<const primitives::Str> Pool::get(const primitives::Str &value) {
+    return strings.get(value);
+}
+
+/**
+ * Returns the stored string equal to the given one, storing it if there is
+ * none yet.
+ */
+std::shared_ptr<const primitives::Str> Pool::get(primitives::Str &&value) {
+    return strings.get(std::move(value));
+}
+
+/**
+ * Returns the stored matrix equal to the given one, storing a copy of it if
+ * there is none yet.
+ */
+std::shared_ptr<const primitives::CMatrix> Pool::get(const primitives::CMatrix &value) {
+    return matrices.get(value);
+}
+
+/**
+ * Returns the stored matrix equal to the given one, storing it if there is
+ * none yet.
+ */
+std::shared_ptr<const primitives::CMatrix> Pool::get(primitives::CMatrix &&value) {
+    return matrices.get(std::move(value));
+}
+
+/**
+ * Returns the number of distinct values in the pool.
+ */
+size_t Pool::size() const {
+    return strings.size() + matrices.size();
+}
+
+/**
+ * Removes the values that are no longer referred to by any program from the
+ * pool, and returns how many were removed.
+ */
+size_t Pool::purge() {
+    return strings.purge() + matrices.purge();
+}
+
+/**
+ * Returns the process-wide pool. It is not selected by default; use
+ * set_default_pool() or a Scope to do so.
+ */
+Pool &Pool::global() {
+    static Pool pool;
+    return pool;
+}
+
+/**
+ * Returns the pool selected for the calling thread, or the default pool if
+ * the thread didn't select one. Returns nullptr if neither is set, in which
+ * case values are not deduplicated.
+ */
+Pool *get_pool() {
+    if (current_pool) {
+        return current_pool;
+    }
+    return default_pool.load(std::memory_order_acquire);
+}
+
+/**
+ * Selects the pool for the calling thread, or falls back to the default pool
+ * when nullptr is passed. Returns the previously selected pool.
+ */
+Pool *set_pool(Pool *pool) {
+    Pool *previous = current_pool;
+    current_pool = pool;
+    return previous;
+}
+
+/**
+ * Selects the pool used by threads that didn't select one themselves, or
+ * disables interning for them when nullptr is passed. Returns the previous
+ * default pool.
+ */
+Pool *set_default_pool(Pool *pool) {
+    return default_pool.exchange(pool, std::memory_order_acq_rel);
+}
+
+/**
+ * Selects the given pool, or the default pool for nullptr.
+ */
+Scope::Scope(Pool *pool) : previous(set_pool(pool)) {
+}
+
+/**
+ * Restores the previously selected pool.
+ */
+Scope::~Scope() {
+    set_pool(previous);
+}
+
+} // namespace intern
+
+namespace primitives {
+
+/**
+ * Adds the heap memory of the given interned string to the given memory
+ * usage report. Pooled strings are counted once, with the memory they own,
+ * as a cqasm::intern::Str object; strings stored inline are attributed to
+ * the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const intern::Str &str) {
+    if (!str.is_pooled()) {
+        add_memory_usage(usage, type, str.get());
+        return;
+    }
+    const char *name = "cqasm::intern::Str";
+    if (usage.add_object(&str.get(), name, sizeof(Str))) {
+        add_memory_usage(usage, name, str.get());
+    }
+}
+
+/**
+ * Adds the heap memory of the given interned matrix to the given memory
+ * usage report. Pooled matrices are counted once, with the memory they own,
+ * as a cqasm::intern::CMatrix object; matrices stored inline are attributed
+ * to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const intern::CMatrix &matrix) {
+    if (!matrix.is_pooled()) {
+        add_memory_usage(usage, type, matrix.get());
+        return;
+    }
+    const char *name = "cqasm::intern::CMatrix";
+    if (usage.add_object(&matrix.get(), name, sizeof(CMatrix))) {
+        add_memory_usage(usage, name, matrix.get());
+    }
+}
+
+} // namespace primitives
+} // namespace cqasm
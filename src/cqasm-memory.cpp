@@ -0,0 +1,144 @@
+#include "cqasm-memory.hpp"
+
+namespace cqasm {
+namespace memory {
+
+/**
+ * Alignment of the memory handed out by Arena::allocate().
+ */
+static const size_t ARENA_ALIGNMENT = alignof(std::max_align_t);
+
+/**
+ * The resource selected for the current thread.
+ */
+static thread_local Resource *current_resource = nullptr;
+
+/**
+ * Creates an empty arena that allocates chunks of the given size.
+ * Allocations larger than a chunk get a chunk of their own.
+ */
+Arena::Arena(size_t chunk_size) :
+    chunks(),
+    chunk_size(chunk_size),
+    next(nullptr),
+    remaining(0),
+    used(0),
+    reserved(0)
+{}
+
+/**
+ * Allocates the given number of bytes from the current chunk, or from a
+ * new one if the current chunk is full.
+ */
+void *Arena::allocate(size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    used += size;
+    if (size > chunk_size) {
+        chunks.emplace_back(new char[size]);
+        reserved += size;
+        return chunks.back().get();
+    }
+    if (size > remaining) {
+        chunks.emplace_back(new char[chunk_size]);
+        reserved += chunk_size;
+        next = chunks.back().get();
+        remaining = chunk_size;
+    }
+    void *ptr = next;
+    next += size;
+    remaining -= size;
+    return ptr;
+}
+
+/**
+ * Does nothing; memory is only freed by release().
+ */
+void Arena::deallocate(void *ptr, size_t size) {
+    (void)ptr;
+    (void)size;
+}
+
+/**
+ * Frees all chunks. Everything allocated from the arena must have been
+ * destroyed by then.
+ */
+void Arena::release() {
+    chunks.clear();
+    next = nullptr;
+    remaining = 0;
+    used = 0;
+    reserved = 0;
+}
+
+/**
+ * Returns the total number of bytes handed out since construction or the
+ * last release().
+ */
+size_t Arena::get_used() const {
+    return used;
+}
+
+/**
+ * Returns the total number of bytes allocated for chunks.
+ */
+size_t Arena::get_reserved() const {
+    return reserved;
+}
+
+/**
+ * Returns the memory resource selected for the calling thread, or nullptr
+ * if the library's default allocation strategy is used.
+ */
+Resource *get_resource() {
+    return current_resource;
+}
+
+/**
+ * Selects the memory resource for the calling thread, or restores the
+ * default allocation strategy when nullptr is passed. Returns the previously
+ * selected resource.
+ */
+Resource *set_resource(Resource *resource) {
+    Resource *previous = current_resource;
+    current_resource = resource;
+    return previous;
+}
+
+/**
+ * Allocates memory from the given resource, or using the global operator new
+ * if it is nullptr.
+ */
+void *allocate(Resource *resource, size_t size) {
+    if (resource) {
+        return resource->allocate(size);
+    }
+    return ::operator new(size);
+}
+
+/**
+ * Frees memory allocated by allocate() with the same resource and size.
+ */
+void deallocate(Resource *resource, void *ptr, size_t size) {
+    if (resource) {
+        resource->deallocate(ptr, size);
+    } else {
+        ::operator delete(ptr);
+    }
+}
+
+/**
+ * Selects the given resource, or the default allocation strategy for
+ * nullptr.
+ */
+Scope::Scope(Resource *resource) : previous(set_resource(resource)) {
+}
+
+/**
+ * Restores the previously selected resource.
+ */
+Scope::~Scope() {
+    set_resource(previous);
+}
+
+} // namespace memory
+} // namespace cqasm
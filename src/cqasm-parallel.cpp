@@ -0,0 +1,213 @@
+#include "cqasm-parallel.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace cqasm {
+namespace parallel {
+
+/**
+ * How long a thread waiting for a task group sleeps before it checks the
+ * queues for new tasks again.
+ */
+static const std::chrono::microseconds WAIT_POLL_INTERVAL(100);
+
+/**
+ * The pool that the current thread is a worker of, if any.
+ */
+static thread_local const WorkPool *current_pool = nullptr;
+
+/**
+ * The index of the queue of the current thread within current_pool.
+ */
+static thread_local size_t current_queue = 0;
+
+/**
+ * Creates a pool for the given number of threads, including the thread that
+ * waits for the tasks, so num_threads - 1 worker threads are started. If
+ * num_threads is zero, the number of hardware threads is used.
+ */
+WorkPool::WorkPool(size_t num_threads) : queued(0), stopping(false) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(&WorkPool::work, this, i);
+    }
+}
+
+/**
+ * Stops the worker threads. All task groups must have been waited for.
+ */
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * Returns the number of threads that the pool was created for.
+ */
+size_t WorkPool::get_num_threads() const {
+    return queues.size();
+}
+
+/**
+ * Returns the index of the queue of the calling thread.
+ */
+size_t WorkPool::get_queue() const {
+    return current_pool == this ? current_queue : 0;
+}
+
+/**
+ * Queues a task on the queue of the calling thread.
+ */
+void WorkPool::push(Task &&task) {
+    auto &queue = *queues[get_queue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    queued++;
+
+    // Taking the mutex ensures that an idle worker is either still before
+    // its check of queued, or already waiting for the notification.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    wakeup.notify_one();
+}
+
+/**
+ * Takes a task from the queue of the calling thread or steals one from
+ * another queue, and runs it. Returns false if there was no task.
+ */
+bool WorkPool::run_one() {
+    if (!queued.load()) {
+        return false;
+    }
+    size_t own = get_queue();
+    Task task;
+    bool found = false;
+    for (size_t i = 0; i < queues.size() && !found; i++) {
+        auto &queue = *queues[(own + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+    if (!found) {
+        return false;
+    }
+    queued--;
+    std::exception_ptr task_error;
+    try {
+        task.function();
+    } catch (...) {
+        task_error = std::current_exception();
+    }
+    task.group->finish(task_error);
+    return true;
+}
+
+/**
+ * Main loop of the worker thread with the given queue index.
+ */
+void WorkPool::work(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        if (run_one()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+/**
+ * Creates an empty group of tasks to be run by the given pool.
+ */
+TaskGroup::TaskGroup(WorkPool &pool) : pool(pool), pending(0) {}
+
+/**
+ * Waits for the remaining tasks, ignoring any exceptions they throw.
+ */
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+/**
+ * Adds a task to the group, to be run by any thread of the pool.
+ */
+void TaskGroup::run(std::function<void()> task) {
+    pending++;
+    pool.push(WorkPool::Task{std::move(task), this});
+}
+
+/**
+ * Called by the pool when one of the tasks of this group finishes, with the
+ * exception that it threw, if any. The mutex is held while the pending
+ * count is decremented, such that wait() can't return and the group can't
+ * be destroyed before this function is done with it.
+ */
+void TaskGroup::finish(std::exception_ptr task_error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (task_error && !error) {
+        error = task_error;
+    }
+    if (--pending == 0) {
+        done.notify_all();
+    }
+}
+
+/**
+ * Waits for all tasks of the group to finish, running queued tasks of the
+ * pool on the calling thread in the meantime. If any of the tasks threw an
+ * exception, the first one is rethrown.
+ */
+void TaskGroup::wait() {
+    while (pending.load() > 0) {
+        if (pool.run_one()) {
+            continue;
+        }
+
+        // The remaining tasks are running on other threads, but they may
+        // still queue new tasks that this thread can help with, so don't
+        // sleep for long.
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait_for(lock, WAIT_POLL_INTERVAL, [this] { return pending.load() == 0; });
+    }
+    std::exception_ptr task_error;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(task_error, error);
+    }
+    if (task_error) {
+        std::rethrow_exception(task_error);
+    }
+}
+
+} // namespace parallel
+} // namespace cqasm
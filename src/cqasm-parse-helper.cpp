@@ -1,29 +1,45 @@
 #include "cqasm-parse-helper.hpp"
 #include "cqasm-parser.hpp"
 #include "cqasm-lexer.hpp"
+#include "cqasm-trace.hpp"
 
 namespace cqasm {
 namespace parser {
 
 /**
- * Parse the given file.
+ * Parse the given file. If a memory resource is given, the AST is allocated
+ * from it; otherwise the resource selected for the calling thread is used.
  */
-ParseResult parse_file(const std::string &filename) {
+ParseResult parse_file(const std::string &filename, memory::Resource *resource) {
+    memory::Scope scope(resource ? resource : memory::get_resource());
     return std::move(ParseHelper(filename, "", true).result);
 }
 
 /**
- * Parse using the given file pointer.
+ * Parse using the given file pointer. If a memory resource is given, the AST
+ * is allocated from it; otherwise the resource selected for the calling
+ * thread is used.
  */
-ParseResult parse_file(FILE *file, const std::string &filename) {
+ParseResult parse_file(
+    FILE *file,
+    const std::string &filename,
+    memory::Resource *resource
+) {
+    memory::Scope scope(resource ? resource : memory::get_resource());
     return std::move(ParseHelper(filename, file).result);
 }
 
 /**
  * Parse the given string. A filename may be given in addition for use within
- * error messages.
+ * error messages. If a memory resource is given, the AST is allocated from
+ * it; otherwise the resource selected for the calling thread is used.
  */
-ParseResult parse_string(const std::string &data, const std::string &filename) {
+ParseResult parse_string(
+    const std::string &data,
+    const std::string &filename,
+    memory::Resource *resource
+) {
+    memory::Scope scope(resource ? resource : memory::get_resource());
     return std::move(ParseHelper(filename, data, false).result);
 }
 
@@ -44,6 +60,9 @@ ParseHelper::ParseHelper(
 
     // Open the file or pass the data buffer to flex.
     if (use_file) {
+        // flex reads the file while parsing, so this only covers opening
+        // it; reading is part of the parse span.
+        trace::Span span("fopen", "parser", filename);
         fptr = fopen(filename.c_str(), "r");
         if (!fptr) {
             std::ostringstream sb;
@@ -101,6 +120,7 @@ bool ParseHelper::construct() {
  * Does the actual parsing.
  */
 void ParseHelper::parse() {
+    trace::Span span("parse", "parser", filename);
     int retcode = yyparse((yyscan_t) scanner, *this);
     if (retcode == 2) {
         std::ostringstream sb;
@@ -185,6 +205,18 @@ void SourceLocation::expand_to_include(uint32_t line, uint32_t column) {
 }
 
 } // namespace parser
+
+namespace primitives {
+
+/**
+ * Adds the heap memory owned by the given source location to the given
+ * memory usage report, attributed to the given type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const parser::SourceLocation &location) {
+    add_memory_usage(usage, type, location.filename);
+}
+
+} // namespace primitives
 } // namespace cqasm
 
 /**
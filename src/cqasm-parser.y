@@ -197,11 +197,11 @@ StringBuilder   : StringBuilder STRBUILD_APPEND
                 ;
 
 /* String literal. */
-StringLiteral   : STRING_OPEN StringBuilder STRING_CLOSE                        { NEW($$, StringLiteral); $$->value = $2->stream.str(); delete $2; }
+StringLiteral   : STRING_OPEN StringBuilder STRING_CLOSE                        { NEW($$, StringLiteral); $$->value = $2->stream.str(); cqasm::tree::delete_raw($2); }
                 ;
 
 /* JSON literal. */
-JsonLiteral     : JSON_OPEN StringBuilder JSON_CLOSE                            { NEW($$, JsonLiteral); $$->value = $2->stream.str(); delete $2; }
+JsonLiteral     : JSON_OPEN StringBuilder JSON_CLOSE                            { NEW($$, JsonLiteral); $$->value = $2->stream.str(); cqasm::tree::delete_raw($2); }
                 ;
 
 /* Identifiers. */
@@ -292,7 +292,7 @@ SLParInstrList  : SLParInstrList '|' AnnotInstr
                 ;
 
 /* Multi-line bundling syntax. */
-CBParInstrList  : CBParInstrList Newline SLParInstrList                         { FROM($$, $1); $$->items.extend($3->items); delete $3; }
+CBParInstrList  : CBParInstrList Newline SLParInstrList                         { FROM($$, $1); $$->items.extend($3->items); cqasm::tree::delete_raw($3); }
                 | SLParInstrList                                                { FROM($$, $1); }
                 ;
 
@@ -325,8 +325,8 @@ StatementList   : StatementList Newline AnnotStatement
                 ;
 
 /* Version. */
-Version         : Version '.' IntegerLiteral                                    { FROM($$, $1); $$->items.push_back($3->value); delete $3; }
-                | IntegerLiteral                                                { NEW($$, Version); $$->items.push_back($1->value); delete $1; }
+Version         : Version '.' IntegerLiteral                                    { FROM($$, $1); $$->items.push_back($3->value); cqasm::tree::delete_raw($3); }
+                | IntegerLiteral                                                { NEW($$, Version); $$->items.push_back($1->value); cqasm::tree::delete_raw($1); }
                 ;
 
 /* Program. */
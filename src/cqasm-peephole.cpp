@@ -0,0 +1,537 @@
+#include "cqasm-peephole.hpp"
+#include "cqasm-parse-helper.hpp"
+#include "cqasm-utils.hpp"
+#include "cqasm-trace.hpp"
+#include <algorithm>
+
+namespace cqasm {
+namespace peephole {
+
+/**
+ * Appends the given value to the given pattern key.
+ */
+static void append_to_key(std::string &key, uint32_t value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * Returns a list of qubit reference operands for the given qubit indices.
+ */
+static values::Values qubit_operands(const std::vector<primitives::Int> &qubits) {
+    values::Values operands;
+    for (auto qubit : qubits) {
+        auto refs = tree::make<values::QubitRefs>();
+        refs->index.add(tree::make<values::ConstInt>(qubit));
+        operands.add(refs);
+    }
+    return operands;
+}
+
+/**
+ * Creates an empty rule table using the given analyzer.
+ */
+RuleTable::RuleTable(const analyzer::Analyzer &analyzer) :
+    analyzer(analyzer),
+    max_length(0)
+{}
+
+/**
+ * Adds a rule. Throws an AnalysisError if one of the gates cannot be
+ * resolved for the given number of qubit operands, and
+ * std::invalid_argument if the pattern is empty, if the replacement is
+ * not shorter than the pattern (which would allow rules to rewrite
+ * indefinitely), or if a rule with the same pattern already exists.
+ */
+void RuleTable::add(
+    const std::vector<std::string> &pattern,
+    const std::vector<std::string> &replacement,
+    size_t num_qubits
+) {
+    if (pattern.empty()) {
+        throw std::invalid_argument("peephole rule pattern cannot be empty");
+    }
+    if (replacement.size() >= pattern.size()) {
+        throw std::invalid_argument("peephole rule replacement must be shorter than its pattern");
+    }
+
+    // Check that all gates exist for the given number of qubits.
+    std::vector<primitives::Int> qubits;
+    for (size_t i = 0; i < num_qubits; i++) {
+        qubits.push_back(i);
+    }
+    auto operands = qubit_operands(qubits);
+    for (const auto &name : pattern) {
+        analyzer.resolve_instruction(name, operands);
+    }
+    for (const auto &name : replacement) {
+        analyzer.resolve_instruction(name, operands);
+    }
+
+    // Construct the key for the pattern.
+    std::string key;
+    append_to_key(key, num_qubits);
+    for (const auto &name : pattern) {
+        auto it = name_ids.insert(std::make_pair(utils::lowercase(name), name_ids.size())).first;
+        append_to_key(key, it->second);
+    }
+    if (!patterns.insert(std::make_pair(key, rules.size())).second) {
+        throw std::invalid_argument("duplicate peephole rule pattern");
+    }
+
+    rules.push_back(Rule{pattern, replacement, num_qubits});
+    max_length = std::max(max_length, pattern.size());
+}
+
+/**
+ * Adds a set of default rules, such as cancellation of pairs of
+ * self-inverse gates (x, y, z, h, cnot, cz, swap) and of s/sdag and
+ * t/tdag, and the h-conjugations of x and z. Rules that refer to gates
+ * that the analyzer does not know are silently skipped.
+ */
+void RuleTable::add_default_rules() {
+    const std::vector<Rule> defaults = {
+        {{"i"}, {}, 1},
+        {{"x", "x"}, {}, 1},
+        {{"y", "y"}, {}, 1},
+        {{"z", "z"}, {}, 1},
+        {{"h", "h"}, {}, 1},
+        {{"s", "sdag"}, {}, 1},
+        {{"sdag", "s"}, {}, 1},
+        {{"t", "tdag"}, {}, 1},
+        {{"tdag", "t"}, {}, 1},
+        {{"s", "s"}, {"z"}, 1},
+        {{"sdag", "sdag"}, {"z"}, 1},
+        {{"h", "z", "h"}, {"x"}, 1},
+        {{"h", "x", "h"}, {"z"}, 1},
+        {{"cnot", "cnot"}, {}, 2},
+        {{"cz", "cz"}, {}, 2},
+        {{"swap", "swap"}, {}, 2}
+    };
+    for (const auto &rule : defaults) {
+        try {
+            add(rule.pattern, rule.replacement, rule.num_qubits);
+        } catch (error::AnalysisError &e) {
+            // Gate not known to the analyzer; skip the rule.
+        }
+    }
+}
+
+/**
+ * Returns the analyzer used to resolve gates.
+ */
+const analyzer::Analyzer &RuleTable::get_analyzer() const {
+    return analyzer;
+}
+
+/**
+ * Returns the list of rules.
+ */
+const std::vector<Rule> &RuleTable::get_rules() const {
+    return rules;
+}
+
+/**
+ * Returns the identifier for the given gate name, or -1 if the name is not
+ * used by any rule pattern.
+ */
+int64_t RuleTable::get_name_id(const std::string &name) const {
+    auto it = name_ids.find(utils::lowercase(name));
+    if (it == name_ids.end()) {
+        return -1;
+    }
+    return it->second;
+}
+
+/**
+ * Returns the index of the rule matching the given pattern key, or -1 if
+ * there is no such rule. See the patterns member for the format of the
+ * key.
+ */
+int64_t RuleTable::find(const std::string &key) const {
+    auto it = patterns.find(key);
+    if (it == patterns.end()) {
+        return -1;
+    }
+    return it->second;
+}
+
+/**
+ * Returns the length of the longest pattern.
+ */
+size_t RuleTable::get_max_length() const {
+    return max_length;
+}
+
+/**
+ * State of the peephole optimizer for a single subcircuit.
+ */
+class PeepholeHelper {
+public:
+
+    /**
+     * A gate in the stream. The first gates correspond one-to-one with the
+     * bundles of the subcircuit (although only those for candidate gates are
+     * used); gates added by rewrites are appended after those.
+     */
+    struct Gate {
+
+        /**
+         * The instruction for this gate.
+         */
+        tree::One<semantic::Instruction> insn;
+
+        /**
+         * Index of the bundle after which this gate appears. For original
+         * gates, this is the bundle of the gate itself.
+         */
+        size_t anchor;
+
+        /**
+         * The rule table identifier for the name of this gate.
+         */
+        uint32_t name_id;
+
+        /**
+         * Whether this gate has been removed by a rewrite.
+         */
+        bool removed;
+
+    };
+
+    /**
+     * The most recent consecutive gates on a particular ordered tuple of
+     * qubits.
+     */
+    struct Window {
+
+        /**
+         * The qubits of the gates in this window.
+         */
+        std::vector<primitives::Int> qubits;
+
+        /**
+         * Indices of the gates in the window, in program order.
+         */
+        std::vector<size_t> stack;
+
+        /**
+         * Whether the window is still open.
+         */
+        bool live;
+
+    };
+
+    /**
+     * The subcircuit being optimized.
+     */
+    semantic::Subcircuit &subcircuit;
+
+    /**
+     * The rules to apply.
+     */
+    const RuleTable &rules;
+
+    /**
+     * All gates in the stream.
+     */
+    std::vector<Gate> gates;
+
+    /**
+     * All windows created so far.
+     */
+    std::vector<Window> windows;
+
+    /**
+     * Indices of windows that may still be open, used to close all windows
+     * at once.
+     */
+    std::vector<size_t> live_windows;
+
+    /**
+     * For each qubit, the index of the open window that includes it, or -1.
+     */
+    std::vector<int64_t> owner;
+
+    /**
+     * Net number of instructions removed.
+     */
+    size_t num_removed;
+
+    /**
+     * Creates the helper for the given subcircuit.
+     */
+    PeepholeHelper(semantic::Subcircuit &subcircuit, const RuleTable &rules) :
+        subcircuit(subcircuit),
+        rules(rules),
+        gates(subcircuit.bundles.size()),
+        num_removed(0)
+    {}
+
+    /**
+     * Returns the owner entry for the given qubit, growing the owner vector
+     * if needed.
+     */
+    int64_t &owner_of(primitives::Int qubit) {
+        if ((size_t)qubit >= owner.size()) {
+            owner.resize(qubit + 1, -1);
+        }
+        return owner[qubit];
+    }
+
+    /**
+     * Closes the given window.
+     */
+    void close(size_t window_index) {
+        auto &window = windows[window_index];
+        if (!window.live) {
+            return;
+        }
+        for (auto qubit : window.qubits) {
+            owner_of(qubit) = -1;
+        }
+        window.live = false;
+        window.stack.clear();
+        window.stack.shrink_to_fit();
+    }
+
+    /**
+     * Closes the window that includes the given qubit, if any.
+     */
+    void close_qubit(primitives::Int qubit) {
+        if (qubit < 0) {
+            return;
+        }
+        auto window_index = owner_of(qubit);
+        if (window_index >= 0) {
+            close(window_index);
+        }
+    }
+
+    /**
+     * Closes all windows.
+     */
+    void close_all() {
+        for (auto window_index : live_windows) {
+            close(window_index);
+        }
+        live_windows.clear();
+    }
+
+    /**
+     * Returns the index of the open window for exactly the given qubits,
+     * closing any other windows that include them and opening a new window
+     * if necessary.
+     */
+    size_t window_for(const std::vector<primitives::Int> &qubits) {
+        auto window_index = owner_of(qubits[0]);
+        if (window_index >= 0 && windows[window_index].qubits == qubits) {
+            return window_index;
+        }
+        for (auto qubit : qubits) {
+            close_qubit(qubit);
+        }
+        window_index = windows.size();
+        windows.push_back(Window{qubits, {}, true});
+        live_windows.push_back(window_index);
+        for (auto qubit : qubits) {
+            owner_of(qubit) = window_index;
+        }
+        return window_index;
+    }
+
+    /**
+     * Returns whether the given instruction participates in matching. If so,
+     * the qubits and name identifier are returned as well.
+     */
+    bool is_candidate(
+        const semantic::Instruction &insn,
+        std::vector<primitives::Int> &qubits,
+        uint32_t &name_id
+    ) const {
+        auto condition = insn.condition->as_const_bool();
+        if (!condition || !condition->value || insn.operands.empty()) {
+            return false;
+        }
+        auto id = rules.get_name_id(insn.name);
+        if (id < 0) {
+            return false;
+        }
+        qubits.clear();
+        for (const auto &operand : insn.operands) {
+            auto refs = operand->as_qubit_refs();
+            if (!refs || refs->index.size() != 1 || refs->index[0]->value < 0) {
+                return false;
+            }
+            qubits.push_back(refs->index[0]->value);
+        }
+        name_id = id;
+        return true;
+    }
+
+    /**
+     * Pushes the given gate onto the given window and applies any rules that
+     * match as a result, including those that match due to replacement
+     * gates.
+     */
+    void push(size_t window_index, size_t gate_index) {
+        std::vector<size_t> pending = {gate_index};
+        std::string key;
+        while (!pending.empty()) {
+            auto &window = windows[window_index];
+            window.stack.push_back(pending.back());
+            pending.pop_back();
+
+            // Look for the longest rule matching the tail of the window.
+            auto max_length = std::min(rules.get_max_length(), window.stack.size());
+            int64_t rule_index = -1;
+            size_t length;
+            for (length = max_length; length > 0; length--) {
+                key.clear();
+                append_to_key(key, window.qubits.size());
+                for (size_t i = window.stack.size() - length; i < window.stack.size(); i++) {
+                    append_to_key(key, gates[window.stack[i]].name_id);
+                }
+                rule_index = rules.find(key);
+                if (rule_index >= 0) {
+                    break;
+                }
+            }
+            if (rule_index < 0) {
+                continue;
+            }
+            const auto &rule = rules.get_rules()[rule_index];
+
+            // Remove the matched gates.
+            auto last = window.stack.back();
+            auto anchor = gates[last].anchor;
+            auto last_insn = gates[last].insn;
+            for (size_t i = 0; i < length; i++) {
+                gates[window.stack.back()].removed = true;
+                window.stack.pop_back();
+            }
+            num_removed += length;
+
+            // Queue the replacement gates, such that they're pushed in
+            // program order.
+            for (auto it = rule.replacement.rbegin(); it != rule.replacement.rend(); it++) {
+                auto insn = rules.get_analyzer().resolve_instruction(*it, qubit_operands(window.qubits));
+                insn->copy_annotation<parser::SourceLocation>(*last_insn);
+                auto name_id = rules.get_name_id(*it);
+                if (name_id < 0) {
+                    // Replacement gates that don't appear in any pattern
+                    // can't match anything, so give them an identifier that
+                    // doesn't appear in any key.
+                    name_id = UINT32_MAX;
+                }
+                pending.push_back(gates.size());
+                gates.push_back(Gate{insn, anchor, (uint32_t)name_id, false});
+            }
+            num_removed -= rule.replacement.size();
+
+        }
+    }
+
+    /**
+     * Runs the optimizer on the subcircuit.
+     */
+    void run() {
+        std::vector<primitives::Int> qubits;
+        for (size_t bundle_index = 0; bundle_index < subcircuit.bundles.size(); bundle_index++) {
+            const auto &bundle = *subcircuit.bundles[bundle_index];
+
+            // Handle candidate gates.
+            uint32_t name_id;
+            if (bundle.items.size() == 1 && is_candidate(*bundle.items[0], qubits, name_id)) {
+                gates[bundle_index] = Gate{bundle.items[0], bundle_index, name_id, false};
+                push(window_for(qubits), bundle_index);
+                continue;
+            }
+
+            // Anything else closes the windows of the qubits it uses, or all
+            // windows if it doesn't use any qubits.
+            for (const auto &insn : bundle.items) {
+                bool uses_qubits = false;
+                for (const auto &operand : insn->operands) {
+                    if (auto refs = operand->as_qubit_refs()) {
+                        for (const auto &index : refs->index) {
+                            close_qubit(index->value);
+                            uses_qubits = true;
+                        }
+                    }
+                }
+                if (!uses_qubits) {
+                    close_all();
+                }
+            }
+
+        }
+
+        // Rebuild the bundle list if anything changed.
+        if (gates.size() == subcircuit.bundles.size() && !num_removed) {
+            return;
+        }
+        std::vector<size_t> added;
+        for (size_t gate_index = subcircuit.bundles.size(); gate_index < gates.size(); gate_index++) {
+            if (!gates[gate_index].removed) {
+                added.push_back(gate_index);
+            }
+        }
+        std::stable_sort(added.begin(), added.end(), [this](size_t a, size_t b) {
+            return gates[a].anchor < gates[b].anchor;
+        });
+        auto added_it = added.begin();
+        tree::Any<semantic::Bundle> bundles;
+        for (size_t bundle_index = 0; bundle_index < subcircuit.bundles.size(); bundle_index++) {
+            if (!gates[bundle_index].removed) {
+                bundles.add(subcircuit.bundles[bundle_index]);
+            }
+            for (; added_it != added.end() && gates[*added_it].anchor == bundle_index; added_it++) {
+                auto bundle = tree::make<semantic::Bundle>();
+                bundle->items.add(gates[*added_it].insn);
+                bundle->copy_annotation<parser::SourceLocation>(*gates[*added_it].insn);
+                bundles.add(bundle);
+            }
+        }
+        subcircuit.bundles = std::move(bundles);
+
+    }
+
+};
+
+/**
+ * Applies the rules in the given table to the given program in a single
+ * pass. Returns the net number of instructions removed.
+ *
+ * The program is treated as a stream of gates per subcircuit. Only gates that
+ * are alone in their bundle, are unconditional, and have only single-qubit
+ * references as operands participate in matching. For each ordered tuple of
+ * qubits, a window of the most recent consecutive gates on exactly those
+ * qubits is kept; a gate on any of those qubits in a different configuration
+ * or with a different kind of operand closes the window, as does any
+ * instruction that does not use qubits and the end of a subcircuit. When the
+ * tail of a window matches a rule, the matched gates are replaced, and the
+ * replacement gates are pushed onto the window like new gates, such that
+ * rewrites can cascade. Since every rewrite removes at least one gate, the
+ * total running time is linear in the number of instructions.
+ *
+ * Replacement gates take the place of the last gate of the match and have
+ * its source location. Annotations of matched gates are dropped.
+ *
+ * Note that a window is closed as soon as a conflicting gate is seen, even
+ * if that gate is cancelled later on. For example, in x a; cnot a, b;
+ * cnot a, b; x a, only the cnot gates are removed. Running the optimizer
+ * again catches such cases.
+ */
+size_t optimize(semantic::Program &program, const RuleTable &rules) {
+    trace::Span span("peephole", "pass");
+    size_t num_removed = 0;
+    for (auto &subcircuit : program.subcircuits) {
+        PeepholeHelper helper(*subcircuit, rules);
+        helper.run();
+        num_removed += helper.num_removed;
+    }
+    return num_removed;
+}
+
+} // namespace peephole
+} // namespace cqasm
@@ -1,4 +1,8 @@
 #include "cqasm-primitives.hpp"
+#include "cqasm-tree.hpp"
+#include <algorithm>
+#include <ostream>
+#include <functional>
 
 namespace cqasm {
 namespace primitives {
@@ -18,6 +22,525 @@ Int initialize<Int>() { return 0; }
 template <>
 Real initialize<Real>() { return 0.0; }
 
+/**
+ * Creates an empty matrix.
+ */
+SparseCMatrix::SparseCMatrix() : SparseCMatrix(1, 0, {0, 0}, {}, {}) {}
+
+/**
+ * Creates a matrix from its CSR representation. row_offsets must have
+ * nrows + 1 nondecreasing entries starting at zero and ending at the
+ * number of elements, and the zero-based column indices must be in
+ * range and strictly increasing within each row. Explicitly stored
+ * zeros are dropped. Throws std::invalid_argument if the representation
+ * is invalid.
+ */
+SparseCMatrix::SparseCMatrix(
+    size_t nrows,
+    size_t ncols,
+    const std::vector<size_t> &row_offsets,
+    const std::vector<size_t> &col_indices,
+    const std::vector<Complex> &values
+) {
+    if (row_offsets.size() != nrows + 1 || row_offsets.front() != 0 || row_offsets.back() != col_indices.size()) {
+        throw std::invalid_argument("invalid sparse matrix row offsets");
+    }
+    if (values.size() != col_indices.size()) {
+        throw std::invalid_argument("sparse matrix column index and value count differ");
+    }
+    auto result = std::make_shared<Data>();
+    result->nrows = nrows;
+    result->ncols = ncols;
+    result->row_offsets.reserve(nrows + 1);
+    result->row_offsets.push_back(0);
+    result->col_indices.reserve(col_indices.size());
+    result->values.reserve(values.size());
+    for (size_t row = 0; row < nrows; row++) {
+        if (row_offsets[row + 1] < row_offsets[row]) {
+            throw std::invalid_argument("invalid sparse matrix row offsets");
+        }
+        for (size_t i = row_offsets[row]; i < row_offsets[row + 1]; i++) {
+            if (col_indices[i] >= ncols || (i > row_offsets[row] && col_indices[i] <= col_indices[i - 1])) {
+                throw std::invalid_argument("invalid sparse matrix column indices");
+            }
+            if (values[i] != 0.0) {
+                result->col_indices.push_back(col_indices[i]);
+                result->values.push_back(values[i]);
+            }
+        }
+        result->row_offsets.push_back(result->values.size());
+    }
+    data = std::move(result);
+}
+
+/**
+ * Converts from a dense matrix.
+ */
+SparseCMatrix SparseCMatrix::from_dense(const CMatrix &matrix) {
+    std::vector<size_t> row_offsets{0};
+    std::vector<size_t> col_indices;
+    std::vector<Complex> values;
+    for (size_t row = 1; row <= matrix.size_rows(); row++) {
+        for (size_t col = 1; col <= matrix.size_cols(); col++) {
+            auto value = matrix.at(row, col);
+            if (value != 0.0) {
+                col_indices.push_back(col - 1);
+                values.push_back(value);
+            }
+        }
+        row_offsets.push_back(values.size());
+    }
+    return SparseCMatrix(matrix.size_rows(), matrix.size_cols(), row_offsets, col_indices, values);
+}
+
+/**
+ * Returns the permutation matrix that maps basis state i to basis state
+ * permutation[i]. Throws std::invalid_argument if the given vector is
+ * not a permutation.
+ */
+SparseCMatrix SparseCMatrix::permutation(const std::vector<size_t> &permutation) {
+    const size_t size = permutation.size();
+    std::vector<size_t> col_indices(size, size);
+    for (size_t col = 0; col < size; col++) {
+        auto row = permutation[col];
+        if (row >= size || col_indices[row] != size) {
+            throw std::invalid_argument("not a permutation");
+        }
+        col_indices[row] = col;
+    }
+    std::vector<size_t> row_offsets(size + 1);
+    for (size_t row = 0; row <= size; row++) {
+        row_offsets[row] = row;
+    }
+    return SparseCMatrix(size, size, row_offsets, col_indices, std::vector<Complex>(size, 1.0));
+}
+
+/**
+ * Returns the number of rows.
+ */
+size_t SparseCMatrix::size_rows() const {
+    return data->nrows;
+}
+
+/**
+ * Returns the number of columns.
+ */
+size_t SparseCMatrix::size_cols() const {
+    return data->ncols;
+}
+
+/**
+ * Returns the number of stored (nonzero) elements.
+ */
+size_t SparseCMatrix::size_nonzero() const {
+    return data->values.size();
+}
+
+/**
+ * Returns the row offsets of the CSR representation.
+ */
+const std::vector<size_t> &SparseCMatrix::get_row_offsets() const {
+    return data->row_offsets;
+}
+
+/**
+ * Returns the column indices of the CSR representation.
+ */
+const std::vector<size_t> &SparseCMatrix::get_col_indices() const {
+    return data->col_indices;
+}
+
+/**
+ * Returns the stored values of the CSR representation.
+ */
+const std::vector<Complex> &SparseCMatrix::get_values() const {
+    return data->values;
+}
+
+/**
+ * Returns the value at the given position. row and col start at 1, like
+ * for Matrix. Throws a std::range_error when either or both indices are
+ * out of range.
+ */
+Complex SparseCMatrix::at(size_t row, size_t col) const {
+    if (row < 1 || row > data->nrows || col < 1 || col > data->ncols) {
+        throw std::range_error("matrix index out of range");
+    }
+    auto begin = data->col_indices.begin() + data->row_offsets[row - 1];
+    auto end = data->col_indices.begin() + data->row_offsets[row];
+    auto it = std::lower_bound(begin, end, col - 1);
+    if (it == end || *it != col - 1) {
+        return 0.0;
+    }
+    return data->values[it - data->col_indices.begin()];
+}
+
+/**
+ * Converts to a dense matrix.
+ */
+CMatrix SparseCMatrix::to_dense() const {
+    CMatrix result(data->nrows, data->ncols);
+    for (size_t row = 0; row < data->nrows; row++) {
+        for (size_t i = data->row_offsets[row]; i < data->row_offsets[row + 1]; i++) {
+            result.at(row + 1, data->col_indices[i] + 1) = data->values[i];
+        }
+    }
+    return result;
+}
+
+/**
+ * Equality operator for sparse matrices.
+ */
+bool SparseCMatrix::operator==(const SparseCMatrix &rhs) const {
+    if (data == rhs.data) {
+        return true;
+    }
+    return data->nrows == rhs.data->nrows
+        && data->ncols == rhs.data->ncols
+        && data->row_offsets == rhs.data->row_offsets
+        && data->col_indices == rhs.data->col_indices
+        && data->values == rhs.data->values;
+}
+
+/**
+ * Inequality operator for sparse matrices.
+ */
+bool SparseCMatrix::operator!=(const SparseCMatrix &rhs) const {
+    return !(*this == rhs);
+}
+
+/**
+ * Returns whether this matrix equals the given dense matrix, without
+ * converting either of them.
+ */
+bool SparseCMatrix::operator==(const CMatrix &rhs) const {
+    if (data->nrows != rhs.size_rows() || data->ncols != rhs.size_cols()) {
+        return false;
+    }
+    for (size_t row = 0; row < data->nrows; row++) {
+        size_t i = data->row_offsets[row];
+        for (size_t col = 0; col < data->ncols; col++) {
+            Complex value = 0.0;
+            if (i < data->row_offsets[row + 1] && data->col_indices[i] == col) {
+                value = data->values[i++];
+            }
+            if (rhs.at(row + 1, col + 1) != value) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns whether this matrix differs from the given dense matrix,
+ * without converting either of them.
+ */
+bool SparseCMatrix::operator!=(const CMatrix &rhs) const {
+    return !(*this == rhs);
+}
+
+/**
+ * Creates a controlled matrix without controls for the 1x1 identity.
+ */
+ControlledCMatrix::ControlledCMatrix() : ControlledCMatrix(0, CMatrix(std::vector<Complex>{1.0}, 1)) {}
+
+/**
+ * Creates a controlled matrix from the number of control qubits and the
+ * target matrix. Throws std::invalid_argument if the target matrix is not
+ * square, or if the result would be too large to address.
+ */
+ControlledCMatrix::ControlledCMatrix(size_t num_controls, const CMatrix &target) :
+    num_controls(num_controls),
+    target(std::make_shared<const CMatrix>(target))
+{
+    if (target.size_rows() != target.size_cols()) {
+        throw std::invalid_argument("target matrix of controlled matrix is not square");
+    }
+    if (num_controls >= sizeof(size_t) * 8 || (target.size_rows() << num_controls) >> num_controls != target.size_rows()) {
+        throw std::invalid_argument("controlled matrix is too large");
+    }
+}
+
+/**
+ * Returns the number of control qubits.
+ */
+size_t ControlledCMatrix::get_num_controls() const {
+    return num_controls;
+}
+
+/**
+ * Returns the target matrix.
+ */
+const CMatrix &ControlledCMatrix::get_target() const {
+    return *target;
+}
+
+/**
+ * Returns the number of rows.
+ */
+size_t ControlledCMatrix::size_rows() const {
+    return target->size_rows() << num_controls;
+}
+
+/**
+ * Returns the number of columns.
+ */
+size_t ControlledCMatrix::size_cols() const {
+    return target->size_cols() << num_controls;
+}
+
+/**
+ * Returns the value at the given position. row and col start at 1, like
+ * for Matrix. Throws a std::range_error when either or both indices are
+ * out of range.
+ */
+Complex ControlledCMatrix::at(size_t row, size_t col) const {
+    const size_t size = size_rows();
+    if (row < 1 || row > size || col < 1 || col > size) {
+        throw std::range_error("matrix index out of range");
+    }
+    const size_t offset = size - target->size_rows();
+    if (row > offset && col > offset) {
+        return target->at(row - offset, col - offset);
+    }
+    return row == col ? 1.0 : 0.0;
+}
+
+/**
+ * Converts to a sparse matrix.
+ */
+SparseCMatrix ControlledCMatrix::to_sparse() const {
+    const size_t size = size_rows();
+    const size_t offset = size - target->size_rows();
+    std::vector<size_t> row_offsets{0};
+    std::vector<size_t> col_indices;
+    std::vector<Complex> values;
+    for (size_t row = 0; row < offset; row++) {
+        col_indices.push_back(row);
+        values.push_back(1.0);
+        row_offsets.push_back(values.size());
+    }
+    for (size_t row = 1; row <= target->size_rows(); row++) {
+        for (size_t col = 1; col <= target->size_cols(); col++) {
+            col_indices.push_back(offset + col - 1);
+            values.push_back(target->at(row, col));
+        }
+        row_offsets.push_back(values.size());
+    }
+    return SparseCMatrix(size, size, row_offsets, col_indices, values);
+}
+
+/**
+ * Converts to a dense matrix.
+ */
+CMatrix ControlledCMatrix::to_dense() const {
+    const size_t size = size_rows();
+    const size_t offset = size - target->size_rows();
+    CMatrix result(size, size);
+    for (size_t i = 1; i <= offset; i++) {
+        result.at(i, i) = 1.0;
+    }
+    for (size_t row = 1; row <= target->size_rows(); row++) {
+        for (size_t col = 1; col <= target->size_cols(); col++) {
+            result.at(offset + row, offset + col) = target->at(row, col);
+        }
+    }
+    return result;
+}
+
+/**
+ * Equality operator for controlled matrices.
+ */
+bool ControlledCMatrix::operator==(const ControlledCMatrix &rhs) const {
+    return num_controls == rhs.num_controls && (target == rhs.target || *target == *rhs.target);
+}
+
+/**
+ * Inequality operator for controlled matrices.
+ */
+bool ControlledCMatrix::operator!=(const ControlledCMatrix &rhs) const {
+    return !(*this == rhs);
+}
+
+/**
+ * Returns whether this matrix equals the given dense matrix, without
+ * converting either of them.
+ */
+bool ControlledCMatrix::operator==(const CMatrix &rhs) const {
+    const size_t size = size_rows();
+    if (rhs.size_rows() != size || rhs.size_cols() != size) {
+        return false;
+    }
+    for (size_t row = 1; row <= size; row++) {
+        for (size_t col = 1; col <= size; col++) {
+            if (rhs.at(row, col) != at(row, col)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns whether this matrix differs from the given dense matrix,
+ * without converting either of them.
+ */
+bool ControlledCMatrix::operator!=(const CMatrix &rhs) const {
+    return !(*this == rhs);
+}
+
+/**
+ * Returns the heap memory used by the given string, assuming the small
+ * string optimization is used for strings of up to 15 characters.
+ */
+static size_t string_size(const std::string &str) {
+    return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+/**
+ * Adds the heap memory owned by the given string to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const Str &str) {
+    usage.add_bytes(type, string_size(str));
+}
+
+/**
+ * Adds the heap memory owned by the given matrix to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const RMatrix &matrix) {
+    usage.add_bytes(type, matrix.size_rows() * matrix.size_cols() * sizeof(Real));
+}
+
+/**
+ * Adds the heap memory owned by the given matrix to the given memory usage
+ * report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const CMatrix &matrix) {
+    usage.add_bytes(type, matrix.size_rows() * matrix.size_cols() * sizeof(Complex));
+}
+
+/**
+ * Adds the heap memory used by the given matrix to the given memory usage
+ * report. The shared contents are counted once, as a separate type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const SparseCMatrix &matrix) {
+    (void)type;
+    const auto &data = *matrix.data;
+    if (usage.add_object(&data, "cqasm::primitives::SparseCMatrix", sizeof(data))) {
+        usage.add_bytes(
+            "cqasm::primitives::SparseCMatrix",
+            data.row_offsets.capacity() * sizeof(size_t)
+            + data.col_indices.capacity() * sizeof(size_t)
+            + data.values.capacity() * sizeof(Complex)
+        );
+    }
+}
+
+/**
+ * Adds the heap memory used by the given matrix to the given memory usage
+ * report. The shared target matrix is counted once, as a separate type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const ControlledCMatrix &matrix) {
+    (void)type;
+    const auto &target = *matrix.target;
+    if (usage.add_object(&target, "cqasm::primitives::ControlledCMatrix", sizeof(target))) {
+        add_memory_usage(usage, "cqasm::primitives::ControlledCMatrix", target);
+    }
+}
+
+/**
+ * Adds the heap memory owned by the given version number to the given
+ * memory usage report, attributed to the given node type.
+ */
+void add_memory_usage(tree::MemoryUsage &usage, const char *type, const Version &version) {
+    usage.add_bytes(type, version.capacity() * sizeof(Int));
+}
+
+/**
+ * Returns a hash of the given string.
+ */
+uint64_t hash(const Str &str) {
+    return std::hash<Str>()(str);
+}
+
+/**
+ * Returns a hash of the given boolean.
+ */
+uint64_t hash(Bool value) {
+    return value ? 1 : 0;
+}
+
+/**
+ * Returns a hash of the given axis.
+ */
+uint64_t hash(Axis axis) {
+    return static_cast<uint64_t>(axis);
+}
+
+/**
+ * Returns a hash of the given integer.
+ */
+uint64_t hash(Int value) {
+    return static_cast<uint64_t>(value);
+}
+
+/**
+ * Returns a hash of the given real number. Positive and negative zero hash
+ * the same, since they compare equal.
+ */
+uint64_t hash(Real value) {
+    if (value == 0.0) {
+        return 0;
+    }
+    return std::hash<Real>()(value);
+}
+
+/**
+ * Returns a hash of the given complex number.
+ */
+uint64_t hash(const Complex &value) {
+    return utils::hash_combine(hash(value.real()), hash(value.imag()));
+}
+
+/**
+ * Returns a hash of the given sparse matrix, covering its shape and its
+ * stored elements.
+ */
+uint64_t hash(const SparseCMatrix &matrix) {
+    uint64_t result = utils::hash_combine(matrix.size_rows(), matrix.size_cols());
+    for (auto offset : matrix.get_row_offsets()) {
+        result = utils::hash_combine(result, offset);
+    }
+    for (auto col : matrix.get_col_indices()) {
+        result = utils::hash_combine(result, col);
+    }
+    for (const auto &value : matrix.get_values()) {
+        result = utils::hash_combine(result, hash(value));
+    }
+    return result;
+}
+
+/**
+ * Returns a hash of the given controlled matrix.
+ */
+uint64_t hash(const ControlledCMatrix &matrix) {
+    return utils::hash_combine(matrix.get_num_controls(), hash(matrix.get_target()));
+}
+
+/**
+ * Returns a hash of the given version number.
+ */
+uint64_t hash(const Version &version) {
+    uint64_t result = version.size();
+    for (auto component : version) {
+        result = utils::hash_combine(result, hash(component));
+    }
+    return result;
+}
+
 } // namespace primitives
 } // namespace cqasm
 
@@ -39,6 +562,35 @@ std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::Axis& axis
     return os;
 }
 
+/**
+ * Stream << overload for sparse matrix nodes.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::SparseCMatrix& mat) {
+    os << "sparse(" << mat.size_rows() << "x" << mat.size_cols() << ": ";
+    const auto &row_offsets = mat.get_row_offsets();
+    bool first = true;
+    for (size_t row = 0; row < mat.size_rows(); row++) {
+        for (size_t i = row_offsets[row]; i < row_offsets[row + 1]; i++) {
+            if (first) {
+                first = false;
+            } else {
+                os << ", ";
+            }
+            os << "(" << row + 1 << "," << mat.get_col_indices()[i] + 1 << ")=" << mat.get_values()[i];
+        }
+    }
+    os << ")";
+    return os;
+}
+
+/**
+ * Stream << overload for controlled matrix nodes.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::primitives::ControlledCMatrix& mat) {
+    os << "controlled(" << mat.get_num_controls() << ", " << mat.get_target() << ")";
+    return os;
+}
+
 /**
  * Stream << overload for version nodes.
  */
@@ -0,0 +1,230 @@
+#include "cqasm-registers.hpp"
+#include "cqasm-parse-helper.hpp"
+#include "cqasm-trace.hpp"
+#include <unordered_set>
+
+namespace cqasm {
+namespace registers {
+
+/**
+ * Visitor for semantic trees that passes all values in the tree to the given
+ * value visitor.
+ */
+class ValueWalker : public semantic::RecursiveVisitor {
+public:
+
+    /**
+     * The visitor to pass the values to.
+     */
+    values::Visitor &value_visitor;
+
+    /**
+     * Constructs a walker for the given value visitor.
+     */
+    explicit ValueWalker(values::Visitor &value_visitor) :
+        value_visitor(value_visitor)
+    {}
+
+    /**
+     * Fallback for nodes that don't contain values.
+     */
+    void visit_node(semantic::Node &) override {
+    }
+
+    /**
+     * Visits the condition and operands of an instruction.
+     */
+    void visit_instruction(semantic::Instruction &node) override {
+        semantic::RecursiveVisitor::visit_instruction(node);
+        node.condition.visit(value_visitor);
+        node.operands.visit(value_visitor);
+    }
+
+    /**
+     * Visits the parameters of the error model.
+     */
+    void visit_error_model(semantic::ErrorModel &node) override {
+        semantic::RecursiveVisitor::visit_error_model(node);
+        node.parameters.visit(value_visitor);
+    }
+
+    /**
+     * Visits the value of a mapping.
+     */
+    void visit_mapping(semantic::Mapping &node) override {
+        semantic::RecursiveVisitor::visit_mapping(node);
+        node.value.visit(value_visitor);
+    }
+
+    /**
+     * Visits the operands of an annotation.
+     */
+    void visit_annotation_data(semantic::AnnotationData &node) override {
+        semantic::RecursiveVisitor::visit_annotation_data(node);
+        node.operands.visit(value_visitor);
+    }
+
+};
+
+/**
+ * Value visitor that marks the qubit/bit indices that are used.
+ */
+class UsageCollector : public values::RecursiveVisitor {
+public:
+
+    /**
+     * Whether each index is used.
+     */
+    std::vector<bool> used;
+
+    /**
+     * Constructs a collector for a register of the given size. The register
+     * grows if larger indices are encountered.
+     */
+    explicit UsageCollector(size_t size) : used(size, false) {}
+
+    /**
+     * Fallback for values that don't reference qubits or bits.
+     */
+    void visit_node(values::Node &) override {
+    }
+
+    /**
+     * Marks the given indices as used.
+     */
+    void mark(const tree::Many<values::ConstInt> &indices) {
+        for (const auto &index : indices) {
+            if (index->value < 0) {
+                continue;
+            }
+            if ((size_t)index->value >= used.size()) {
+                used.resize(index->value + 1, false);
+            }
+            used[index->value] = true;
+        }
+    }
+
+    /**
+     * Marks the referenced qubits as used.
+     */
+    void visit_qubit_refs(values::QubitRefs &node) override {
+        mark(node.index);
+    }
+
+    /**
+     * Marks the referenced bits as used.
+     */
+    void visit_bit_refs(values::BitRefs &node) override {
+        mark(node.index);
+    }
+
+};
+
+/**
+ * Value visitor that renumbers qubit/bit references.
+ */
+class RefsRewriter : public values::RecursiveVisitor {
+public:
+
+    /**
+     * The mapping to apply.
+     */
+    const RegisterMap &map;
+
+    /**
+     * The reference nodes that were already rewritten, in case a node is
+     * reachable more than once.
+     */
+    std::unordered_set<const values::Node*> rewritten;
+
+    /**
+     * Constructs a rewriter for the given mapping.
+     */
+    explicit RefsRewriter(const RegisterMap &map) : map(map) {}
+
+    /**
+     * Fallback for values that don't reference qubits or bits.
+     */
+    void visit_node(values::Node &) override {
+    }
+
+    /**
+     * Replaces the given indices with their new values, if the containing
+     * node was not rewritten before.
+     */
+    void rewrite(const values::Node &node, tree::Many<values::ConstInt> &indices) {
+        if (!rewritten.insert(&node).second) {
+            return;
+        }
+        for (auto &index : indices) {
+            if (index->value < 0) {
+                continue;
+            }
+            auto replacement = tree::make<values::ConstInt>(map.old_to_new[index->value]);
+            replacement->copy_annotation<parser::SourceLocation>(*index);
+            index = replacement;
+        }
+    }
+
+    /**
+     * Renumbers the referenced qubits.
+     */
+    void visit_qubit_refs(values::QubitRefs &node) override {
+        rewrite(node, node.index);
+    }
+
+    /**
+     * Renumbers the referenced bits.
+     */
+    void visit_bit_refs(values::BitRefs &node) override {
+        rewrite(node, node.index);
+    }
+
+};
+
+/**
+ * Renumbers the qubits and measurement bits of the given program, such that
+ * only the indices that are actually used remain, in their original order.
+ * All qubit and bit references in the program are rewritten accordingly,
+ * including those in conditions, the error model, mappings, and annotations,
+ * and num_qubits is set to the number of used indices (or one, if no qubits
+ * or bits are used at all, since a program needs at least one qubit). Qubits
+ * and bits share a single mapping, because measurements implicitly write to
+ * the bit with the same index as the measured qubit. Returns the mapping.
+ *
+ * The qubit/bit reference nodes are updated in place, but the index nodes
+ * within them are replaced rather than modified, because the analyzer may
+ * share those between references.
+ *
+ * This takes time linear in the size of the program and the original number
+ * of qubits.
+ */
+RegisterMap compact(semantic::Program &program) {
+    trace::Span span("compact registers", "pass");
+
+    // Find the used indices.
+    UsageCollector collector(std::max<primitives::Int>(program.num_qubits, 0));
+    ValueWalker collect_walker(collector);
+    program.visit(collect_walker);
+
+    // Construct the mapping.
+    RegisterMap map;
+    map.old_to_new.resize(collector.used.size(), -1);
+    for (size_t index = 0; index < collector.used.size(); index++) {
+        if (collector.used[index]) {
+            map.old_to_new[index] = map.new_to_old.size();
+            map.new_to_old.push_back(index);
+        }
+    }
+
+    // Apply it.
+    RefsRewriter rewriter(map);
+    ValueWalker rewrite_walker(rewriter);
+    program.visit(rewrite_walker);
+    program.num_qubits = std::max<primitives::Int>(map.new_to_old.size(), 1);
+
+    return map;
+}
+
+} // namespace registers
+} // namespace cqasm
@@ -39,6 +39,19 @@ Value MappingTable::resolve(const std::string &name) const {
     }
 }
 
+/**
+ * Returns the value of a mapping without copying it. Throws
+ * NameResolutionFailure if no mapping by the given name exists. The value is
+ * shared with the table, so it must not be modified or added to a tree.
+ */
+const Value &MappingTable::get(const std::string &name) const {
+    auto entry = table.find(utils::lowercase(name));
+    if (entry == table.end()) {
+        throw NameResolutionFailure("failed to resolve " + name);
+    }
+    return entry->second.first;
+}
+
 /**
  * Grants read access to the underlying map.
  */
@@ -0,0 +1,289 @@
+#include "cqasm-scheduler.hpp"
+#include "cqasm-parse-helper.hpp"
+#include "cqasm-trace.hpp"
+#include <unordered_map>
+
+namespace cqasm {
+namespace scheduler {
+
+/**
+ * Constructs a resource usage annotation.
+ */
+ResourceUsage::ResourceUsage(const std::vector<std::string> &resources) :
+    resources(resources)
+{}
+
+/**
+ * Creates an empty report.
+ */
+Report::Report() : bundles_before(0), bundles_after(0) {}
+
+/**
+ * State of the scheduler for a single subcircuit.
+ */
+class SchedulerHelper {
+public:
+
+    /**
+     * The subcircuit being scheduled.
+     */
+    semantic::Subcircuit &subcircuit;
+
+    /**
+     * For each qubit/bit index, the first cycle at which it is free.
+     */
+    std::vector<uint64_t> ready;
+
+    /**
+     * Map from named resource to index into occupied.
+     */
+    std::unordered_map<std::string, size_t> resource_ids;
+
+    /**
+     * For each named resource, a disjoint-set forest over the cycles in which
+     * the resource is occupied, mapping each such cycle to a later cycle
+     * that is closer to (or equal to) the first free cycle after it.
+     */
+    std::vector<std::unordered_map<uint64_t, uint64_t>> occupied;
+
+    /**
+     * The first cycle after the most recent barrier.
+     */
+    uint64_t floor;
+
+    /**
+     * One past the last cycle that is in use.
+     */
+    uint64_t end;
+
+    /**
+     * Creates the helper for the given subcircuit.
+     */
+    explicit SchedulerHelper(semantic::Subcircuit &subcircuit) :
+        subcircuit(subcircuit),
+        floor(0),
+        end(0)
+    {}
+
+    /**
+     * Returns the first cycle at or after the given cycle in which the given
+     * named resource is free.
+     */
+    uint64_t find_free(size_t resource, uint64_t cycle) {
+        auto &forest = occupied[resource];
+        auto root = cycle;
+        for (auto it = forest.find(root); it != forest.end(); it = forest.find(root)) {
+            root = it->second;
+        }
+        while (cycle != root) {
+            auto &next = forest[cycle];
+            cycle = next;
+            next = root;
+        }
+        return root;
+    }
+
+    /**
+     * Adds the given qubit/bit index to the given list, growing the ready
+     * vector as needed. Negative indices are ignored.
+     */
+    void add_index(primitives::Int index, std::vector<size_t> &indices) {
+        if (index < 0) {
+            return;
+        }
+        if ((size_t)index >= ready.size()) {
+            ready.resize(index + 1, 0);
+        }
+        indices.push_back(index);
+    }
+
+    /**
+     * Adds the qubit and bit indices referenced by the given value to the
+     * given list.
+     */
+    void add_indices(const values::Node &value, std::vector<size_t> &indices) {
+        if (auto qubit_refs = value.as_qubit_refs()) {
+            for (const auto &index : qubit_refs->index) {
+                add_index(index->value, indices);
+            }
+        } else if (auto bit_refs = value.as_bit_refs()) {
+            for (const auto &index : bit_refs->index) {
+                add_index(index->value, indices);
+            }
+        }
+    }
+
+    /**
+     * Returns the index for the named resource with the given name.
+     */
+    size_t get_resource_id(const std::string &name) {
+        auto it = resource_ids.insert(std::make_pair(name, occupied.size())).first;
+        if (it->second == occupied.size()) {
+            occupied.emplace_back();
+        }
+        return it->second;
+    }
+
+    /**
+     * Schedules the given bundle, returning the cycle it was placed in.
+     */
+    uint64_t schedule_bundle(const semantic::Bundle &bundle) {
+
+        // Figure out which qubits, bits, and named resources the bundle uses,
+        // and whether it's a barrier.
+        std::vector<size_t> indices;
+        std::vector<size_t> resources;
+        bool barrier = false;
+        for (const auto &insn : bundle.items) {
+            for (const auto &operand : insn->operands) {
+                add_indices(*operand, indices);
+            }
+            if (!insn->condition.empty()) {
+                add_indices(*insn->condition, indices);
+            }
+            if (!insn->instruction.empty()) {
+                if (!insn->instruction->allow_parallel) {
+                    barrier = true;
+                }
+                if (auto usage = insn->instruction->get_annotation_ptr<ResourceUsage>()) {
+                    for (const auto &name : usage->resources) {
+                        resources.push_back(get_resource_id(name));
+                    }
+                }
+            }
+        }
+        if (indices.empty()) {
+            barrier = true;
+        }
+
+        // Barriers get a cycle of their own after everything scheduled so
+        // far, and nothing can be scheduled before them.
+        if (barrier) {
+            auto cycle = end;
+            floor = end = cycle + 1;
+            return cycle;
+        }
+
+        // Otherwise, the bundle is scheduled in the first cycle where all
+        // qubits, bits, and resources are free.
+        auto cycle = floor;
+        for (auto index : indices) {
+            cycle = std::max(cycle, ready[index]);
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto resource : resources) {
+                auto free = find_free(resource, cycle);
+                if (free != cycle) {
+                    cycle = free;
+                    changed = true;
+                }
+            }
+        }
+
+        // Mark everything as used.
+        for (auto index : indices) {
+            ready[index] = cycle + 1;
+        }
+        for (auto resource : resources) {
+            occupied[resource][cycle] = cycle + 1;
+        }
+        end = std::max(end, cycle + 1);
+        return cycle;
+
+    }
+
+    /**
+     * Schedules the subcircuit.
+     */
+    void run() {
+
+        // Determine the cycle for each bundle.
+        std::vector<uint64_t> cycles;
+        cycles.reserve(subcircuit.bundles.size());
+        for (const auto &bundle : subcircuit.bundles) {
+            cycles.push_back(schedule_bundle(*bundle));
+        }
+
+        // Bucket the bundles by cycle, preserving program order within each
+        // cycle.
+        std::vector<std::vector<size_t>> buckets(end);
+        for (size_t bundle_index = 0; bundle_index < cycles.size(); bundle_index++) {
+            buckets[cycles[bundle_index]].push_back(bundle_index);
+        }
+
+        // Construct the new bundle list.
+        tree::Any<semantic::Bundle> bundles;
+        for (const auto &bucket : buckets) {
+            if (bucket.empty()) {
+                continue;
+            }
+            if (bucket.size() == 1) {
+                bundles.add(subcircuit.bundles[bucket[0]]);
+                continue;
+            }
+            auto merged = tree::make<semantic::Bundle>();
+            merged->copy_annotation<parser::SourceLocation>(*subcircuit.bundles[bucket[0]]);
+            for (auto bundle_index : bucket) {
+                const auto &bundle = *subcircuit.bundles[bundle_index];
+                for (const auto &insn : bundle.items) {
+                    merged->items.add(insn);
+                }
+                for (const auto &annotation : bundle.annotations) {
+                    merged->annotations.add(annotation);
+                }
+            }
+            bundles.add(merged);
+        }
+        subcircuit.bundles = std::move(bundles);
+
+    }
+
+};
+
+/**
+ * Reschedules the instructions of each subcircuit of the given program as
+ * soon as possible, packing them into as few bundles as the dependencies
+ * between them allow. Returns how many bundles there were before and after.
+ *
+ * The bundles of the original program are the units of scheduling; they are
+ * never split, but can be merged with other bundles. A bundle depends on all
+ * earlier bundles that use one of its qubits or bits, or one of the named
+ * resources of its instructions as specified by ResourceUsage annotations.
+ * Qubit k and measurement bit k are considered to be the same resource,
+ * because measurements write to the bit corresponding to the measured qubit,
+ * and the bits in the condition of conditional instructions count as used.
+ * Bundles containing an instruction that is not allowed to be parallelized,
+ * as well as bundles that don't use any qubits or bits at all (which are
+ * assumed to affect the whole machine), act as barriers: they end up in a
+ * bundle of their own, and nothing is moved across them.
+ *
+ * Bundles placed in the same cycle are merged in program order, keeping the
+ * annotations of all of them and the source location of the first.
+ *
+ * Scheduling takes O(n log n) time in the number of bundles.
+ */
+Report schedule(semantic::Program &program) {
+    trace::Span span("schedule", "pass");
+    Report report;
+    for (auto &subcircuit : program.subcircuits) {
+        report.bundles_before += subcircuit->bundles.size();
+        SchedulerHelper helper(*subcircuit);
+        helper.run();
+        report.bundles_after += subcircuit->bundles.size();
+    }
+    return report;
+}
+
+} // namespace scheduler
+} // namespace cqasm
+
+/**
+ * Stream << overload for scheduler reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::scheduler::Report& report) {
+    os << report.bundles_before << " bundles before scheduling, ";
+    os << report.bundles_after << " after";
+    return os;
+}
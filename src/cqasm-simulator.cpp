@@ -0,0 +1,575 @@
+#include "cqasm-simulator.hpp"
+#include "cqasm-utils.hpp"
+#include "cqasm-trace.hpp"
+#include <cmath>
+#include <cstdint>
+#include <new>
+#include <thread>
+
+namespace cqasm {
+namespace simulator {
+
+/**
+ * Minimum number of work items per thread for the amplitude updates to be
+ * divided over multiple threads. Below this, handing the work to the pool
+ * costs more than it gains.
+ */
+static const size_t MIN_ITEMS_PER_THREAD = 1 << 15;
+
+/**
+ * Number of qubits spanned by a block of amplitudes when applying pending
+ * gates. A block of 2^14 amplitudes takes 256KiB, which fits in the L2 cache
+ * of most processors.
+ */
+static const size_t BLOCK_QUBITS = 14;
+
+/**
+ * Calls fn(begin, end, range) for consecutive ranges of [0, count), each
+ * with at least min_items items, using at most all threads of the given
+ * pool. The first range is handled by the calling thread. If the pool is
+ * null, fn is called once for the whole range.
+ */
+template <class F>
+static void parallel_for(parallel::WorkPool *pool, size_t count, size_t min_items, const F &fn) {
+    size_t num_ranges = 1;
+    if (pool) {
+        num_ranges = std::min(pool->get_num_threads(), std::max<size_t>(1, count / min_items));
+    }
+    if (num_ranges <= 1) {
+        fn(0, count, 0);
+        return;
+    }
+    parallel::TaskGroup group(*pool);
+    for (size_t i = 1; i < num_ranges; i++) {
+        group.run([&fn, count, num_ranges, i]() {
+            fn(count * i / num_ranges, count * (i + 1) / num_ranges, i);
+        });
+    }
+    fn(0, count / num_ranges, 0);
+    group.wait();
+}
+
+/**
+ * Calls fn(index, run) for all pairs of amplitudes (index + j, index + j +
+ * 2^qubit) for j in [0, run) that differ only in the given qubit, for the
+ * pairs numbered [begin, end). The runs are contiguous blocks of at most
+ * 2^qubit pairs, such that fn can be a simple loop.
+ */
+template <class F>
+static void for_each_run(size_t qubit, size_t begin, size_t end, const F &fn) {
+    const size_t stride = (size_t)1 << qubit;
+    size_t pair = begin;
+    while (pair < end) {
+        auto offset = pair & (stride - 1);
+        auto run = std::min(stride - offset, end - pair);
+        fn(((pair - offset) << 1) + offset, run);
+        pair += run;
+    }
+}
+
+/**
+ * Calls fn(index, run, range) for all pairs of amplitudes in a state of the
+ * given size that differ only in the given qubit, as for for_each_run().
+ * The pairs are divided over the threads of the given pool.
+ */
+template <class F>
+static void for_each_pair(parallel::WorkPool *pool, size_t size, size_t qubit, const F &fn) {
+    parallel_for(pool, size / 2, MIN_ITEMS_PER_THREAD, [qubit, &fn](size_t begin, size_t end, size_t range) {
+        for_each_run(qubit, begin, end, [&fn, range](size_t index, size_t run) {
+            fn(index, run, range);
+        });
+    });
+}
+
+/**
+ * Applies the single-qubit gate with the given matrix, split into real and
+ * imaginary parts in row-major order, to the pairs [begin, end) of the
+ * amplitudes at pr and pi.
+ */
+static void apply_single(
+    primitives::Real *pr, primitives::Real *pi,
+    const primitives::Real *mr, const primitives::Real *mi,
+    size_t qubit, size_t begin, size_t end
+) {
+    const size_t stride = (size_t)1 << qubit;
+    const primitives::Real
+        m0r = mr[0], m0i = mi[0],
+        m1r = mr[1], m1i = mi[1],
+        m2r = mr[2], m2i = mi[2],
+        m3r = mr[3], m3i = mi[3];
+    for_each_run(qubit, begin, end, [=](size_t index, size_t run) {
+        primitives::Real *r0 = pr + index;
+        primitives::Real *i0 = pi + index;
+        primitives::Real *r1 = r0 + stride;
+        primitives::Real *i1 = i0 + stride;
+        for (size_t j = 0; j < run; j++) {
+            auto ar = r0[j], ai = i0[j], br = r1[j], bi = i1[j];
+            r0[j] = m0r * ar - m0i * ai + m1r * br - m1i * bi;
+            i0[j] = m0r * ai + m0i * ar + m1r * bi + m1i * br;
+            r1[j] = m2r * ar - m2i * ai + m3r * br - m3i * bi;
+            i1[j] = m2r * ai + m2i * ar + m3r * bi + m3i * br;
+        }
+    });
+}
+
+/**
+ * Applies the two-qubit gate with the given 4x4 matrix, split into real and
+ * imaginary parts in row-major order, to the groups of four amplitudes
+ * [begin, end) at pr and pi, with qubit a as the most significant qubit of
+ * the matrix.
+ */
+static void apply_double(
+    primitives::Real *pr, primitives::Real *pi,
+    const primitives::Real *mr, const primitives::Real *mi,
+    size_t a, size_t b, size_t begin, size_t end
+) {
+
+    // Each group of four amplitudes is identified by the index with the
+    // bits for both qubits cleared, which is formed by inserting zeros into
+    // the group number. Runs of consecutive groups map to consecutive
+    // indices until the lower of the two qubit bits would carry.
+    const size_t lo = std::min(a, b);
+    const size_t hi = std::max(a, b);
+    const size_t lo_stride = (size_t)1 << lo;
+    const size_t offsets[4] = {0, (size_t)1 << b, (size_t)1 << a, ((size_t)1 << a) | ((size_t)1 << b)};
+    size_t group = begin;
+    while (group < end) {
+        auto offset = group & (lo_stride - 1);
+        auto run = std::min(lo_stride - offset, end - group);
+        auto index = group - offset;
+        index = ((index >> lo) << (lo + 1));
+        index = ((index >> hi) << (hi + 1)) | (index & (((size_t)1 << hi) - 1));
+        index += offset;
+        primitives::Real *r[4], *i[4];
+        for (size_t k = 0; k < 4; k++) {
+            r[k] = pr + index + offsets[k];
+            i[k] = pi + index + offsets[k];
+        }
+        for (size_t j = 0; j < run; j++) {
+            primitives::Real vr[4], vi[4];
+            for (size_t k = 0; k < 4; k++) {
+                vr[k] = r[k][j];
+                vi[k] = i[k][j];
+            }
+            for (size_t row = 0; row < 4; row++) {
+                primitives::Real sr = 0.0, si = 0.0;
+                for (size_t col = 0; col < 4; col++) {
+                    sr += mr[row * 4 + col] * vr[col] - mi[row * 4 + col] * vi[col];
+                    si += mr[row * 4 + col] * vi[col] + mi[row * 4 + col] * vr[col];
+                }
+                r[row][j] = sr;
+                i[row][j] = si;
+            }
+        }
+        group += run;
+    }
+}
+
+/**
+ * Creates a simulator for zero qubits, using at most the given number of
+ * threads for the amplitude updates, and seeding the random number
+ * generator used for measurements with the given seed. If num_threads
+ * is zero, the number of hardware threads is used.
+ */
+Simulator::Simulator(size_t num_threads, uint64_t seed) :
+    num_qubits(0),
+    num_threads(num_threads ? num_threads : std::max(1u, std::thread::hardware_concurrency())),
+    rng(seed)
+{
+    if (this->num_threads > 1) {
+        pool.reset(new parallel::WorkPool(this->num_threads));
+    }
+    reset(0);
+}
+
+/**
+ * Resets the simulator to the all-zero state of the given number of
+ * qubits, and clears the bit register. Throws std::invalid_argument if
+ * the state doesn't fit in memory, in which case the simulator is left
+ * with zero qubits.
+ */
+void Simulator::reset(size_t num_qubits) {
+    pending.clear();
+
+    // Release the current state first, so it doesn't count against the new
+    // one.
+    this->num_qubits = 0;
+    std::vector<primitives::Real>().swap(re);
+    std::vector<primitives::Real>().swap(im);
+    bits.clear();
+
+    // Both arrays must be addressable, and their combined byte size must not
+    // overflow.
+    const size_t max_size = std::min(re.max_size(), SIZE_MAX / (2 * sizeof(primitives::Real)));
+    if (num_qubits >= sizeof(size_t) * 8 || ((size_t)1 << num_qubits) > max_size) {
+        reset(0);
+        throw std::invalid_argument(
+            "cannot simulate " + std::to_string(num_qubits) + " qubits: state is too large");
+    }
+    const size_t size = (size_t)1 << num_qubits;
+    try {
+        re.assign(size, 0.0);
+        im.assign(size, 0.0);
+    } catch (std::bad_alloc &) {
+        reset(0);
+        throw std::invalid_argument(
+            "cannot simulate " + std::to_string(num_qubits) + " qubits: out of memory for "
+            + std::to_string(2 * sizeof(primitives::Real) * size) + " bytes of state");
+    }
+    this->num_qubits = num_qubits;
+    re[0] = 1.0;
+    bits.assign(num_qubits, false);
+}
+
+/**
+ * Returns the number of qubits.
+ */
+size_t Simulator::get_num_qubits() const {
+    return num_qubits;
+}
+
+/**
+ * Returns the amplitude of the given basis state.
+ */
+primitives::Complex Simulator::get_amplitude(size_t index) const {
+    return primitives::Complex(re.at(index), im.at(index));
+}
+
+/**
+ * Returns the probability of measuring a one for the given qubit.
+ */
+primitives::Real Simulator::get_probability(size_t qubit) const {
+    if (qubit >= num_qubits) {
+        throw std::invalid_argument("qubit index out of range");
+    }
+    const size_t stride = (size_t)1 << qubit;
+    const primitives::Real *pr = re.data() + stride;
+    const primitives::Real *pi = im.data() + stride;
+    std::vector<primitives::Real> partial(num_threads, 0.0);
+    for_each_pair(pool.get(), re.size(), qubit, [=, &partial](size_t index, size_t run, size_t range) {
+        primitives::Real sum = 0.0;
+        for (size_t j = index; j < index + run; j++) {
+            sum += pr[j] * pr[j] + pi[j] * pi[j];
+        }
+        partial[range] += sum;
+    });
+    primitives::Real probability = 0.0;
+    for (auto sum : partial) {
+        probability += sum;
+    }
+    return probability;
+}
+
+/**
+ * Returns the bit register.
+ */
+const std::vector<bool> &Simulator::get_bits() const {
+    return bits;
+}
+
+/**
+ * Applies a single-qubit gate.
+ */
+void Simulator::apply(const unitary::Matrix2 &matrix, size_t qubit) {
+    if (qubit >= num_qubits) {
+        throw std::invalid_argument("qubit index out of range");
+    }
+    primitives::Real mr[4], mi[4];
+    for (size_t k = 0; k < 4; k++) {
+        mr[k] = matrix.m[k].real();
+        mi[k] = matrix.m[k].imag();
+    }
+    primitives::Real *pr = re.data();
+    primitives::Real *pi = im.data();
+    parallel_for(pool.get(), re.size() / 2, MIN_ITEMS_PER_THREAD, [&](size_t begin, size_t end, size_t) {
+        apply_single(pr, pi, mr, mi, qubit, begin, end);
+    });
+}
+
+/**
+ * Applies a two-qubit gate, with qubit a as the most significant qubit
+ * of the matrix. Throws std::invalid_argument if the matrix is not 4x4 or
+ * the qubits are equal.
+ */
+void Simulator::apply(const primitives::CMatrix &matrix, size_t a, size_t b) {
+    if (matrix.size_rows() != 4 || matrix.size_cols() != 4) {
+        throw std::invalid_argument("matrix is not 4x4");
+    }
+    if (a >= num_qubits || b >= num_qubits) {
+        throw std::invalid_argument("qubit index out of range");
+    }
+    if (a == b) {
+        throw std::invalid_argument("two-qubit gate applied to the same qubit twice");
+    }
+    primitives::Real mr[16], mi[16];
+    for (size_t row = 0; row < 4; row++) {
+        for (size_t col = 0; col < 4; col++) {
+            mr[row * 4 + col] = matrix.at(row + 1, col + 1).real();
+            mi[row * 4 + col] = matrix.at(row + 1, col + 1).imag();
+        }
+    }
+    primitives::Real *pr = re.data();
+    primitives::Real *pi = im.data();
+    parallel_for(pool.get(), re.size() / 4, MIN_ITEMS_PER_THREAD, [&](size_t begin, size_t end, size_t) {
+        apply_double(pr, pi, mr, mi, a, b, begin, end);
+    });
+}
+
+/**
+ * Applies the pending gates, one block of amplitudes at a time.
+ */
+void Simulator::flush() {
+    if (pending.empty()) {
+        return;
+    }
+    const size_t block_qubits = std::min(num_qubits, BLOCK_QUBITS);
+    const size_t block_size = (size_t)1 << block_qubits;
+    const size_t min_blocks = std::max<size_t>(1, MIN_ITEMS_PER_THREAD >> block_qubits);
+    primitives::Real *pr = re.data();
+    primitives::Real *pi = im.data();
+    parallel_for(pool.get(), re.size() / block_size, min_blocks, [&](size_t begin, size_t end, size_t) {
+        for (size_t block = begin; block < end; block++) {
+            auto br = pr + block * block_size;
+            auto bi = pi + block * block_size;
+            for (const auto &gate : pending) {
+                if (gate.two_qubit) {
+                    apply_double(br, bi, gate.mr, gate.mi, gate.a, gate.b, 0, block_size / 4);
+                } else {
+                    apply_single(br, bi, gate.mr, gate.mi, gate.a, 0, block_size / 2);
+                }
+            }
+        }
+    });
+    pending.clear();
+}
+/**
+ * Measures the given qubit in the Z basis, collapsing the state and
+ * storing the result in the bit with the same index. Returns the result.
+ */
+bool Simulator::measure(size_t qubit) {
+    auto probability = get_probability(qubit);
+    bool result = std::uniform_real_distribution<primitives::Real>(0.0, 1.0)(rng) < probability;
+    if (result && probability <= 0.0) {
+        result = false;
+    } else if (!result && probability >= 1.0) {
+        result = true;
+    }
+
+    // Zero out the amplitudes for the other outcome and renormalize.
+    const size_t stride = (size_t)1 << qubit;
+    const primitives::Real scale = 1.0 / std::sqrt(result ? probability : 1.0 - probability);
+    const size_t keep = result ? stride : 0;
+    const size_t drop = result ? 0 : stride;
+    primitives::Real *pr = re.data();
+    primitives::Real *pi = im.data();
+    for_each_pair(pool.get(), re.size(), qubit, [=](size_t index, size_t run, size_t) {
+        for (size_t j = index; j < index + run; j++) {
+            pr[j + keep] *= scale;
+            pi[j + keep] *= scale;
+            pr[j + drop] = 0.0;
+            pi[j + drop] = 0.0;
+        }
+    });
+
+    bits[qubit] = result;
+    return result;
+}
+
+/**
+ * Resets the given qubit to zero by measuring it and flipping it if the
+ * result was one.
+ */
+void Simulator::prep(size_t qubit) {
+    if (measure(qubit)) {
+        unitary::Matrix2 x;
+        x.m[0] = 0.0;
+        x.m[1] = 1.0;
+        x.m[2] = 1.0;
+        x.m[3] = 0.0;
+        apply(x, qubit);
+    }
+}
+
+/**
+ * Returns whether the condition of the given instruction is satisfied.
+ */
+bool Simulator::evaluate_condition(const semantic::Instruction &insn) const {
+    if (auto value = insn.condition->as_const_bool()) {
+        return value->value;
+    }
+    if (auto refs = insn.condition->as_bit_refs()) {
+        for (const auto &index : refs->index) {
+            if (index->value < 0 || (size_t)index->value >= bits.size()) {
+                throw SimulationError("bit index out of range", &insn);
+            }
+            if (!bits[index->value]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    throw SimulationError("unsupported condition", &insn);
+}
+
+/**
+ * Applies the given instruction, assuming that its condition has already
+ * been checked.
+ */
+void Simulator::apply(const semantic::Instruction &insn) {
+
+    // Gather the qubit operands.
+    std::vector<std::vector<size_t>> qubits;
+    for (const auto &operand : insn.operands) {
+        if (auto refs = operand->as_qubit_refs()) {
+            qubits.emplace_back();
+            for (const auto &index : refs->index) {
+                if (index->value < 0 || (size_t)index->value >= num_qubits) {
+                    throw SimulationError("qubit index out of range", &insn);
+                }
+                qubits.back().push_back(index->value);
+            }
+        }
+    }
+
+    // Handle gates.
+    auto matrix = unitary::matrix_of(insn);
+    if (matrix.size_cols() == 0) {
+        matrix = unitary::matrix_operand(insn.operands);
+    }
+    // Gates on the qubits within a block are postponed until flush(), so
+    // they can be applied to the whole state in a single pass. Other gates
+    // are applied immediately, after the pending gates.
+    if (matrix.size_rows() == 2 && matrix.size_cols() == 2 && qubits.size() == 1) {
+        auto matrix2 = unitary::Matrix2::from_cmatrix(matrix);
+        PendingGate gate;
+        gate.b = 0;
+        gate.two_qubit = false;
+        for (size_t k = 0; k < 4; k++) {
+            gate.mr[k] = matrix2.m[k].real();
+            gate.mi[k] = matrix2.m[k].imag();
+        }
+        for (auto qubit : qubits[0]) {
+            if (qubit < BLOCK_QUBITS) {
+                gate.a = qubit;
+                pending.push_back(gate);
+            } else {
+                flush();
+                apply(matrix2, qubit);
+            }
+        }
+        return;
+    }
+    if (matrix.size_rows() == 4 && matrix.size_cols() == 4 && qubits.size() == 2) {
+        if (qubits[0].size() != qubits[1].size()) {
+            throw SimulationError("qubit operands of two-qubit gate differ in size", &insn);
+        }
+        PendingGate gate;
+        gate.two_qubit = true;
+        for (size_t row = 0; row < 4; row++) {
+            for (size_t col = 0; col < 4; col++) {
+                gate.mr[row * 4 + col] = matrix.at(row + 1, col + 1).real();
+                gate.mi[row * 4 + col] = matrix.at(row + 1, col + 1).imag();
+            }
+        }
+        for (size_t i = 0; i < qubits[0].size(); i++) {
+            if (qubits[0][i] == qubits[1][i]) {
+                throw SimulationError("two-qubit gate applied to the same qubit twice", &insn);
+            }
+            if (qubits[0][i] < BLOCK_QUBITS && qubits[1][i] < BLOCK_QUBITS) {
+                gate.a = qubits[0][i];
+                gate.b = qubits[1][i];
+                pending.push_back(gate);
+            } else {
+                flush();
+                apply(matrix, qubits[0][i], qubits[1][i]);
+            }
+        }
+        return;
+    }
+    if (matrix.size_cols() != 0) {
+        throw SimulationError("gate matrix does not match qubit operands", &insn);
+    }
+
+    // Handle non-unitary instructions.
+    auto name = utils::lowercase(insn.name);
+    if (name == "measure" || name == "measure_z" || name == "prep" || name == "prep_z") {
+        flush();
+        bool is_prep = name.compare(0, 4, "prep") == 0;
+        for (const auto &operand : qubits) {
+            for (auto qubit : operand) {
+                if (is_prep) {
+                    prep(qubit);
+                } else {
+                    measure(qubit);
+                }
+            }
+        }
+    } else if (name == "measure_all") {
+        flush();
+        for (size_t qubit = 0; qubit < num_qubits; qubit++) {
+            measure(qubit);
+        }
+    } else if (name == "not") {
+        for (const auto &operand : insn.operands) {
+            if (auto refs = operand->as_bit_refs()) {
+                for (const auto &index : refs->index) {
+                    if (index->value < 0 || (size_t)index->value >= bits.size()) {
+                        throw SimulationError("bit index out of range", &insn);
+                    }
+                    bits[index->value] = !bits[index->value];
+                }
+            }
+        }
+    } else if (name != "display" && name != "wait" && name != "skip" && name != "barrier") {
+        throw SimulationError("don't know how to simulate instruction " + insn.name.get(), &insn);
+    }
+
+}
+
+/**
+ * Runs the given program, starting from the all-zero state of
+ * program.num_qubits qubits. Subcircuits are repeated according to their
+ * iteration count. The instructions in a bundle are applied in order,
+ * but their conditions are all evaluated before any of them is applied.
+ *
+ * Gates are simulated using the matrix returned by unitary::matrix_of(),
+ * or if that is empty, using the matrix operand of the instruction (see
+ * unitary::matrix_operand()). 2x2 matrices are applied to each qubit of
+ * the qubit operand, 4x4 matrices pairwise to the qubits of two qubit
+ * operands. Furthermore, the following instructions are recognized by
+ * name: measure, measure_z, and measure_all (measurement in the Z basis),
+ * prep and prep_z (reset to zero), not (bit flip), and display, wait,
+ * skip, and barrier (no-op). Conditions must be constant booleans or bit
+ * references, in which case all referenced bits must be set. Anything
+ * else results in a SimulationError.
+ */
+void Simulator::run(const semantic::Program &program) {
+    trace::Span span("simulate", "pass");
+    reset(std::max<primitives::Int>(program.num_qubits, 0));
+    std::vector<const semantic::Instruction*> enabled;
+    try {
+        for (const auto &subcircuit : program.subcircuits) {
+            for (primitives::Int iteration = 0; iteration < subcircuit->iterations; iteration++) {
+                for (const auto &bundle : subcircuit->bundles) {
+                    enabled.clear();
+                    for (const auto &insn : bundle->items) {
+                        if (evaluate_condition(*insn)) {
+                            enabled.push_back(&*insn);
+                        }
+                    }
+                    for (auto insn : enabled) {
+                        apply(*insn);
+                    }
+                }
+            }
+        }
+    } catch (...) {
+        // Leave the state as it was when the error occurred.
+        flush();
+        throw;
+    }
+    flush();
+}
+
+} // namespace simulator
+} // namespace cqasm
@@ -0,0 +1,351 @@
+#include "cqasm-trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace cqasm {
+namespace trace {
+
+/**
+ * Whether tracing is enabled. Use is_enabled() instead of accessing this
+ * directly.
+ */
+std::atomic<bool> tracing_enabled(false);
+
+/**
+ * Ring buffer of the events recorded by a single thread. The buffer is only
+ * written by its own thread, but may be read or cleared by others, so access
+ * is guarded by a mutex, which is uncontended in the common case.
+ */
+class ThreadBuffer {
+public:
+
+    /**
+     * Guards the members below, except for retired.
+     */
+    std::mutex mutex;
+
+    /**
+     * The sequence number of the thread.
+     */
+    uint32_t thread;
+
+    /**
+     * The recorded events. Once the buffer is full, the oldest event is
+     * overwritten.
+     */
+    std::vector<Event> events;
+
+    /**
+     * The index in events where the next event is written once the buffer
+     * is full.
+     */
+    size_t next;
+
+    /**
+     * Whether the thread that owned this buffer has exited. Guarded by the
+     * mutex of the tracer.
+     */
+    bool retired;
+
+    /**
+     * Creates a buffer for the thread with the given sequence number.
+     */
+    explicit ThreadBuffer(uint32_t thread) : thread(thread), next(0), retired(false) {}
+
+};
+
+/**
+ * Returns the current time of the steady clock in nanoseconds.
+ */
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+/**
+ * Global tracer state.
+ */
+class Tracer {
+public:
+
+    /**
+     * Guards the other members, except for the atomic ones.
+     */
+    std::mutex mutex;
+
+    /**
+     * The buffers of the threads that have recorded events. Buffers of
+     * threads that have exited are kept until their events are cleared, or
+     * reused by new threads in the meantime, so the number of buffers is
+     * bounded by the number of threads that exist at the same time.
+     */
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+    /**
+     * The number of threads that have registered a buffer so far.
+     */
+    uint32_t num_threads;
+
+    /**
+     * The maximum number of events per thread.
+     */
+    std::atomic<size_t> capacity;
+
+    /**
+     * The time at which tracing was enabled, in nanoseconds of the steady
+     * clock. This is read without taking the lock.
+     */
+    std::atomic<int64_t> epoch;
+
+    /**
+     * Creates the tracer.
+     */
+    Tracer() : num_threads(0), capacity(1 << 16), epoch(steady_ns()) {}
+
+    /**
+     * Registers a buffer for the calling thread, reusing the buffer of a
+     * thread that has exited if there is one. Its remaining events keep the
+     * sequence number of the old thread.
+     */
+    std::shared_ptr<ThreadBuffer> add_buffer() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t thread = ++num_threads;
+        for (auto &buffer : buffers) {
+            if (buffer->retired) {
+                std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+                buffer->retired = false;
+                buffer->thread = thread;
+                return buffer;
+            }
+        }
+        auto buffer = std::make_shared<ThreadBuffer>(thread);
+        buffers.push_back(buffer);
+        return buffer;
+    }
+
+    /**
+     * Unregisters the buffer of a thread that is exiting. The buffer is
+     * dropped right away if it holds no events, and is otherwise kept for
+     * get_events() until it is cleared or reused.
+     */
+    void retire_buffer(const std::shared_ptr<ThreadBuffer> &buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool empty;
+        {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            empty = buffer->events.empty();
+        }
+        if (empty) {
+            buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer), buffers.end());
+        } else {
+            buffer->retired = true;
+        }
+    }
+
+};
+
+/**
+ * Returns the global tracer state.
+ */
+static Tracer &get_tracer() {
+    static Tracer tracer;
+    return tracer;
+}
+
+/**
+ * Owns the buffer of a thread, and unregisters it when the thread exits.
+ */
+class BufferHandle {
+public:
+
+    /**
+     * The buffer, or null if the thread hasn't recorded anything yet.
+     */
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    /**
+     * Unregisters the buffer, if any.
+     */
+    ~BufferHandle() {
+        if (buffer) {
+            get_tracer().retire_buffer(buffer);
+        }
+    }
+
+};
+
+/**
+ * Returns the buffer for the calling thread, creating it if needed.
+ */
+static ThreadBuffer &get_buffer() {
+    static thread_local BufferHandle handle;
+    if (!handle.buffer) {
+        handle.buffer = get_tracer().add_buffer();
+    }
+    return *handle.buffer;
+}
+
+/**
+ * Enables tracing, discarding any previously recorded events. Each thread
+ * keeps at most the given number of most recent events.
+ */
+void enable(size_t capacity_per_thread) {
+    auto &tracer = get_tracer();
+    clear();
+    {
+        std::lock_guard<std::mutex> lock(tracer.mutex);
+        tracer.capacity = std::max<size_t>(1, capacity_per_thread);
+        tracer.epoch.store(steady_ns(), std::memory_order_release);
+    }
+    tracing_enabled = true;
+}
+
+/**
+ * Disables tracing. Events recorded so far are kept.
+ */
+void disable() {
+    tracing_enabled = false;
+}
+
+/**
+ * Discards all recorded events.
+ */
+void clear() {
+    auto &tracer = get_tracer();
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+    for (auto &buffer : tracer.buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        std::vector<Event>().swap(buffer->events);
+        buffer->next = 0;
+    }
+
+    // The buffers of threads that have exited are only kept for their
+    // events.
+    tracer.buffers.erase(std::remove_if(
+        tracer.buffers.begin(), tracer.buffers.end(),
+        [](const std::shared_ptr<ThreadBuffer> &buffer) { return buffer->retired; }
+    ), tracer.buffers.end());
+}
+
+/**
+ * Returns a copy of all recorded events, ordered by start time. Spans that
+ * are still open are not included.
+ */
+std::vector<Event> get_events() {
+    auto &tracer = get_tracer();
+    std::vector<Event> events;
+    {
+        std::lock_guard<std::mutex> lock(tracer.mutex);
+        for (auto &buffer : tracer.buffers) {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+        return a.start < b.start;
+    });
+    return events;
+}
+
+/**
+ * Writes the given string as a JSON string literal.
+ */
+static void write_json_string(std::ostream &os, const char *str) {
+    static const char *hex = "0123456789abcdef";
+    os << '"';
+    for (; *str; str++) {
+        auto c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            os << '\\' << (char)c;
+        } else if (c < 0x20) {
+            os << "\\u00" << hex[c >> 4] << hex[c & 15];
+        } else {
+            os << (char)c;
+        }
+    }
+    os << '"';
+}
+
+/**
+ * Writes the given number of nanoseconds as microseconds.
+ */
+static void write_microseconds(std::ostream &os, uint64_t ns) {
+    os << ns / 1000 << '.';
+    auto fraction = ns % 1000;
+    os << (char)('0' + fraction / 100) << (char)('0' + fraction / 10 % 10) << (char)('0' + fraction % 10);
+}
+
+/**
+ * Writes all recorded events to the given stream as a Chrome trace event
+ * JSON document.
+ */
+void write_chrome_json(std::ostream &os) {
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto &event : get_events()) {
+        if (first) {
+            first = false;
+        } else {
+            os << ",";
+        }
+        os << "\n{\"name\":";
+        write_json_string(os, event.name);
+        os << ",\"cat\":";
+        write_json_string(os, event.category);
+        os << ",\"ph\":\"X\",\"ts\":";
+        write_microseconds(os, event.start);
+        os << ",\"dur\":";
+        write_microseconds(os, event.duration);
+        os << ",\"pid\":1,\"tid\":" << event.thread;
+        if (!event.detail.empty()) {
+            os << ",\"args\":{\"detail\":";
+            write_json_string(os, event.detail.c_str());
+            os << "}";
+        }
+        os << "}";
+    }
+    os << "\n]}\n";
+}
+
+/**
+ * Returns the current time in nanoseconds since tracing was enabled.
+ */
+uint64_t now() {
+
+    // Loading the epoch before reading the clock ensures that the result
+    // can't be negative, also when tracing is enabled concurrently.
+    auto epoch = get_tracer().epoch.load(std::memory_order_acquire);
+    return steady_ns() - epoch;
+
+}
+
+/**
+ * Records the given event in the ring buffer of the calling thread.
+ */
+void record(const char *name, const char *category, std::string &&detail, uint64_t start, uint64_t duration) {
+    auto &buffer = get_buffer();
+    auto capacity = get_tracer().capacity.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    Event *event;
+    if (buffer.events.size() < capacity) {
+        buffer.events.emplace_back();
+        event = &buffer.events.back();
+    } else {
+        if (buffer.next >= buffer.events.size()) {
+            buffer.next = 0;
+        }
+        event = &buffer.events[buffer.next++];
+    }
+    event->name = name;
+    event->category = category;
+    event->detail = std::move(detail);
+    event->start = start;
+    event->duration = duration;
+    event->thread = buffer.thread;
+}
+
+} // namespace trace
+} // namespace cqasm
@@ -0,0 +1,654 @@
+#include "cqasm-tree.hpp"
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace cqasm {
+namespace tree {
+
+/**
+ * Granularity of the node pool size classes in bytes.
+ */
+static const size_t POOL_GRANULARITY = 16;
+
+/**
+ * Number of node pool size classes. Larger allocations bypass the pool.
+ */
+static const size_t POOL_NUM_CLASSES = 32;
+
+/**
+ * Maximum number of bytes each thread keeps in its node pool.
+ */
+static std::atomic<size_t> pool_capacity(0);
+
+/**
+ * A free block in a node pool.
+ */
+struct FreeBlock {
+
+    /**
+     * The next free block of the same size class.
+     */
+    FreeBlock *next;
+
+};
+
+/**
+ * The node pool of a thread. This is trivially destructible, such that it
+ * remains usable while other thread-local and static objects are destroyed;
+ * the memory it holds is released by NodePoolReleaser instead.
+ */
+struct NodePool {
+
+    /**
+     * Free lists per size class.
+     */
+    FreeBlock *free_lists[POOL_NUM_CLASSES];
+
+    /**
+     * Statistics of the pool.
+     */
+    NodePoolStatistics statistics;
+
+    /**
+     * Whether the releaser of this thread has been constructed.
+     */
+    bool registered;
+
+    /**
+     * Whether the thread is exiting, after which freed blocks are no longer
+     * cached.
+     */
+    bool exiting;
+
+};
+
+/**
+ * The node pool of the calling thread.
+ */
+static thread_local NodePool pool = {};
+
+/**
+ * The node that delete_node() returns to a memory resource, as set by the
+ * innermost DeleteScope of the calling thread, and that resource.
+ */
+static thread_local const void *deleting_node = nullptr;
+static thread_local memory::Resource *deleting_resource = nullptr;
+
+/**
+ * Releases the node pool of a thread when the thread exits.
+ */
+class NodePoolReleaser {
+public:
+
+    /**
+     * Releases the node pool of the calling thread.
+     */
+    ~NodePoolReleaser() {
+        release_node_pool();
+        pool.exiting = true;
+    }
+
+};
+
+/**
+ * The releaser of the calling thread.
+ */
+static thread_local NodePoolReleaser releaser;
+
+/**
+ * Allocates memory for a node of the given size. Nodes are allocated from
+ * per-thread pools with free lists per size class, such that programs that
+ * are parsed and dropped over and over again reuse the memory of their
+ * predecessors without going back to malloc. Allocations larger than the
+ * largest size class go straight to the global operator new.
+ */
+void *allocate_node(size_t size) {
+    if (size == 0 || size > POOL_NUM_CLASSES * POOL_GRANULARITY) {
+        return ::operator new(size);
+    }
+    auto size_class = (size - 1) / POOL_GRANULARITY;
+    pool.statistics.allocations++;
+    if (auto block = pool.free_lists[size_class]) {
+        pool.free_lists[size_class] = block->next;
+        pool.statistics.cached_bytes -= (size_class + 1) * POOL_GRANULARITY;
+        pool.statistics.recycled++;
+        return block;
+    }
+    return ::operator new((size_class + 1) * POOL_GRANULARITY);
+}
+
+/**
+ * Frees memory allocated by allocate_node() with the same size. The block
+ * is kept in the free list of the calling thread if the pool has room for
+ * it, and freed otherwise. Blocks may be freed by a different thread than
+ * the one that allocated them.
+ */
+void deallocate_node(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (size == 0 || size > POOL_NUM_CLASSES * POOL_GRANULARITY) {
+        ::operator delete(ptr);
+        return;
+    }
+    auto size_class = (size - 1) / POOL_GRANULARITY;
+    auto block_size = (size_class + 1) * POOL_GRANULARITY;
+    if (
+        pool.exiting ||
+        pool.statistics.cached_bytes + block_size > pool_capacity.load(std::memory_order_relaxed)
+    ) {
+        ::operator delete(ptr);
+        return;
+    }
+    if (!pool.registered) {
+        pool.registered = true;
+        (void)&releaser;
+    }
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = pool.free_lists[size_class];
+    pool.free_lists[size_class] = block;
+    pool.statistics.cached_bytes += block_size;
+}
+
+/**
+ * Allocates memory for a node of the given size from the memory resource
+ * selected for the calling thread, or using allocate_node() if there is none.
+ * This is used for nodes created with new. The node doesn't record where it
+ * came from; the tree reference that takes ownership of it does, so it must
+ * do so while the same resource is still selected (see adopt()).
+ */
+void *new_node(size_t size) {
+    if (auto resource = memory::get_resource()) {
+        return resource->allocate(size);
+    }
+    return allocate_node(size);
+}
+
+/**
+ * Frees memory allocated by new_node() with the same size. The memory is
+ * returned to the resource of the DeleteScope for the given node if there is
+ * one, and using deallocate_node() otherwise.
+ */
+void delete_node(void *ptr, size_t size) {
+    if (ptr && ptr == deleting_node && deleting_resource) {
+        deleting_resource->deallocate(ptr, size);
+    } else {
+        deallocate_node(ptr, size);
+    }
+}
+
+/**
+ * Makes delete_node() return the given node, being a pointer to the
+ * most-derived object, to the given resource, or to the node pool if nullptr
+ * is passed.
+ */
+DeleteScope::DeleteScope(const void *node, memory::Resource *resource) :
+    previous_node(deleting_node),
+    previous_resource(deleting_resource)
+{
+    deleting_node = node;
+    deleting_resource = resource;
+}
+
+/**
+ * Restores the enclosing scope.
+ */
+DeleteScope::~DeleteScope() {
+    deleting_node = previous_node;
+    deleting_resource = previous_resource;
+}
+
+/**
+ * Sets the maximum number of bytes each thread keeps in its node pool for
+ * reuse. Setting it to 0 disables recycling, such that nodes are allocated
+ * and freed using the global operator new and delete. This is the default,
+ * because while the pool is several times faster than malloc for the
+ * allocations themselves, the recycled blocks are scattered in memory,
+ * which can make traversing the new trees slower than what malloc saves.
+ * Measure before enabling it.
+ */
+void set_node_pool_capacity(size_t bytes) {
+    pool_capacity = bytes;
+}
+
+/**
+ * Returns the maximum number of bytes each thread keeps in its node pool.
+ */
+size_t get_node_pool_capacity() {
+    return pool_capacity;
+}
+
+/**
+ * Frees all memory held by the node pool of the calling thread. This is
+ * done automatically when the thread exits.
+ */
+void release_node_pool() {
+    for (auto &free_list : pool.free_lists) {
+        while (auto block = free_list) {
+            free_list = block->next;
+            ::operator delete(block);
+        }
+    }
+    pool.statistics.cached_bytes = 0;
+}
+
+/**
+ * Returns the statistics of the node pool of the calling thread.
+ */
+NodePoolStatistics get_node_pool_statistics() {
+    return pool.statistics;
+}
+
+/**
+ * Approximate overhead of the control block of a shared pointer allocated
+ * with std::make_shared() or make().
+ */
+const size_t MemoryUsage::SHARED_OVERHEAD;
+
+/**
+ * Creates an empty report.
+ */
+MemoryUsage::MemoryUsage() : total(0) {}
+
+/**
+ * Counts a shared heap object of the given type name and size, unless it
+ * was already counted. Returns whether it was counted now; if not, the
+ * memory it owns should not be counted again either. The type name must
+ * have static lifetime.
+ */
+bool MemoryUsage::add_object(const void *object, const char *type, size_t size) {
+    if (!counted.insert(object).second) {
+        return false;
+    }
+    auto &usage = types[type];
+    usage.count++;
+    usage.bytes += size + SHARED_OVERHEAD;
+    total += size + SHARED_OVERHEAD;
+    return true;
+}
+
+/**
+ * Counts additional heap memory owned by an object of the given type that
+ * was already counted.
+ */
+void MemoryUsage::add_bytes(const char *type, size_t bytes) {
+    types[type].bytes += bytes;
+    total += bytes;
+}
+
+/**
+ * Counts the annotation table of a node of the given type.
+ */
+void MemoryUsage::add_annotations(const char *type, const annotatable::Annotatable &object) {
+    add_bytes(type, object.get_annotation_table_size());
+}
+
+/**
+ * Returns the total heap memory used in bytes.
+ */
+size_t MemoryUsage::get_total() const {
+    return total;
+}
+
+/**
+ * Returns the memory used per type, keyed by type name.
+ */
+std::map<std::string, TypeMemoryUsage> MemoryUsage::get_types() const {
+    std::map<std::string, TypeMemoryUsage> result;
+    for (const auto &it : types) {
+        auto &usage = result.insert(std::make_pair(std::string(it.first), TypeMemoryUsage{0, 0})).first->second;
+        usage.count += it.second.count;
+        usage.bytes += it.second.bytes;
+    }
+    return result;
+}
+
+/**
+ * Number of subtrees per thread that TypeIndex::build() tries to divide the
+ * tree into, such that the threads get about the same amount of work even
+ * when the subtrees differ in size.
+ */
+static const size_t INDEX_SUBTREES_PER_THREAD = 16;
+
+/**
+ * Creates an empty index.
+ */
+TypeIndex::TypeIndex() : last_tree(0), pending(nullptr) {}
+
+/**
+ * Returns the nodes of the tree with the given NodeType enumeration, or
+ * null if no nodes of that tree have been indexed.
+ */
+const TypeIndex::TreeNodes *TypeIndex::find_tree(const void *tree) const {
+    for (const auto &nodes : trees) {
+        if (nodes.tree == tree) {
+            return &nodes;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Returns the nodes of the given type of the tree with the given NodeType
+ * enumeration, creating an empty bucket if needed.
+ */
+std::vector<const Base*> &TypeIndex::get_bucket(const void *tree, size_t type) {
+    if (last_tree >= trees.size() || trees[last_tree].tree != tree) {
+        last_tree = 0;
+        while (last_tree < trees.size() && trees[last_tree].tree != tree) {
+            last_tree++;
+        }
+        if (last_tree == trees.size()) {
+            trees.push_back(TreeNodes{tree, {}});
+        }
+    }
+    auto &types = trees[last_tree].types;
+    if (type >= types.size()) {
+        types.resize(type + 1);
+    }
+    return types[type];
+}
+
+/**
+ * Appends the nodes of the given index to this one.
+ */
+void TypeIndex::merge(const TypeIndex &other) {
+    for (const auto &nodes : other.trees) {
+        for (size_t type = 0; type < nodes.types.size(); type++) {
+            if (!nodes.types[type].empty()) {
+                auto &bucket = get_bucket(nodes.tree, type);
+                bucket.insert(bucket.end(), nodes.types[type].begin(), nodes.types[type].end());
+            }
+        }
+    }
+}
+
+/**
+ * Indexes the given node and its descendants, using up to num_threads
+ * threads. The first levels of the tree are indexed breadth-first on the
+ * calling thread until there are enough subtrees to divide over the
+ * threads; each thread then indexes a contiguous range of the subtrees into
+ * its own index, and these are concatenated in order.
+ */
+void TypeIndex::build(Pending root, size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (num_threads == 1) {
+        root.add(root.node, *this);
+        return;
+    }
+
+    // Index the first levels of the tree until there are enough subtrees.
+    std::vector<Pending> subtrees{root};
+    while (!subtrees.empty() && subtrees.size() < num_threads * INDEX_SUBTREES_PER_THREAD) {
+        std::vector<Pending> children;
+        pending = &children;
+        for (const auto &subtree : subtrees) {
+            subtree.add(subtree.node, *this);
+        }
+        pending = nullptr;
+        subtrees.swap(children);
+    }
+
+    // Index the subtrees in parallel.
+    num_threads = std::max<size_t>(1, std::min(num_threads, subtrees.size()));
+    std::vector<TypeIndex> indices(num_threads);
+    auto worker = [&subtrees, &indices, num_threads](size_t thread) {
+        size_t begin = subtrees.size() * thread / num_threads;
+        size_t end = subtrees.size() * (thread + 1) / num_threads;
+        for (size_t i = begin; i < end; i++) {
+            subtrees[i].add(subtrees[i].node, indices[thread]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &index : indices) {
+        merge(index);
+    }
+}
+
+/**
+ * Returns the number of nodes hashed so far.
+ */
+size_t MerkleHashes::size() const {
+    return hashes.size();
+}
+
+/**
+ * Maximum number of insertions and deletions for which Differ aligns the
+ * differing middle parts of two lists optimally. Beyond this, the elements
+ * are paired up by position, which keeps the cost of aligning completely
+ * different lists linear.
+ */
+static const size_t DIFF_MAX_ALIGN_EDITS = 256;
+
+/**
+ * Creates a differ for trees with the given hashes. Nodes that have an
+ * annotation of the given type, if any, are recorded as the context of the
+ * edits within them.
+ */
+Differ::Differ(MerkleHashes &old_hashes, MerkleHashes &new_hashes, const std::type_info *context_type) :
+    old_hashes(old_hashes),
+    new_hashes(new_hashes),
+    context_type(context_type)
+{}
+
+/**
+ * Appends the given field name to the path, returning the length of the path
+ * before.
+ */
+size_t Differ::enter_field(const char *name) {
+    auto length = path.size();
+    if (!path.empty()) {
+        path += ".";
+    }
+    path += name;
+    return length;
+}
+
+/**
+ * Appends the given list index to the path, returning the length of the path
+ * before.
+ */
+size_t Differ::enter_index(size_t index) {
+    auto length = path.size();
+    path += "[" + std::to_string(index) + "]";
+    return length;
+}
+
+/**
+ * Returns the given node if it has a context annotation, or the given context
+ * otherwise.
+ */
+const Base *Differ::get_context(const Base *node, const Base *context) const {
+    if (node && context_type && node->has_annotation(std::type_index(*context_type))) {
+        return node;
+    }
+    return context;
+}
+
+/**
+ * Starts comparing the given pair of nodes.
+ */
+void Differ::enter_node(const Base &old_node, const Base &new_node) {
+    Level level{&old_node, &new_node, nullptr, nullptr};
+    if (!levels.empty()) {
+        level.old_context = levels.back().old_context;
+        level.new_context = levels.back().new_context;
+    }
+    level.old_context = get_context(&old_node, level.old_context);
+    level.new_context = get_context(&new_node, level.new_context);
+    levels.push_back(level);
+}
+
+/**
+ * Records a difference at the current path.
+ */
+void Differ::add_edit(EditKind kind, const Base *old_node, const Base *new_node) {
+    Edit edit;
+    edit.kind = kind;
+    edit.path = path;
+    edit.old_node = old_node;
+    edit.new_node = new_node;
+    edit.old_context = levels.empty() ? nullptr : levels.back().old_context;
+    edit.new_context = levels.empty() ? nullptr : levels.back().new_context;
+    edit.old_context = get_context(old_node, edit.old_context);
+    edit.new_context = get_context(new_node, edit.new_context);
+    edits.push_back(std::move(edit));
+}
+
+/**
+ * Records that the primitive field with the given name of the nodes being
+ * compared changed from the given old value to the given new value, as
+ * printed.
+ */
+void Differ::add_changed_field(const char *name, const std::string &old_value, const std::string &new_value) {
+    auto length = enter_field(name);
+    add_edit(EditKind::Changed, levels.back().old_node, levels.back().new_node);
+    edits.back().old_value = old_value;
+    edits.back().new_value = new_value;
+    path.resize(length);
+}
+
+/**
+ * Returns the differences found so far, in tree order.
+ */
+const std::vector<Edit> &Differ::get_edits() const {
+    return edits;
+}
+
+/**
+ * Aligns two lists by the hashes of their elements, returning the steps
+ * needed to turn the old list into the new one, in order. The common prefix
+ * and suffix are skipped first. The middle parts are aligned with Myers'
+ * O((N+M)D) algorithm, where D is the number of insertions and deletions,
+ * up to DIFF_MAX_ALIGN_EDITS of them. The removed and added elements between
+ * two kept elements are then paired up, such that modified elements are
+ * compared recursively rather than reported as replaced.
+ */
+std::vector<Differ::AlignStep> Differ::align(
+    const std::vector<uint64_t> &old_list,
+    const std::vector<uint64_t> &new_list
+) {
+    std::vector<AlignStep> steps;
+
+    // Skip the common prefix and suffix.
+    size_t prefix = 0;
+    while (prefix < old_list.size() && prefix < new_list.size() && old_list[prefix] == new_list[prefix]) {
+        prefix++;
+    }
+    size_t old_end = old_list.size();
+    size_t new_end = new_list.size();
+    while (old_end > prefix && new_end > prefix && old_list[old_end - 1] == new_list[new_end - 1]) {
+        old_end--;
+        new_end--;
+    }
+    long n = old_end - prefix;
+    long m = new_end - prefix;
+
+    // Find the shortest edit script for the middle parts, keeping the
+    // furthest reaching paths of each round for the backtracking pass.
+    long max_edits = std::min<long>(n + m, DIFF_MAX_ALIGN_EDITS);
+    std::vector<std::vector<long>> trace;
+    std::vector<long> furthest(2 * max_edits + 3, 0);
+    long offset = max_edits + 1;
+    long edits = -1;
+    for (long d = 0; d <= max_edits && edits < 0; d++) {
+        trace.push_back(furthest);
+        for (long k = -d; k <= d; k += 2) {
+            long x;
+            if (k == -d || (k != d && furthest[offset + k - 1] < furthest[offset + k + 1])) {
+                x = furthest[offset + k + 1];
+            } else {
+                x = furthest[offset + k - 1] + 1;
+            }
+            long y = x - k;
+            while (x < n && y < m && old_list[prefix + x] == new_list[prefix + y]) {
+                x++;
+                y++;
+            }
+            furthest[offset + k] = x;
+            if (x >= n && y >= m) {
+                edits = d;
+                break;
+            }
+        }
+    }
+
+    // When the lists differ too much, pair the elements up by position.
+    if (edits < 0) {
+        for (long i = 0; i < std::max(n, m); i++) {
+            if (i < n && i < m) {
+                steps.push_back(AlignStep{EditKind::Changed, prefix + i, prefix + i});
+            } else if (i < n) {
+                steps.push_back(AlignStep{EditKind::Removed, prefix + i, 0});
+            } else {
+                steps.push_back(AlignStep{EditKind::Added, 0, prefix + i});
+            }
+        }
+        return steps;
+    }
+
+    // Backtrack through the rounds, collecting the removals and additions
+    // in groups that are separated by kept elements.
+    std::vector<std::vector<AlignStep>> groups(1);
+    long x = n;
+    long y = m;
+    for (long d = edits; d > 0; d--) {
+        const auto &previous = trace[d];
+        long k = x - y;
+        bool added = k == -d || (k != d && previous[offset + k - 1] < previous[offset + k + 1]);
+        long previous_k = added ? k + 1 : k - 1;
+        long previous_x = previous[offset + previous_k];
+        long previous_y = previous_x - previous_k;
+        long edit_x = added ? previous_x : previous_x + 1;
+        if (x > edit_x && !groups.back().empty()) {
+            groups.emplace_back();
+        }
+        if (added) {
+            groups.back().push_back(AlignStep{EditKind::Added, 0, prefix + previous_y});
+        } else {
+            groups.back().push_back(AlignStep{EditKind::Removed, prefix + previous_x, 0});
+        }
+        x = previous_x;
+        y = previous_y;
+    }
+
+    // Pair up the removals and additions within each group.
+    for (auto group = groups.rbegin(); group != groups.rend(); group++) {
+        std::vector<AlignStep> removed, added;
+        for (auto step = group->rbegin(); step != group->rend(); step++) {
+            (step->kind == EditKind::Removed ? removed : added).push_back(*step);
+        }
+        size_t pairs = std::min(removed.size(), added.size());
+        for (size_t i = 0; i < pairs; i++) {
+            steps.push_back(AlignStep{EditKind::Changed, removed[i].old_index, added[i].new_index});
+        }
+        steps.insert(steps.end(), removed.begin() + pairs, removed.end());
+        steps.insert(steps.end(), added.begin() + pairs, added.end());
+    }
+    return steps;
+}
+
+} // namespace tree
+} // namespace cqasm
+
+/**
+ * Stream << overload for memory usage reports.
+ */
+std::ostream& operator<<(std::ostream& os, const ::cqasm::tree::MemoryUsage& usage) {
+    for (const auto &it : usage.get_types()) {
+        os << it.first << ": " << it.second.count << " objects, ";
+        os << it.second.bytes << " bytes" << std::endl;
+    }
+    os << "total: " << usage.get_total() << " bytes" << std::endl;
+    return os;
+}
@@ -0,0 +1,464 @@
+#include "cqasm-unitary.hpp"
+#include "cqasm-parse-helper.hpp"
+#include <cmath>
+
+namespace cqasm {
+namespace unitary {
+
+/**
+ * Constructs a gate matrix annotation from a function.
+ */
+GateMatrix::GateMatrix(const MatrixFunction &matrix) : matrix(matrix) {}
+
+/**
+ * Constructs a gate matrix annotation for an instruction with a fixed
+ * matrix.
+ */
+GateMatrix::GateMatrix(const primitives::CMatrix &matrix) :
+    matrix([matrix](const values::Values&) { return matrix; })
+{}
+
+/**
+ * Returns the identity matrix.
+ */
+Matrix2 Matrix2::identity() {
+    Matrix2 result;
+    result.m[0] = 1.0;
+    result.m[1] = 0.0;
+    result.m[2] = 0.0;
+    result.m[3] = 1.0;
+    return result;
+}
+
+/**
+ * Converts from a CMatrix. Throws std::invalid_argument if the matrix is
+ * not 2x2.
+ */
+Matrix2 Matrix2::from_cmatrix(const primitives::CMatrix &matrix) {
+    if (matrix.size_rows() != 2 || matrix.size_cols() != 2) {
+        throw std::invalid_argument("matrix is not 2x2");
+    }
+    Matrix2 result;
+    result.m[0] = matrix.at(1, 1);
+    result.m[1] = matrix.at(1, 2);
+    result.m[2] = matrix.at(2, 1);
+    result.m[3] = matrix.at(2, 2);
+    return result;
+}
+
+/**
+ * Converts to a CMatrix.
+ */
+primitives::CMatrix Matrix2::to_cmatrix() const {
+    return primitives::CMatrix({m[0], m[1], m[2], m[3]}, 2);
+}
+
+/**
+ * Returns the unitary matrix of the given instruction, based on the
+ * GateMatrix annotation of its instruction type. Returns an empty matrix if
+ * the instruction is unresolved, has no such annotation, or the annotation
+ * cannot determine the matrix.
+ */
+primitives::CMatrix matrix_of(const semantic::Instruction &insn) {
+    if (insn.instruction.empty()) {
+        return primitives::CMatrix();
+    }
+    auto gate_matrix = insn.instruction->get_annotation_ptr<GateMatrix>();
+    if (!gate_matrix || !gate_matrix->matrix) {
+        return primitives::CMatrix();
+    }
+    return gate_matrix->matrix(insn.operands);
+}
+
+/**
+ * Returns the matrix operand of instructions like `u q[0], [...]`, i.e. the
+ * first complex matrix operand of the given operand list. Sparse and
+ * controlled matrix operands are converted to dense matrices. This can be
+ * used as the MatrixFunction of such instructions. Returns an empty matrix if
+ * there is no such operand.
+ */
+primitives::CMatrix matrix_operand(const values::Values &operands) {
+    for (const auto &operand : operands) {
+        if (
+            operand->as_const_complex_matrix() ||
+            operand->as_const_sparse_complex_matrix() ||
+            operand->as_const_controlled_complex_matrix()
+        ) {
+            return values::dense_complex_matrix(operand);
+        }
+    }
+    return primitives::CMatrix();
+}
+
+/**
+ * Returns a matrix function for a rotation about the given axis, taking the
+ * angle from the first real operand.
+ */
+static MatrixFunction rotation(primitives::Axis axis) {
+    return [axis](const values::Values &operands) {
+        for (const auto &operand : operands) {
+            if (auto angle = operand->as_const_real()) {
+                auto c = std::cos(angle->value / 2.0);
+                auto s = std::sin(angle->value / 2.0);
+                const primitives::Complex i(0.0, 1.0);
+                switch (axis) {
+                    case primitives::Axis::X:
+                        return primitives::CMatrix({c, -i * s, -i * s, c}, 2);
+                    case primitives::Axis::Y:
+                        return primitives::CMatrix({c, -s, s, c}, 2);
+                    case primitives::Axis::Z:
+                        return primitives::CMatrix({std::polar(1.0, -angle->value / 2.0), 0.0, 0.0, std::polar(1.0, angle->value / 2.0)}, 2);
+                }
+            }
+        }
+        return primitives::CMatrix();
+    };
+}
+
+/**
+ * Returns a matrix function for a fixed rotation about the given axis.
+ */
+static GateMatrix fixed_rotation(primitives::Axis axis, primitives::Real angle) {
+    values::Values operands;
+    operands.add(tree::make<values::ConstReal>(angle));
+    return GateMatrix(rotation(axis)(operands));
+}
+
+/**
+ * Returns a matrix function for a controlled phase gate, taking the angle from
+ * the first real operand, or if k is set, taking it to be 2*pi/2^k for the
+ * first integer operand k.
+ */
+static MatrixFunction controlled_phase(bool k) {
+    return [k](const values::Values &operands) {
+        for (const auto &operand : operands) {
+            primitives::Real angle;
+            auto real = operand->as_const_real();
+            auto integer = operand->as_const_int();
+            if (real && !k) {
+                angle = real->value;
+            } else if (integer && k) {
+                angle = 2.0 * M_PI / std::pow(2.0, (primitives::Real)integer->value);
+            } else {
+                continue;
+            }
+            return primitives::CMatrix({
+                1.0, 0.0, 0.0, 0.0,
+                0.0, 1.0, 0.0, 0.0,
+                0.0, 0.0, 1.0, 0.0,
+                0.0, 0.0, 0.0, std::polar(1.0, angle)
+            }, 4);
+        }
+        return primitives::CMatrix();
+    };
+}
+
+/**
+ * Registers the usual single-qubit gates (i, x, y, z, h, s, sdag, t, tdag,
+ * x90, y90, mx90, my90, rx, ry, and rz), the usual two-qubit gates (cnot, cz,
+ * swap, cr, and crk), as well as the generic one- and two-qubit unitary gate
+ * `u`, with the given analyzer, along with their GateMatrix annotations.
+ */
+void register_default_gates(analyzer::Analyzer &analyzer) {
+    using primitives::CMatrix;
+    using primitives::Complex;
+    const Complex i(0.0, 1.0);
+    const double r = std::sqrt(0.5);
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, 1.0}, 2)), "i", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({0.0, 1.0, 1.0, 0.0}, 2)), "x", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({0.0, -i, i, 0.0}, 2)), "y", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, -1.0}, 2)), "z", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({r, r, r, -r}, 2)), "h", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, i}, 2)), "s", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, -i}, 2)), "sdag", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, std::polar(1.0, M_PI / 4)}, 2)), "t", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({1.0, 0.0, 0.0, std::polar(1.0, -M_PI / 4)}, 2)), "tdag", "Q");
+    analyzer.register_instruction_with_annotation(fixed_rotation(primitives::Axis::X, M_PI / 2), "x90", "Q");
+    analyzer.register_instruction_with_annotation(fixed_rotation(primitives::Axis::Y, M_PI / 2), "y90", "Q");
+    analyzer.register_instruction_with_annotation(fixed_rotation(primitives::Axis::X, -M_PI / 2), "mx90", "Q");
+    analyzer.register_instruction_with_annotation(fixed_rotation(primitives::Axis::Y, -M_PI / 2), "my90", "Q");
+    analyzer.register_instruction_with_annotation(GateMatrix(rotation(primitives::Axis::X)), "rx", "Qr");
+    analyzer.register_instruction_with_annotation(GateMatrix(rotation(primitives::Axis::Y)), "ry", "Qr");
+    analyzer.register_instruction_with_annotation(GateMatrix(rotation(primitives::Axis::Z)), "rz", "Qr");
+    analyzer.register_instruction_with_annotation(GateMatrix(matrix_operand), "u", "Qu");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({
+        1.0, 0.0, 0.0, 0.0,
+        0.0, 1.0, 0.0, 0.0,
+        0.0, 0.0, 0.0, 1.0,
+        0.0, 0.0, 1.0, 0.0
+    }, 4)), "cnot", "QQ");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({
+        1.0, 0.0, 0.0, 0.0,
+        0.0, 1.0, 0.0, 0.0,
+        0.0, 0.0, 1.0, 0.0,
+        0.0, 0.0, 0.0, -1.0
+    }, 4)), "cz", "QQ");
+    analyzer.register_instruction_with_annotation(GateMatrix(CMatrix({
+        1.0, 0.0, 0.0, 0.0,
+        0.0, 0.0, 1.0, 0.0,
+        0.0, 1.0, 0.0, 0.0,
+        0.0, 0.0, 0.0, 1.0
+    }, 4)), "swap", "QQ");
+    analyzer.register_instruction_with_annotation(GateMatrix(controlled_phase(false)), "cr", "QQr");
+    analyzer.register_instruction_with_annotation(GateMatrix(controlled_phase(true)), "crk", "QQi");
+    analyzer.register_instruction_with_annotation(GateMatrix(matrix_operand), "u", "QQu");
+}
+
+/**
+ * State of the single-qubit gate fusion pass for a single subcircuit.
+ */
+class FusionHelper {
+public:
+
+    /**
+     * A run of fusable gates on a single qubit.
+     */
+    struct Run {
+
+        /**
+         * Indices of the bundles containing the gates of this run.
+         */
+        std::vector<size_t> bundles;
+
+        /**
+         * The product of the matrices of the gates in this run.
+         */
+        Matrix2 matrix;
+
+    };
+
+    /**
+     * The subcircuit being optimized.
+     */
+    semantic::Subcircuit &subcircuit;
+
+    /**
+     * The analyzer used to resolve fused instructions.
+     */
+    const analyzer::Analyzer &analyzer;
+
+    /**
+     * The name of the fused instruction.
+     */
+    const std::string &name;
+
+    /**
+     * The current run for each qubit.
+     */
+    std::vector<Run> runs;
+
+    /**
+     * The qubits that currently have a nonempty run.
+     */
+    std::vector<size_t> active;
+
+    /**
+     * Which bundles are to be removed.
+     */
+    std::vector<bool> removed;
+
+    /**
+     * Number of instructions removed so far.
+     */
+    size_t num_removed;
+
+    /**
+     * Creates the helper for the given subcircuit.
+     */
+    FusionHelper(
+        semantic::Subcircuit &subcircuit,
+        const analyzer::Analyzer &analyzer,
+        const std::string &name
+    ) :
+        subcircuit(subcircuit),
+        analyzer(analyzer),
+        name(name),
+        removed(subcircuit.bundles.size(), false),
+        num_removed(0)
+    {}
+
+    /**
+     * Returns whether the given instruction can be fused. If so, qubit and
+     * matrix are set accordingly.
+     */
+    static bool is_fusable(const semantic::Instruction &insn, size_t &qubit, Matrix2 &matrix) {
+        auto condition = insn.condition->as_const_bool();
+        if (!condition || !condition->value) {
+            return false;
+        }
+        const values::QubitRefs *qubit_refs = nullptr;
+        for (const auto &operand : insn.operands) {
+            if (auto refs = operand->as_qubit_refs()) {
+                if (qubit_refs || refs->index.size() != 1) {
+                    return false;
+                }
+                qubit_refs = refs;
+            } else if (operand->as_bit_refs()) {
+                return false;
+            }
+        }
+        if (!qubit_refs || qubit_refs->index[0]->value < 0) {
+            return false;
+        }
+        auto cmatrix = matrix_of(insn);
+        if (cmatrix.size_rows() != 2 || cmatrix.size_cols() != 2) {
+            return false;
+        }
+        qubit = qubit_refs->index[0]->value;
+        matrix = Matrix2::from_cmatrix(cmatrix);
+        return true;
+    }
+
+    /**
+     * Adds a fusable gate in the given bundle to the run for the given qubit.
+     */
+    void extend(size_t qubit, size_t bundle, const Matrix2 &matrix) {
+        if (qubit >= runs.size()) {
+            runs.resize(qubit + 1);
+        }
+        auto &run = runs[qubit];
+        if (run.bundles.empty()) {
+            run.matrix = matrix;
+            active.push_back(qubit);
+        } else {
+            run.matrix = matrix * run.matrix;
+        }
+        run.bundles.push_back(bundle);
+    }
+
+    /**
+     * Ends the run for the given qubit, replacing it with a single
+     * instruction if it consists of more than one gate.
+     */
+    void flush(size_t qubit) {
+        if (qubit >= runs.size()) {
+            return;
+        }
+        auto &run = runs[qubit];
+        if (run.bundles.size() > 1) {
+            auto &last = subcircuit.bundles[run.bundles.back()]->items[0];
+
+            // Construct the operand list of the fused instruction. We make a
+            // new qubit reference rather than sharing the node of the
+            // original instruction.
+            values::Values operands;
+            auto qubit_refs = tree::make<values::QubitRefs>();
+            qubit_refs->index.add(tree::make<values::ConstInt>(qubit));
+            for (const auto &operand : last->operands) {
+                if (operand->as_qubit_refs()) {
+                    qubit_refs->copy_annotation<parser::SourceLocation>(*operand);
+                }
+            }
+            operands.add(qubit_refs);
+            operands.add(tree::make<values::ConstComplexMatrix>(run.matrix.to_cmatrix()));
+
+            // Resolve the instruction and replace the last gate of the run
+            // with it.
+            auto fused = analyzer.resolve_instruction(name, operands);
+            fused->copy_annotation<parser::SourceLocation>(*last);
+            last = fused;
+
+            // Remove the other gates.
+            for (size_t i = 0; i < run.bundles.size() - 1; i++) {
+                removed[run.bundles[i]] = true;
+            }
+            num_removed += run.bundles.size() - 1;
+
+        }
+        run.bundles.clear();
+    }
+
+    /**
+     * Ends all runs.
+     */
+    void flush_all() {
+        for (auto qubit : active) {
+            flush(qubit);
+        }
+        active.clear();
+    }
+
+    /**
+     * Runs the pass on the subcircuit.
+     */
+    void run() {
+        for (size_t bundle_index = 0; bundle_index < subcircuit.bundles.size(); bundle_index++) {
+            const auto &bundle = *subcircuit.bundles[bundle_index];
+
+            // Handle fusable gates.
+            size_t qubit;
+            Matrix2 matrix;
+            if (bundle.items.size() == 1 && is_fusable(*bundle.items[0], qubit, matrix)) {
+                extend(qubit, bundle_index, matrix);
+                continue;
+            }
+
+            // Anything else ends the runs for the qubits it uses, or all runs
+            // if it doesn't use any qubits.
+            for (const auto &insn : bundle.items) {
+                bool uses_qubits = false;
+                for (const auto &operand : insn->operands) {
+                    if (auto refs = operand->as_qubit_refs()) {
+                        for (const auto &index : refs->index) {
+                            if (index->value >= 0) {
+                                flush(index->value);
+                            }
+                            uses_qubits = true;
+                        }
+                    }
+                }
+                if (!uses_qubits) {
+                    flush_all();
+                }
+            }
+
+        }
+        flush_all();
+
+        // Remove the bundles of the gates that were fused away.
+        if (num_removed) {
+            tree::Any<semantic::Bundle> bundles;
+            for (size_t bundle_index = 0; bundle_index < subcircuit.bundles.size(); bundle_index++) {
+                if (!removed[bundle_index]) {
+                    bundles.add(subcircuit.bundles[bundle_index]);
+                }
+            }
+            subcircuit.bundles = std::move(bundles);
+        }
+
+    }
+
+};
+
+/**
+ * Fuses runs of consecutive single-qubit gates on the same qubit into a
+ * single instruction with a constant-folded matrix operand. The fused
+ * instruction is resolved by the given analyzer using the given name and
+ * the operand types (qubit, complex matrix), so the analyzer must know such
+ * an instruction; `u` as registered by register_default_gates() works.
+ *
+ * Only gates that are in a bundle on their own, are unconditional, operate
+ * on exactly one qubit, and have a 2x2 matrix according to matrix_of() are
+ * fused. A run on a qubit is broken by any other instruction using that
+ * qubit, by any instruction that does not use any qubits (these are assumed
+ * to act on the whole machine), and by subcircuit boundaries. Runs of length
+ * one are left as they are. The fused instruction takes the place and source
+ * location of the last gate of its run; the annotations of the fused gates
+ * are dropped. Returns the number of instructions that were removed.
+ */
+size_t fuse_single_qubit_gates(
+    semantic::Program &program,
+    const analyzer::Analyzer &analyzer,
+    const std::string &name
+) {
+    size_t num_removed = 0;
+    for (auto &subcircuit : program.subcircuits) {
+        FusionHelper helper(*subcircuit, analyzer, name);
+        helper.run();
+        num_removed += helper.num_removed;
+    }
+    return num_removed;
+}
+
+} // namespace unitary
+} // namespace cqasm
@@ -50,29 +50,34 @@ Value promote(const Value &value, const types::Type &type) {
             break;
 
         case TypeEnum::Real:
-            if (auto const_int = value->as_const_int()) {
-                if (!type->assignable) {
-                    retval = tree::make<values::ConstReal>(const_int->value);
-                }
-            } else if (auto const_real = value->as_const_real()) {
-                if (!type->assignable) {
-                    retval = tree::make<values::ConstReal>(const_real->value);
+            if (!type->assignable) {
+                switch (value->type()) {
+                    case ValueEnum::ConstInt:
+                        retval = tree::make<values::ConstReal>(static_cast<const ConstInt&>(*value).value);
+                        break;
+                    case ValueEnum::ConstReal:
+                        retval = tree::make<values::ConstReal>(static_cast<const ConstReal&>(*value).value);
+                        break;
+                    default:
+                        break;
                 }
             }
             break;
 
         case TypeEnum::Complex:
-            if (auto const_int = value->as_const_int()) {
-                if (!type->assignable) {
-                    retval = tree::make<values::ConstComplex>(const_int->value);
-                }
-            } else if (auto const_real = value->as_const_real()) {
-                if (!type->assignable) {
-                    retval = tree::make<values::ConstComplex>(const_real->value);
-                }
-            } else if (auto const_complex = value->as_const_complex()) {
-                if (!type->assignable) {
-                    retval = tree::make<values::ConstComplex>(const_complex->value);
+            if (!type->assignable) {
+                switch (value->type()) {
+                    case ValueEnum::ConstInt:
+                        retval = tree::make<values::ConstComplex>(static_cast<const ConstInt&>(*value).value);
+                        break;
+                    case ValueEnum::ConstReal:
+                        retval = tree::make<values::ConstComplex>(static_cast<const ConstReal&>(*value).value);
+                        break;
+                    case ValueEnum::ConstComplex:
+                        retval = tree::make<values::ConstComplex>(static_cast<const ConstComplex&>(*value).value);
+                        break;
+                    default:
+                        break;
                 }
             }
             break;
@@ -97,12 +102,32 @@ Value promote(const Value &value, const types::Type &type) {
             if (auto const_complex_matrix = value->as_const_complex_matrix()) {
                 if (!type->assignable) {
                     // Match matrix size. Negative sizes in the type mean unconstrained.
-                    if ((ssize_t) const_complex_matrix->value.size_rows() == mat_type->num_rows || mat_type->num_rows < 0) {
-                        if ((ssize_t) const_complex_matrix->value.size_cols() == mat_type->num_cols || mat_type->num_cols < 0) {
+                    if ((ssize_t) const_complex_matrix->value->size_rows() == mat_type->num_rows || mat_type->num_rows < 0) {
+                        if ((ssize_t) const_complex_matrix->value->size_cols() == mat_type->num_cols || mat_type->num_cols < 0) {
                             retval = tree::make<values::ConstComplexMatrix>(const_complex_matrix->value);
                         }
                     }
                 }
+            } else if (auto const_sparse_matrix = value->as_const_sparse_complex_matrix()) {
+                if (!type->assignable) {
+                    // Match matrix size. Negative sizes in the type mean
+                    // unconstrained. The sparse representation is kept; it's
+                    // only converted to a dense matrix when needed.
+                    if ((ssize_t) const_sparse_matrix->value.size_rows() == mat_type->num_rows || mat_type->num_rows < 0) {
+                        if ((ssize_t) const_sparse_matrix->value.size_cols() == mat_type->num_cols || mat_type->num_cols < 0) {
+                            retval = tree::make<values::ConstSparseComplexMatrix>(const_sparse_matrix->value);
+                        }
+                    }
+                }
+            } else if (auto const_controlled_matrix = value->as_const_controlled_complex_matrix()) {
+                if (!type->assignable) {
+                    // Same as above, for controlled matrices.
+                    if ((ssize_t) const_controlled_matrix->value.size_rows() == mat_type->num_rows || mat_type->num_rows < 0) {
+                        if ((ssize_t) const_controlled_matrix->value.size_cols() == mat_type->num_cols || mat_type->num_cols < 0) {
+                            retval = tree::make<values::ConstControlledComplexMatrix>(const_controlled_matrix->value);
+                        }
+                    }
+                }
             } else if (auto const_real_matrix = value->as_const_real_matrix()) {
                 if (!type->assignable) {
                     // Match matrix size. Negative sizes in the type mean unconstrained.
@@ -178,36 +203,43 @@ Value promote(const Value &value, const types::Type &type) {
  * Returns the type of the given value.
  */
 types::Type type_of(const Value &value) {
-    if (value->as_const_bool()) {
-        return tree::make<types::Bool>(false);
-    } else if (value->as_const_axis()) {
-        return tree::make<types::Axis>(false);
-    } else if (value->as_const_int()) {
-        return tree::make<types::Int>(false);
-    } else if (value->as_const_real()) {
-        return tree::make<types::Real>(false);
-    } else if (value->as_const_complex()) {
-        return tree::make<types::Complex>(false);
-    } else if (auto const_real_matrix = value->as_const_real_matrix()) {
-        return tree::make<types::RealMatrix>(
-            const_real_matrix->value.size_rows(),
-            const_real_matrix->value.size_cols(),
-            false);
-    } else if (auto const_complex_matrix = value->as_const_complex_matrix()) {
-        return tree::make<types::ComplexMatrix>(
-            const_complex_matrix->value.size_rows(),
-            const_complex_matrix->value.size_cols(),
-            false);
-    } else if (value->as_const_string()) {
-        return tree::make<types::String>(false);
-    } else if (value->as_const_json()) {
-        return tree::make<types::Json>(false);
-    } else if (value->as_qubit_refs()) {
-        return tree::make<types::Qubit>(true);
-    } else if (value->as_bit_refs()) {
-        return tree::make<types::Bool>(true);
-    } else {
-        throw std::runtime_error("unknown type!");
+    switch (value->type()) {
+        case ValueEnum::ConstBool:
+            return tree::make<types::Bool>(false);
+        case ValueEnum::ConstAxis:
+            return tree::make<types::Axis>(false);
+        case ValueEnum::ConstInt:
+            return tree::make<types::Int>(false);
+        case ValueEnum::ConstReal:
+            return tree::make<types::Real>(false);
+        case ValueEnum::ConstComplex:
+            return tree::make<types::Complex>(false);
+        case ValueEnum::ConstRealMatrix: {
+            auto &matrix = static_cast<const ConstRealMatrix&>(*value).value;
+            return tree::make<types::RealMatrix>(matrix.size_rows(), matrix.size_cols(), false);
+        }
+        case ValueEnum::ConstComplexMatrix: {
+            auto &matrix = static_cast<const ConstComplexMatrix&>(*value).value.get();
+            return tree::make<types::ComplexMatrix>(matrix.size_rows(), matrix.size_cols(), false);
+        }
+        case ValueEnum::ConstSparseComplexMatrix: {
+            auto &matrix = static_cast<const ConstSparseComplexMatrix&>(*value).value;
+            return tree::make<types::ComplexMatrix>(matrix.size_rows(), matrix.size_cols(), false);
+        }
+        case ValueEnum::ConstControlledComplexMatrix: {
+            auto &matrix = static_cast<const ConstControlledComplexMatrix&>(*value).value;
+            return tree::make<types::ComplexMatrix>(matrix.size_rows(), matrix.size_cols(), false);
+        }
+        case ValueEnum::ConstString:
+            return tree::make<types::String>(false);
+        case ValueEnum::ConstJson:
+            return tree::make<types::Json>(false);
+        case ValueEnum::QubitRefs:
+            return tree::make<types::Qubit>(true);
+        case ValueEnum::BitRefs:
+            return tree::make<types::Bool>(true);
+        default:
+            throw std::runtime_error("unknown type!");
     }
 }
 
@@ -216,7 +248,7 @@ types::Type type_of(const Value &value) {
  */
 types::Types types_of(const Values &values) {
     types::Types types;
-    for (auto value : values) {
+    for (const auto &value : values) {
         types.add(type_of(value));
     }
     return types;
@@ -237,11 +269,43 @@ void check_const(const Value &value) {
  * if it doesn't have a known value at this time.
  */
 void check_const(const Values &values) {
-    for (auto value : values) {
+    for (const auto &value : values) {
         check_const(value);
     }
 }
 
+/**
+ * Returns the given complex matrix value as a dense matrix. Sparse and
+ * controlled matrices are converted; this is needed wherever the elements of
+ * a complex matrix operand are accessed directly, since promote() keeps these
+ * representations as they are. Returns an empty matrix if the value is not a
+ * constant complex matrix.
+ */
+primitives::CMatrix dense_complex_matrix(const Value &value) {
+    if (auto matrix = value->as_const_complex_matrix()) {
+        return matrix->value.get();
+    } else if (auto sparse = value->as_const_sparse_complex_matrix()) {
+        return sparse->value.to_dense();
+    } else if (auto controlled = value->as_const_controlled_complex_matrix()) {
+        return controlled->value.to_dense();
+    }
+    return primitives::CMatrix();
+}
+
+/**
+ * Like dense_complex_matrix(), but returns a reference to the stored matrix
+ * if the value is a dense matrix already, and only converts the value into
+ * the given storage otherwise. The result may refer to the value or to the
+ * storage, so it must not outlive either.
+ */
+const primitives::CMatrix &dense_complex_matrix(const Value &value, primitives::CMatrix &storage) {
+    if (auto matrix = value->as_const_complex_matrix()) {
+        return matrix->value.get();
+    }
+    storage = dense_complex_matrix(value);
+    return storage;
+}
+
 
 } // namespace values
 } // namespace cqasm
@@ -0,0 +1,226 @@
+#include <gtest/gtest.h> // googletest header file
+
+#include <cqasm.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <sstream>
+
+/**
+ * Number of heap allocations made by this process so far, counted by the
+ * replacement of operator new below.
+ */
+static std::atomic<size_t> allocations(0);
+
+/**
+ * The replacements below must not be inlined into their callers: GCC would
+ * then see a pointer from operator new reach free() directly, and report it
+ * with -Wmismatched-new-delete.
+ */
+#if defined(__GNUC__)
+#define COMPLEXITY_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define COMPLEXITY_NOINLINE __declspec(noinline)
+#else
+#define COMPLEXITY_NOINLINE
+#endif
+
+COMPLEXITY_NOINLINE void *operator new(size_t size) {
+    allocations++;
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+COMPLEXITY_NOINLINE void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+COMPLEXITY_NOINLINE void operator delete(void *ptr, size_t size) noexcept {
+    (void)size;
+    std::free(ptr);
+}
+
+/**
+ * Time and number of allocations needed for one run of a workload.
+ */
+struct Cost {
+    double seconds;
+    size_t allocations;
+};
+
+/**
+ * Returns the allowed growth in time from size n to 8n. Linear code grows by
+ * about 8x, and a path with a significant quadratic term by well over 30x at
+ * these sizes. Timing is noisy on loaded machines and under sanitizers, so
+ * the default bound is generous; setting the CQASM_TEST_TIMING environment
+ * variable tightens it for runs on a quiet machine.
+ */
+static double time_growth_bound() {
+    static const double bound = std::getenv("CQASM_TEST_TIMING") != nullptr ? 14.0 : 30.0;
+    return bound;
+}
+
+/**
+ * Runs the given workload for size n, and returns its time and number of
+ * allocations. The workload is run a few times and the lowest values are
+ * returned, to filter out noise.
+ */
+static Cost measure(const std::function<void(size_t)> &workload, size_t n) {
+    Cost best = {1e30, static_cast<size_t>(-1)};
+    for (int run = 0; run < 3; run++) {
+        size_t allocations_before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        workload(n);
+        auto stop = std::chrono::steady_clock::now();
+        best.seconds = std::min(best.seconds, std::chrono::duration<double>(stop - start).count());
+        best.allocations = std::min(best.allocations, allocations.load() - allocations_before);
+    }
+    return best;
+}
+
+/**
+ * Runs the given workload at sizes n, 2n, 4n and 8n, and checks that
+ * allocations and time grow about linearly. Allocation counts are exact, so
+ * they are checked for every doubling. Time is only checked from n to 8n,
+ * against time_growth_bound().
+ */
+static void expect_linear(const std::function<void(size_t)> &workload, size_t n) {
+    workload(n);
+    Cost previous = measure(workload, n);
+    Cost first = previous;
+    for (size_t size = 2 * n; size <= 8 * n; size *= 2) {
+        Cost cost = measure(workload, size);
+        EXPECT_LE(cost.allocations, 2.5 * previous.allocations) << "allocations at size " << size;
+        previous = cost;
+    }
+    EXPECT_LE(previous.allocations, 10 * first.allocations) << "allocations at size " << 8 * n;
+    EXPECT_LE(previous.seconds, time_growth_bound() * first.seconds) << "time at size " << 8 * n;
+}
+
+/**
+ * Parses and analyzes the given cQASM code, and returns the number of
+ * errors.
+ */
+static size_t analyze(const cqasm::analyzer::Analyzer &a, const std::string &code) {
+    auto parsed = cqasm::parser::parse_string(code, "test.cq");
+    EXPECT_TRUE(parsed.errors.empty());
+    return a.analyze(*parsed.root->as_program()).errors.size();
+}
+
+/**
+ * Returns an analyzer with the default functions and mappings, and an
+ * instruction with overloads that don't match a single qubit operand, such
+ * that resolution has to retry.
+ */
+static cqasm::analyzer::Analyzer make_analyzer() {
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Qb");
+    a.register_instruction("x", "Qi");
+    a.register_instruction("x", "Q");
+    return a;
+}
+
+TEST(complexity, mapping_resolution) {
+    auto a = make_analyzer();
+
+    // Every instruction indexes the full qubit register, which used to be
+    // copied for every reference.
+    expect_linear([&a](size_t n) {
+        std::ostringstream ss;
+        ss << "version 1.0\nqubits " << n << "\n";
+        for (size_t i = 0; i < n; i++) {
+            ss << "x q[" << i << "]\n";
+        }
+        EXPECT_EQ(analyze(a, ss.str()), 0u);
+    }, 1000);
+}
+
+TEST(complexity, any_add_with_position) {
+
+    // Inserting at the front or in the middle shifts the elements after the
+    // position, so a fixed number of such inserts must cost time linear in
+    // the size of the list, without allocating anything but the nodes.
+    expect_linear([](size_t n) {
+        cqasm::tree::Any<cqasm::values::ConstInt> list;
+        for (size_t i = 0; i < n; i++) {
+            list.add(cqasm::tree::make<cqasm::values::ConstInt>(i));
+        }
+        for (size_t i = 0; i < 100; i++) {
+            list.add(cqasm::tree::make<cqasm::values::ConstInt>(-1), 0);
+            list.add(cqasm::tree::make<cqasm::values::ConstInt>(-2), list.size() / 2);
+        }
+        EXPECT_EQ(list.size(), n + 200);
+        EXPECT_EQ(list[0]->value, -1);
+        EXPECT_EQ(list.back()->value, (cqasm::primitives::Int)n - 1);
+    }, 20000);
+}
+
+TEST(complexity, bundle_extension) {
+    auto a = make_analyzer();
+
+    // A multi-line bundle is built by extending the bundle of the lines so
+    // far with each next line.
+    expect_linear([&a](size_t n) {
+        std::ostringstream ss;
+        ss << "version 1.0\nqubits " << n << "\n{\n";
+        for (size_t i = 0; i < n; i++) {
+            ss << "x q[" << i << "]\n";
+        }
+        ss << "}\n";
+        EXPECT_EQ(analyze(a, ss.str()), 0u);
+    }, 1000);
+}
+
+TEST(complexity, bundle_conflicts) {
+    auto a = make_analyzer();
+    a.enable_bundle_conflict_check();
+
+    // The conflict check marks every qubit of a bundle in a bitset, and
+    // clears only the words that it touched afterwards.
+    expect_linear([&a](size_t n) {
+        std::ostringstream ss;
+        ss << "version 1.0\nqubits " << 2 * n << "\n";
+        for (size_t i = 0; i < 20; i++) {
+            ss << "{ x q[0:" << n - 1 << "] | x q[" << n << ":" << 2 * n - 1 << "] }\n";
+        }
+        EXPECT_EQ(analyze(a, ss.str()), 0u);
+    }, 500);
+}
+
+TEST(complexity, overload_resolution) {
+    auto a = make_analyzer();
+
+    // Every overload that is tried promotes the full operand list.
+    expect_linear([&a](size_t n) {
+        std::ostringstream ss;
+        ss << "version 1.0\nqubits " << n << "\n";
+        for (size_t i = 0; i < 20; i++) {
+            ss << "x q[0:" << n - 1 << "]\n";
+        }
+        EXPECT_EQ(analyze(a, ss.str()), 0u);
+    }, 500);
+}
+
+TEST(complexity, error_messages) {
+    auto a = make_analyzer();
+
+    // Every instruction fails to resolve, and the message lists the types
+    // of all its operands.
+    expect_linear([&a](size_t n) {
+        std::ostringstream ss;
+        ss << "version 1.0\nqubits " << n << "\n";
+        for (size_t i = 0; i < n; i++) {
+            ss << "x q[" << i << "], 1.5";
+            for (size_t j = 0; j < 10; j++) {
+                ss << ", " << j;
+            }
+            ss << "\n";
+        }
+        EXPECT_EQ(analyze(a, ss.str()), n);
+    }, 250);
+}
@@ -0,0 +1,1651 @@
+#include <gtest/gtest.h> // googletest header file
+
+#include <cqasm.hpp>
+#include <cqasm-unitary.hpp>
+#include <cqasm-peephole.hpp>
+#include <cqasm-scheduler.hpp>
+#include <cqasm-registers.hpp>
+#include <cqasm-simulator.hpp>
+#include <cqasm-compact.hpp>
+#include <cqasm-trace.hpp>
+#include <cqasm-memory.hpp>
+#include <cqasm-diff.hpp>
+#include <cqasm-intern.hpp>
+#include <cqasm-c.h>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/**
+ * Parses and analyzes the given cQASM code, expecting no errors.
+ */
+static cqasm::tree::One<cqasm::semantic::Program> analyze(
+    const cqasm::analyzer::Analyzer &a,
+    const std::string &code
+) {
+    auto r = cqasm::parser::parse_string(code, "test.cq");
+    for (auto err : r.errors) {
+        EXPECT_EQ(err, "");
+    }
+    auto r2 = a.analyze(*r.root->as_program());
+    for (auto err : r2.errors) {
+        EXPECT_EQ(err, "");
+    }
+    return r2.root;
+}
+
+/**
+ * Returns the instruction names of the given subcircuit, one per bundle.
+ */
+static std::vector<std::string> names(const cqasm::semantic::Subcircuit &subcircuit) {
+    std::vector<std::string> result;
+    for (const auto &bundle : subcircuit.bundles) {
+        std::string name;
+        for (const auto &insn : bundle->items) {
+            name += (name.empty() ? "" : "|") + insn->name.get();
+        }
+        result.push_back(name);
+    }
+    return result;
+}
+
+/**
+ * Parses and analyzes the given cQASM code, expecting no parse errors, and
+ * returns the analysis errors.
+ */
+static std::vector<std::string> analysis_errors(
+    const cqasm::analyzer::Analyzer &a,
+    const std::string &code
+) {
+    auto r = cqasm::parser::parse_string(code, "test.cq");
+    for (auto err : r.errors) {
+        EXPECT_EQ(err, "");
+    }
+    return a.analyze(*r.root->as_program()).errors;
+}
+
+TEST(analyzer, bundle_conflicts) {
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("y", "Q");
+    a.register_instruction("cnot", "QQ", true, true, true);
+    a.register_instruction("measure", "QB");
+    std::string header = "version 1.0\nqubits 4096\n";
+
+    // The check is off by default.
+    EXPECT_TRUE(analysis_errors(a, header + "{ x q[0] | y q[0] }\n").empty());
+
+    a.enable_bundle_conflict_check();
+    auto errors = analysis_errors(a, header + "{ x q[0] | y q[0] }\n");
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("qubit with index 0 is used by more than one instruction"), std::string::npos);
+    errors = analysis_errors(a, header + "{ measure q[0], b[3] | measure q[1], b[3] }\n");
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("measurement bit with index 3 is used by more than one instruction"), std::string::npos);
+
+    // Reuse within a single instruction is governed by allow_reused_qubits,
+    // not by this check.
+    EXPECT_TRUE(analysis_errors(a, header + "{ cnot q[0], q[0] | x q[1] }\n").empty());
+
+    // Large single-gate-multiple-qubit bundles. The marks of each bundle
+    // must be cleared before the next, also in the last word.
+    errors = analysis_errors(a, header +
+        "{ x q[0:2047] | y q[2048:4095] }\n"
+        "x q[0:4095]\n"
+        "{ x q[0:4095] | y q[4095] }\n"
+        "{ x q[4095] | y q[0] }\n"
+    );
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("qubit with index 4095 is used"), std::string::npos);
+
+    // Indices outside of the register can come from initial mappings. These
+    // are checked as well, without growing the bitsets to their value.
+    cqasm::tree::Many<cqasm::values::ConstInt> far_index;
+    far_index.add(cqasm::tree::make<cqasm::values::ConstInt>(100000000000));
+    a.register_mapping("far", cqasm::tree::make<cqasm::values::QubitRefs>(far_index));
+    EXPECT_TRUE(analysis_errors(a, header + "{ x far | y q[0] }\n").empty());
+    errors = analysis_errors(a, header + "{ x far | y far }\nx far\n");
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("qubit with index 100000000000 is used"), std::string::npos);
+}
+
+TEST(analyzer, instruction_index) {
+    using cqasm::index::Position;
+    using cqasm::index::Positions;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("x", "Qr");
+    a.register_instruction("h", "Q");
+    a.register_instruction("measure", "Q");
+    auto parsed = cqasm::parser::parse_string(
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "{ X q[1] | h q[0] }\n"
+        ".sub\n"
+        "measure q[0]\n"
+        "x q[1], 0.5\n",
+        "test.cq"
+    );
+    ASSERT_TRUE(parsed.errors.empty());
+
+    // The index is not built by default.
+    auto result = a.analyze(*parsed.root->as_program());
+    ASSERT_TRUE(result.errors.empty());
+    EXPECT_TRUE(result.instruction_index.get_table().empty());
+    EXPECT_TRUE(result.instruction_index.find("x").empty());
+
+    a.enable_instruction_index();
+    result = a.analyze(*parsed.root->as_program());
+    ASSERT_TRUE(result.errors.empty());
+    const auto &index = result.instruction_index;
+    EXPECT_EQ(index.get_table().size(), 3u);
+
+    // Lookup by name is case insensitive, and returns the positions in
+    // program order.
+    EXPECT_EQ(index.find("X"), Positions({{0, 0, 0}, {0, 1, 0}, {1, 1, 0}}));
+    EXPECT_EQ(index.find("h"), Positions({{0, 1, 1}}));
+    EXPECT_EQ(index.find("measure"), Positions({{1, 0, 0}}));
+    EXPECT_EQ(index.count("x"), 3u);
+    EXPECT_EQ(index.count("cnot"), 0u);
+    for (const auto &position : index.find("x")) {
+        EXPECT_EQ(cqasm::utils::lowercase(cqasm::index::get(*result.root, position).name), "x");
+    }
+
+    // Lookup by descriptor only returns the instructions that resolved to
+    // the given overload.
+    EXPECT_EQ(
+        index.find(*result.root, cqasm::instruction::Instruction("x", "Qr")),
+        Positions({{1, 1, 0}})
+    );
+    EXPECT_EQ(
+        index.find(*result.root, cqasm::instruction::Instruction("x", "Q")),
+        Positions({{0, 0, 0}, {0, 1, 0}})
+    );
+    EXPECT_TRUE(index.find(*result.root, cqasm::instruction::Instruction("h", "QQ")).empty());
+}
+
+/**
+ * Returns the positions in the given range of a timeline index as a vector.
+ */
+static std::vector<uint32_t> flat_positions(const cqasm::index::FlatRange &range) {
+    return std::vector<uint32_t>(range.begin(), range.end());
+}
+
+TEST(analyzer, timeline_index) {
+    using cqasm::index::TimelineIndex;
+    using Flat = std::vector<uint32_t>;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("cnot", "QQ");
+    a.register_instruction("measure", "QB");
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 4\n"
+        ".a\n"
+        "x q[0]\n"
+        "{ x q[0] | x q[2] }\n"
+        ".b\n"
+        "cnot q[0], q[2]\n"
+        "measure q[2], b[2]\n"
+        ".c\n"
+        "c-x b[2], q[0]\n"
+        "x q[0, 2]\n"
+        ".d\n"
+        "x q[0]\n"
+    );
+    auto index = TimelineIndex::build(*program, 1);
+    ASSERT_EQ(index.size(), 8u);
+    EXPECT_EQ(index.locate(2), cqasm::index::Position({0, 1, 1}));
+    EXPECT_EQ(index.locate(7), cqasm::index::Position({3, 0, 0}));
+    EXPECT_THROW(index.locate(8), std::out_of_range);
+
+    // An instruction that uses a qubit more than once is listed once, and
+    // conditions count as uses of their bits.
+    EXPECT_EQ(index.qubits().size(), 3u);
+    EXPECT_EQ(flat_positions(index.qubit(0)), Flat({0, 1, 3, 5, 6, 7}));
+    EXPECT_EQ(flat_positions(index.qubit(2)), Flat({2, 3, 4, 6}));
+    EXPECT_EQ(index.bits().size(), 3u);
+    EXPECT_EQ(flat_positions(index.bit(2)), Flat({4, 5}));
+
+    // Indices that are never used, either below or above the highest used
+    // index, have no positions.
+    EXPECT_TRUE(index.qubit(1).empty());
+    EXPECT_TRUE(index.qubit(3).empty());
+    EXPECT_TRUE(index.qubit(1000, 0, 8).empty());
+    EXPECT_TRUE(index.bit(0).empty());
+
+    // Range queries are half-open.
+    EXPECT_EQ(flat_positions(index.qubit(0, 3, 7)), Flat({3, 5, 6}));
+    EXPECT_EQ(flat_positions(index.qubit(0, 5, 6)), Flat({5}));
+    EXPECT_EQ(flat_positions(index.qubit(0, 0, 100)), Flat({0, 1, 3, 5, 6, 7}));
+    EXPECT_TRUE(index.qubit(0, 3, 3).empty());
+    EXPECT_TRUE(index.qubit(0, 7, 3).empty());
+    EXPECT_TRUE(index.qubit(0, 8, 100).empty());
+    EXPECT_TRUE(index.qubit(1, 0, 8).empty());
+    EXPECT_EQ(flat_positions(index.bit(2, 5, 8)), Flat({5}));
+    EXPECT_TRUE(index.bit(2, 0, 4).empty());
+
+    // Building in parallel, with the subcircuits divided over the threads,
+    // gives the same index.
+    for (size_t threads : {2, 3, 4, 8, 0}) {
+        auto parallel = TimelineIndex::build(*program, threads);
+        ASSERT_EQ(parallel.size(), index.size());
+        for (uint32_t flat = 0; flat < index.size(); flat++) {
+            EXPECT_EQ(parallel.locate(flat), index.locate(flat));
+        }
+        EXPECT_EQ(parallel.qubits().offsets, index.qubits().offsets);
+        EXPECT_EQ(parallel.qubits().entries, index.qubits().entries);
+        EXPECT_EQ(parallel.bits().offsets, index.bits().offsets);
+        EXPECT_EQ(parallel.bits().entries, index.bits().entries);
+    }
+}
+
+TEST(passes, single_qubit_gate_fusion) {
+    using namespace cqasm::unitary;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    register_default_gates(a);
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 2\n"
+        "rx q[0], 0.5\n"
+        "ry q[0], 0.25\n"
+        "h q[1]\n"
+        "rz q[0], 1.0\n"
+        "cnot q[0], q[1]\n"
+        "x q[0]\n"
+        "c-x b[0], q[0]\n"
+        "x q[0]\n"
+        "{ x q[1] | y q[0] }\n"
+        "x q[0]\n"
+        "y q[0]\n"
+        ".next\n"
+        "z q[0]\n"
+    );
+
+    EXPECT_EQ(fuse_single_qubit_gates(*program, a), 3u);
+    EXPECT_EQ(names(*program->subcircuits[0]), std::vector<std::string>({
+        "h", "u", "cnot", "x", "x", "x", "x|y", "u"
+    }));
+    EXPECT_EQ(names(*program->subcircuits[1]), std::vector<std::string>({"z"}));
+
+    // Check the fused matrix against the product of the individual gates.
+    const auto &fused = *program->subcircuits[0]->bundles[1]->items[0];
+    auto expected = Matrix2::identity();
+    for (auto gate : {"rx", "ry", "rz"}) {
+        cqasm::values::Values operands;
+        operands.add(cqasm::tree::make<cqasm::values::QubitRefs>());
+        operands.add(cqasm::tree::make<cqasm::values::ConstReal>(
+            std::string(gate) == "rx" ? 0.5 : std::string(gate) == "ry" ? 0.25 : 1.0));
+        expected = Matrix2::from_cmatrix(matrix_of(*a.resolve_instruction(gate, operands))) * expected;
+    }
+    auto actual = Matrix2::from_cmatrix(matrix_of(fused));
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_NEAR(std::abs(actual.m[i] - expected.m[i]), 0.0, 1e-12);
+    }
+}
+
+TEST(passes, peephole) {
+    using namespace cqasm::peephole;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    cqasm::unitary::register_default_gates(a);
+    a.register_instruction("measure", "Q");
+    RuleTable rules(a);
+    rules.add_default_rules();
+    EXPECT_THROW(rules.add({"x"}, {"y"}), std::invalid_argument);
+    EXPECT_THROW(rules.add({"foo", "foo"}), cqasm::error::AnalysisError);
+
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 3\n"
+        "h q[0]\n"
+        "x q[1]\n"
+        "z q[0]\n"
+        "h q[0]\n"
+        "x q[0]\n"
+        "cnot q[1], q[2]\n"
+        "cnot q[1], q[2]\n"
+        "cnot q[2], q[1]\n"
+        "x q[1]\n"
+        "y q[2]\n"
+        "measure q[2]\n"
+        "y q[2]\n"
+        "s q[0]\n"
+        "h q[0]\n"
+        "h q[0]\n"
+        "s q[0]\n"
+        "c-z b[0], q[0]\n"
+        "z q[0]\n"
+    );
+
+    // h;z;h -> x, which then cancels with the following x. The two cnots on
+    // (1, 2) cancel, but the cnot with swapped operands does not match them
+    // and separates the x gates on qubit 1. The y gates on qubit 2 are
+    // separated by a measurement. h;h cancels, after which s;s becomes z.
+    // The conditional z does not participate.
+    EXPECT_EQ(optimize(*program, rules), 9u);
+    EXPECT_EQ(names(*program->subcircuits[0]), std::vector<std::string>({
+        "x", "cnot", "x", "y", "measure", "y", "z", "z", "z"
+    }));
+}
+
+TEST(passes, scheduler) {
+    using namespace cqasm::scheduler;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    cqasm::unitary::register_default_gates(a);
+    a.register_instruction("measure", "Q");
+    a.register_instruction("wait", "i", false, false);
+    a.register_instruction_with_annotation(ResourceUsage({"awg"}), "a", "Q");
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 3\n"
+        "x q[0]\n"
+        "y q[1]\n"
+        "z q[2]\n"
+        "cnot q[0], q[1]\n"
+        "measure q[2]\n"
+        "c-x b[2], q[0]\n"
+        "h q[1]\n"
+        "wait 1\n"
+        "a q[0]\n"
+        "a q[1]\n"
+        "x q[2]\n"
+        "a q[2]\n"
+        "{ x q[0] | y q[1] }\n"
+    );
+
+    // The conditional x has to wait for the measurement of q[2], the wait
+    // instruction is a barrier, and the a gates share a resource.
+    auto report = schedule(*program);
+    EXPECT_EQ(report.bundles_before, 13u);
+    EXPECT_EQ(report.bundles_after, 7u);
+    EXPECT_EQ(names(*program->subcircuits[0]), std::vector<std::string>({
+        "x|y|z", "cnot|measure", "x|h", "wait", "a|x", "a", "a|x|y"
+    }));
+}
+
+TEST(passes, register_compaction) {
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 10\n"
+        "map q[7], ancilla\n"
+        "x q[2]\n"
+        "measure ancilla\n"
+        "c-x b[7], q[2]\n"
+        "cnot q[7], q[2]\n"
+        "{ x ancilla | y q[2] }\n"
+    );
+
+    auto map = cqasm::registers::compact(*program);
+    EXPECT_EQ(program->num_qubits, 2);
+    EXPECT_EQ(map.new_to_old, std::vector<cqasm::primitives::Int>({2, 7}));
+    EXPECT_EQ(map.old_to_new[7], 1);
+    EXPECT_EQ(map.old_to_new[5], -1);
+
+    // Dump the references of all instructions and the mapping.
+    auto refs = [](const cqasm::values::Value &value) {
+        std::ostringstream ss;
+        const cqasm::tree::Many<cqasm::values::ConstInt> *indices = nullptr;
+        if (auto qubit_refs = value->as_qubit_refs()) {
+            ss << "q";
+            indices = &qubit_refs->index;
+        } else if (auto bit_refs = value->as_bit_refs()) {
+            ss << "b";
+            indices = &bit_refs->index;
+        } else {
+            return std::string("-");
+        }
+        for (const auto &index : *indices) {
+            ss << index->value;
+        }
+        return ss.str();
+    };
+    std::ostringstream ss;
+    for (const auto &bundle : program->subcircuits[0]->bundles) {
+        for (const auto &insn : bundle->items) {
+            ss << insn->name << " " << refs(insn->condition);
+            for (const auto &operand : insn->operands) {
+                ss << " " << refs(operand);
+            }
+            ss << "\n";
+        }
+    }
+    ss << refs(program->mappings[0]->value) << "\n";
+    EXPECT_EQ(ss.str(),
+        "x - q0\n"
+        "measure - q1\n"
+        "x b1 q0\n"
+        "cnot - q1 q0\n"
+        "x - q1\n"
+        "y - q0\n"
+        "q1\n"
+    );
+}
+
+TEST(passes, simulator) {
+    using cqasm::primitives::Complex;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    cqasm::unitary::register_default_gates(a);
+    a.register_instruction("measure", "Q");
+    auto sim = cqasm::simulator::Simulator(1, 42);
+
+    // GHZ state.
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 3\n"
+        "h q[0]\n"
+        "cnot q[0], q[1]\n"
+        "cnot q[1], q[2]\n"
+    );
+    sim.run(*program);
+    EXPECT_NEAR(std::abs(sim.get_amplitude(0) - Complex(std::sqrt(0.5))), 0.0, 1e-12);
+    EXPECT_NEAR(std::abs(sim.get_amplitude(7) - Complex(std::sqrt(0.5))), 0.0, 1e-12);
+    EXPECT_NEAR(sim.get_probability(2), 0.5, 1e-12);
+
+    // Measurement collapses all qubits, and conditional gates and subcircuit
+    // iterations are honoured: q[2] is flipped back to zero if it was one,
+    // and q[0] is flipped three times.
+    program = analyze(a,
+        "version 1.0\n"
+        "qubits 3\n"
+        "h q[0]\n"
+        "cnot q[0], q[1]\n"
+        "cnot q[1], q[2]\n"
+        "measure q[0]\n"
+        "measure q[1:2]\n"
+        "c-x b[2], q[2]\n"
+        ".loop(3)\n"
+        "x q[0]\n"
+    );
+    for (int i = 0; i < 8; i++) {
+        sim.run(*program);
+        EXPECT_EQ(sim.get_bits()[0], sim.get_bits()[1]);
+        EXPECT_EQ(sim.get_bits()[1], sim.get_bits()[2]);
+        EXPECT_NEAR(sim.get_probability(0), sim.get_bits()[1] ? 0.0 : 1.0, 1e-12);
+        EXPECT_NEAR(sim.get_probability(2), 0.0, 1e-12);
+    }
+
+    // Fusing single-qubit gates does not change the final state.
+    program = analyze(a,
+        "version 1.0\n"
+        "qubits 3\n"
+        "rx q[0], 0.5\n"
+        "ry q[0], 0.25\n"
+        "h q[1]\n"
+        "t q[1]\n"
+        "cr q[1], q[0], 0.75\n"
+        "rz q[0], 1.0\n"
+        "x90 q[0]\n"
+        "swap q[2], q[0]\n"
+        "h q[1]\n"
+        "crk q[2], q[1], 3\n"
+        "sdag q[2]\n"
+        "y q[2]\n"
+    );
+    sim.run(*program);
+    std::vector<Complex> expected;
+    for (size_t i = 0; i < 8; i++) {
+        expected.push_back(sim.get_amplitude(i));
+    }
+    EXPECT_EQ(cqasm::unitary::fuse_single_qubit_gates(*program, a), 4u);
+    sim.run(*program);
+    for (size_t i = 0; i < 8; i++) {
+        EXPECT_NEAR(std::abs(sim.get_amplitude(i) - expected[i]), 0.0, 1e-12);
+    }
+
+    // The threaded kernels give the same result as the single-threaded ones.
+    std::ostringstream code;
+    code << "version 1.0\nqubits 18\n";
+    for (int i = 0; i < 18; i++) {
+        code << "ry q[" << i << "], " << (0.1 * i + 0.3) << "\n";
+    }
+    for (int i = 0; i < 18; i++) {
+        code << "cr q[" << i << "], q[" << (i * 7 + 3) % 18 << "], " << (0.2 * i + 0.1) << "\n";
+    }
+    for (int i = 0; i < 18; i++) {
+        code << "h q[" << i << "]\n";
+    }
+    program = analyze(a, code.str());
+    sim.run(*program);
+    auto sim4 = cqasm::simulator::Simulator(4);
+    sim4.run(*program);
+    for (size_t i = 0; i < ((size_t)1 << 18); i += 997) {
+        EXPECT_NEAR(std::abs(sim4.get_amplitude(i) - sim.get_amplitude(i)), 0.0, 1e-12);
+    }
+    EXPECT_NEAR(sim4.get_probability(5), sim.get_probability(5), 1e-12);
+
+    // Running the program applies the gates on the lower qubits block by
+    // block; applying them one at a time over the whole state gives the same
+    // result.
+    auto direct = cqasm::simulator::Simulator(4);
+    direct.reset(18);
+    for (const auto &bundle : program->subcircuits[0]->bundles) {
+        const auto &insn = *bundle->items[0];
+        auto matrix = cqasm::unitary::matrix_of(insn);
+        std::vector<size_t> qubits;
+        for (const auto &operand : insn.operands) {
+            if (auto refs = operand->as_qubit_refs()) {
+                qubits.push_back(refs->index[0]->value);
+            }
+        }
+        if (qubits.size() == 1) {
+            direct.apply(cqasm::unitary::Matrix2::from_cmatrix(matrix), qubits[0]);
+        } else {
+            direct.apply(matrix, qubits[0], qubits[1]);
+        }
+    }
+    for (size_t i = 0; i < ((size_t)1 << 18); i += 997) {
+        EXPECT_NEAR(std::abs(direct.get_amplitude(i) - sim.get_amplitude(i)), 0.0, 1e-12);
+    }
+
+    // Instructions without a known matrix can't be simulated.
+    a.register_instruction("foo", "Q");
+    program = analyze(a, "version 1.0\nqubits 1\nfoo q[0]\n");
+    EXPECT_THROW(sim.run(*program), cqasm::simulator::SimulationError);
+
+    // States that don't fit in memory are rejected, leaving an empty state.
+    EXPECT_THROW(direct.reset(sizeof(size_t) * 8 - 4), std::invalid_argument);
+    EXPECT_EQ(direct.get_num_qubits(), 0u);
+    EXPECT_EQ(direct.get_amplitude(0), cqasm::primitives::Complex(1.0, 0.0));
+}
+
+TEST(values, structured_matrices) {
+    using namespace cqasm::primitives;
+    using cqasm::tree::make;
+
+    // A Toffoli gate as permutation, controlled, and dense matrix.
+    auto toffoli = SparseCMatrix::permutation({0, 1, 2, 3, 4, 5, 7, 6});
+    auto controlled = ControlledCMatrix(2, CMatrix({0.0, 1.0, 1.0, 0.0}, 2));
+    auto dense = toffoli.to_dense();
+    EXPECT_EQ(toffoli.size_nonzero(), 8u);
+    EXPECT_EQ(toffoli.at(7, 8), Complex(1.0));
+    EXPECT_EQ(toffoli.at(7, 7), Complex(0.0));
+    EXPECT_EQ(controlled.size_rows(), 8u);
+    EXPECT_EQ(controlled.at(8, 7), Complex(1.0));
+    EXPECT_TRUE(toffoli == dense);
+    EXPECT_TRUE(controlled == dense);
+    EXPECT_EQ(controlled.to_sparse(), toffoli);
+    EXPECT_EQ(controlled.to_dense(), dense);
+    EXPECT_EQ(SparseCMatrix::from_dense(dense), toffoli);
+    EXPECT_NE(SparseCMatrix::permutation({1, 0}), SparseCMatrix::from_dense(CMatrix({0.0, 1.0, 1.0, 0.0}, 1)));
+    EXPECT_THROW(SparseCMatrix::permutation({0, 0}), std::invalid_argument);
+    EXPECT_THROW(SparseCMatrix(1, 2, {0, 2}, {1, 0}, {1.0, 1.0}), std::invalid_argument);
+
+    // Copies share their contents.
+    auto copy = toffoli;
+    EXPECT_EQ(&copy.get_values(), &toffoli.get_values());
+
+    // Promotion to a three-qubit unitary keeps the representation, and the
+    // values can be used as matrix operands.
+    auto type = cqasm::types::from_spec("QQQu")[3];
+    cqasm::values::Value value = make<cqasm::values::ConstSparseComplexMatrix>(toffoli);
+    auto promoted = cqasm::values::promote(value, type);
+    ASSERT_FALSE(promoted.empty());
+    ASSERT_NE(promoted->as_const_sparse_complex_matrix(), nullptr);
+    EXPECT_EQ(*promoted, *value);
+    value = make<cqasm::values::ConstControlledComplexMatrix>(controlled);
+    promoted = cqasm::values::promote(value, type);
+    ASSERT_FALSE(promoted.empty());
+    ASSERT_NE(promoted->as_const_controlled_complex_matrix(), nullptr);
+    EXPECT_TRUE(cqasm::values::promote(value, cqasm::types::from_spec("QQu")[2]).empty());
+    auto value_type = cqasm::values::type_of(value);
+    auto result_type = value_type->as_complex_matrix();
+    ASSERT_NE(result_type, nullptr);
+    EXPECT_EQ(result_type->num_rows, 8);
+    cqasm::values::Values operands;
+    operands.add(value);
+    EXPECT_EQ(cqasm::unitary::matrix_operand(operands), dense);
+}
+
+TEST(values, structured_matrix_operands) {
+    using namespace cqasm::primitives;
+    using cqasm::tree::make;
+
+    // Sparse and controlled matrices given through mappings are kept as they
+    // are by promotion, and consumers of the operand see the dense matrix.
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    cqasm::unitary::register_default_gates(a);
+    auto x = SparseCMatrix::permutation({1, 0});
+    auto cnot = ControlledCMatrix(1, CMatrix({0.0, 1.0, 1.0, 0.0}, 2));
+    a.register_mapping("xs", make<cqasm::values::ConstSparseComplexMatrix>(x));
+    a.register_mapping("cnotc", make<cqasm::values::ConstControlledComplexMatrix>(cnot));
+    auto program = analyze(a,
+        "version 1.0\n"
+        "qubits 2\n"
+        "u q[0], xs\n"
+        "u q[0], q[1], cnotc\n"
+    );
+    ASSERT_FALSE(program.empty());
+    const auto &bundles = program->subcircuits[0]->bundles;
+    ASSERT_EQ(bundles.size(), 2u);
+    const auto &sparse_operand = bundles[0]->items[0]->operands[1];
+    ASSERT_NE(sparse_operand->as_const_sparse_complex_matrix(), nullptr);
+    EXPECT_EQ(cqasm::values::dense_complex_matrix(sparse_operand), x.to_dense());
+    EXPECT_EQ(cqasm::unitary::matrix_of(*bundles[0]->items[0]), x.to_dense());
+    const auto &controlled_operand = bundles[1]->items[0]->operands[2];
+    ASSERT_NE(controlled_operand->as_const_controlled_complex_matrix(), nullptr);
+    EXPECT_EQ(cqasm::values::dense_complex_matrix(controlled_operand), cnot.to_dense());
+    EXPECT_EQ(cqasm::unitary::matrix_of(*bundles[1]->items[0]), cnot.to_dense());
+    EXPECT_EQ(cqasm::values::dense_complex_matrix(make<cqasm::values::ConstInt>(1)), CMatrix());
+
+    // Dense matrices are returned by reference without a copy; others are
+    // converted into the given storage.
+    cqasm::values::Value dense = make<cqasm::values::ConstComplexMatrix>(x.to_dense());
+    CMatrix storage;
+    EXPECT_EQ(
+        &cqasm::values::dense_complex_matrix(dense, storage),
+        &dense->as_const_complex_matrix()->value.get()
+    );
+    EXPECT_EQ(storage, CMatrix());
+    EXPECT_EQ(&cqasm::values::dense_complex_matrix(sparse_operand, storage), &storage);
+    EXPECT_EQ(storage, x.to_dense());
+}
+
+TEST(passes, compaction) {
+    using cqasm::parser::SourceLocation;
+    auto a = cqasm::analyzer::Analyzer();
+    a.register_default_functions_and_mappings();
+    cqasm::unitary::register_default_gates(a);
+    std::ostringstream code;
+    code << "version 1.0\nqubits 4\nmap q[3], ancilla\n";
+    for (int i = 0; i < 50; i++) {
+        code << "x q[" << (i % 4) << "]\n";
+        code << "rx ancilla, 0.5\n";
+        code << "cnot q[0], ancilla\n";
+    }
+    auto program = analyze(a, code.str());
+    auto original = analyze(a, code.str());
+
+    // Compaction with the default options preserves the tree, but shares
+    // descriptors. Constants can't be shared yet because their locations
+    // differ.
+    auto report = cqasm::compact::compact(*program);
+    EXPECT_GT(report.bytes_before, report.bytes_after);
+    EXPECT_EQ(report.bytes_before, cqasm::compact::memory_usage(*original));
+    EXPECT_EQ(report.bytes_after, cqasm::compact::memory_usage(*program));
+    EXPECT_TRUE(*program == *original);
+    const auto &bundles = program->subcircuits[0]->bundles;
+    const auto &x = *bundles[0]->items[0];
+    const auto &rx1 = *bundles[1]->items[0];
+    const auto &cnot = *bundles[2]->items[0];
+    const auto &rx2 = *bundles[4]->items[0];
+    EXPECT_EQ(rx1.instruction.get_ptr(), rx2.instruction.get_ptr());
+    EXPECT_NE(rx1.operands[1].get_ptr(), rx2.operands[1].get_ptr());
+    ASSERT_TRUE(rx1.has_annotation<SourceLocation>());
+    EXPECT_EQ(rx1.get_annotation<SourceLocation>().first_line, 5u);
+
+    // Compacting again doesn't change anything.
+    auto report2 = cqasm::compact::compact(*program);
+    EXPECT_EQ(report2.bytes_before, report2.bytes_after);
+
+    // Stripping the locations of values reclaims more, but keeps the
+    // locations of the instructions. Now equal constants are shared.
+    cqasm::compact::Options options;
+    options.locations = cqasm::compact::Locations::StripValues;
+    auto report3 = cqasm::compact::compact(*program, options);
+    EXPECT_LT(report3.bytes_after, report2.bytes_after);
+    EXPECT_TRUE(*program == *original);
+    EXPECT_TRUE(rx1.has_annotation<SourceLocation>());
+    EXPECT_FALSE(rx1.operands[0]->has_annotation<SourceLocation>());
+    EXPECT_EQ(rx1.operands[1].get_ptr(), rx2.operands[1].get_ptr());
+    EXPECT_EQ(
+        x.operands[0]->as_qubit_refs()->index[0].get_ptr(),
+        cnot.operands[0]->as_qubit_refs()->index[0].get_ptr()
+    );
+    EXPECT_NE(
+        x.operands[0]->as_qubit_refs()->index[0].get_ptr(),
+        cnot.operands[1]->as_qubit_refs()->index[0].get_ptr()
+    );
+
+    // Stripping everything removes the rest.
+    options.locations = cqasm::compact::Locations::Strip;
+    auto report4 = cqasm::compact::compact(*program, options);
+    EXPECT_LT(report4.bytes_after, report3.bytes_after);
+    EXPECT_FALSE(rx1.has_annotation<SourceLocation>());
+    EXPECT_TRUE(*program == *original);
+}
+
+/**
+ * Tests recording parse and analysis spans and writing them as Chrome trace
+ * event JSON.
+ */
+TEST(passes, trace) {
+    cqasm::analyzer::Analyzer a;
+    a.register_instruction("x", "Q");
+    auto code = "version 1.0\nqubits 2\nmap q[0], q0\n.main\nx q0\nx q[1]\n";
+
+    // Nothing is recorded while tracing is disabled.
+    cqasm::trace::clear();
+    analyze(a, code);
+    EXPECT_TRUE(cqasm::trace::get_events().empty());
+
+    // All pipeline stages are recorded when it is enabled, in order of their
+    // start time, including those of other threads.
+    cqasm::trace::enable();
+    analyze(a, code);
+    std::thread thread([&a, &code]() { analyze(a, code); });
+    thread.join();
+    cqasm::trace::disable();
+    analyze(a, code);
+    auto events = cqasm::trace::get_events();
+    std::vector<std::string> names;
+    for (const auto &event : events) {
+        if (event.thread == events[0].thread) {
+            names.emplace_back(event.name);
+        }
+    }
+    EXPECT_EQ(names, std::vector<std::string>({
+        "parse", "analyze", "version", "qubits", "mapping",
+        "subcircuit", "bundle", "bundle", "mappings"
+    }));
+    EXPECT_EQ(events.size(), names.size() * 2);
+    EXPECT_NE(events.front().thread, events.back().thread);
+    for (size_t i = 1; i < events.size(); i++) {
+        EXPECT_LE(events[i - 1].start, events[i].start);
+    }
+    EXPECT_EQ(events[0].detail, "test.cq");
+
+    // The output is a Chrome trace event document.
+    std::ostringstream ss;
+    cqasm::trace::write_chrome_json(ss);
+    auto json = ss.str();
+    EXPECT_EQ(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["), 0u);
+    EXPECT_NE(json.find("{\"name\":\"parse\",\"cat\":\"parser\",\"ph\":\"X\",\"ts\":"), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"detail\":\"test.cq\"}"), std::string::npos);
+
+    // The ring buffers only keep the most recent events.
+    cqasm::trace::enable(2);
+    analyze(a, code);
+    cqasm::trace::disable();
+    names.clear();
+    for (const auto &event : cqasm::trace::get_events()) {
+        names.emplace_back(event.name);
+    }
+    EXPECT_EQ(names, std::vector<std::string>({"analyze", "mappings"}));
+    cqasm::trace::clear();
+    EXPECT_TRUE(cqasm::trace::get_events().empty());
+
+    // The buffers of threads that exited are reused by later threads, but
+    // their events are kept until they are cleared.
+    cqasm::trace::enable();
+    for (int i = 0; i < 20; i++) {
+        std::thread([]() { cqasm::trace::Span span("worker", "test"); }).join();
+    }
+    events = cqasm::trace::get_events();
+    ASSERT_EQ(events.size(), 20u);
+    std::set<uint32_t> threads;
+    for (const auto &event : events) {
+        threads.insert(event.thread);
+    }
+    EXPECT_EQ(threads.size(), 20u);
+
+    // Enabling tracing again while a span is open doesn't make the span
+    // appear to take forever.
+    {
+        cqasm::trace::Span span("restarted", "test");
+        cqasm::trace::enable();
+    }
+    cqasm::trace::disable();
+    events = cqasm::trace::get_events();
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_LT(events[0].duration, 1000000000u);
+    cqasm::trace::clear();
+}
+
+/**
+ * Tests reporting the statements that are slowest to analyze.
+ */
+TEST(analyzer, statement_profile) {
+    cqasm::analyzer::Analyzer a;
+    a.register_instruction("x", "Q");
+    auto code =
+        "version 1.0\n"
+        "qubits 10000\n"
+        "x q[0]\n"
+        "x q[1]\n"
+        "x q[0:9999]\n"
+        "x q[2]\n"
+        "x q[3]\n";
+
+    // Disabled by default.
+    auto parsed = cqasm::parser::parse_string(code, "test.cq");
+    EXPECT_TRUE(a.analyze(*parsed.root->as_program()).slow_statements.empty());
+
+    // The slowest statements are reported slowest first.
+    a.enable_statement_profile(2);
+    auto result = a.analyze(*parsed.root->as_program());
+    ASSERT_EQ(result.slow_statements.size(), 2u);
+    const auto &slowest = result.slow_statements[0];
+    EXPECT_EQ(slowest.location.filename, "test.cq");
+    EXPECT_EQ(slowest.location.first_line, 5u);
+    EXPECT_EQ(slowest.kind, "bundle");
+    EXPECT_GE(slowest.nodes, 10000u);
+    EXPECT_GE(slowest.bytes, slowest.nodes * sizeof(cqasm::values::ConstInt));
+    EXPECT_GE(slowest.duration, result.slow_statements[1].duration);
+    EXPECT_LT(result.slow_statements[1].nodes, 100u);
+    std::ostringstream ss;
+    ss << slowest;
+    EXPECT_EQ(ss.str().find("test.cq:5"), 0u);
+
+    // Nodes cloned while resolving a mapping are counted, so referring to a
+    // mapping costs as much as writing out its value.
+    a.enable_statement_profile(3);
+    auto mapped = cqasm::parser::parse_string(
+        "version 1.0\n"
+        "qubits 1\n"
+        "map 1, a\n"
+        "map a, b\n"
+        "map 2, c\n",
+        "test.cq"
+    );
+    ASSERT_TRUE(mapped.errors.empty());
+    result = a.analyze(*mapped.root->as_program());
+    ASSERT_EQ(result.slow_statements.size(), 3u);
+    std::vector<const cqasm::analyzer::StatementProfile*> by_line(6, nullptr);
+    for (const auto &profile : result.slow_statements) {
+        by_line.at(profile.location.first_line) = &profile;
+    }
+    ASSERT_NE(by_line[4], nullptr);
+    ASSERT_NE(by_line[5], nullptr);
+    EXPECT_GE(by_line[4]->nodes, 2u);
+    EXPECT_EQ(by_line[4]->nodes, by_line[5]->nodes);
+    EXPECT_EQ(by_line[4]->bytes, by_line[5]->bytes);
+    a.enable_statement_profile(2);
+
+    // The profile doesn't depend on the tracer, whose epoch moves whenever
+    // tracing is enabled.
+    std::atomic<bool> done(false);
+    std::thread tracer([&done]() {
+        while (!done) {
+            cqasm::trace::enable();
+        }
+    });
+    for (int i = 0; i < 20; i++) {
+        result = a.analyze(*parsed.root->as_program());
+        ASSERT_EQ(result.slow_statements.size(), 2u);
+        EXPECT_LT(result.slow_statements[0].duration, 10000000000u);
+    }
+    done = true;
+    tracer.join();
+    cqasm::trace::disable();
+    cqasm::trace::clear();
+}
+
+/**
+ * Tests the memory usage reports of the generated tree classes.
+ */
+TEST(tree, memory_usage) {
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("u", "Qu");
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "x q[1]\n"
+        "u q[0], [1, 0, 0, 0, 0, 0, 1, 0]\n"
+        "x q[0]\n";
+    auto parsed = cqasm::parser::parse_string(code, "test.cq");
+    auto program = analyze(a, code);
+
+    // The breakdown accounts for every node once, per type.
+    auto usage = program->memory_usage();
+    auto types = usage.get_types();
+    EXPECT_EQ(types["cqasm::semantic::Program"].count, 1u);
+    EXPECT_EQ(types["cqasm::semantic::Bundle"].count, 4u);
+    EXPECT_EQ(types["cqasm::semantic::Instruction"].count, 4u);
+    EXPECT_EQ(types["cqasm::values::ConstComplexMatrix"].count, 1u);
+    EXPECT_GE(types["cqasm::values::ConstComplexMatrix"].bytes, 4 * sizeof(cqasm::primitives::Complex));
+    EXPECT_GE(types["cqasm::parser::SourceLocation"].count, 4u);
+    size_t total = 0;
+    for (const auto &it : types) {
+        total += it.second.bytes;
+    }
+    EXPECT_EQ(total, usage.get_total());
+    EXPECT_EQ(usage.get_total(), cqasm::compact::memory_usage(*program));
+    std::ostringstream ss;
+    ss << usage;
+    EXPECT_NE(ss.str().find("cqasm::semantic::Bundle: 4 objects, "), std::string::npos);
+
+    // Shared subtrees and descriptors are counted once.
+    cqasm::compact::compact(*program);
+    auto compacted = program->memory_usage();
+    EXPECT_LT(compacted.get_total(), usage.get_total());
+    EXPECT_EQ(compacted.get_types()["cqasm::instruction::Instruction"].count, 2u);
+    EXPECT_EQ(compacted.get_types()["cqasm::semantic::Instruction"].count, 4u);
+
+    // The AST can be measured as well.
+    auto ast_usage = parsed.root->memory_usage();
+    EXPECT_EQ(ast_usage.get_types()["cqasm::ast::Bundle"].count, 4u);
+    EXPECT_GT(ast_usage.get_total(), 0u);
+}
+
+TEST(tree, node_pool) {
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "cnot q[0], q[1]\n";
+
+    // With the default capacity of zero, nothing is recycled.
+    EXPECT_EQ(cqasm::tree::get_node_pool_capacity(), 0u);
+    auto before = cqasm::tree::get_node_pool_statistics();
+    cqasm::parser::parse_string(code, "test.cq");
+    auto after = cqasm::tree::get_node_pool_statistics();
+    EXPECT_GT(after.allocations, before.allocations);
+    EXPECT_EQ(after.recycled, before.recycled);
+    EXPECT_EQ(after.cached_bytes, 0u);
+
+    // Parsing again after the first tree was dropped reuses its nodes.
+    cqasm::tree::set_node_pool_capacity(1 << 20);
+    cqasm::parser::parse_string(code, "test.cq");
+    before = cqasm::tree::get_node_pool_statistics();
+    EXPECT_GT(before.cached_bytes, 0u);
+    cqasm::parser::parse_string(code, "test.cq");
+    after = cqasm::tree::get_node_pool_statistics();
+    EXPECT_GT(after.recycled, before.recycled);
+
+    // Releasing the pool frees the cached blocks.
+    cqasm::tree::set_node_pool_capacity(0);
+    cqasm::tree::release_node_pool();
+    EXPECT_EQ(cqasm::tree::get_node_pool_statistics().cached_bytes, 0u);
+}
+
+/**
+ * Memory resource that counts the memory it hands out.
+ */
+class CountingResource : public cqasm::memory::Resource {
+public:
+    size_t allocations = 0;
+    size_t live_bytes = 0;
+
+    void *allocate(size_t size) override {
+        allocations++;
+        live_bytes += size;
+        return ::operator new(size);
+    }
+
+    void deallocate(void *ptr, size_t size) override {
+        live_bytes -= size;
+        ::operator delete(ptr);
+    }
+};
+
+TEST(tree, memory_resource) {
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "cnot q[0], q[1]\n";
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("cnot", "QQ");
+
+    // Both the AST and the semantic tree come from the given resource, and
+    // everything is returned to it when the trees are dropped.
+    CountingResource counter;
+    {
+        auto parsed = cqasm::parser::parse_string(code, "test.cq", &counter);
+        ASSERT_TRUE(parsed.errors.empty());
+        auto ast_allocations = counter.allocations;
+        EXPECT_GT(ast_allocations, 0u);
+        a.set_memory_resource(&counter);
+        auto result = a.analyze(*parsed.root->as_program());
+        ASSERT_TRUE(result.errors.empty());
+        EXPECT_GT(counter.allocations, ast_allocations);
+        EXPECT_EQ(cqasm::memory::get_resource(), nullptr);
+
+        // Clones are allocated from the selected resource.
+        cqasm::memory::Arena arena;
+        {
+            cqasm::memory::Scope scope(&arena);
+            auto clone = result.root->clone();
+            EXPECT_GT(arena.get_used(), 0u);
+        }
+        EXPECT_EQ(cqasm::memory::get_resource(), nullptr);
+    }
+    EXPECT_EQ(counter.live_bytes, 0u);
+
+    // Without a resource, nothing is allocated from it.
+    a.set_memory_resource(nullptr);
+    auto allocations = counter.allocations;
+    auto parsed = cqasm::parser::parse_string(code, "test.cq");
+    a.analyze(*parsed.root->as_program());
+    EXPECT_EQ(counter.allocations, allocations);
+
+    // Nodes created with new without a resource take exactly the block of
+    // their size class.
+    cqasm::tree::set_node_pool_capacity(1 << 20);
+    cqasm::tree::release_node_pool();
+    {
+        cqasm::tree::Maybe<cqasm::ast::IntegerLiteral> literal;
+        literal.set_raw(new cqasm::ast::IntegerLiteral());
+    }
+    EXPECT_EQ(
+        cqasm::tree::get_node_pool_statistics().cached_bytes,
+        (sizeof(cqasm::ast::IntegerLiteral) + 15) / 16 * 16
+    );
+    cqasm::tree::set_node_pool_capacity(0);
+    cqasm::tree::release_node_pool();
+
+    // Nodes created with new with and without a resource can be mixed, and
+    // each is returned to where it came from.
+    {
+        cqasm::tree::One<cqasm::ast::Negate> outer;
+        cqasm::tree::One<cqasm::ast::Negate> inner;
+        {
+            cqasm::memory::Scope scope(&counter);
+            outer.set_raw(new cqasm::ast::Negate());
+            inner.set_raw(new cqasm::ast::Negate());
+            inner->expr.set_raw(new cqasm::ast::IntegerLiteral());
+        }
+        outer->expr.set_raw(new cqasm::ast::Negate());
+        outer->expr->as_negate()->expr = inner;
+        EXPECT_GT(counter.live_bytes, 0u);
+    }
+    EXPECT_EQ(counter.live_bytes, 0u);
+}
+
+TEST(tree, typecasts) {
+    // Every leaf type lies within the type range of each of its ancestors.
+    EXPECT_TRUE(cqasm::ast::BinaryOp::is_type(cqasm::ast::NodeType::Add));
+    EXPECT_TRUE(cqasm::ast::Expression::is_type(cqasm::ast::NodeType::Add));
+    EXPECT_TRUE(cqasm::ast::Expression::is_type(cqasm::ast::NodeType::Negate));
+    EXPECT_FALSE(cqasm::ast::BinaryOp::is_type(cqasm::ast::NodeType::Negate));
+    EXPECT_FALSE(cqasm::ast::Expression::is_type(cqasm::ast::NodeType::Bundle));
+    EXPECT_TRUE(cqasm::values::Constant::is_type(cqasm::values::NodeType::ConstSparseComplexMatrix));
+    EXPECT_FALSE(cqasm::values::Constant::is_type(cqasm::values::NodeType::QubitRefs));
+
+    // Casts through the node functions and through Maybe::as().
+    cqasm::values::Value value = cqasm::tree::make<cqasm::values::ConstInt>(3);
+    EXPECT_NE(value->as_constant(), nullptr);
+    EXPECT_NE(value->as_const_int(), nullptr);
+    EXPECT_EQ(value->as_const_real(), nullptr);
+    EXPECT_EQ(value->as_reference(), nullptr);
+    auto constant = value.as<cqasm::values::Constant>();
+    ASSERT_FALSE(constant.empty());
+    EXPECT_EQ(constant.get_ptr(), value.get_ptr());
+    EXPECT_EQ(constant.as<cqasm::values::ConstInt>()->value, 3);
+    EXPECT_TRUE(constant.as<cqasm::values::ConstReal>().empty());
+    EXPECT_TRUE(cqasm::values::Value().as<cqasm::values::ConstInt>().empty());
+}
+
+TEST(tree, small_lists) {
+    // Value lists store their first two elements inline, as configured in
+    // the values tree specification.
+    cqasm::values::Values values;
+    EXPECT_EQ(values.capacity(), 2u);
+    values.add(cqasm::tree::make<cqasm::values::ConstInt>(1));
+    values.add(cqasm::tree::make<cqasm::values::ConstInt>(3));
+    EXPECT_EQ(values.heap_capacity(), 0u);
+    values.add(cqasm::tree::make<cqasm::values::ConstInt>(2), 1);
+    EXPECT_GE(values.heap_capacity(), 3u);
+    std::vector<cqasm::primitives::Int> contents;
+    for (const auto &value : values) {
+        contents.push_back(value->as_const_int()->value);
+    }
+    EXPECT_EQ(contents, std::vector<cqasm::primitives::Int>({1, 2, 3}));
+
+    // Copies and moves keep the contents, and shrinking moves the elements
+    // back inline once they fit.
+    auto copy = values;
+    EXPECT_EQ(copy, values);
+    values.remove(0);
+    values.shrink_to_fit();
+    EXPECT_EQ(values.heap_capacity(), 0u);
+    EXPECT_EQ(values[0]->as_const_int()->value, 2);
+    EXPECT_EQ(values[1]->as_const_int()->value, 3);
+    EXPECT_THROW(values.at(2), std::out_of_range);
+    auto moved = std::move(copy);
+    EXPECT_EQ(moved.size(), 3u);
+    EXPECT_TRUE(copy.empty());
+    copy = moved;
+    moved = std::move(values);
+    EXPECT_EQ(moved.size(), 2u);
+    EXPECT_EQ(copy.size(), 3u);
+
+    // A list can be extended with itself, and elements of a full list can be
+    // added to it again, although both move the elements to the heap.
+    moved.extend(moved);
+    EXPECT_EQ(moved.size(), 4u);
+    EXPECT_EQ(moved[2]->as_const_int()->value, 2);
+    EXPECT_EQ(moved[3]->as_const_int()->value, 3);
+    ASSERT_EQ(moved.capacity(), 4u);
+    moved.add(moved[3]);
+    EXPECT_EQ(moved.size(), 5u);
+    EXPECT_EQ(moved[4]->as_const_int()->value, 3);
+
+    // Lists of node types without an inline capacity are unchanged.
+    cqasm::tree::Any<cqasm::semantic::Bundle> bundles;
+    EXPECT_EQ(bundles.capacity(), 0u);
+    bundles.add(cqasm::tree::make<cqasm::semantic::Bundle>());
+    bundles.extend(bundles);
+    EXPECT_EQ(bundles.size(), 2u);
+    EXPECT_EQ(bundles[0], bundles[1]);
+}
+
+TEST(tree, frozen) {
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "cnot q[0], q[1]\n"
+        "x q[1]\n";
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("cnot", "QQ");
+    auto program = analyze(a, code);
+
+    // References count the owners of a node, regardless of whether the
+    // counts are atomic or intrusive.
+    auto version = program->version;
+    EXPECT_EQ(version.get_ptr().use_count(), 2);
+    version.reset();
+    EXPECT_EQ(program->version.get_ptr().use_count(), 1);
+
+    // A frozen program can be shared by several threads, which may copy
+    // references into it.
+    cqasm::tree::Frozen<cqasm::semantic::Program> frozen(std::move(program));
+    EXPECT_TRUE(program.empty());
+    std::vector<size_t> counts(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < counts.size(); i++) {
+        threads.emplace_back([frozen, &counts, i]() {
+            for (int repeat = 0; repeat < 1000; repeat++) {
+                for (const auto &subcircuit : frozen->subcircuits) {
+                    for (auto bundle : subcircuit->bundles) {
+                        cqasm::tree::Any<cqasm::semantic::Instruction> copy = bundle->items;
+                        counts[i] += copy.size();
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto count : counts) {
+        EXPECT_EQ(count, 3000u);
+    }
+
+    // Dropping the last handle thaws the tree and frees it.
+    EXPECT_EQ(frozen->version->items.size(), 2u);
+    frozen = cqasm::tree::Frozen<cqasm::semantic::Program>();
+    EXPECT_TRUE(frozen.empty());
+    EXPECT_THROW(frozen.get(), std::out_of_range);
+}
+
+TEST(tree, flat) {
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "{ x q[1] | y q[0] }\n"
+        "cnot q[0], q[1]\n";
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("y", "Q");
+    a.register_instruction("cnot", "QQ");
+    auto program = analyze(a, code);
+
+    // The nodes of each type are stored contiguously, and lists refer to a
+    // range of references.
+    cqasm::semantic::flat::Tree flat(*program);
+    EXPECT_EQ(flat.root.type, cqasm::semantic::NodeType::Program);
+    EXPECT_EQ(flat.program_nodes.size(), 1u);
+    EXPECT_EQ(flat.bundle_nodes.size(), 3u);
+    EXPECT_EQ(flat.instruction_nodes.size(), 4u);
+    const auto &root = flat.program_nodes[flat.root.index];
+    EXPECT_EQ(root.num_qubits, 2);
+    std::vector<std::string> names;
+    for (const auto &subcircuit : flat.get(root.subcircuits)) {
+        for (const auto &bundle : flat.get(flat.subcircuit_nodes[subcircuit.index].bundles)) {
+            for (const auto &insn : flat.get(flat.bundle_nodes[bundle.index].items)) {
+                EXPECT_EQ(insn.type, cqasm::semantic::NodeType::Instruction);
+                names.push_back(flat.instruction_nodes[insn.index].name);
+            }
+        }
+    }
+    EXPECT_EQ(names, std::vector<std::string>({"x", "x", "y", "cnot"}));
+    EXPECT_TRUE(flat.program_nodes[0].error_model.empty());
+
+    // Converting back yields an equal tree with the same annotations.
+    auto rebuilt = flat.build();
+    ASSERT_FALSE(rebuilt.empty());
+    EXPECT_EQ(*rebuilt, *program);
+    const auto &insn = *rebuilt->as_program()->subcircuits[0]->bundles[2]->items[0];
+    ASSERT_TRUE(insn.has_annotation<cqasm::parser::SourceLocation>());
+    EXPECT_EQ(insn.get_annotation<cqasm::parser::SourceLocation>().first_line, 5u);
+
+    // The AST has a flat variant as well.
+    auto parsed = cqasm::parser::parse_string(code, "flat.cq");
+    ASSERT_TRUE(parsed.errors.empty());
+    cqasm::ast::flat::Tree flat_ast(*parsed.root);
+    EXPECT_EQ(flat_ast.bundle_nodes.size(), 3u);
+    EXPECT_EQ(*flat_ast.build(), *parsed.root);
+    EXPECT_TRUE(cqasm::ast::flat::Tree().build().empty());
+}
+
+TEST(tree, type_index) {
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "{ x q[1] | y q[0] }\n"
+        "cnot q[0], q[1]\n";
+    for (int i = 0; i < 100; i++) {
+        code += "y q[1]\n";
+    }
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("y", "Q");
+    a.register_instruction("cnot", "QQ");
+    auto program = analyze(a, code);
+
+    // Sequentially built indices list the nodes of each type in depth-first
+    // order, and descend into the values referred to by the program.
+    auto index = program->index_types();
+    const auto &insns = index.get_nodes(cqasm::semantic::NodeType::Instruction);
+    ASSERT_EQ(insns.size(), 104u);
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 4; i++) {
+        names.push_back(static_cast<const cqasm::semantic::Instruction*>(insns[i])->name);
+    }
+    EXPECT_EQ(names, std::vector<std::string>({"x", "x", "y", "cnot"}));
+    EXPECT_EQ(index.count<cqasm::semantic::Bundle>(), 103u);
+    EXPECT_EQ(index.find<cqasm::semantic::Program>().size(), 1u);
+    auto qubit_refs = index.find<cqasm::values::QubitRefs>();
+    EXPECT_GE(qubit_refs.size(), 104u);
+    EXPECT_EQ(index.count<cqasm::values::Node>(), index.count<cqasm::values::Constant>() + index.count<cqasm::values::Reference>());
+    EXPECT_TRUE(index.get_nodes(cqasm::ast::NodeType::Program).empty());
+    EXPECT_EQ(index.count<cqasm::ast::Node>(), 0u);
+
+    // Building in parallel finds the same nodes.
+    auto parallel = cqasm::tree::TypeIndex::build(*program, 4);
+    EXPECT_EQ(parallel.count<cqasm::semantic::Node>(), index.count<cqasm::semantic::Node>());
+    auto parallel_refs = parallel.find<cqasm::values::QubitRefs>();
+    std::sort(qubit_refs.begin(), qubit_refs.end());
+    std::sort(parallel_refs.begin(), parallel_refs.end());
+    EXPECT_EQ(parallel_refs, qubit_refs);
+}
+
+/**
+ * Threads that entered a visit function, shared between the forks of a
+ * parallel visitor. Visits block until the given number of threads have
+ * entered, so the remaining chunks must be picked up by other threads.
+ */
+struct ThreadRendezvous {
+    std::mutex mutex;
+    std::condition_variable entered;
+    std::set<std::thread::id> threads;
+    size_t num_threads;
+
+    explicit ThreadRendezvous(size_t num_threads) : num_threads(num_threads) {}
+
+    void enter() {
+        std::unique_lock<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+        entered.notify_all();
+        entered.wait_for(lock, std::chrono::seconds(10), [this]() {
+            return threads.size() >= num_threads;
+        });
+    }
+};
+
+/**
+ * Parallel visitor that collects the instructions it visits, their names,
+ * and the threads it runs on.
+ */
+class InstructionNameCollector : public cqasm::semantic::ParallelVisitor {
+public:
+    std::vector<std::string> names;
+    std::vector<const cqasm::semantic::Instruction*> nodes;
+    std::set<std::thread::id> threads;
+    ThreadRendezvous *rendezvous;
+
+    InstructionNameCollector(cqasm::parallel::WorkPool &pool, size_t grain_size, ThreadRendezvous *rendezvous = nullptr)
+        : ParallelVisitor(pool, grain_size), rendezvous(rendezvous) {}
+
+    void visit_node(cqasm::semantic::Node &node) override {
+        (void)node;
+    }
+
+    void visit_instruction(cqasm::semantic::Instruction &node) override {
+        if (rendezvous) {
+            rendezvous->enter();
+        }
+        names.push_back(node.name);
+        nodes.push_back(&node);
+        threads.insert(std::this_thread::get_id());
+        if (node.name == "fail") {
+            throw std::runtime_error("fail");
+        }
+    }
+
+    std::unique_ptr<ParallelVisitor> fork() override {
+        return std::unique_ptr<ParallelVisitor>(new InstructionNameCollector(pool, grain_size, rendezvous));
+    }
+
+    void join(ParallelVisitor &other) override {
+        auto &collector = static_cast<InstructionNameCollector&>(other);
+        names.insert(names.end(), collector.names.begin(), collector.names.end());
+        nodes.insert(nodes.end(), collector.nodes.begin(), collector.nodes.end());
+        threads.insert(collector.threads.begin(), collector.threads.end());
+    }
+};
+
+TEST(tree, parallel_visitor) {
+    std::string body;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 500; i++) {
+        body += "x q[0]\n{ y q[1] | z q[0] }\n";
+        expected.insert(expected.end(), {"x", "y", "z"});
+    }
+    std::string code = "version 1.0\nqubits 2\n" + body;
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("y", "Q");
+    a.register_instruction("z", "Q");
+    a.register_instruction("fail", "Q");
+    auto program = analyze(a, code);
+
+    // The results are joined in the same order as a sequential traversal.
+    cqasm::parallel::WorkPool pool(4);
+    EXPECT_EQ(pool.get_num_threads(), 4u);
+    InstructionNameCollector collector(pool, 8);
+    program->visit(collector);
+    EXPECT_EQ(collector.names, expected);
+
+    // Every instruction is visited exactly once.
+    std::vector<const cqasm::semantic::Instruction*> instructions;
+    for (const auto &subcircuit : program->subcircuits) {
+        for (const auto &bundle : subcircuit->bundles) {
+            for (const auto &insn : bundle->items) {
+                instructions.push_back(&*insn);
+            }
+        }
+    }
+    ASSERT_EQ(instructions.size(), expected.size());
+    EXPECT_EQ(collector.nodes, instructions);
+
+    // The chunks are divided over the threads of the pool. The visits wait
+    // for a second thread to show up, so the caller can't do all the work
+    // by itself.
+    ThreadRendezvous rendezvous(2);
+    InstructionNameCollector parallel(pool, 8, &rendezvous);
+    program->visit(parallel);
+    EXPECT_EQ(parallel.nodes, instructions);
+    EXPECT_GT(parallel.threads.size(), 1u);
+
+    // Small lists are visited by the visitor itself.
+    InstructionNameCollector sequential(pool, 10000);
+    program->visit(sequential);
+    EXPECT_EQ(sequential.names, expected);
+    EXPECT_EQ(sequential.threads.size(), 1u);
+
+    // Exceptions thrown by a chunk are rethrown once the list is done.
+    auto failing = analyze(a, code + "fail q[0]\n" + body);
+    InstructionNameCollector failing_collector(pool, 8);
+    EXPECT_THROW(failing->visit(failing_collector), std::runtime_error);
+
+    // Task groups can be used directly, including nested ones.
+    std::atomic<int> count(0);
+    cqasm::parallel::TaskGroup group(pool);
+    for (int i = 0; i < 10; i++) {
+        group.run([&pool, &count]() {
+            cqasm::parallel::TaskGroup nested(pool);
+            for (int j = 0; j < 10; j++) {
+                nested.run([&count]() { count++; });
+            }
+            nested.wait();
+        });
+    }
+    group.wait();
+    EXPECT_EQ(count.load(), 100);
+}
+
+TEST(tree, merkle_diff) {
+    std::string filler;
+    for (int i = 0; i < 20; i++) {
+        filler += "y q[1]\n";
+    }
+    std::string old_code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[0]\n"
+        "{ x q[1] | y q[0] }\n"
+        "cnot q[0], q[1]\n" + filler;
+    std::string new_code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "x q[1]\n"
+        "cnot q[0], q[1]\n" + filler +
+        "z q[0]\n";
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("y", "Q");
+    a.register_instruction("z", "Q");
+    a.register_instruction("cnot", "QQ");
+    auto old_program = analyze(a, old_code);
+    auto new_program = analyze(a, new_code);
+
+    // Equal programs have equal hashes, regardless of source locations.
+    cqasm::tree::MerkleHashes old_hashes, new_hashes, copy_hashes;
+    auto copy = analyze(a, "\n" + old_code);
+    EXPECT_EQ(old_hashes.get(*old_program), copy_hashes.get(*copy));
+    EXPECT_NE(old_hashes.get(*old_program), new_hashes.get(*new_program));
+    EXPECT_TRUE(cqasm::diff::diff(*old_program, *copy).empty());
+
+    // The changed operand, the removed bundle, and the added bundle are
+    // reported, and the rest is skipped.
+    auto edits = cqasm::diff::diff(*old_program, *new_program, old_hashes, new_hashes);
+    std::vector<std::string> lines;
+    for (const auto &edit : edits) {
+        std::ostringstream ss;
+        ss << edit;
+        lines.push_back(ss.str());
+    }
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0], "changed subcircuits[0].bundles[0].items[0].operands[0].index[0].value at test.cq:3:5..6 / test.cq:3:5..6: 0 -> 1");
+    EXPECT_EQ(edits[1].kind, cqasm::tree::EditKind::Removed);
+    EXPECT_EQ(edits[1].path, "subcircuits[0].bundles[1]");
+    ASSERT_NE(edits[1].old_location, nullptr);
+    EXPECT_EQ(edits[1].old_location->first_line, 4u);
+    EXPECT_EQ(edits[2].kind, cqasm::tree::EditKind::Added);
+    EXPECT_EQ(edits[2].path, "subcircuits[0].bundles[22]");
+    ASSERT_NE(edits[2].new_location, nullptr);
+    EXPECT_EQ(edits[2].new_location->first_line, 25u);
+
+    // The hashes are reused by later diffs of the same programs.
+    auto hashed = old_hashes.size();
+    EXPECT_EQ(cqasm::diff::diff(*old_program, *new_program, old_hashes, new_hashes).size(), 3u);
+    EXPECT_EQ(old_hashes.size(), hashed);
+}
+
+TEST(tree, interning) {
+    cqasm::analyzer::Analyzer a;
+    a.register_default_functions_and_mappings();
+    a.register_instruction("x", "Q");
+    a.register_instruction("u", "Qu");
+    std::string code =
+        "version 1.0\n"
+        "qubits 2\n"
+        "map q[1], ancilla\n"
+        "x q[0]\n"
+        "u q[0], [0, 0, 1, 0, 1, 0, 0, 0]\n";
+    auto instruction = [](const cqasm::semantic::Program &program, size_t index) -> const cqasm::semantic::Instruction & {
+        return *program.subcircuits[0]->bundles[index]->items[0];
+    };
+    auto matrix = [&](const cqasm::semantic::Program &program) -> const cqasm::primitives::CMatrix & {
+        return instruction(program, 1).operands[1]->as_const_complex_matrix()->value.get();
+    };
+
+    // Without a pool, every program has its own copies, stored inline.
+    auto first = analyze(a, code);
+    auto second = analyze(a, code);
+    EXPECT_FALSE(instruction(*first, 0).name.is_pooled());
+    EXPECT_NE(&instruction(*first, 0).name.get(), &instruction(*second, 0).name.get());
+    EXPECT_NE(&matrix(*first), &matrix(*second));
+    EXPECT_EQ(first->memory_usage().get_types().count("cqasm::intern::CMatrix"), 0u);
+
+    // With a pool, equal names and matrices are stored once, across programs.
+    cqasm::intern::Pool pool;
+    {
+        cqasm::intern::Scope scope(&pool);
+        first = analyze(a, code);
+        second = analyze(a, code);
+    }
+    EXPECT_EQ(instruction(*first, 0).name, "x");
+    EXPECT_EQ(&instruction(*first, 0).name.get(), &instruction(*second, 0).name.get());
+    EXPECT_EQ(&first->mappings[0]->name.get(), &second->mappings[0]->name.get());
+    EXPECT_EQ(&matrix(*first), &matrix(*second));
+    EXPECT_TRUE(*first == *second);
+    auto usage = first->memory_usage();
+    second->add_memory_usage(usage);
+    EXPECT_EQ(usage.get_types()["cqasm::values::ConstComplexMatrix"].count, 2u);
+    EXPECT_EQ(usage.get_types()["cqasm::intern::CMatrix"].count, 1u);
+    EXPECT_EQ(
+        usage.get_types()["cqasm::intern::CMatrix"].bytes,
+        sizeof(cqasm::primitives::CMatrix) + 4 * sizeof(cqasm::primitives::Complex)
+        + cqasm::tree::MemoryUsage::SHARED_OVERHEAD
+    );
+
+    // The pool can be shared by threads, and by default is used by all of
+    // them.
+    auto previous = cqasm::intern::set_default_pool(&pool);
+    std::vector<const std::string*> stored(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < stored.size(); i++) {
+        threads.emplace_back([&stored, i] {
+            auto value = cqasm::tree::make<cqasm::values::ConstString>(std::string("shared"));
+            stored[i] = &value->value.get();
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    cqasm::intern::set_default_pool(previous);
+    for (auto value : stored) {
+        EXPECT_EQ(value, stored[0]);
+    }
+
+    // Values that are no longer referred to can be purged.
+    auto size = pool.size();
+    EXPECT_EQ(pool.purge(), 1u);
+    first.reset();
+    second.reset();
+    EXPECT_EQ(pool.purge(), size - 1);
+    EXPECT_EQ(pool.size(), 0u);
+}
+
+TEST(c_api, bulk_accessors) {
+    auto analyzer = cqasm_analyzer_new();
+    ASSERT_NE(analyzer, nullptr);
+    ASSERT_EQ(cqasm_analyzer_register_default_functions_and_mappings(analyzer), 0);
+    auto program = cqasm_analyze_string(analyzer,
+        "version 1.0\n"
+        "qubits 3\n"
+        "x q[0]\n"
+        "{ h q[1] | cnot q[0], q[2] }\n"
+        "rx q[1], 0.5\n"
+        "u q[0], [1, 2; 3, 4]\n"
+        "c-x b[0], q[0]\n",
+        "test.cq"
+    );
+    ASSERT_NE(program, nullptr);
+    ASSERT_EQ(cqasm_program_get_num_errors(program), 0u);
+    EXPECT_EQ(cqasm_program_get_num_qubits(program), 3);
+
+    // Querying the size doesn't need a buffer, and a buffer that is too
+    // small is filled as far as it goes.
+    ASSERT_EQ(cqasm_program_get_version(program, nullptr, 0), 2u);
+    std::vector<int64_t> version(1);
+    EXPECT_EQ(cqasm_program_get_version(program, version.data(), version.size()), 2u);
+    EXPECT_EQ(version, std::vector<int64_t>({1}));
+
+    std::vector<uint64_t> subcircuits(cqasm_program_get_subcircuit_offsets(program, nullptr, 0));
+    cqasm_program_get_subcircuit_offsets(program, subcircuits.data(), subcircuits.size());
+    EXPECT_EQ(subcircuits, std::vector<uint64_t>({0, 5}));
+
+    std::vector<uint64_t> bundles(cqasm_program_get_bundle_offsets(program, nullptr, 0));
+    cqasm_program_get_bundle_offsets(program, bundles.data(), bundles.size());
+    EXPECT_EQ(bundles, std::vector<uint64_t>({0, 1, 3, 4, 5, 6}));
+
+    std::vector<uint32_t> ids(cqasm_program_get_instruction_ids(program, nullptr, 0));
+    cqasm_program_get_instruction_ids(program, ids.data(), ids.size());
+    EXPECT_EQ(ids, std::vector<uint32_t>({0, 1, 2, 3, 4, 0}));
+    ASSERT_EQ(cqasm_program_get_num_instruction_names(program), 5u);
+    EXPECT_STREQ(cqasm_program_get_instruction_name(program, 0), "x");
+    EXPECT_STREQ(cqasm_program_get_instruction_name(program, 2), "cnot");
+    EXPECT_EQ(cqasm_program_get_instruction_name(program, 5), nullptr);
+
+    std::vector<uint64_t> offsets(cqasm_program_get_operand_offsets(program, nullptr, 0));
+    cqasm_program_get_operand_offsets(program, offsets.data(), offsets.size());
+    EXPECT_EQ(offsets, std::vector<uint64_t>({0, 1, 2, 4, 6, 8, 9}));
+
+    std::vector<int64_t> conditions(cqasm_program_get_conditions(program, nullptr, 0));
+    cqasm_program_get_conditions(program, conditions.data(), conditions.size());
+    EXPECT_EQ(conditions, std::vector<int64_t>({-1, -1, -1, -1, -1, 9}));
+
+    std::vector<cqasm_operand> operands(cqasm_program_get_operands(program, nullptr, 0));
+    cqasm_program_get_operands(program, operands.data(), operands.size());
+    ASSERT_EQ(operands.size(), 10u);
+    std::vector<int32_t> kinds;
+    for (const auto &operand : operands) {
+        kinds.push_back(operand.kind);
+    }
+    EXPECT_EQ(kinds, std::vector<int32_t>({
+        CQASM_OPERAND_QUBIT_REFS, CQASM_OPERAND_QUBIT_REFS, CQASM_OPERAND_QUBIT_REFS,
+        CQASM_OPERAND_QUBIT_REFS, CQASM_OPERAND_QUBIT_REFS, CQASM_OPERAND_REAL,
+        CQASM_OPERAND_QUBIT_REFS, CQASM_OPERAND_REAL_MATRIX, CQASM_OPERAND_QUBIT_REFS,
+        CQASM_OPERAND_BIT_REFS
+    }));
+    EXPECT_EQ(operands[7].rows, 2u);
+    EXPECT_EQ(operands[7].cols, 2u);
+    EXPECT_EQ(operands[7].offset, 1u);
+    EXPECT_EQ(operands[7].size, 4u);
+
+    std::vector<int64_t> integers(cqasm_program_get_integers(program, nullptr, 0));
+    cqasm_program_get_integers(program, integers.data(), integers.size());
+    EXPECT_EQ(integers, std::vector<int64_t>({0, 1, 0, 2, 1, 0, 0, 0}));
+
+    std::vector<double> reals(cqasm_program_get_reals(program, nullptr, 0));
+    cqasm_program_get_reals(program, reals.data(), reals.size());
+    EXPECT_EQ(reals, std::vector<double>({0.5, 1, 2, 3, 4}));
+    cqasm_program_free(program);
+
+    // Errors in the input are reported by the program.
+    program = cqasm_analyze_string(analyzer, "version 1.0\nqubits 2\nx q[2]\n", nullptr);
+    ASSERT_NE(program, nullptr);
+    EXPECT_EQ(cqasm_program_get_num_errors(program), 1u);
+    EXPECT_NE(cqasm_program_get_error(program, 0), nullptr);
+    EXPECT_EQ(cqasm_program_get_instruction_ids(program, nullptr, 0), 0u);
+    cqasm_program_free(program);
+
+    // Failures are described by the last error.
+    EXPECT_NE(cqasm_analyzer_register_instruction(analyzer, "x", "?", 1, 1, 0), 0);
+    EXPECT_STRNE(cqasm_get_last_error(), "");
+    cqasm_analyzer_free(analyzer);
+}
@@ -6,6 +6,7 @@
     #include <cstdio>
     #include <cstdint>
     #include <cstring>
+    #include <cstdlib>
     #include <iostream>
     #include "tree-gen.hpp"
     typedef void* yyscan_t;
@@ -68,6 +69,9 @@
 %token SOURCE HEADER TREE_NS SOURCE_LOC
 %token NAMESPACE NAMESPACE_SEP
 %token ERROR
+%token INLINE_CAP
+%token FLAT
+%token <str> NUMBER
 %token MAYBE ONE ANY MANY EXT
 %token <str> IDENT
 %token <str> STRING
@@ -93,6 +97,7 @@ String          : STRING
 
 Node            : Documentation IDENT '{'                                       { TRY auto nb = std::make_shared<NodeBuilder>(std::string($2), *$1); specification.add_node(nb); $$ = nb.get(); delete $1; std::free($2); CATCH }
                 | Node ERROR ';'                                                { TRY $$ = $1->mark_error(); CATCH }
+                | Node Documentation INLINE_CAP NUMBER ';'                      { TRY $$ = $1->with_inline_capacity(std::strtoul($4, nullptr, 10)); delete $2; std::free($4); CATCH }
                 | Node Documentation IDENT ':' MAYBE '<' Identifier '>' ';'     { TRY $$ = $1->with_child(Maybe, *$7, std::string($3), *$2); delete $2; std::free($3); delete $7; CATCH }
                 | Node Documentation IDENT ':' ONE '<' Identifier '>' ';'       { TRY $$ = $1->with_child(One, *$7, std::string($3), *$2); delete $2; std::free($3); delete $7; CATCH }
                 | Node Documentation IDENT ':' ANY '<' Identifier '>' ';'       { TRY $$ = $1->with_child(Any, *$7, std::string($3), *$2); delete $2; std::free($3); delete $7; CATCH }
@@ -113,6 +118,8 @@ Root            :
                 | Root Documentation INCLUDE                                    { TRY specification.add_include(std::string($3)); delete $2; std::free($3); CATCH }
                 | Root Documentation SRC_INCLUDE                                { TRY specification.add_src_include(std::string($3 + 4)); delete $2; std::free($3); CATCH }
                 | Root Documentation NAMESPACE IDENT                            { TRY specification.add_namespace(std::string($4)); delete $2; std::free($4); CATCH }
+                | Root Documentation INLINE_CAP NUMBER                          { TRY specification.set_node_inline_capacity(std::strtoul($4, nullptr, 10)); delete $2; std::free($4); CATCH }
+                | Root Documentation FLAT                                       { TRY specification.set_flat(); delete $2; CATCH }
                 | Root Node '}'                                                 {}
                 ;
 
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <iostream>
 #include <cctype>
+#include <algorithm>
 #include <unordered_set>
 #include "tree-gen.hpp"
 #include "parser.hpp"
@@ -51,6 +52,39 @@ static void format_doc(
     stream << indent << " */" << std::endl;
 }
 
+/**
+ * Returns the node types directly derived from the given node type, sorted
+ * by name.
+ */
+static Nodes sorted_derived(const NodeType &node) {
+    Nodes derived;
+    for (auto &weak : node.derived) {
+        derived.push_back(weak.lock());
+    }
+    std::sort(derived.begin(), derived.end(), [](
+        const std::shared_ptr<NodeType> &a,
+        const std::shared_ptr<NodeType> &b
+    ) {
+        return a->title_case_name < b->title_case_name;
+    });
+    return derived;
+}
+
+/**
+ * Appends the names of the leaf types derived from the given node type (or
+ * the node type itself if it is a leaf) to the given list, in the order in
+ * which they appear in the NodeType enum.
+ */
+static void gather_leaf_types(const NodeType &node, std::vector<std::string> &variants) {
+    if (node.derived.empty()) {
+        variants.push_back(node.title_case_name);
+        return;
+    }
+    for (auto &derived : sorted_derived(node)) {
+        gather_leaf_types(*derived, variants);
+    }
+}
+
 /**
  * Generates the node type enumeration.
  */
@@ -59,11 +93,12 @@ static void generate_enum(
     Nodes &nodes
 ) {
 
-    // Gather the leaf types.
+    // Gather the leaf types in depth-first order, such that the types derived
+    // from any node type form a contiguous range.
     std::vector<std::string> variants;
     for (auto &node : nodes) {
-        if (node->derived.empty()) {
-            variants.push_back(node->title_case_name);
+        if (!node->parent) {
+            gather_leaf_types(*node, variants);
         }
     }
 
@@ -82,14 +117,14 @@ static void generate_enum(
 }
 
 /**
- * Generates an `as_<type>` function.
+ * Generates an `as_<type>` function for the Node base class. The cast is
+ * based on the NodeType of the node and the is_type() range check of the
+ * target class, rather than on RTTI.
  */
 static void generate_typecast_function(
     std::ofstream &header,
     std::ofstream &source,
-    const std::string &clsname,
-    NodeType &into,
-    bool allowed
+    NodeType &into
 ) {
     for (int constant = 0; constant < 2; constant++) {
         std::string doc = "Interprets this node to a node of type "
@@ -97,30 +132,39 @@ static void generate_typecast_function(
                           + ". Returns null if it has the wrong type.";
         format_doc(header, doc, "    ");
         header << "    ";
-        if (!allowed) header << "virtual ";
         if (constant) header << "const ";
         header << into.title_case_name << " *";
         header << "as_" << into.snake_case_name << "()";
         if (constant) header << " const";
-        if (allowed) header << " override";
         header << ";" << std::endl << std::endl;
         format_doc(source, doc);
         if (constant) source << "const ";
         source << into.title_case_name << " *";
-        source << clsname << "::as_" << into.snake_case_name << "()";
+        source << "Node::as_" << into.snake_case_name << "()";
         if (constant) source << " const";
         source << " {" << std::endl;
-        if (allowed) {
-            source << "    return dynamic_cast<";
-            if (constant) source << "const ";
-            source << into.title_case_name << "*>(this);" << std::endl;
-        } else {
-            source << "    return nullptr;" << std::endl;
-        }
+        source << "    if (!" << into.title_case_name << "::is_type(type())) return nullptr;" << std::endl;
+        source << "    return static_cast<";
+        if (constant) source << "const ";
+        source << into.title_case_name << "*>(this);" << std::endl;
         source << "}" << std::endl << std::endl;
     }
 }
 
+/**
+ * Generates the inline_capacity() overload for lists of the given node class.
+ */
+static void generate_inline_capacity(
+    std::ofstream &header,
+    const std::string &clsname,
+    size_t capacity
+) {
+    format_doc(header, "Number of elements that Any and Many lists of " + clsname + " nodes store inline.");
+    header << "constexpr size_t inline_capacity(const " << clsname << "*) {" << std::endl;
+    header << "    return " << capacity << ";" << std::endl;
+    header << "}" << std::endl << std::endl;
+}
+
 /**
  * Generates the base class for the nodes.
  */
@@ -137,8 +181,13 @@ static void generate_base_class(
     format_doc(header, "Returns the `NodeType` of this node.", "    ");
     header << "    virtual NodeType type() const = 0;" << std::endl << std::endl;
 
+    format_doc(header, "Returns whether a node of the given type is a Node, which is always the case.", "    ");
+    header << "    static bool is_type(NodeType) {" << std::endl;
+    header << "        return true;" << std::endl;
+    header << "    }" << std::endl << std::endl;
+
     format_doc(header, "Returns a copy of this node.", "    ");
-    header << "    virtual std::shared_ptr<Node> clone() const = 0;" << std::endl << std::endl;
+    header << "    virtual Ptr<Node> clone() const = 0;" << std::endl << std::endl;
 
     format_doc(header, "Equality operator. Ignores annotations!", "    ");
     header << "    virtual bool operator==(const Node& rhs) const = 0;" << std::endl << std::endl;
@@ -151,6 +200,37 @@ static void generate_base_class(
     format_doc(header, "Visit this object.", "    ");
     header << "    virtual void visit(Visitor &visitor) = 0;" << std::endl << std::endl;
 
+    format_doc(header, "Adds the memory used by this node and its descendants to the given report, unless the node was already counted.", "    ");
+    header << "    virtual void add_memory_usage(MemoryUsage &usage) const = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Returns an estimate of the heap memory used by this node and its descendants, broken down per node type.", "    ");
+    header << "    MemoryUsage memory_usage() const;" << std::endl << std::endl;
+
+    format_doc(header, "Freezes or thaws this node and its descendants. See `Frozen`.", "    ");
+    header << "    virtual void set_frozen(bool frozen) const = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Adds this node and its descendants to the given index.", "    ");
+    header << "    virtual void add_to_index(TypeIndex &type_index) const = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Returns the Merkle hash of this node, computed from its type, its primitive fields, and the hashes of its children in the given table. Use `MerkleHashes::get()` to get the hash of a node instead.", "    ");
+    header << "    virtual uint64_t compute_hash(MerkleHashes &hashes) const = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Compares the fields of this node with those of the given node of the same type, reporting the differences to the given differ. Use `Differ::diff_nodes()` to compare two nodes instead.", "    ");
+    header << "    virtual void diff_fields(const Node &other, Differ &differ) const = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Returns an index of this node and its descendants by node type, built using up to the given number of threads. See `TypeIndex::build()`.", "    ");
+    header << "    TypeIndex index_types(size_t num_threads = 1) const;" << std::endl << std::endl;
+    format_doc(source, "Returns an index of this node and its descendants by node type, built using up to the given number of threads. See `TypeIndex::build()`.");
+    source << "TypeIndex Node::index_types(size_t num_threads) const {" << std::endl;
+    source << "    return TypeIndex::build(*this, num_threads);" << std::endl;
+    source << "}" << std::endl << std::endl;
+    format_doc(source, "Returns an estimate of the heap memory used by this node and its descendants, broken down per node type.");
+    source << "MemoryUsage Node::memory_usage() const {" << std::endl;
+    source << "    MemoryUsage usage;" << std::endl;
+    source << "    add_memory_usage(usage);" << std::endl;
+    source << "    return usage;" << std::endl;
+    source << "}" << std::endl << std::endl;
+
     format_doc(header, "Writes a debug dump of this node to the given stream.", "    ");
     header << "    void dump(std::ostream &out=std::cout, int indent=0);" << std::endl << std::endl;
     format_doc(source, "Writes a debug dump of this node to the given stream.");
@@ -160,7 +240,7 @@ static void generate_base_class(
     source << "}" << std::endl << std::endl;
 
     for (auto &node : nodes) {
-        generate_typecast_function(header, source, "Node", *node, false);
+        generate_typecast_function(header, source, *node);
     }
 
     header << "};" << std::endl << std::endl;
@@ -173,7 +253,10 @@ static void generate_base_class(
 static void generate_node_class(
     std::ofstream &header,
     std::ofstream &source,
-    NodeType &node
+    NodeType &node,
+    const std::string &name_space,
+    const std::string &tree_namespace,
+    const std::string &source_location
 ) {
     const auto all_children = node.all_children();
 
@@ -310,6 +393,21 @@ static void generate_node_class(
         source << "}" << std::endl << std::endl;
     }
 
+    // Print the type range check used for the typecasts. Leaf types are
+    // numbered depth-first, so the leaves derived from a node type form a
+    // contiguous range of the NodeType enum.
+    std::vector<std::string> variants;
+    gather_leaf_types(node, variants);
+    format_doc(header, "Returns whether a node of the given type is a " + node.title_case_name + ".", "    ");
+    header << "    static bool is_type(NodeType type) {" << std::endl;
+    if (variants.size() == 1) {
+        header << "        return type == NodeType::" << variants.front() << ";" << std::endl;
+    } else {
+        header << "        return type >= NodeType::" << variants.front();
+        header << " && type <= NodeType::" << variants.back() << ";" << std::endl;
+    }
+    header << "    }" << std::endl << std::endl;
+
     // Print type() function.
     if (node.derived.empty()) {
         auto doc = "Returns the `NodeType` of this node.";
@@ -326,11 +424,12 @@ static void generate_node_class(
     if (node.derived.empty()) {
         auto doc = "Returns a copy of this node.";
         format_doc(header, doc, "    ");
-        header << "    std::shared_ptr<Node> clone() const override;" << std::endl << std::endl;
+        header << "    Ptr<Node> clone() const override;" << std::endl << std::endl;
         format_doc(source, doc);
-        source << "std::shared_ptr<Node> " << node.title_case_name;
+        source << "Ptr<Node> " << node.title_case_name;
         source << "::clone() const {" << std::endl;
-        source << "    return std::make_shared<" << node.title_case_name << ">(*this);" << std::endl;
+        source << "    return " << tree_namespace << "construct<" << node.title_case_name << ">(";
+        source << "::cqasm::memory::get_resource(), *this);" << std::endl;
         source << "}" << std::endl << std::endl;
     }
 
@@ -344,7 +443,7 @@ static void generate_node_class(
         source << "::operator==(const Node& rhs) const {" << std::endl;
         source << "    if (rhs.type() != NodeType::" << node.title_case_name << ") return false;" << std::endl;
         if (!all_children.empty()) {
-            source << "    auto rhsc = dynamic_cast<const " << node.title_case_name << "&>(rhs);" << std::endl;
+            source << "    auto &rhsc = static_cast<const " << node.title_case_name << "&>(rhs);" << std::endl;
             for (auto &child : all_children) {
                 source << "    if (this->" << child.name << " != rhsc." << child.name << ") return false;" << std::endl;
             }
@@ -353,6 +452,123 @@ static void generate_node_class(
         source << "}" << std::endl << std::endl;
     }
 
+    // Print memory usage function.
+    if (node.derived.empty()) {
+        auto doc = "Adds the memory used by this node and its descendants to the given report, unless the node was already counted.";
+        auto type_name = "\"" + name_space + "::" + node.title_case_name + "\"";
+        format_doc(header, doc, "    ");
+        header << "    void add_memory_usage(MemoryUsage &usage) const override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "void " << node.title_case_name;
+        source << "::add_memory_usage(MemoryUsage &usage) const {" << std::endl;
+        source << "    if (!usage.add_object(this, " << type_name << ", sizeof(*this))) return;" << std::endl;
+        source << "    usage.add_annotations(" << type_name << ", *this);" << std::endl;
+        if (!source_location.empty()) {
+            source << "    if (auto loc = get_annotation_ptr<" << source_location << ">()) {" << std::endl;
+            source << "        if (usage.add_object(loc, \"" << source_location << "\", sizeof(" << source_location << ") + sizeof(cqasm::annotatable::Anything))) {" << std::endl;
+            source << "            cqasm::primitives::add_memory_usage(usage, \"" << source_location << "\", *loc);" << std::endl;
+            source << "        }" << std::endl;
+            source << "    }" << std::endl;
+        }
+        for (auto &child : all_children) {
+            if (child.ext_type == Prim) {
+                source << "    cqasm::primitives::add_memory_usage(usage, " << type_name << ", " << child.name << ");" << std::endl;
+            } else {
+                source << "    usage.add_children(" << type_name << ", " << child.name << ");" << std::endl;
+            }
+        }
+        source << "}" << std::endl << std::endl;
+    }
+
+    // Print freeze function.
+    if (node.derived.empty()) {
+        auto doc = "Freezes or thaws this node and its descendants. See `Frozen`.";
+        format_doc(header, doc, "    ");
+        header << "    void set_frozen(bool frozen) const override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "void " << node.title_case_name;
+        source << "::set_frozen(bool frozen) const {" << std::endl;
+        source << "    if (!mark_frozen(frozen)) return;" << std::endl;
+        for (auto &child : all_children) {
+            if (child.ext_type == Prim) {
+                source << "    cqasm::primitives::set_frozen(" << child.name << ", frozen);" << std::endl;
+            } else {
+                source << "    " << tree_namespace << "set_frozen(" << child.name << ", frozen);" << std::endl;
+            }
+        }
+        source << "}" << std::endl << std::endl;
+    }
+
+    // Print type index function.
+    if (node.derived.empty()) {
+        auto doc = "Adds this node and its descendants to the given index.";
+        format_doc(header, doc, "    ");
+        header << "    void add_to_index(TypeIndex &type_index) const override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "void " << node.title_case_name;
+        source << "::add_to_index(TypeIndex &type_index) const {" << std::endl;
+        source << "    type_index.add_node(NodeType::" << node.title_case_name << ", this);" << std::endl;
+        for (auto &child : all_children) {
+            if (child.ext_type != Prim) {
+                source << "    type_index.add_children(" << child.name << ");" << std::endl;
+            }
+        }
+        source << "}" << std::endl << std::endl;
+    }
+
+    // Print Merkle hash function.
+    if (node.derived.empty()) {
+        auto doc = "Returns the Merkle hash of this node, computed from its type, its primitive fields, and the hashes of its children in the given table.";
+        format_doc(header, doc, "    ");
+        header << "    uint64_t compute_hash(MerkleHashes &hashes) const override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "uint64_t " << node.title_case_name;
+        source << "::compute_hash(MerkleHashes &hashes) const {" << std::endl;
+        source << "    auto hash = MerkleHashes::seed(NodeType::" << node.title_case_name << ");" << std::endl;
+        for (auto &child : all_children) {
+            if (child.ext_type == Prim) {
+                source << "    hash = cqasm::utils::hash_combine(hash, cqasm::primitives::hash(" << child.name << "));" << std::endl;
+            } else {
+                source << "    hash = cqasm::utils::hash_combine(hash, hashes.get_children(" << child.name << "));" << std::endl;
+            }
+        }
+        bool has_children = false;
+        for (auto &child : all_children) {
+            has_children |= child.ext_type != Prim;
+        }
+        if (!has_children) {
+            source << "    (void)hashes;" << std::endl;
+        }
+        source << "    return hash;" << std::endl;
+        source << "}" << std::endl << std::endl;
+    }
+
+    // Print diff function.
+    if (node.derived.empty()) {
+        auto doc = "Compares the fields of this node with those of the given node of the same type, reporting the differences to the given differ.";
+        format_doc(header, doc, "    ");
+        header << "    void diff_fields(const Node &other, Differ &differ) const override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "void " << node.title_case_name;
+        source << "::diff_fields(const Node &other, Differ &differ) const {" << std::endl;
+        if (all_children.empty()) {
+            source << "    (void)other;" << std::endl;
+            source << "    (void)differ;" << std::endl;
+        } else {
+            source << "    auto &rhsc = static_cast<const " << node.title_case_name << "&>(other);" << std::endl;
+        }
+        for (auto &child : all_children) {
+            if (child.ext_type == Prim) {
+                source << "    if (!(this->" << child.name << " == rhsc." << child.name << ")) {" << std::endl;
+                source << "        differ.add_changed_field(\"" << child.name << "\", print_primitive(this->" << child.name << "), print_primitive(rhsc." << child.name << "));" << std::endl;
+                source << "    }" << std::endl;
+            } else {
+                source << "    differ.diff_children(\"" << child.name << "\", this->" << child.name << ", rhsc." << child.name << ");" << std::endl;
+            }
+        }
+        source << "}" << std::endl << std::endl;
+    }
+
     // Print visitor function.
     if (node.derived.empty()) {
         auto doc = "Visit a `" + node.title_case_name + "` node.";
@@ -366,9 +582,6 @@ static void generate_node_class(
         source << "}" << std::endl << std::endl;
     }
 
-    // Print conversion function.
-    generate_typecast_function(header, source, node.title_case_name, node, true);
-
     // Print class footer.
     header << "};" << std::endl << std::endl;
 }
@@ -473,6 +686,122 @@ static void generate_recursive_visitor_class(
     header << "};" << std::endl << std::endl;
 }
 
+// Generate the parallel recursive visitor class.
+static void generate_parallel_visitor_class(
+    std::ofstream &header,
+    std::ofstream &source,
+    Nodes &nodes,
+    const std::string &tree_namespace
+) {
+
+    // Print class header.
+    format_doc(
+        header,
+        "Recursive visitor that visits the nodes of large lists in parallel.\n\n"
+        "Lists with more than `grain_size` nodes are split into chunks of "
+        "`grain_size` nodes. Each chunk is visited by a visitor obtained "
+        "through `fork()`, as a task of the given pool. When all chunks of "
+        "a list are done, the forked visitors are passed to `join()` in list "
+        "order, after which the traversal continues with the next child. "
+        "Within a chunk, the nodes are visited depth-first by the same "
+        "visitor, so a visitor that collects its results in the visit "
+        "functions and appends the results of the forked visitors in "
+        "`join()` ends up with the same results in the same order as a "
+        "sequential traversal.\n\n"
+        "The visit functions for different chunks run concurrently, so they "
+        "must not modify state shared between the visitors or the structure "
+        "of the tree. When the library is built with CQASM_INTRUSIVE_REFCOUNT, "
+        "the tree must also be frozen (see `Frozen`) if the visit functions "
+        "copy references into it.");
+    header << "class ParallelVisitor : public RecursiveVisitor {" << std::endl;
+    header << "protected:" << std::endl << std::endl;
+
+    format_doc(header, "The pool that runs the forked visitors.", "    ");
+    header << "    ::cqasm::parallel::WorkPool &pool;" << std::endl << std::endl;
+
+    format_doc(header, "The number of nodes per chunk. Smaller lists are visited sequentially.", "    ");
+    header << "    size_t grain_size;" << std::endl << std::endl;
+
+    format_doc(header, "Visits the given list of nodes, in parallel if it has more than `grain_size` nodes.", "    ");
+    header << "    template <class T>" << std::endl;
+    header << "    void visit_children(" << tree_namespace << "Any<T> &children) {" << std::endl;
+    header << "        if (children.size() <= grain_size) {" << std::endl;
+    header << "            children.visit(*this);" << std::endl;
+    header << "            return;" << std::endl;
+    header << "        }" << std::endl;
+    header << "        std::vector<std::unique_ptr<ParallelVisitor>> forks;" << std::endl;
+    header << "        ::cqasm::parallel::TaskGroup group(pool);" << std::endl;
+    header << "        for (size_t begin = 0; begin < children.size(); begin += grain_size) {" << std::endl;
+    header << "            size_t end = std::min(children.size(), begin + grain_size);" << std::endl;
+    header << "            forks.push_back(fork());" << std::endl;
+    header << "            auto visitor = forks.back().get();" << std::endl;
+    header << "            group.run([&children, visitor, begin, end]() {" << std::endl;
+    header << "                for (size_t i = begin; i < end; i++) {" << std::endl;
+    header << "                    children[i].visit(*visitor);" << std::endl;
+    header << "                }" << std::endl;
+    header << "            });" << std::endl;
+    header << "        }" << std::endl;
+    header << "        group.wait();" << std::endl;
+    header << "        for (auto &visitor : forks) {" << std::endl;
+    header << "            join(*visitor);" << std::endl;
+    header << "        }" << std::endl;
+    header << "    }" << std::endl << std::endl;
+
+    header << "public:" << std::endl << std::endl;
+
+    format_doc(header, "Creates a visitor that runs the visitors for the chunks of large lists on the given pool.", "    ");
+    header << "    explicit ParallelVisitor(::cqasm::parallel::WorkPool &pool, size_t grain_size = 64);" << std::endl << std::endl;
+    format_doc(source, "Creates a visitor that runs the visitors for the chunks of large lists on the given pool.");
+    source << "ParallelVisitor::ParallelVisitor(::cqasm::parallel::WorkPool &pool, size_t grain_size) :" << std::endl;
+    source << "    pool(pool), grain_size(std::max<size_t>(1, grain_size))" << std::endl;
+    source << "{}" << std::endl << std::endl;
+
+    format_doc(header, "Returns a new visitor for a chunk of a large list, usually configured like this one but without any results yet.", "    ");
+    header << "    virtual std::unique_ptr<ParallelVisitor> fork() = 0;" << std::endl << std::endl;
+
+    format_doc(header, "Merges the results of a visitor returned by `fork()` into this one. Does nothing by default.", "    ");
+    header << "    virtual void join(ParallelVisitor &other);" << std::endl << std::endl;
+    format_doc(source, "Merges the results of a visitor returned by `fork()` into this one. Does nothing by default.");
+    source << "void ParallelVisitor::join(ParallelVisitor &other) {" << std::endl;
+    source << "    (void)other;" << std::endl;
+    source << "}" << std::endl << std::endl;
+
+    // Functions for the node types with lists of children.
+    for (auto &node : nodes) {
+        auto all_children = node->all_children();
+        bool has_list = false;
+        for (auto &child : all_children) {
+            if (child.node_type && (child.type == Any || child.type == Many)) {
+                has_list = true;
+                break;
+            }
+        }
+        if (!has_list) {
+            continue;
+        }
+        auto doc = "Recursive traversal for `" + node->title_case_name + "` nodes, visiting large lists in parallel.";
+        format_doc(header, doc, "    ");
+        header << "    void visit_" << node->snake_case_name;
+        header << "(" << node->title_case_name << " &node) override;" << std::endl << std::endl;
+        format_doc(source, doc);
+        source << "void ParallelVisitor::visit_" << node->snake_case_name;
+        source << "(" << node->title_case_name << " &node) {" << std::endl;
+        for (auto &child : all_children) {
+            if (!child.node_type) {
+                continue;
+            }
+            if (child.type == Any || child.type == Many) {
+                source << "    visit_children(node." << child.name << ");" << std::endl;
+            } else {
+                source << "    node." << child.name << ".visit(*this);" << std::endl;
+            }
+        }
+        source << "}" << std::endl << std::endl;
+    }
+
+    header << "};" << std::endl << std::endl;
+}
+
 // Generate the dumper class.
 static void generate_dumper_class(
     std::ofstream &header,
@@ -611,6 +940,246 @@ static void generate_dumper_class(
     header << "};" << std::endl << std::endl;
 }
 
+/**
+ * Generates the flat variant of the tree, in which the nodes are stored in
+ * contiguous arrays per node type and refer to their children by index.
+ */
+static void generate_flat_tree(
+    std::ofstream &header,
+    std::ofstream &source,
+    Nodes &nodes,
+    const std::string &name_space,
+    const std::string &tree_namespace
+) {
+    Nodes leaves;
+    for (auto &node : nodes) {
+        if (node->derived.empty()) {
+            leaves.push_back(node);
+        }
+    }
+
+    header << "namespace flat {" << std::endl << std::endl;
+    source << "namespace flat {" << std::endl << std::endl;
+
+    // Print the reference type.
+    format_doc(header, "Reference to a node of a flat tree: the type of the node, and its index in the array of nodes of that type. Empty references have index `FLAT_NONE`.");
+    header << "struct Ref {" << std::endl << std::endl;
+    format_doc(header, "The type of the node.", "    ");
+    header << "    NodeType type;" << std::endl << std::endl;
+    format_doc(header, "The index of the node in the array of nodes of its type, or `FLAT_NONE` for empty references.", "    ");
+    header << "    " << tree_namespace << "FlatIndex index;" << std::endl << std::endl;
+    format_doc(header, "Constructs an empty reference.", "    ");
+    header << "    Ref() : type(), index(" << tree_namespace << "FLAT_NONE) {}" << std::endl << std::endl;
+    format_doc(header, "Constructs a reference to the node with the given type and index.", "    ");
+    header << "    Ref(NodeType type, " << tree_namespace << "FlatIndex index) : type(type), index(index) {}" << std::endl << std::endl;
+    format_doc(header, "Returns whether this reference is empty.", "    ");
+    header << "    bool empty() const {" << std::endl;
+    header << "        return index == " << tree_namespace << "FLAT_NONE;" << std::endl;
+    header << "    }" << std::endl << std::endl;
+    format_doc(header, "Equality operator.", "    ");
+    header << "    bool operator==(const Ref &rhs) const {" << std::endl;
+    header << "        return index == rhs.index && (empty() || type == rhs.type);" << std::endl;
+    header << "    }" << std::endl << std::endl;
+    format_doc(header, "Inequality operator.", "    ");
+    header << "    bool operator!=(const Ref &rhs) const {" << std::endl;
+    header << "        return !(*this == rhs);" << std::endl;
+    header << "    }" << std::endl << std::endl;
+    header << "};" << std::endl << std::endl;
+
+    // Print the node structures.
+    for (auto &node : leaves) {
+        format_doc(header, "Flat variant of `" + name_space + "::" + node->title_case_name + "`.");
+        header << "struct " << node->title_case_name << " {" << std::endl << std::endl;
+        for (auto &child : node->all_children()) {
+            if (!child.doc.empty()) {
+                format_doc(header, child.doc, "    ");
+            }
+            header << "    ";
+            switch (child.type) {
+                case Maybe:
+                case One:
+                    header << "Ref " << child.name << ";";
+                    break;
+                case Any:
+                case Many:
+                    header << tree_namespace << "FlatList " << child.name << ";";
+                    break;
+                case Prim:
+                    header << child.prim_type << " " << child.name;
+                    header << " = cqasm::primitives::initialize<" << child.prim_type << ">();";
+                    break;
+            }
+            header << std::endl << std::endl;
+        }
+        header << "};" << std::endl << std::endl;
+    }
+
+    // Print the tree class.
+    format_doc(header, "Flat variant of a tree. The nodes are stored in contiguous arrays per node type, and refer to their children by type and index. The children in lists are stored contiguously in `refs`. Primitives and nodes of other trees are stored by value, and annotations are stored in a separate table. Nodes that are shared by several parents in the pointer tree are stored once.");
+    header << "class Tree {" << std::endl;
+    header << "private:" << std::endl << std::endl;
+    format_doc(header, "Nodes already converted from the pointer tree.", "    ");
+    header << "    using Converted = std::unordered_map<const Node*, Ref>;" << std::endl << std::endl;
+    format_doc(header, "Nodes already built from the flat tree, per node type.", "    ");
+    header << "    using Built = std::vector<std::vector<Ptr<Node>>>;" << std::endl << std::endl;
+    format_doc(header, "Adds the given node and its descendants to this tree, unless it was already converted.", "    ");
+    header << "    Ref convert(const Node &node, Converted &converted);" << std::endl << std::endl;
+    format_doc(header, "Adds the given optional node and its descendants to this tree.", "    ");
+    header << "    template <class T>" << std::endl;
+    header << "    Ref convert(const " << tree_namespace << "Maybe<T> &node, Converted &converted);" << std::endl << std::endl;
+    format_doc(header, "Adds the given list of nodes and their descendants to this tree.", "    ");
+    header << "    template <class T>" << std::endl;
+    header << "    " << tree_namespace << "FlatList convert(const " << tree_namespace << "Any<T> &list, Converted &converted);" << std::endl << std::endl;
+    format_doc(header, "Builds the pointer tree for the given node, unless it was already built.", "    ");
+    header << "    Ptr<Node> build(Ref ref, Built &built) const;" << std::endl << std::endl;
+    header << "public:" << std::endl << std::endl;
+    for (auto &node : leaves) {
+        format_doc(header, "The `" + node->title_case_name + "` nodes.", "    ");
+        header << "    std::vector<" << node->title_case_name << "> " << node->snake_case_name << "_nodes;" << std::endl << std::endl;
+    }
+    format_doc(header, "The children of all lists. Each list refers to a contiguous range.", "    ");
+    header << "    std::vector<Ref> refs;" << std::endl << std::endl;
+    format_doc(header, "The annotations of the nodes that have any.", "    ");
+    header << "    std::vector<std::pair<Ref, ::cqasm::annotatable::Annotatable>> annotations;" << std::endl << std::endl;
+    format_doc(header, "The root node.", "    ");
+    header << "    Ref root;" << std::endl << std::endl;
+    format_doc(header, "Constructs an empty tree.", "    ");
+    header << "    Tree() = default;" << std::endl << std::endl;
+    format_doc(header, "Converts the given pointer tree.", "    ");
+    header << "    explicit Tree(const Node &root);" << std::endl << std::endl;
+    format_doc(header, "Returns the children in the given list.", "    ");
+    header << "    " << tree_namespace << "FlatRange<Ref> get(const " << tree_namespace << "FlatList &list) const {" << std::endl;
+    header << "        return " << tree_namespace << "FlatRange<Ref>(refs.data() + list.offset, list.size);" << std::endl;
+    header << "    }" << std::endl << std::endl;
+    format_doc(header, "Converts this tree back to a pointer tree.", "    ");
+    header << "    " << tree_namespace << "One<Node> build() const;" << std::endl << std::endl;
+    header << "};" << std::endl << std::endl;
+
+    // Print the conversion from the pointer tree.
+    format_doc(source, "Adds the given optional node and its descendants to this tree.");
+    source << "template <class T>" << std::endl;
+    source << "Ref Tree::convert(const " << tree_namespace << "Maybe<T> &node, Converted &converted) {" << std::endl;
+    source << "    if (node.empty()) {" << std::endl;
+    source << "        return Ref();" << std::endl;
+    source << "    }" << std::endl;
+    source << "    return convert(static_cast<const Node&>(*node), converted);" << std::endl;
+    source << "}" << std::endl << std::endl;
+    format_doc(source, "Adds the given list of nodes and their descendants to this tree.");
+    source << "template <class T>" << std::endl;
+    source << tree_namespace << "FlatList Tree::convert(const " << tree_namespace << "Any<T> &list, Converted &converted) {" << std::endl;
+    source << "    std::vector<Ref> children;" << std::endl;
+    source << "    children.reserve(list.size());" << std::endl;
+    source << "    for (const auto &child : list) {" << std::endl;
+    source << "        children.push_back(convert(child, converted));" << std::endl;
+    source << "    }" << std::endl;
+    source << "    " << tree_namespace << "FlatList result;" << std::endl;
+    source << "    result.offset = " << tree_namespace << "to_flat_index(refs.size());" << std::endl;
+    source << "    result.size = " << tree_namespace << "to_flat_index(children.size());" << std::endl;
+    source << "    refs.insert(refs.end(), children.begin(), children.end());" << std::endl;
+    source << "    return result;" << std::endl;
+    source << "}" << std::endl << std::endl;
+    format_doc(source, "Adds the given node and its descendants to this tree, unless it was already converted.");
+    source << "Ref Tree::convert(const Node &node, Converted &converted) {" << std::endl;
+    source << "    auto it = converted.find(&node);" << std::endl;
+    source << "    if (it != converted.end()) {" << std::endl;
+    source << "        return it->second;" << std::endl;
+    source << "    }" << std::endl;
+    source << "    Ref ref;" << std::endl;
+    source << "    ref.type = node.type();" << std::endl;
+    source << "    switch (node.type()) {" << std::endl;
+    for (auto &node : leaves) {
+        source << "        case NodeType::" << node->title_case_name << ": {" << std::endl;
+        if (!node->all_children().empty()) {
+            source << "            auto &from = static_cast<const " << name_space << "::" << node->title_case_name << "&>(node);" << std::endl;
+        }
+        source << "            " << node->title_case_name << " to;" << std::endl;
+        for (auto &child : node->all_children()) {
+            if (child.type == Prim) {
+                source << "            to." << child.name << " = from." << child.name << ";" << std::endl;
+            } else {
+                source << "            to." << child.name << " = convert(from." << child.name << ", converted);" << std::endl;
+            }
+        }
+        source << "            ref.index = " << tree_namespace << "to_flat_index(" << node->snake_case_name << "_nodes.size());" << std::endl;
+        source << "            " << node->snake_case_name << "_nodes.push_back(std::move(to));" << std::endl;
+        source << "            break;" << std::endl;
+        source << "        }" << std::endl;
+    }
+    source << "    }" << std::endl;
+    source << "    if (node.get_annotation_count()) {" << std::endl;
+    source << "        annotations.emplace_back(ref, node);" << std::endl;
+    source << "    }" << std::endl;
+    source << "    converted.emplace(&node, ref);" << std::endl;
+    source << "    return ref;" << std::endl;
+    source << "}" << std::endl << std::endl;
+    format_doc(source, "Converts the given pointer tree.");
+    source << "Tree::Tree(const Node &root) {" << std::endl;
+    source << "    Converted converted;" << std::endl;
+    source << "    this->root = convert(root, converted);" << std::endl;
+    source << "}" << std::endl << std::endl;
+
+    // Print the conversion back to the pointer tree.
+    format_doc(source, "Builds the pointer tree for the given node, unless it was already built.");
+    source << "Ptr<Node> Tree::build(Ref ref, Built &built) const {" << std::endl;
+    source << "    if (ref.empty()) {" << std::endl;
+    source << "        return Ptr<Node>();" << std::endl;
+    source << "    }" << std::endl;
+    source << "    auto &result = built.at(static_cast<size_t>(ref.type)).at(ref.index);" << std::endl;
+    source << "    if (result) {" << std::endl;
+    source << "        return result;" << std::endl;
+    source << "    }" << std::endl;
+    source << "    switch (ref.type) {" << std::endl;
+    for (auto &node : leaves) {
+        source << "        case NodeType::" << node->title_case_name << ": {" << std::endl;
+        if (!node->all_children().empty()) {
+            source << "            const auto &from = " << node->snake_case_name << "_nodes[ref.index];" << std::endl;
+        }
+        source << "            auto to = " << tree_namespace << "make<" << name_space << "::" << node->title_case_name << ">();" << std::endl;
+        for (auto &child : node->all_children()) {
+            switch (child.type) {
+                case Maybe:
+                case One:
+                    source << "            to->" << child.name << ".set(build(from." << child.name << ", built));" << std::endl;
+                    break;
+                case Any:
+                case Many:
+                    source << "            for (const auto &child : get(from." << child.name << ")) {" << std::endl;
+                    source << "                to->" << child.name << ".add(" << tree_namespace << "Maybe<Node>(build(child, built)));" << std::endl;
+                    source << "            }" << std::endl;
+                    break;
+                case Prim:
+                    source << "            to->" << child.name << " = from." << child.name << ";" << std::endl;
+                    break;
+            }
+        }
+        source << "            result = to.get_ptr();" << std::endl;
+        source << "            break;" << std::endl;
+        source << "        }" << std::endl;
+    }
+    source << "    }" << std::endl;
+    source << "    return result;" << std::endl;
+    source << "}" << std::endl << std::endl;
+    format_doc(source, "Converts this tree back to a pointer tree.");
+    source << tree_namespace << "One<Node> Tree::build() const {" << std::endl;
+    source << "    Built built(" << leaves.size() << ");" << std::endl;
+    for (auto &node : leaves) {
+        source << "    built[static_cast<size_t>(NodeType::" << node->title_case_name << ")].resize(";
+        source << node->snake_case_name << "_nodes.size());" << std::endl;
+    }
+    source << "    auto result = " << tree_namespace << "One<Node>(build(root, built));" << std::endl;
+    source << "    for (const auto &annotation : annotations) {" << std::endl;
+    source << "        const auto &node = built.at(static_cast<size_t>(annotation.first.type)).at(annotation.first.index);" << std::endl;
+    source << "        if (node) {" << std::endl;
+    source << "            static_cast<::cqasm::annotatable::Annotatable&>(*node) = annotation.second;" << std::endl;
+    source << "        }" << std::endl;
+    source << "    }" << std::endl;
+    source << "    return result;" << std::endl;
+    source << "}" << std::endl << std::endl;
+
+    header << "} // namespace flat" << std::endl << std::endl;
+    source << "} // namespace flat" << std::endl << std::endl;
+}
+
 /**
  * Main function for generating the the header and source file for a tree.
  */
@@ -724,6 +1293,11 @@ int main(
         tree_namespace = "::" + specification.tree_namespace + "::";
     }
     header << "using Base = " << tree_namespace << "Base;" << std::endl;
+    header << "using MemoryUsage = " << tree_namespace << "MemoryUsage;" << std::endl;
+    header << "using TypeIndex = " << tree_namespace << "TypeIndex;" << std::endl;
+    header << "using MerkleHashes = " << tree_namespace << "MerkleHashes;" << std::endl;
+    header << "using Differ = " << tree_namespace << "Differ;" << std::endl;
+    header << "template <class T> using Ptr   = " << tree_namespace << "Ptr<T>;" << std::endl;
     if (uses_maybe)    header << "template <class T> using Maybe = " << tree_namespace << "Maybe<T>;" << std::endl;
     if (uses_one)      header << "template <class T> using One   = " << tree_namespace << "One<T>;" << std::endl;
     if (uses_any)      header << "template <class T> using Any   = " << tree_namespace << "Any<T>;" << std::endl;
@@ -735,12 +1309,24 @@ int main(
         source << "#" << include << std::endl;
     }
     source << "#include \"" << specification.header_filename << "\"" << std::endl;
+    source << "#include <sstream>" << std::endl;
     source << std::endl;
     for (auto &name : specification.namespaces) {
         source << "namespace " << name << " {" << std::endl;
     }
     source << std::endl;
 
+    // Generate the helper function that prints primitives for the edits
+    // reported by the diff functions. This lives in the source file, such
+    // that the stream << overloads of all the primitives are visible.
+    format_doc(source, "Returns the given primitive as printed by its stream << overload.");
+    source << "template <class T>" << std::endl;
+    source << "static std::string print_primitive(const T &value) {" << std::endl;
+    source << "    std::ostringstream out;" << std::endl;
+    source << "    out << value;" << std::endl;
+    source << "    return out.str();" << std::endl;
+    source << "}" << std::endl << std::endl;
+
     // Generate forward references for all the classes.
     header << "// Forward declarations for all classes." << std::endl;
     header << "class Node;" << std::endl;
@@ -749,9 +1335,22 @@ int main(
     }
     header << "class Visitor;" << std::endl;
     header << "class RecursiveVisitor;" << std::endl;
+    header << "class ParallelVisitor;" << std::endl;
     header << "class Dumper;" << std::endl;
     header << std::endl;
 
+    // Generate the inline capacities of the lists of the node types that
+    // have one. These overload cqasm::tree::inline_capacity() and are found
+    // through argument-dependent lookup.
+    if (specification.node_inline_capacity) {
+        generate_inline_capacity(header, "Node", specification.node_inline_capacity);
+    }
+    for (auto &node : nodes) {
+        if (node->inline_capacity) {
+            generate_inline_capacity(header, node->title_case_name, node->inline_capacity);
+        }
+    }
+
     // Generate the NodeType enum.
     generate_enum(header, nodes);
 
@@ -759,6 +1358,10 @@ int main(
     generate_base_class(header, source, nodes);
 
     // Generate the node classes.
+    std::string type_namespace = "";
+    for (auto &name : specification.namespaces) {
+        type_namespace += (type_namespace.empty() ? "" : "::") + name;
+    }
     std::unordered_set<std::string> generated;
     for (auto node : nodes) {
         if (generated.count(node->snake_case_name)) {
@@ -775,15 +1378,21 @@ int main(
                 continue;
             }
             generated.insert(node->snake_case_name);
-            generate_node_class(header, source, *node);
+            generate_node_class(header, source, *node, type_namespace, tree_namespace, specification.source_location);
         }
     }
 
     // Generate the visitor classes.
     generate_visitor_base_class(header, source, nodes);
     generate_recursive_visitor_class(header, source, nodes);
+    generate_parallel_visitor_class(header, source, nodes, tree_namespace);
     generate_dumper_class(header, source, nodes, specification.source_location);
 
+    // Generate the flat variant of the tree, if requested.
+    if (specification.flat) {
+        generate_flat_tree(header, source, nodes, type_namespace, tree_namespace);
+    }
+
     // Close the namespaces.
     for (auto name_it = specification.namespaces.rbegin(); name_it != specification.namespaces.rend(); name_it++) {
         header << "} // namespace " << *name_it << std::endl;
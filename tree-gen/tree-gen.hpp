@@ -124,6 +124,12 @@ struct NodeType {
      */
     bool is_error_marker;
 
+    /**
+     * Number of elements that Any and Many lists of this node type store
+     * inline, before falling back to a heap allocation.
+     */
+    size_t inline_capacity;
+
     /**
      * Gathers all child nodes, including those in parent classes.
      */
@@ -162,6 +168,7 @@ public:
         node->snake_case_name = name;
         node->doc = doc;
         node->is_error_marker = false;
+        node->inline_capacity = 0;
 
         // Generate title case name.
         auto snake_ss = std::stringstream(name);
@@ -234,6 +241,15 @@ public:
         return this;
     }
 
+    /**
+     * Sets the number of elements that Any and Many lists of this node type
+     * store inline.
+     */
+    NodeBuilder *with_inline_capacity(size_t capacity) {
+        node->inline_capacity = capacity;
+        return this;
+    }
+
 };
 
 /**
@@ -286,6 +302,18 @@ public:
      */
     std::string source_location;
 
+    /**
+     * Number of elements that Any and Many lists of the Node base class
+     * store inline, before falling back to a heap allocation.
+     */
+    size_t node_inline_capacity = 0;
+
+    /**
+     * Whether to also generate the flat variant of the tree, in which the
+     * nodes are stored in contiguous arrays per node type.
+     */
+    bool flat = false;
+
     /**
      * All the nodes.
      */
@@ -331,6 +359,21 @@ public:
         source_location = ident;
     }
 
+    /**
+     * Sets the number of elements that Any and Many lists of the Node base
+     * class store inline.
+     */
+    void set_node_inline_capacity(size_t capacity) {
+        node_inline_capacity = capacity;
+    }
+
+    /**
+     * Requests the flat variant of the tree to be generated as well.
+     */
+    void set_flat() {
+        flat = true;
+    }
+
     /**
      * Adds an include statement to the header file.
      */